@@ -298,6 +298,7 @@ int Application::run_fiber()
         if (!i.name.empty()) {
             server->setName(i.name);
         }
+        server->setReusePort(i.reuse_port, i.reuse_port_cpu_steering);
         std::vector<Address::ptr> fails;
         if (!server->bind(address, fails, i.ssl)) {
             for (auto &x : fails) {
@@ -311,6 +312,13 @@ int Application::run_fiber()
                                      << " key_file=" << i.key_file;
             }
         }
+        if (i.io_shard_by_cpu && !i.io_worker.empty()) {
+            std::vector<IOManager *> shards;
+            for (auto &x : base::WorkerMgr::GetInstance()->getAllAsIOManager(i.io_worker)) {
+                shards.push_back(x.get());
+            }
+            server->setIOWorkerShards(shards);
+        }
         server->setConf(i);
         // server->start();
         m_servers[i.type].push_back(server);
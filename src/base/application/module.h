@@ -85,6 +85,14 @@ public:
     virtual bool handleRockRequest(base::RockRequest::ptr request, base::RockResponse::ptr response,
                                    base::RockStream::ptr stream) = 0;
     virtual bool handleRockNotify(base::RockNotify::ptr notify, base::RockStream::ptr stream) = 0;
+    /**
+     * @brief 处理对端打开的 v2 流
+     * @return 是否接管了这个流, 接管后负责 finish 或 cancel
+     */
+    virtual bool handleRockStream(base::RockChannel::ptr channel, base::RockStream::ptr stream)
+    {
+        return false;
+    }
 
     virtual bool handleRequest(base::Message::ptr req, base::Message::ptr rsp,
                                base::Stream::ptr stream);
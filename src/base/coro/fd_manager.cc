@@ -6,13 +6,93 @@
 
 namespace base {
 
+/// 上下文的代数
+static std::atomic<uint64_t> s_generation = {0};
+
+/// 回收用的全局代数, 每摘下一个上下文加一
+static std::atomic<uint64_t> s_epoch = {1};
+
+/// 攒够这么多摘下的上下文才扫描一次读者
+static const size_t kRetireBatch = 64;
+
+/**
+ * @brief 线程的读临界区记录, 只增不减, 线程退出后给新线程复用
+ */
+struct ReaderRecord {
+    /// 所在读临界区开始时的全局代数, 0 表示不在读临界区
+    std::atomic<uint64_t> epoch = {0};
+    /// 是否被某个线程占用
+    std::atomic<bool> inUse = {false};
+    ReaderRecord *next = nullptr;
+};
+
+static std::atomic<ReaderRecord *> s_readers = {nullptr};
+
+/**
+ * @brief 当前线程的读临界区记录和嵌套层数
+ */
+struct ThreadReader {
+    ~ThreadReader()
+    {
+        if (record) {
+            record->epoch.store(0, std::memory_order_release);
+            record->inUse.store(false, std::memory_order_release);
+            record = nullptr;
+        }
+    }
+
+    ReaderRecord *acquire()
+    {
+        if (record) {
+            return record;
+        }
+        for (ReaderRecord *r = s_readers.load(std::memory_order_acquire); r; r = r->next) {
+            bool expected = false;
+            if (!r->inUse.load(std::memory_order_relaxed)
+                && r->inUse.compare_exchange_strong(expected, true)) {
+                record = r;
+                return record;
+            }
+        }
+        record = new ReaderRecord;
+        record->inUse.store(true, std::memory_order_relaxed);
+        ReaderRecord *head = s_readers.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!s_readers.compare_exchange_weak(head, record));
+        return record;
+    }
+
+    ReaderRecord *record = nullptr;
+    uint32_t depth = 0;
+};
+
+static thread_local ThreadReader t_reader;
+
+/**
+ * @brief 所有读临界区中最早的开始代数, 没有读者时返回 UINT64_MAX
+ */
+static uint64_t MinActiveEpoch()
+{
+    uint64_t min = ~0ull;
+    for (ReaderRecord *r = s_readers.load(std::memory_order_acquire); r; r = r->next) {
+        uint64_t e = r->epoch.load(std::memory_order_seq_cst);
+        if (e && e < min) {
+            min = e;
+        }
+    }
+    return min;
+}
+
 FdCtx::FdCtx(int fd)
     :m_isInit(false)
     ,m_isSocket(false)
+    ,m_isPollable(false)
     ,m_sysNonblock(false)
     ,m_userNonblock(false)
     ,m_isClosed(false)
     ,m_fd(fd)
+    ,m_generation(++s_generation)
     ,m_recvTimeout(-1)
     ,m_sendTimeout(-1) {
     init();
@@ -32,11 +112,17 @@ bool FdCtx::init() {
     if(-1 == fstat(m_fd, &fd_stat)) {
         m_isInit = false;
         m_isSocket = false;
+        m_isPollable = false;
     } else {
         m_isInit = true;
         m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        // eventfd/timerfd/signalfd/epoll 等匿名 inode 没有文件类型位
+        m_isPollable = m_isSocket || S_ISFIFO(fd_stat.st_mode)
+                       || (fd_stat.st_mode & S_IFMT) == 0;
     }
 
+    // 只有 socket 在创建时切换成非阻塞; pipe/eventfd 的文件描述可能和子进程共享,
+    // 等到第一次在协程里阻塞式读写时再切换(enableSysNonblock)
     if(m_isSocket) {
         int flags = fcntl_f(m_fd, F_GETFL, 0);
         if(!(flags & O_NONBLOCK)) {
@@ -48,10 +134,36 @@ bool FdCtx::init() {
     }
 
     m_userNonblock = false;
-    m_isClosed = false;
+    m_isClosed.store(false, std::memory_order_release);
     return m_isInit;
 }
 
+bool FdCtx::enableSysNonblock() {
+    if(m_sysNonblock) {
+        return true;
+    }
+    int flags = fcntl_f(m_fd, F_GETFL, 0);
+    if(flags == -1) {
+        return false;
+    }
+    if(!(flags & O_NONBLOCK) && fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return false;
+    }
+    m_sysNonblock = true;
+    return true;
+}
+
+void FdCtx::restoreBlocking() {
+    if(m_isSocket || !m_sysNonblock || m_userNonblock) {
+        return;
+    }
+    int flags = fcntl_f(m_fd, F_GETFL, 0);
+    if(flags != -1 && (flags & O_NONBLOCK)) {
+        fcntl_f(m_fd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    m_sysNonblock = false;
+}
+
 void FdCtx::setTimeout(int type, uint64_t v) {
     if(type == SO_RCVTIMEO) {
         m_recvTimeout = v;
@@ -68,41 +180,114 @@ uint64_t FdCtx::getTimeout(int type) {
     }
 }
 
+FdManager::ReadGuard::ReadGuard() {
+    if(t_reader.depth++ == 0) {
+        ReaderRecord* r = t_reader.acquire();
+        r->epoch.store(s_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        // 和 retire 中摘下后扫描读者配对: 要么回收方看到本记录, 要么这里看到已经摘下的槽位
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+FdManager::ReadGuard::~ReadGuard() {
+    if(--t_reader.depth == 0) {
+        t_reader.record->epoch.store(0, std::memory_order_release);
+    }
+}
+
 FdManager::FdManager() {
-    m_datas.resize(64);
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
+FdManager::~FdManager() {
+    for(auto& i : m_retired) {
+        delete i.ctx;
+    }
+}
+
+FdCtx* FdManager::get(int fd, bool auto_create) {
+    Slot* slot = auto_create ? m_datas.getOrCreate(fd) : m_datas.get(fd);
+    if(!slot) {
         return nullptr;
     }
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
-        if(auto_create == false) {
-            return nullptr;
-        }
-    } else {
-        if(m_datas[fd] || !auto_create) {
-            return m_datas[fd];
+    FdCtx* cur = slot->ctx.load(std::memory_order_acquire);
+    if(cur && !cur->isClose()) {
+        return cur;
+    }
+    if(!auto_create) {
+        return nullptr;
+    }
+
+    // 同一个 fd 关闭后被重新打开时换一个新的上下文
+    FdCtx* ctx = new FdCtx(fd);
+    while(!slot->ctx.compare_exchange_weak(cur, ctx, std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+        if(cur && !cur->isClose()) {
+            // 其它线程先装好了
+            delete ctx;
+            return cur;
         }
     }
-    lock.unlock();
+    if(cur) {
+        retire(cur);
+    }
+    return ctx;
+}
 
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx = std::make_shared<FdCtx>(fd);
-    if(fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+FdCtx* FdManager::open(int fd) {
+    Slot* slot = m_datas.getOrCreate(fd);
+    if(!slot) {
+        return nullptr;
+    }
+    FdCtx* ctx = new FdCtx(fd);
+    FdCtx* old = slot->ctx.exchange(ctx, std::memory_order_seq_cst);
+    if(old) {
+        old->m_isClosed.store(true, std::memory_order_release);
+        retire(old);
     }
-    m_datas[fd] = ctx;
     return ctx;
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
+    Slot* slot = m_datas.get(fd);
+    if(!slot) {
         return;
     }
-    m_datas[fd].reset();
+    FdCtx* ctx = slot->ctx.exchange(nullptr, std::memory_order_seq_cst);
+    if(ctx) {
+        ctx->m_isClosed.store(true, std::memory_order_release);
+        retire(ctx);
+    }
+}
+
+void FdManager::retire(FdCtx* ctx) {
+    uint64_t epoch = s_epoch.fetch_add(1, std::memory_order_seq_cst);
+    std::vector<FdCtx*> frees;
+    {
+        MutexType::Lock lock(m_retireMutex);
+        m_retired.push_back({ctx, epoch});
+        if(m_retired.size() < kRetireBatch) {
+            return;
+        }
+        // 开始代数大于 epoch 的读者是在摘下之后进入的, 看不到这些上下文
+        uint64_t min_active = MinActiveEpoch();
+        size_t keep = 0;
+        for(auto& i : m_retired) {
+            if(i.epoch < min_active) {
+                frees.push_back(i.ctx);
+            } else {
+                m_retired[keep++] = i;
+            }
+        }
+        m_retired.resize(keep);
+    }
+    for(auto i : frees) {
+        delete i;
+    }
+}
+
+size_t FdManager::getRetiredCount() {
+    MutexType::Lock lock(m_retireMutex);
+    return m_retired.size();
 }
 
 }
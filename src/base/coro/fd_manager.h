@@ -1,8 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <vector>
-#include "base/thread.h"
+#include "base/coro/fd_table.h"
+#include "base/mutex.h"
 #include "base/singleton.h"
 
 namespace base
@@ -10,13 +12,13 @@ namespace base
 
 /**
  * @brief 文件句柄上下文类
- * @details 管理文件句柄类型(是否socket)
- *          是否阻塞,是否关闭,读/写超时时间
+ * @details 管理文件句柄类型(是否socket, 是否可以 epoll)
+ *          是否阻塞,是否关闭,读/写超时时间.
+ *          fd 每次打开都对应一个新的对象(代数不同), 关闭后标记为关闭, 不会被重新初始化
  */
-class FdCtx : public std::enable_shared_from_this<FdCtx>
+class FdCtx
 {
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
     /**
      * @brief 通过文件句柄构造FdCtx
      */
@@ -36,10 +38,20 @@ public:
      */
     bool isSocket() const { return m_isSocket; }
 
+    /**
+     * @brief 是否可以用 epoll 等待(socket/pipe/eventfd/timerfd 等)
+     */
+    bool isPollable() const { return m_isPollable; }
+
+    /**
+     * @brief 返回代数, 进程内每次打开 fd 都不同, 用来区分同一个 fd 号前后两次打开
+     */
+    uint64_t getGeneration() const { return m_generation; }
+
     /**
      * @brief 是否已关闭
      */
-    bool isClose() const { return m_isClosed; }
+    bool isClose() const { return m_isClosed.load(std::memory_order_acquire); }
 
     /**
      * @brief 设置用户主动设置非阻塞
@@ -63,6 +75,18 @@ public:
      */
     bool getSysNonblock() const { return m_sysNonblock; }
 
+    /**
+     * @brief 把 pipe/eventfd 等切换成非阻塞, 第一次在协程中阻塞式读写时调用
+     * @return 是否已经是非阻塞
+     */
+    bool enableSysNonblock();
+
+    /**
+     * @brief 关闭前恢复 enableSysNonblock 之前的阻塞模式
+     * @details 文件描述可能被 dup/fork 到别处继续使用, socket 不恢复
+     */
+    void restoreBlocking();
+
     /**
      * @brief 设置超时时间
      * @param[in] type 类型SO_RCVTIMEO(读超时), SO_SNDTIMEO(写超时)
@@ -83,19 +107,25 @@ private:
      */
     bool init();
 
+    friend class FdManager;
+
 private:
     /// 是否初始化
     bool m_isInit : 1;
     /// 是否socket
     bool m_isSocket : 1;
+    /// 是否可以用 epoll 等待
+    bool m_isPollable : 1;
     /// 是否hook非阻塞
     bool m_sysNonblock : 1;
     /// 是否用户主动设置非阻塞
     bool m_userNonblock : 1;
-    /// 是否关闭
-    bool m_isClosed : 1;
+    /// 是否关闭, 无锁查找时用来判断 fd 是否在管理中
+    std::atomic<bool> m_isClosed;
     /// 文件句柄
     int m_fd;
+    /// 代数
+    uint64_t m_generation;
     /// 读超时时间毫秒
     uint64_t m_recvTimeout;
     /// 写超时时间毫秒
@@ -104,24 +134,53 @@ private:
 
 /**
  * @brief 文件句柄管理类
+ * @details 查找不加锁也不改引用计数: fd 表的槽位保存当前上下文的裸指针.
+ *          fd 关闭后上下文从槽位摘下, 等所有可能看到它的读临界区(ReadGuard)结束后才释放(基于代数的延迟回收)
  */
 class FdManager
 {
 public:
-    // typedef RWMutex RWMutexType;
-    typedef RWSpinlock RWMutexType;
+    typedef Spinlock MutexType;
+
+    /**
+     * @brief 读临界区
+     * @details 持有期间 get 返回的 FdCtx 不会被释放. 只在当前线程有效, 可以嵌套,
+     *          不能跨协程切换, 也不要在里面执行会长时间阻塞的系统调用
+     */
+    class ReadGuard : Noncopyable
+    {
+    public:
+        ReadGuard();
+        ~ReadGuard();
+    };
+
     /**
      * @brief 无参构造函数
      */
     FdManager();
 
+    /**
+     * @brief 析构函数
+     */
+    ~FdManager();
+
     /**
      * @brief 获取/创建文件句柄类FdCtx
      * @param[in] fd 文件句柄
      * @param[in] auto_create 是否自动创建
-     * @return 返回对应文件句柄类FdCtx::ptr
+     * @return 返回对应文件句柄类FdCtx, 不存在或已关闭时返回 nullptr
+     * @pre 使用返回值期间需要持有 ReadGuard
+     * @attention fd 关闭并被重新打开后, 之前返回的对象保持关闭状态, 不会变成新句柄的状态
+     */
+    FdCtx *get(int fd, bool auto_create = false);
+
+    /**
+     * @brief fd 刚由系统调用创建时换上新的上下文
+     * @details 槽位中残留的旧上下文(在没有 hook 的线程里用 close_f 关闭的)标记为关闭后回收
+     * @return 新的上下文, fd 超出范围时返回 nullptr
+     * @pre 使用返回值期间需要持有 ReadGuard
      */
-    FdCtx::ptr get(int fd, bool auto_create = false);
+    FdCtx *open(int fd);
 
     /**
      * @brief 删除文件句柄类
@@ -129,11 +188,44 @@ public:
      */
     void del(int fd);
 
+    /**
+     * @brief 已经摘下还没有释放的上下文数量
+     */
+    size_t getRetiredCount();
+
+private:
+    /**
+     * @brief fd 表中的槽位, 指向 fd 当前打开的上下文
+     */
+    struct Slot {
+        Slot(int) {}
+        ~Slot() { delete ctx.load(std::memory_order_relaxed); }
+
+        /// 当前的上下文, fd 未打开时为空
+        std::atomic<FdCtx *> ctx = {nullptr};
+    };
+
+    /**
+     * @brief 已经从槽位摘下, 等待回收的上下文
+     */
+    struct Retired {
+        FdCtx *ctx;
+        /// 摘下之后的全局代数, 比它早进入的读临界区才可能还在使用 ctx
+        uint64_t epoch;
+    };
+
+    /**
+     * @brief 摘下的上下文放入回收列表, 攒够一批后释放已经没有读者的
+     */
+    void retire(FdCtx *ctx);
+
 private:
-    /// 读写锁
-    RWMutexType m_mutex;
     /// 文件句柄集合
-    std::vector<FdCtx::ptr> m_datas;
+    FdTable<Slot> m_datas;
+    /// m_retired 的锁, 只在关闭 fd 时使用
+    MutexType m_retireMutex;
+    /// 等待回收的上下文
+    std::vector<Retired> m_retired;
 };
 
 /// 文件句柄单例
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "base/noncopyable.h"
+
+namespace base
+{
+
+/**
+ * @brief 按 fd 下标的两级分段数组
+ * @details 第一级是固定长度的段目录, 第二级是按需分配的段, 段和元素都通过CAS原子安装,
+ *          只增不减, 已经创建的元素地址在表的生命周期内不变.
+ *          查找只有两次 acquire load, 不加锁, 也不需要像 vector::resize 那样整体拷贝.
+ *          元素在表析构时统一释放, 元素的复用(fd关闭后重新打开)由调用方处理.
+ * @tparam T 元素类型, 需要有 T(int fd) 构造函数
+ * @tparam SegmentBits 每段 2^SegmentBits 个元素
+ * @tparam MaxSegments 段目录长度, 能表示的最大 fd 为 MaxSegments << SegmentBits
+ */
+template <class T, size_t SegmentBits = 10, size_t MaxSegments = 4096>
+class FdTable : Noncopyable
+{
+public:
+    static const size_t kSegmentSize = 1ull << SegmentBits;
+    static const size_t kSegmentMask = kSegmentSize - 1;
+    static const size_t kCapacity = MaxSegments << SegmentBits;
+
+    typedef std::atomic<T *> Slot;
+
+    FdTable()
+    {
+        for (auto &seg : m_segments) {
+            seg.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FdTable()
+    {
+        for (auto &seg : m_segments) {
+            Slot *slots = seg.load(std::memory_order_acquire);
+            if (!slots) {
+                continue;
+            }
+            for (size_t i = 0; i < kSegmentSize; ++i) {
+                delete slots[i].load(std::memory_order_relaxed);
+            }
+            delete[] slots;
+        }
+    }
+
+    /**
+     * @brief 查找 fd 对应的元素
+     * @return 不存在或 fd 超出范围时返回 nullptr
+     */
+    T *get(int fd) const
+    {
+        if (fd < 0 || (size_t)fd >= kCapacity) {
+            return nullptr;
+        }
+        Slot *slots = m_segments[fd >> SegmentBits].load(std::memory_order_acquire);
+        if (!slots) {
+            return nullptr;
+        }
+        return slots[fd & kSegmentMask].load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 查找 fd 对应的元素, 不存在时创建
+     * @details 并发创建时只有一个线程的元素会被安装, 其余的被释放
+     * @return fd 超出范围时返回 nullptr
+     */
+    T *getOrCreate(int fd)
+    {
+        if (fd < 0 || (size_t)fd >= kCapacity) {
+            return nullptr;
+        }
+        std::atomic<Slot *> &seg = m_segments[fd >> SegmentBits];
+        Slot *slots = seg.load(std::memory_order_acquire);
+        if (!slots) {
+            Slot *fresh = new Slot[kSegmentSize]();
+            if (seg.compare_exchange_strong(slots, fresh, std::memory_order_acq_rel)) {
+                slots = fresh;
+            } else {
+                delete[] fresh;
+            }
+        }
+
+        Slot &slot = slots[fd & kSegmentMask];
+        T *v = slot.load(std::memory_order_acquire);
+        if (v) {
+            return v;
+        }
+        T *fresh = new T(fd);
+        if (slot.compare_exchange_strong(v, fresh, std::memory_order_acq_rel)) {
+            return fresh;
+        }
+        delete fresh;
+        return v;
+    }
+
+private:
+    /// 段目录
+    std::atomic<Slot *> m_segments[MaxSegments];
+};
+
+} // namespace base
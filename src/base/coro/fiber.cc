@@ -3,8 +3,10 @@
 #include "base/macro.h"
 #include "base/log/log.h"
 #include "scheduler.h"
+#include "fiber_pool.h"
 #include <atomic>
-#include <sys/mman.h>
+#include <algorithm>
+#include <string.h>
 
 namespace base
 {
@@ -16,80 +18,77 @@ static std::atomic<uint64_t> s_fiber_count{0};
 
 static thread_local Fiber *t_fiber = nullptr;
 static thread_local Fiber::ptr t_threadFiber = nullptr;
+/// 不在协程中运行时使用的局部存储
+static thread_local FiberLocalStorage t_thread_locals;
 
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-class MallocStackAllocator
-{
-public:
-    static void *Alloc(size_t size) { return malloc(size); }
+static ConfigVar<bool>::ptr g_shared_stack_enable =
+    Config::Lookup("fiber.shared_stack.enable", false,
+                   "scheduler callback fibers run on per-thread shared stacks");
 
-    static void Dealloc(void *vp, size_t size) { return free(vp); }
-};
+static ConfigVar<uint32_t>::ptr g_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack.size", 1024 * 1024, "shared stack size");
 
-class MMapStackAllocator
-{
-public:
-    static void *Alloc(size_t size)
+static ConfigVar<uint32_t>::ptr g_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack.count", 4, "shared stacks per thread");
+
+/// Fiber对象放在映射区的最高处, 栈从它的下方开始向低地址增长
+static const size_t kFiberHeaderSize = (sizeof(Fiber) + 63) & ~(size_t)63;
+
+/**
+ * @brief 共享栈
+ * @details 同一时刻只有 owner 的栈内容在共享栈上,
+ *          其它绑定在该共享栈上的协程的栈内容保存在各自的堆内存中
+ */
+struct SharedStack {
+    typedef std::shared_ptr<SharedStack> ptr;
+    typedef Spinlock MutexType;
+
+    SharedStack(size_t size)
     {
-        return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        size_t guard = FiberStackPool::GuardSize();
+        base = (char *)FiberStackPool::Alloc(size, allocSize);
+        if (!base) {
+            throw std::bad_alloc();
+        }
+        stack = base + guard;
+        this->size = allocSize - guard;
     }
 
-    static void Dealloc(void *vp, size_t size) { munmap(vp, size); }
+    ~SharedStack() { FiberStackPool::Dealloc(base, allocSize); }
+
+    /// 映射起始地址(含保护页)
+    char *base = nullptr;
+    /// 映射大小
+    size_t allocSize = 0;
+    /// 栈低地址
+    char *stack = nullptr;
+    /// 栈大小
+    size_t size = 0;
+    /// 当前栈内容属于哪个协程
+    Fiber *owner = nullptr;
+    /// 保护owner, 协程可能在其它线程析构
+    MutexType mutex;
 };
 
-using StackAllocator = MallocStackAllocator;
-// using StackAllocator = MMapStackAllocator;
-
-// class FiberPool {
-// public:
-//     FiberPool(size_t max_size)
-//         :m_maxSize(max_size) {
-//     }
-//     ~FiberPool() {
-//         for(auto& i : m_mems) {
-//             free(i);
-//         }
-//     }
-//     void* alloc(size_t size);
-//     void dealloc(void* ptr);
-// private:
-//     struct MemItem {
-//         size_t size;
-//         char data[];
-//     };
-// private:
-//     size_t m_maxSize;
-//     std::list<MemItem*> m_mems;
-// };
-//
-// void* FiberPool::alloc(size_t size) {
-//     for(auto it = m_mems.begin();
-//             it != m_mems.end(); ++it) {
-//         if((*it)->size >= size) {
-//             auto p = (*it)->data;
-//             m_mems.erase(it);
-//             return p;
-//         }
-//     }
-//     MemItem* mi = (MemItem*)malloc(sizeof(size_t) + size);
-//     mi->size = size;
-//     return mi->data;
-// }
-//
-// void FiberPool::dealloc(void* ptr) {
-//     MemItem* mi = (MemItem*)((char*)ptr - sizeof(size_t));
-//     m_mems.push_front(mi);
-//     if(m_mems.size() > m_maxSize) {
-//         MemItem* v = m_mems.back();
-//         m_mems.pop_back();
-//         free(v);
-//         _LOG_INFO(g_logger) << "poll full";
-//     }
-// }
-//
-// static thread_local FiberPool s_fiber_pool(1024);
+static thread_local std::vector<SharedStack::ptr> t_shared_stacks;
+static thread_local size_t t_shared_stack_cursor = 0;
+
+/**
+ * @brief 轮流从当前线程的共享栈中取一个
+ */
+static SharedStack::ptr NextSharedStack()
+{
+    size_t count = std::max(g_shared_stack_count->getValue(), (uint32_t)1);
+    size_t idx = t_shared_stack_cursor++ % count;
+    if (idx >= t_shared_stacks.size()) {
+        t_shared_stacks.push_back(std::make_shared<SharedStack>(g_shared_stack_size->getValue()));
+        idx = t_shared_stacks.size() - 1;
+    }
+    return t_shared_stacks[idx];
+}
 
 uint64_t Fiber::GetFiberId()
 {
@@ -101,31 +100,50 @@ uint64_t Fiber::GetFiberId()
 
 Fiber *NewFiber()
 {
-    // Fiber* p = (Fiber*)malloc(sizeof(Fiber));
-    // return new (p) Fiber();
-    // p->Fiber();
-    // return p;
     return new Fiber();
 }
 
 Fiber *NewFiber(std::function<void()> cb, size_t stacksize, bool use_caller)
 {
     stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-    // Fiber* p = (Fiber*)malloc(sizeof(Fiber) + stacksize);
-    // Fiber* p = (Fiber*)s_fiber_pool.alloc(sizeof(Fiber) + stacksize);
-    Fiber *p = (Fiber *)StackAllocator::Alloc(sizeof(Fiber) + stacksize);
-    return new (p) Fiber(cb, stacksize, use_caller);
-    // p->Fiber(cb, stacksize, use_caller);
-    // return p;
+    size_t alloc_size = 0;
+    char *base = (char *)FiberStackPool::Alloc(stacksize + kFiberHeaderSize, alloc_size);
+    if (!base) {
+        throw std::bad_alloc();
+    }
+    size_t guard = FiberStackPool::GuardSize();
+    char *p = base + alloc_size - kFiberHeaderSize;
+    return new (p) Fiber(cb, base + guard, alloc_size - guard - kFiberHeaderSize, use_caller);
+}
+
+Fiber *NewSharedStackFiber(std::function<void()> cb)
+{
+#if FIBER_CONTEXT_TYPE == FIBER_FCONTEXT
+    SharedStack::ptr ss = NextSharedStack();
+    // 不传栈地址, 上下文延迟到首次切入时初始化
+    Fiber *fiber = new Fiber(cb, nullptr, 0, false);
+    fiber->m_stack = ss->stack;
+    fiber->m_stacksize = ss->size;
+    fiber->m_sharedStack = ss;
+    fiber->m_bindThread = base::GetThreadId();
+    return fiber;
+#else
+    return NewFiber(cb);
+#endif
 }
 
 void FreeFiber(Fiber *ptr)
 {
+    if (!ptr->m_stack || ptr->m_sharedStack) {
+        // 主协程 或 共享栈协程
+        delete ptr;
+        return;
+    }
+    size_t guard = FiberStackPool::GuardSize();
+    char *base = ptr->m_stack - guard;
+    size_t alloc_size = guard + ptr->m_stacksize + kFiberHeaderSize;
     ptr->~Fiber();
-    // free(ptr);
-    // s_fiber_pool.dealloc(ptr);
-    // StackAllocator::Dealloc(ptr, ptr->m_stacksize + sizeof(Fiber));
-    StackAllocator::Dealloc(ptr, 0);
+    FiberStackPool::Dealloc(base, alloc_size);
 }
 
 Fiber::Fiber()
@@ -148,14 +166,14 @@ Fiber::Fiber()
     _LOG_DEBUG(g_logger) << "Fiber::Fiber main";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
-    : m_id(++s_fiber_id), m_cb(cb)
+Fiber::Fiber(std::function<void()> cb, char *stack, size_t stacksize, bool use_caller)
+    : m_id(++s_fiber_id), m_stacksize(stacksize), m_cb(cb), m_stack(stack)
 {
     ++s_fiber_count;
-    // m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-    m_stacksize = stacksize;
-
-    // m_stack = StackAllocator::Alloc(m_stacksize);
+    FiberLocalStorage *locals = FiberLocalStorage::Current();
+    if (locals->hasInheritable()) {
+        m_locals.inherit(*locals);
+    }
 #if FIBER_CONTEXT_TYPE == FIBER_UCONTEXT
     if (getcontext(&m_ctx)) {
         _ASSERT2(false, "getcontext");
@@ -170,7 +188,9 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
         makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
     }
 #elif FIBER_CONTEXT_TYPE == FIBER_FCONTEXT
-    if (!use_caller) {
+    // 共享栈协程延迟到首次切入时再初始化上下文, 此时共享栈上可能还有其它协程的内容
+    if (!m_stack) {
+    } else if (!use_caller) {
         m_ctx = make_fcontext((char *)m_stack + m_stacksize, m_stacksize, &Fiber::MainFunc);
     } else {
         m_ctx = make_fcontext((char *)m_stack + m_stacksize, m_stacksize, &Fiber::CallerMainFunc);
@@ -194,10 +214,15 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
 Fiber::~Fiber()
 {
     --s_fiber_count;
+    if (m_sharedStack) {
+        SharedStack::MutexType::Lock lock(m_sharedStack->mutex);
+        if (m_sharedStack->owner == this) {
+            m_sharedStack->owner = nullptr;
+        }
+    }
+    free(m_savedStack);
     if (m_stack != nullptr && m_stacksize != 0) {
         _ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
-
-        // StackAllocator::Dealloc(m_stack, m_stacksize);
     } else {
         // GetThis() 创建的主协程 释放
         _ASSERT(!m_cb);
@@ -218,6 +243,9 @@ void Fiber::reset(std::function<void()> cb)
     _ASSERT(m_stack);
     _ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
     m_cb = cb;
+    m_priority = NORMAL;
+    m_deadlineUs = 0;
+    m_locals.clear();
 
 #if FIBER_CONTEXT_TYPE == FIBER_UCONTEXT
     if (getcontext(&m_ctx)) {
@@ -230,7 +258,12 @@ void Fiber::reset(std::function<void()> cb)
 
     makecontext(&m_ctx, &Fiber::MainFunc, 0);
 #elif FIBER_CONTEXT_TYPE == FIBER_FCONTEXT
-    m_ctx = make_fcontext((char *)m_stack + m_stacksize, m_stacksize, &Fiber::MainFunc);
+    if (m_sharedStack) {
+        m_ctx = nullptr;
+        m_savedSize = 0;
+    } else {
+        m_ctx = make_fcontext((char *)m_stack + m_stacksize, m_stacksize, &Fiber::MainFunc);
+    }
 #elif FIBER_CONTEXT_TYPE == FIBER_LIBCO
     coctx_make(&m_ctx, &Fiber::MainFunc, 0, 0);
 #elif FIBER_CONTEXT_TYPE == FIBER_LIBACO
@@ -272,9 +305,53 @@ void Fiber::back()
 #endif
 }
 
+void Fiber::saveStack()
+{
+#if FIBER_CONTEXT_TYPE == FIBER_FCONTEXT
+    // 切出时 jump_fcontext 把寄存器压在栈上, m_ctx 就是栈的最低使用地址
+    char *top = m_sharedStack->stack + m_sharedStack->size;
+    size_t used = top - (char *)m_ctx;
+    if (used > m_savedCap || used * 2 < m_savedCap) {
+        free(m_savedStack);
+        m_savedStack = (char *)malloc(used);
+        m_savedCap = used;
+    }
+    memcpy(m_savedStack, m_ctx, used);
+    m_savedSize = used;
+#endif
+}
+
+void Fiber::restoreStack()
+{
+#if FIBER_CONTEXT_TYPE == FIBER_FCONTEXT
+    _ASSERT2(m_bindThread == base::GetThreadId(),
+             "shared stack fiber id=" << m_id << " bind_thread=" << m_bindThread);
+    SharedStack &ss = *m_sharedStack;
+    char *top = ss.stack + ss.size;
+    SharedStack::MutexType::Lock lock(ss.mutex);
+    if (ss.owner != this) {
+        Fiber *owner = ss.owner;
+        if (owner && owner->m_ctx && owner->m_state != TERM && owner->m_state != EXCEPT) {
+            owner->saveStack();
+        }
+        ss.owner = this;
+        if (m_ctx && m_savedSize) {
+            memcpy(top - m_savedSize, m_savedStack, m_savedSize);
+        }
+    }
+    lock.unlock();
+    if (!m_ctx) {
+        m_ctx = make_fcontext(top, ss.size, &Fiber::MainFunc);
+    }
+#endif
+}
+
 // 切换到当前协程执行
 void Fiber::swapIn()
 {
+    if (m_sharedStack) {
+        restoreStack();
+    }
     SetThis(this);
     _ASSERT(m_state != EXEC);
     m_state = EXEC;
@@ -314,6 +391,12 @@ void Fiber::SetThis(Fiber *f)
     t_fiber = f;
 }
 
+// 返回当前协程的局部存储, 不在协程中时返回线程级的存储
+FiberLocalStorage *FiberLocalStorage::Current()
+{
+    return t_fiber ? &t_fiber->getLocals() : &t_thread_locals;
+}
+
 // 返回当前协程
 Fiber::ptr Fiber::GetThis()
 {
@@ -345,11 +428,46 @@ void Fiber::YieldToHold()
     cur->swapOut();
 }
 
+void Fiber::MaybeYield()
+{
+    if (Scheduler::ConsumePreempt()) {
+        YieldToReady();
+    }
+}
+
 // 总协程数
 uint64_t Fiber::TotalFibers()
 {
     return s_fiber_count;
 }
+
+void Fiber::setBindThread(int thread)
+{
+    _ASSERT2(!m_sharedStack, "shared stack fiber id=" << m_id << " bind_thread=" << m_bindThread);
+    m_bindThread = thread;
+}
+
+const char *Fiber::PriorityToString(Priority prio)
+{
+    switch (prio) {
+        case REALTIME:
+            return "realtime";
+        case NORMAL:
+            return "normal";
+        case BACKGROUND:
+            return "background";
+    }
+    return "unknown";
+}
+
+bool Fiber::SharedStackEnabled()
+{
+#if FIBER_CONTEXT_TYPE == FIBER_FCONTEXT
+    return g_shared_stack_enable->getValue();
+#else
+    return false;
+#endif
+}
 #if FIBER_CONTEXT_TYPE == FIBER_UCONTEXT || FIBER_CONTEXT_TYPE == FIBER_LIBACO
 void Fiber::MainFunc()
 {
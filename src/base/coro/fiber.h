@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <functional>
+#include "base/coro/fiber_local.h"
 
 #define FIBER_UCONTEXT 1
 #define FIBER_FCONTEXT 2
@@ -27,9 +28,17 @@ namespace base
 
 class Scheduler;
 class Fiber;
+struct SharedStack;
 
 Fiber *NewFiber();
 Fiber *NewFiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+/**
+ * @brief 创建共享栈协程
+ * @details 协程运行在当前线程的共享栈上, 切出后由下一个使用该共享栈的协程
+ *          把它的栈内容拷贝到按实际大小申请的堆内存中, 切回时再拷贝回来.
+ *          协程绑定在创建它的线程上执行. 仅 FIBER_FCONTEXT 支持, 其它实现退化为 NewFiber
+ */
+Fiber *NewSharedStackFiber(std::function<void()> cb);
 void FreeFiber(Fiber *ptr);
 
 /**
@@ -40,6 +49,7 @@ class Fiber : public std::enable_shared_from_this<Fiber>
     friend class Scheduler;
     friend Fiber *NewFiber();
     friend Fiber *NewFiber(std::function<void()> cb, size_t stacksize, bool use_caller);
+    friend Fiber *NewSharedStackFiber(std::function<void()> cb);
     friend void FreeFiber(Fiber *ptr);
 
 public:
@@ -63,6 +73,21 @@ public:
         EXCEPT
     };
 
+    /**
+     * @brief 调度优先级
+     * @details 调度器为每个优先级维护一条队列, 数值小的先执行
+     */
+    enum Priority {
+        /// 延迟敏感的任务, 例如 RPC 请求处理
+        REALTIME = 0,
+        /// 默认优先级
+        NORMAL = 1,
+        /// 后台批量任务, 例如日志投递
+        BACKGROUND = 2,
+    };
+    /// 优先级数量
+    static const int kPriorityCount = 3;
+
 private:
     /**
      * @brief 无参构造函数
@@ -73,10 +98,11 @@ private:
     /**
      * @brief 构造函数
      * @param[in] cb 协程执行的函数
+     * @param[in] stack 协程栈起始地址(低地址)
      * @param[in] stacksize 协程栈大小
      * @param[in] use_caller 是否在MainFiber上调度
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    Fiber(std::function<void()> cb, char *stack, size_t stacksize, bool use_caller = false);
 
 public:
     /**
@@ -131,6 +157,46 @@ public:
      */
     void setState(State state) { m_state = state; }
 
+    /**
+     * @brief 是否运行在共享栈上
+     */
+    bool isSharedStack() const { return m_sharedStack != nullptr; }
+
+    /**
+     * @brief 协程绑定的线程id, -1表示可以在任意线程执行
+     */
+    int getBindThread() const { return m_bindThread; }
+
+    /**
+     * @brief 绑定线程, 之后协程每次被重新调度(yield/IO唤醒)都回到该线程执行
+     * @pre 不是共享栈协程(共享栈协程固定在创建它的线程)
+     * @param[in] thread 线程id, -1表示解除绑定
+     */
+    void setBindThread(int thread);
+
+    /**
+     * @brief 切出后保存的栈大小(共享栈协程)
+     */
+    uint32_t getSavedStackSize() const { return m_savedSize; }
+
+    /**
+     * @brief 调度优先级, 协程每次被重新调度(yield/IO唤醒)都放入该优先级的队列
+     */
+    Priority getPriority() const { return (Priority)m_priority; }
+    void setPriority(Priority v) { m_priority = v; }
+
+    /**
+     * @brief 截止时间(绝对时间, 微秒), 0表示没有截止时间
+     * @details 同一优先级中有截止时间的协程按截止时间先后(EDF)执行
+     */
+    uint64_t getDeadline() const { return m_deadlineUs; }
+    void setDeadline(uint64_t us) { m_deadlineUs = us; }
+
+    /**
+     * @brief 协程局部存储, 构造时继承当前协程的可继承槽位, reset 时清空
+     */
+    FiberLocalStorage &getLocals() { return m_locals; }
+
 public:
     /**
      * @brief 设置当前线程的运行协程
@@ -155,6 +221,13 @@ public:
      */
     static void YieldToHold();
 
+    /**
+     * @brief 协作式抢占的安全点
+     * @details 开启 scheduler.preempt.slice_ms 后, 当前协程运行超过时间片时在这里让出(READY),
+     *          否则立即返回. 只能在没有持有线程锁的位置调用, 调用方要能接受在这里切换协程
+     */
+    static void MaybeYield();
+
     /**
      * @brief 返回当前协程的总数量
      */
@@ -189,6 +262,28 @@ public:
      */
     static uint64_t GetFiberId();
 
+    /**
+     * @brief 是否启用共享栈模式(fiber.shared_stack.enable)
+     */
+    static bool SharedStackEnabled();
+
+    /**
+     * @brief 优先级名称, 用于输出统计
+     */
+    static const char *PriorityToString(Priority prio);
+
+private:
+    /**
+     * @brief 把本协程在共享栈上的内容保存到堆内存
+     * @pre 本协程已切出, 且是共享栈的当前属主
+     */
+    void saveStack();
+
+    /**
+     * @brief 切入前准备共享栈: 保存旧属主的栈, 恢复本协程的栈
+     */
+    void restoreStack();
+
 private:
     /// 协程id
     uint64_t m_id = 0;
@@ -209,8 +304,24 @@ private:
     aco_t *m_ctx = nullptr;
     aco_share_stack_t m_astack;
 #endif
-    /// 协程运行栈指针
-    char m_stack[];
+    /// 协程运行栈指针(由FiberStackPool分配, Fiber对象位于栈顶之上)
+    char *m_stack = nullptr;
+    /// 绑定的线程id
+    int m_bindThread = -1;
+    /// 共享栈
+    std::shared_ptr<SharedStack> m_sharedStack;
+    /// 切出时保存的栈内容
+    char *m_savedStack = nullptr;
+    /// 保存的栈大小
+    uint32_t m_savedSize = 0;
+    /// 保存缓冲区的容量
+    uint32_t m_savedCap = 0;
+    /// 调度优先级
+    uint8_t m_priority = NORMAL;
+    /// 截止时间(微秒)
+    uint64_t m_deadlineUs = 0;
+    /// 协程局部存储
+    FiberLocalStorage m_locals;
 };
 
 } // namespace base
\ No newline at end of file
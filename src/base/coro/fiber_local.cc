@@ -0,0 +1,55 @@
+#include "fiber_local.h"
+#include "base/macro.h"
+#include "base/util.h"
+
+namespace base
+{
+
+std::atomic<uint32_t> FiberLocalStorage::s_inheritMask = {0};
+
+size_t FiberLocalStorage::AllocSlot(bool inheritable)
+{
+    static std::atomic<size_t> s_next = {0};
+    size_t idx = s_next++;
+    _ASSERT2(idx < kMaxSlots, "too many FiberLocal, increase FiberLocalStorage::kMaxSlots");
+    if (inheritable) {
+        s_inheritMask |= 1u << idx;
+    }
+    return idx;
+}
+
+/**
+ * @brief 局部静态变量, 其它编译单元静态初始化期间也能使用
+ */
+static FiberLocal<RequestContext> &GetRequestContextLocal()
+{
+    static FiberLocal<RequestContext> s_local;
+    return s_local;
+}
+
+const RequestContext *RequestContext::Get()
+{
+    return GetRequestContextLocal().get();
+}
+
+void RequestContext::Set(RequestContext v)
+{
+    GetRequestContextLocal().set(std::move(v));
+}
+
+void RequestContext::Reset()
+{
+    GetRequestContextLocal().reset();
+}
+
+uint64_t RequestContext::RemainingMs(uint64_t def)
+{
+    const RequestContext *ctx = Get();
+    if (!ctx || !ctx->deadlineMs) {
+        return def;
+    }
+    uint64_t now = GetCurrentMS();
+    return ctx->deadlineMs > now ? ctx->deadlineMs - now : 0;
+}
+
+} // namespace base
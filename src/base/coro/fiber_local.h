@@ -0,0 +1,237 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include "base/noncopyable.h"
+
+namespace base
+{
+
+/**
+ * @brief 协程局部变量的值
+ * @details 侵入式引用计数, 设置后不再修改, 继承给派生的协程时只复制指针并增加计数
+ */
+struct FiberLocalValue : Noncopyable {
+    virtual ~FiberLocalValue() {}
+
+    void ref() { m_refs.fetch_add(1, std::memory_order_relaxed); }
+    void unref()
+    {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+private:
+    std::atomic<uint32_t> m_refs = {1};
+};
+
+/**
+ * @brief 协程局部存储, 内联在 Fiber 和调度任务中
+ * @details 固定 kMaxSlots 个槽位, 下标在 FiberLocal 构造时分配, 查找就是一次数组下标访问.
+ *          不在协程中运行的代码使用线程级的存储
+ */
+class FiberLocalStorage : Noncopyable
+{
+public:
+    static const size_t kMaxSlots = 8;
+
+    FiberLocalStorage() {}
+    ~FiberLocalStorage() { clear(); }
+
+    FiberLocalValue *get(size_t idx) const { return m_values[idx]; }
+
+    /**
+     * @brief 设置槽位, 接管 v 的一个引用, v 为 nullptr 时清空
+     */
+    void set(size_t idx, FiberLocalValue *v)
+    {
+        FiberLocalValue *old = m_values[idx];
+        m_values[idx] = v;
+        if (v) {
+            m_mask |= 1u << idx;
+        } else {
+            m_mask &= ~(1u << idx);
+        }
+        if (old) {
+            old->unref();
+        }
+    }
+
+    bool empty() const { return !m_mask; }
+
+    /**
+     * @brief 清空所有槽位
+     */
+    void clear()
+    {
+        for (uint32_t mask = m_mask; mask; mask &= mask - 1) {
+            size_t idx = __builtin_ctz(mask);
+            m_values[idx]->unref();
+            m_values[idx] = nullptr;
+        }
+        m_mask = 0;
+    }
+
+    /**
+     * @brief 是否设置了可继承的槽位
+     */
+    bool hasInheritable() const
+    {
+        return m_mask & s_inheritMask.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 复制 o 中可继承的槽位(FiberLocal 的 Inheritable 参数), 原有的值被替换
+     */
+    void inherit(const FiberLocalStorage &o)
+    {
+        uint32_t mask = o.m_mask & s_inheritMask.load(std::memory_order_relaxed);
+        clear();
+        m_mask = mask;
+        for (; mask; mask &= mask - 1) {
+            size_t idx = __builtin_ctz(mask);
+            o.m_values[idx]->ref();
+            m_values[idx] = o.m_values[idx];
+        }
+    }
+
+    /**
+     * @brief 用 o 的内容替换本存储, o 被清空
+     */
+    void moveFrom(FiberLocalStorage &o)
+    {
+        if (empty() && o.empty()) {
+            return;
+        }
+        clear();
+        for (size_t i = 0; i < kMaxSlots; ++i) {
+            m_values[i] = o.m_values[i];
+            o.m_values[i] = nullptr;
+        }
+        m_mask = o.m_mask;
+        o.m_mask = 0;
+    }
+
+    /**
+     * @brief 当前协程的存储, 不在协程中时返回线程级的存储
+     */
+    static FiberLocalStorage *Current();
+
+    /**
+     * @brief 分配一个槽位, 超过 kMaxSlots 时断言失败
+     * @param[in] inheritable 是否被 schedule() 派生的协程继承
+     */
+    static size_t AllocSlot(bool inheritable);
+
+private:
+    FiberLocalValue *m_values[kMaxSlots] = {};
+    /// 已设置的槽位
+    uint32_t m_mask = 0;
+    /// 可继承的槽位
+    static std::atomic<uint32_t> s_inheritMask;
+};
+
+/**
+ * @brief 类型化的协程局部变量
+ * @details 一般定义为全局或静态对象, 槽位下标在构造时确定, 之后 get/set 都是 O(1) 的数组访问,
+ *          不查 map, 也不复制 shared_ptr. 值设置后不可修改, 需要修改时重新 set.
+ *          Inheritable 为 true 时, 在协程中 schedule() 的回调任务(包括 WorkerGroup)
+ *          和新建的协程会继承当前的值
+ * @tparam T 值类型
+ * @tparam Inheritable 是否被派生的协程继承
+ */
+template <class T, bool Inheritable = true>
+class FiberLocal : Noncopyable
+{
+public:
+    FiberLocal() : m_index(FiberLocalStorage::AllocSlot(Inheritable)) {}
+
+    /**
+     * @brief 当前协程的值, 没有设置时返回 nullptr
+     * @details 返回的指针在当前协程重新 set/reset 之前有效
+     */
+    const T *get() const
+    {
+        FiberLocalValue *v = FiberLocalStorage::Current()->get(m_index);
+        return v ? &static_cast<Value *>(v)->value : nullptr;
+    }
+
+    /**
+     * @brief 设置当前协程的值
+     */
+    void set(T v) { FiberLocalStorage::Current()->set(m_index, new Value(std::move(v))); }
+
+    /**
+     * @brief 清空当前协程的值
+     */
+    void reset() { FiberLocalStorage::Current()->set(m_index, nullptr); }
+
+    /**
+     * @brief 作用域内设置值, 析构时恢复原来的值
+     */
+    class Scope : Noncopyable
+    {
+    public:
+        Scope(const FiberLocal &local, T v) : m_index(local.m_index)
+        {
+            FiberLocalStorage *ls = FiberLocalStorage::Current();
+            m_old = ls->get(m_index);
+            if (m_old) {
+                m_old->ref();
+            }
+            ls->set(m_index, new Value(std::move(v)));
+        }
+        ~Scope() { FiberLocalStorage::Current()->set(m_index, m_old); }
+
+    private:
+        size_t m_index;
+        FiberLocalValue *m_old;
+    };
+
+private:
+    struct Value : FiberLocalValue {
+        explicit Value(T &&v) : value(std::move(v)) {}
+        T value;
+    };
+
+private:
+    size_t m_index;
+};
+
+/**
+ * @brief 请求上下文, 随 schedule() 继承给派生的协程
+ * @details 日志格式 %R 输出请求id
+ */
+struct RequestContext {
+    /// 请求id/trace id
+    std::string requestId;
+    /// 截止时间(毫秒, GetCurrentMS), 0表示没有
+    uint64_t deadlineMs = 0;
+
+    /**
+     * @brief 当前协程的请求上下文, 没有时返回 nullptr
+     */
+    static const RequestContext *Get();
+
+    /**
+     * @brief 设置当前协程的请求上下文
+     */
+    static void Set(RequestContext v);
+
+    /**
+     * @brief 清空当前协程的请求上下文
+     */
+    static void Reset();
+
+    /**
+     * @brief 距离截止时间的剩余毫秒数
+     * @return 没有截止时间时返回 def, 已经超时返回 0
+     */
+    static uint64_t RemainingMs(uint64_t def = ~0ull);
+};
+
+} // namespace base
@@ -0,0 +1,249 @@
+#include "fiber_pool.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/thread.h"
+#include <atomic>
+#include <sstream>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace base
+{
+
+static Logger::ptr g_logger = _LOG_NAME("system");
+
+static ConfigVar<bool>::ptr g_stack_pool_enable =
+    Config::Lookup("fiber.stack_pool.enable", true, "cache fiber stacks per thread");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_guard_pages =
+    Config::Lookup<uint32_t>("fiber.stack_pool.guard_pages", 1,
+                             "fiber stack guard pages, fixed after first fiber created");
+
+static ConfigVar<uint64_t>::ptr g_stack_pool_high_water =
+    Config::Lookup<uint64_t>("fiber.stack_pool.high_water", 64 * 1024 * 1024,
+                             "max cached fiber stack bytes per thread");
+
+/// 最小分级 16K, 共7级, 最大 1M
+static const size_t kMinClassShift = 14;
+static const size_t kClassCount = 7;
+
+static std::atomic<uint64_t> s_alloc{0};
+static std::atomic<uint64_t> s_reuse{0};
+static std::atomic<uint64_t> s_mmap{0};
+static std::atomic<uint64_t> s_free{0};
+static std::atomic<uint64_t> s_unmap{0};
+static std::atomic<int64_t> s_cached_bytes{0};
+static std::atomic<int64_t> s_mapped_bytes{0};
+
+static size_t PageSize()
+{
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+size_t FiberStackPool::GuardSize()
+{
+    static size_t s_guard_size = g_stack_pool_guard_pages->getValue() * PageSize();
+    return s_guard_size;
+}
+
+/**
+ * @brief 分级的可用大小: 栈(2的幂) + 一页header
+ */
+static size_t ClassSize(size_t idx)
+{
+    return ((size_t)1 << (kMinClassShift + idx)) + PageSize();
+}
+
+/**
+ * @brief 根据映射大小反查分级, 不属于任何分级返回 kClassCount
+ */
+static size_t ClassIndex(size_t alloc_size)
+{
+    for (size_t i = 0; i < kClassCount; ++i) {
+        if (ClassSize(i) + FiberStackPool::GuardSize() == alloc_size) {
+            return i;
+        }
+    }
+    return kClassCount;
+}
+
+static void *MapStack(size_t alloc_size)
+{
+    void *ptr = mmap(nullptr, alloc_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        // 每个带保护页的栈占用两个VMA, 大量协程时可能触达 vm.max_map_count
+        _LOG_ERROR(g_logger) << "mmap fiber stack size=" << alloc_size << " errno=" << errno
+                             << " " << strerror(errno) << " mapped_bytes=" << s_mapped_bytes
+                             << ", check vm.max_map_count or fiber.stack_pool.guard_pages";
+        return nullptr;
+    }
+    size_t guard = FiberStackPool::GuardSize();
+    if (guard && mprotect(ptr, guard, PROT_NONE)) {
+        _LOG_ERROR(g_logger) << "mprotect fiber stack guard errno=" << errno << " "
+                             << strerror(errno);
+    }
+    // 协程可能被其它线程执行, 按映射绑定节点, 而不是依赖首次访问的线程
+    int node = Thread::GetMemoryNode();
+    if (node >= 0) {
+        Thread::BindMemory((char *)ptr + guard, alloc_size - guard, node);
+    }
+    ++s_mmap;
+    s_mapped_bytes += alloc_size;
+    return ptr;
+}
+
+static void UnmapStack(void *ptr, size_t alloc_size)
+{
+    munmap(ptr, alloc_size);
+    s_mapped_bytes -= alloc_size;
+}
+
+/**
+ * @brief 线程本地的栈缓存
+ */
+class ThreadStackCache
+{
+public:
+    ~ThreadStackCache() { clear(); }
+
+    void clear()
+    {
+        for (size_t i = 0; i < kClassCount; ++i) {
+            size_t alloc_size = ClassSize(i) + FiberStackPool::GuardSize();
+            for (auto p : m_free[i]) {
+                UnmapStack(p, alloc_size);
+                s_cached_bytes -= alloc_size;
+            }
+            m_free[i].clear();
+        }
+        m_cachedBytes = 0;
+    }
+
+    void *pop(size_t idx)
+    {
+        auto &list = m_free[idx];
+        if (list.empty()) {
+            return nullptr;
+        }
+        void *ptr = list.back();
+        list.pop_back();
+        size_t alloc_size = ClassSize(idx) + FiberStackPool::GuardSize();
+        m_cachedBytes -= alloc_size;
+        s_cached_bytes -= alloc_size;
+        return ptr;
+    }
+
+    bool push(size_t idx, void *ptr)
+    {
+        size_t alloc_size = ClassSize(idx) + FiberStackPool::GuardSize();
+        if (m_cachedBytes + alloc_size > g_stack_pool_high_water->getValue()) {
+            return false;
+        }
+        m_free[idx].push_back(ptr);
+        m_cachedBytes += alloc_size;
+        s_cached_bytes += alloc_size;
+        return true;
+    }
+
+private:
+    /// 各分级的空闲栈(LIFO, 优先复用刚释放的热内存)
+    std::vector<void *> m_free[kClassCount];
+    /// 本线程缓存的字节数
+    size_t m_cachedBytes = 0;
+};
+
+/// 线程退出后缓存已析构, 之后的释放直接 munmap
+static thread_local bool t_cache_destroyed = false;
+
+struct ThreadStackCacheHolder {
+    ~ThreadStackCacheHolder() { t_cache_destroyed = true; }
+    ThreadStackCache cache;
+};
+
+static ThreadStackCache *GetThreadCache()
+{
+    if (t_cache_destroyed) {
+        return nullptr;
+    }
+    static thread_local ThreadStackCacheHolder s_holder;
+    return &s_holder.cache;
+}
+
+void *FiberStackPool::Alloc(size_t size, size_t &alloc_size)
+{
+    ++s_alloc;
+    size_t page = PageSize();
+    size_t idx = 0;
+    while (idx < kClassCount && ClassSize(idx) < size) {
+        ++idx;
+    }
+
+    if (idx == kClassCount) {
+        alloc_size = (size + page - 1) / page * page + GuardSize();
+        return MapStack(alloc_size);
+    }
+
+    alloc_size = ClassSize(idx) + GuardSize();
+    if (g_stack_pool_enable->getValue()) {
+        ThreadStackCache *cache = GetThreadCache();
+        void *ptr = cache ? cache->pop(idx) : nullptr;
+        if (ptr) {
+            ++s_reuse;
+            return ptr;
+        }
+    }
+    return MapStack(alloc_size);
+}
+
+void FiberStackPool::Dealloc(void *ptr, size_t alloc_size)
+{
+    if (!ptr) {
+        return;
+    }
+    ++s_free;
+    size_t idx = ClassIndex(alloc_size);
+    if (idx != kClassCount && g_stack_pool_enable->getValue()) {
+        ThreadStackCache *cache = GetThreadCache();
+        if (cache && cache->push(idx, ptr)) {
+            return;
+        }
+        ++s_unmap;
+    }
+    UnmapStack(ptr, alloc_size);
+}
+
+void FiberStackPool::ReleaseThreadCache()
+{
+    ThreadStackCache *cache = GetThreadCache();
+    if (cache) {
+        cache->clear();
+    }
+}
+
+FiberStackPool::Stats FiberStackPool::GetStats()
+{
+    Stats st;
+    st.alloc = s_alloc;
+    st.reuse = s_reuse;
+    st.mmap = s_mmap;
+    st.free = s_free;
+    st.unmap = s_unmap;
+    st.cachedBytes = s_cached_bytes;
+    st.mappedBytes = s_mapped_bytes;
+    return st;
+}
+
+std::string FiberStackPool::Stats::toString() const
+{
+    std::stringstream ss;
+    ss << "alloc=" << alloc << " reuse=" << reuse << " reuse_rate=" << reuseRate()
+       << " mmap=" << mmap << " free=" << free << " unmap=" << unmap
+       << " cached_bytes=" << cachedBytes << " mapped_bytes=" << mappedBytes;
+    return ss.str();
+}
+
+} // namespace base
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace base
+{
+
+/**
+ * @brief 协程栈内存池
+ * @details 每个线程一个缓存, 按栈大小分级(16K ~ 1M, 2的幂),
+ *          内存通过 mmap(MAP_NORESERVE) 申请, 物理页在首次访问时才提交.
+ *          每块内存的低地址端是 mprotect(PROT_NONE) 的保护页,
+ *          栈溢出会直接触发 SIGSEGV, 而不是悄悄踩坏相邻内存.
+ *          内存布局(低地址 -> 高地址): [guard][stack ... ][header]
+ *          超过最大分级的栈不进入缓存, 释放时直接 munmap.
+ *          线程设置了NUMA节点(Thread::SetMemoryNode)时, 新映射的栈绑定到该节点.
+ */
+class FiberStackPool
+{
+public:
+    /**
+     * @brief 内存池统计(所有线程汇总)
+     */
+    struct Stats {
+        /// 申请次数
+        uint64_t alloc = 0;
+        /// 命中缓存的次数
+        uint64_t reuse = 0;
+        /// 新建映射的次数
+        uint64_t mmap = 0;
+        /// 释放次数
+        uint64_t free = 0;
+        /// 释放时超过上限直接 munmap 的次数
+        uint64_t unmap = 0;
+        /// 当前缓存的字节数
+        int64_t cachedBytes = 0;
+        /// 当前映射的字节数(使用中 + 缓存)
+        int64_t mappedBytes = 0;
+
+        /**
+         * @brief 缓存命中率
+         */
+        double reuseRate() const { return alloc ? (double)reuse / alloc : 0; }
+
+        std::string toString() const;
+    };
+
+    /**
+     * @brief 申请一块内存
+     * @param[in] size 需要的可用大小(栈 + header), 不含保护页
+     * @param[out] alloc_size 实际映射大小(含保护页), 释放时传回
+     * @return 映射的起始地址(保护页的起始), 失败返回nullptr
+     */
+    static void *Alloc(size_t size, size_t &alloc_size);
+
+    /**
+     * @brief 释放内存, 放回当前线程的缓存或直接 munmap
+     * @param[in] ptr Alloc 返回的地址
+     * @param[in] alloc_size Alloc 返回的映射大小
+     */
+    static void Dealloc(void *ptr, size_t alloc_size);
+
+    /**
+     * @brief 释放当前线程缓存的所有栈
+     * @details 线程切换NUMA节点后调用, 之后申请的栈都重新映射到新节点
+     */
+    static void ReleaseThreadCache();
+
+    /**
+     * @brief 保护页大小(字节), 进程启动后固定
+     */
+    static size_t GuardSize();
+
+    /**
+     * @brief 获取统计数据
+     */
+    static Stats GetStats();
+};
+
+} // namespace base
@@ -0,0 +1,384 @@
+#include "fiber_sync.h"
+#include "base/coro/scheduler.h"
+#include "base/macro.h"
+
+namespace base
+{
+
+void FiberWaiter::init(std::atomic<int> *s, int idx, void *d)
+{
+    _ASSERT(Scheduler::GetThis());
+    scheduler = Scheduler::GetThis();
+    fiber = Fiber::GetThis();
+    state = s ? s : &ownState;
+    index = idx;
+    data = d;
+    ok = false;
+}
+
+void FiberWaiter::wake()
+{
+    // 调度之后协程随时可能恢复并销毁节点, 先把需要的字段取出来
+    Scheduler *sc = scheduler;
+    Fiber::ptr f;
+    f.swap(fiber);
+    sc->schedule(std::move(f));
+}
+
+void FiberWaiter::Park()
+{
+    Fiber::YieldToHold();
+}
+
+void FiberWaiterQueue::push(FiberWaiter *w)
+{
+    w->prev = m_tail;
+    w->next = nullptr;
+    if (m_tail) {
+        m_tail->next = w;
+    } else {
+        m_head = w;
+    }
+    m_tail = w;
+    w->queued = true;
+    ++m_size;
+}
+
+FiberWaiter *FiberWaiterQueue::pop()
+{
+    FiberWaiter *w = m_head;
+    if (w) {
+        remove(w);
+    }
+    return w;
+}
+
+void FiberWaiterQueue::remove(FiberWaiter *w)
+{
+    if (!w->queued) {
+        return;
+    }
+    if (w->prev) {
+        w->prev->next = w->next;
+    } else {
+        m_head = w->next;
+    }
+    if (w->next) {
+        w->next->prev = w->prev;
+    } else {
+        m_tail = w->prev;
+    }
+    w->prev = w->next = nullptr;
+    w->queued = false;
+    --m_size;
+}
+
+FiberWaiter *FiberWaiterQueue::popClaimed()
+{
+    while (FiberWaiter *w = pop()) {
+        if (w->claim()) {
+            return w;
+        }
+    }
+    return nullptr;
+}
+
+void FiberWakeList::push(FiberWaiter *w)
+{
+    w->next = nullptr;
+    if (m_tail) {
+        m_tail->next = w;
+    } else {
+        m_head = w;
+    }
+    m_tail = w;
+}
+
+void FiberWakeList::wakeAll()
+{
+    FiberWaiter *w = m_head;
+    m_head = m_tail = nullptr;
+    while (w) {
+        // wake 之后节点随时可能失效
+        FiberWaiter *next = w->next;
+        w->next = nullptr;
+        w->wake();
+        w = next;
+    }
+}
+
+FiberMutex::~FiberMutex()
+{
+    _ASSERT(m_waiters.empty());
+}
+
+void FiberMutex::lock()
+{
+    FiberParkNode<FiberWaiter> waiter;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (!m_locked) {
+            m_locked = true;
+            return;
+        }
+        waiter->init();
+        m_waiters.push(waiter.get());
+    }
+    // unlock 直接把锁交给本协程, 醒来时已经持有锁
+    FiberWaiter::Park();
+}
+
+bool FiberMutex::tryLock()
+{
+    MutexType::Lock lock(m_mutex);
+    if (m_locked) {
+        return false;
+    }
+    m_locked = true;
+    return true;
+}
+
+void FiberMutex::unlock()
+{
+    FiberWaiter *w = nullptr;
+    {
+        MutexType::Lock lock(m_mutex);
+        _ASSERT(m_locked);
+        w = m_waiters.popClaimed();
+        if (!w) {
+            m_locked = false;
+            return;
+        }
+    }
+    // 锁直接交给等待者, 释放 m_mutex 之后再唤醒
+    w->ok = true;
+    w->wake();
+}
+
+FiberConditionVariable::~FiberConditionVariable()
+{
+    _ASSERT(m_waiters.empty());
+}
+
+void FiberConditionVariable::wait(FiberMutex &mutex)
+{
+    FiberParkNode<FiberWaiter> waiter;
+    waiter->init();
+    {
+        MutexType::Lock lock(m_mutex);
+        m_waiters.push(waiter.get());
+    }
+    // 先入队再释放 mutex, notify 不会丢失; 入队后到挂起之前被唤醒时,
+    // 调度器会等协程切出后再恢复它
+    mutex.unlock();
+    FiberWaiter::Park();
+    mutex.lock();
+}
+
+void FiberConditionVariable::notifyOne()
+{
+    FiberWaiter *w = nullptr;
+    {
+        MutexType::Lock lock(m_mutex);
+        w = m_waiters.popClaimed();
+    }
+    if (w) {
+        w->ok = true;
+        w->wake();
+    }
+}
+
+void FiberConditionVariable::notifyAll()
+{
+    FiberWakeList wakeups;
+    {
+        MutexType::Lock lock(m_mutex);
+        while (FiberWaiter *w = m_waiters.popClaimed()) {
+            w->ok = true;
+            wakeups.push(w);
+        }
+    }
+    wakeups.wakeAll();
+}
+
+WaitGroup::~WaitGroup()
+{
+    _ASSERT(m_waiters.empty());
+}
+
+void WaitGroup::add(int64_t n)
+{
+    FiberWakeList wakeups;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_count += n;
+        _ASSERT2(m_count >= 0, "WaitGroup count=" << m_count);
+        if (m_count > 0) {
+            return;
+        }
+        while (FiberWaiter *w = m_waiters.popClaimed()) {
+            w->ok = true;
+            wakeups.push(w);
+        }
+    }
+    // 释放锁之后不能再访问 this, 等待者醒来后可能销毁 WaitGroup
+    wakeups.wakeAll();
+}
+
+void WaitGroup::wait()
+{
+    FiberParkNode<FiberWaiter> waiter;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_count == 0) {
+            return;
+        }
+        waiter->init();
+        m_waiters.push(waiter.get());
+    }
+    FiberWaiter::Park();
+}
+
+ChannelBase::~ChannelBase()
+{
+    _ASSERT(m_sendWaiters.empty() && m_recvWaiters.empty());
+}
+
+void ChannelBase::close()
+{
+    FiberWakeList wakeups;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_closed = true;
+        while (FiberWaiter *w = m_recvWaiters.popClaimed()) {
+            w->ok = false;
+            wakeups.push(w);
+        }
+        while (FiberWaiter *w = m_sendWaiters.popClaimed()) {
+            w->ok = false;
+            wakeups.push(w);
+        }
+    }
+    wakeups.wakeAll();
+}
+
+bool ChannelBase::isClosed()
+{
+    MutexType::Lock lock(m_mutex);
+    return m_closed;
+}
+
+bool ChannelBase::transfer(bool send, void *data, void *local)
+{
+    FiberParkNode<FiberWaiter> waiter;
+    FiberWakeList wakeups;
+    Result rt;
+    {
+        MutexType::Lock lock(m_mutex);
+        rt = send ? trySendLocked(data, wakeups) : tryRecvLocked(data, wakeups);
+        if (rt == PENDING) {
+            FiberWaiter *w = waiter.get();
+            if (!waiter.isLocal()) {
+                // 共享栈协程的数据槽也要放在堆上
+                local = nullptr;
+            }
+            w->init(nullptr, 0, newSlot(send, data, local));
+            (send ? m_sendWaiters : m_recvWaiters).push(w);
+        }
+    }
+    wakeups.wakeAll();
+    if (rt != PENDING) {
+        return rt == DONE;
+    }
+    FiberWaiter::Park();
+    freeSlot(send, waiter->data, data, waiter->ok, local);
+    return waiter->ok;
+}
+
+Select &Select::addCase(ChannelBase *ch, bool send, void *data)
+{
+    _ASSERT2(m_count < kMaxCases, "select cases=" << m_count);
+    m_cases[m_count++] = {ch, send, data};
+
+    // 插入排序, 保持加锁顺序一致
+    size_t i = 0;
+    while (i < m_lockCount && m_locks[i] < ch) {
+        ++i;
+    }
+    if (i < m_lockCount && m_locks[i] == ch) {
+        return *this;
+    }
+    for (size_t j = m_lockCount; j > i; --j) {
+        m_locks[j] = m_locks[j - 1];
+    }
+    m_locks[i] = ch;
+    ++m_lockCount;
+    return *this;
+}
+
+void Select::lockAll()
+{
+    for (size_t i = 0; i < m_lockCount; ++i) {
+        m_locks[i]->m_mutex.lock();
+    }
+}
+
+void Select::unlockAll()
+{
+    for (size_t i = m_lockCount; i > 0; --i) {
+        m_locks[i - 1]->m_mutex.unlock();
+    }
+}
+
+int Select::select(bool block)
+{
+    _ASSERT(m_count > 0);
+    // 持有所有通道的锁时, 本协程的节点都还没入队, 不会有其它协程来唤醒
+    FiberWakeList wakeups;
+    lockAll();
+    for (size_t i = 0; i < m_count; ++i) {
+        Case &c = m_cases[i];
+        ChannelBase::Result rt = c.send ? c.ch->trySendLocked(c.data, wakeups)
+                                        : c.ch->tryRecvLocked(c.data, wakeups);
+        if (rt != ChannelBase::PENDING) {
+            unlockAll();
+            wakeups.wakeAll();
+            m_ok = rt == ChannelBase::DONE;
+            return i;
+        }
+    }
+    if (!block) {
+        unlockAll();
+        return -1;
+    }
+
+    struct Wait {
+        std::atomic<int> state = {0};
+        FiberWaiter waiters[kMaxCases];
+    };
+    FiberParkNode<Wait> wait;
+    for (size_t i = 0; i < m_count; ++i) {
+        Case &c = m_cases[i];
+        wait->waiters[i].init(&wait->state, i, c.ch->newSlot(c.send, c.data, nullptr));
+        (c.send ? c.ch->m_sendWaiters : c.ch->m_recvWaiters).push(&wait->waiters[i]);
+    }
+    unlockAll();
+
+    FiberWaiter::Park();
+
+    // 从其它通道上摘掉没有用到的节点, 加锁之后其它通道不会再访问节点
+    int index = wait->state.load(std::memory_order_acquire) - 1;
+    for (size_t i = 0; i < m_count; ++i) {
+        Case &c = m_cases[i];
+        if ((int)i != index) {
+            ChannelBase::MutexType::Lock lock(c.ch->m_mutex);
+            (c.send ? c.ch->m_sendWaiters : c.ch->m_recvWaiters).remove(&wait->waiters[i]);
+        }
+        c.ch->freeSlot(c.send, wait->waiters[i].data, c.data,
+                       (int)i == index && wait->waiters[i].ok, nullptr);
+    }
+    m_ok = wait->waiters[index].ok;
+    return index;
+}
+
+} // namespace base
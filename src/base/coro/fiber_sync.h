@@ -0,0 +1,547 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <stddef.h>
+#include <stdint.h>
+#include "base/coro/fiber.h"
+#include "base/mutex.h"
+#include "base/noncopyable.h"
+
+namespace base
+{
+
+class Scheduler;
+
+/**
+ * @brief 挂起在同步原语上的协程
+ * @details 节点和它指向的数据由 FiberParkNode 放在挂起协程的栈上, 只有共享栈协程放在堆上.
+ *          节点由挂起的协程在恢复后释放.
+ *          多个节点(select 的多个分支)可以共享同一个 state, 谁先 claim 成功谁负责唤醒协程,
+ *          协程只会被唤醒一次
+ */
+struct FiberWaiter : Noncopyable {
+    /// 所在队列中的前后节点
+    FiberWaiter *prev = nullptr;
+    FiberWaiter *next = nullptr;
+    /// 是否在队列中(由所在队列的锁保护)
+    bool queued = false;
+    /// 等待的调度器
+    Scheduler *scheduler = nullptr;
+    /// 等待的协程
+    Fiber::ptr fiber;
+    /// 唤醒状态, 0表示未唤醒, 否则为完成的分支下标+1
+    std::atomic<int> *state = nullptr;
+    /// 不和其它节点共享时使用的唤醒状态
+    std::atomic<int> ownState = {0};
+    /// select 分支下标
+    int index = 0;
+    /// 收发的数据槽, 由通道解释
+    void *data = nullptr;
+    /// 操作是否成功, false 表示通道已关闭
+    bool ok = false;
+
+    /**
+     * @brief 以当前协程初始化
+     * @param[in] s 共享的唤醒状态, 为空时使用 ownState
+     */
+    void init(std::atomic<int> *s = nullptr, int idx = 0, void *d = nullptr);
+
+    /**
+     * @brief 抢占唤醒权
+     * @return 成功后调用方必须调用 wake()
+     */
+    bool claim()
+    {
+        int expected = 0;
+        return state->compare_exchange_strong(expected, index + 1, std::memory_order_acq_rel);
+    }
+
+    /**
+     * @brief 调度等待的协程, 之后不能再访问本节点
+     */
+    void wake();
+
+    /**
+     * @brief 挂起当前协程直到被 wake
+     */
+    static void Park();
+};
+
+/**
+ * @brief 协程挂起期间唤醒方要访问的节点(等待节点, 通道数据槽)
+ * @details 独立栈协程挂起后栈保持不动, 节点直接用栈上的 m_local; 共享栈协程挂起后栈内容会被换出,
+ *          其它线程上的唤醒方访问不到, 这时才在堆上分配. 第一次 get() 时决定位置, 无竞争的路径不调用
+ */
+template <class T>
+class FiberParkNode : Noncopyable
+{
+public:
+    ~FiberParkNode()
+    {
+        if (m_node != &m_local) {
+            delete m_node;
+        }
+    }
+
+    T *get()
+    {
+        if (!m_node) {
+            m_node = Fiber::GetThis()->isSharedStack() ? new T : &m_local;
+        }
+        return m_node;
+    }
+
+    T *operator->() { return get(); }
+
+    /**
+     * @brief 是否已经调用过 get()
+     */
+    explicit operator bool() const { return m_node != nullptr; }
+
+    /**
+     * @brief 节点是否在栈上
+     */
+    bool isLocal() const { return m_node == &m_local; }
+
+private:
+    T m_local;
+    T *m_node = nullptr;
+};
+
+/**
+ * @brief FiberWaiter 的侵入式双向队列(FIFO), 由使用方加锁
+ */
+class FiberWaiterQueue : Noncopyable
+{
+public:
+    bool empty() const { return m_head == nullptr; }
+    size_t size() const { return m_size; }
+
+    void push(FiberWaiter *w);
+    FiberWaiter *pop();
+
+    /**
+     * @brief 节点还在队列中时摘除
+     */
+    void remove(FiberWaiter *w);
+
+    /**
+     * @brief 取出第一个 claim 成功的节点, claim 失败的节点(select 的其它分支已完成)直接丢弃
+     */
+    FiberWaiter *popClaimed();
+
+private:
+    FiberWaiter *m_head = nullptr;
+    FiberWaiter *m_tail = nullptr;
+    size_t m_size = 0;
+};
+
+/**
+ * @brief 持锁时取出的待唤醒节点, 释放锁之后再统一唤醒
+ * @details 被唤醒的协程可能马上在其它线程恢复并销毁同步对象(例如栈上的 WaitGroup),
+ *          所以 wake 不能在持有对象的锁时调用. 用节点的 next 串成链表, 不分配内存
+ */
+class FiberWakeList : Noncopyable
+{
+public:
+    bool empty() const { return m_head == nullptr; }
+
+    /**
+     * @pre 节点已经 claim 成功且不在任何队列中
+     */
+    void push(FiberWaiter *w);
+
+    /**
+     * @brief 唤醒所有节点并清空, 调用时不能持有同步对象的锁
+     */
+    void wakeAll();
+
+private:
+    FiberWaiter *m_head = nullptr;
+    FiberWaiter *m_tail = nullptr;
+};
+
+/**
+ * @brief 协程互斥锁
+ * @details 竞争时挂起协程而不是阻塞线程. 解锁时直接把锁交给队首的等待者(FIFO, 不会饿死)
+ */
+class FiberMutex : Noncopyable
+{
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+    typedef Spinlock MutexType;
+
+    ~FiberMutex();
+
+    void lock();
+    bool tryLock();
+    void unlock();
+
+private:
+    MutexType m_mutex;
+    bool m_locked = false;
+    FiberWaiterQueue m_waiters;
+};
+
+/**
+ * @brief 协程条件变量, 配合 FiberMutex 使用
+ */
+class FiberConditionVariable : Noncopyable
+{
+public:
+    typedef Spinlock MutexType;
+
+    ~FiberConditionVariable();
+
+    /**
+     * @brief 释放 mutex 并挂起, 被唤醒后重新加锁
+     * @pre 当前协程持有 mutex
+     */
+    void wait(FiberMutex &mutex);
+
+    template <class Predicate>
+    void wait(FiberMutex &mutex, Predicate pred)
+    {
+        while (!pred()) {
+            wait(mutex);
+        }
+    }
+
+    void notifyOne();
+    void notifyAll();
+
+private:
+    MutexType m_mutex;
+    FiberWaiterQueue m_waiters;
+};
+
+/**
+ * @brief 等待一组协程完成
+ */
+class WaitGroup : Noncopyable
+{
+public:
+    typedef Spinlock MutexType;
+
+    ~WaitGroup();
+
+    /**
+     * @brief 计数加 n, 计数不能小于0
+     */
+    void add(int64_t n = 1);
+    void done() { add(-1); }
+
+    /**
+     * @brief 挂起直到计数归零
+     */
+    void wait();
+
+    int64_t count() const { return m_count; }
+
+private:
+    MutexType m_mutex;
+    int64_t m_count = 0;
+    FiberWaiterQueue m_waiters;
+};
+
+class Select;
+
+/**
+ * @brief 通道中与元素类型无关的部分: 锁, 关闭状态和两端的等待队列
+ */
+class ChannelBase : Noncopyable
+{
+    friend class Select;
+
+public:
+    typedef Spinlock MutexType;
+
+    virtual ~ChannelBase();
+
+    /**
+     * @brief 关闭通道, 唤醒所有等待者
+     * @details 关闭后发送失败, 接收在缓冲区读空后失败
+     */
+    void close();
+
+    bool isClosed();
+
+protected:
+    /// 收发的结果
+    enum Result {
+        /// 需要等待
+        PENDING = 0,
+        /// 完成
+        DONE = 1,
+        /// 通道已关闭
+        CLOSED = 2,
+    };
+
+    /**
+     * @brief 尝试立即发送(需持有m_mutex)
+     * @param[in] value T*, 成功时被移走
+     * @param[out] wakeups 需要唤醒的等待者, 释放锁后唤醒
+     */
+    virtual Result trySendLocked(void *value, FiberWakeList &wakeups) = 0;
+
+    /**
+     * @brief 尝试立即接收(需持有m_mutex)
+     * @param[out] out T*
+     */
+    virtual Result tryRecvLocked(void *out, FiberWakeList &wakeups) = 0;
+
+    /**
+     * @brief 为挂起的收发创建数据槽, 作为等待节点的 data
+     * @param[in] data T*, 发送时值被移入槽中
+     * @param[in] local 调用方栈上的空槽, 为空时(共享栈协程)在堆上创建
+     */
+    virtual void *newSlot(bool send, void *data, void *local) = 0;
+
+    /**
+     * @brief 协程恢复后释放数据槽
+     * @details 接收成功时把值移到 data; 发送没有完成时把值还给 data
+     */
+    virtual void freeSlot(bool send, void *slot, void *data, bool ok, void *local) = 0;
+
+    /**
+     * @brief 发送或接收, 无法立即完成时挂起当前协程
+     * @param[in] local 调用方栈上的空数据槽
+     * @return 是否成功
+     */
+    bool transfer(bool send, void *data, void *local);
+
+protected:
+    MutexType m_mutex;
+    bool m_closed = false;
+    /// 等待发送的协程
+    FiberWaiterQueue m_sendWaiters;
+    /// 等待接收的协程
+    FiberWaiterQueue m_recvWaiters;
+};
+
+/**
+ * @brief 多生产者多消费者的协程通道
+ * @details capacity 为0时是同步通道(发送方等到接收方取走才返回),
+ *          为 Unbounded 时发送永不阻塞. 可以通过 Select 同时等待多个通道
+ */
+template <class T>
+class Channel : public ChannelBase
+{
+public:
+    typedef std::shared_ptr<Channel> ptr;
+    static const size_t Unbounded = (size_t)-1;
+
+    explicit Channel(size_t capacity = 0) : m_capacity(capacity) {}
+
+    /**
+     * @brief 发送, 缓冲区满时挂起
+     * @return 通道已关闭时返回 false
+     */
+    bool send(T value)
+    {
+        Slot local;
+        return transfer(true, &value, &local);
+    }
+
+    /**
+     * @brief 接收, 没有数据时挂起
+     * @return 通道已关闭且没有剩余数据时返回 false
+     */
+    bool recv(T &out)
+    {
+        Slot local;
+        return transfer(false, &out, &local);
+    }
+
+    /**
+     * @brief 不挂起的发送
+     * @return 成功发送返回 true, 通道已满或已关闭返回 false
+     */
+    bool trySend(T value)
+    {
+        FiberWakeList wakeups;
+        Result rt;
+        {
+            MutexType::Lock lock(m_mutex);
+            rt = trySendLocked(&value, wakeups);
+        }
+        wakeups.wakeAll();
+        return rt == DONE;
+    }
+
+    /**
+     * @brief 不挂起的接收
+     */
+    bool tryRecv(T &out)
+    {
+        FiberWakeList wakeups;
+        Result rt;
+        {
+            MutexType::Lock lock(m_mutex);
+            rt = tryRecvLocked(&out, wakeups);
+        }
+        wakeups.wakeAll();
+        return rt == DONE;
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+    /**
+     * @brief 缓冲区中的元素数量
+     */
+    size_t size()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_buffer.size();
+    }
+
+protected:
+    /// 挂起的收发使用的数据槽
+    typedef std::optional<T> Slot;
+
+    Result trySendLocked(void *value, FiberWakeList &wakeups) override
+    {
+        if (m_closed) {
+            return CLOSED;
+        }
+        T &v = *(T *)value;
+        // 有接收者等待时直接交给它, 不经过缓冲区
+        if (FiberWaiter *w = m_recvWaiters.popClaimed()) {
+            ((Slot *)w->data)->emplace(std::move(v));
+            w->ok = true;
+            wakeups.push(w);
+            return DONE;
+        }
+        if (m_buffer.size() < m_capacity) {
+            m_buffer.push_back(std::move(v));
+            return DONE;
+        }
+        return PENDING;
+    }
+
+    Result tryRecvLocked(void *out, FiberWakeList &wakeups) override
+    {
+        T &v = *(T *)out;
+        if (!m_buffer.empty()) {
+            v = std::move(m_buffer.front());
+            m_buffer.pop_front();
+            // 缓冲区腾出位置, 放入一个等待发送者的数据
+            if (FiberWaiter *w = m_sendWaiters.popClaimed()) {
+                m_buffer.push_back(std::move(**(Slot *)w->data));
+                w->ok = true;
+                wakeups.push(w);
+            }
+            return DONE;
+        }
+        if (FiberWaiter *w = m_sendWaiters.popClaimed()) {
+            v = std::move(**(Slot *)w->data);
+            w->ok = true;
+            wakeups.push(w);
+            return DONE;
+        }
+        return m_closed ? CLOSED : PENDING;
+    }
+
+    void *newSlot(bool send, void *data, void *local) override
+    {
+        Slot *s = local ? (Slot *)local : new Slot();
+        if (send) {
+            s->emplace(std::move(*(T *)data));
+        }
+        return s;
+    }
+
+    void freeSlot(bool send, void *slot, void *data, bool ok, void *local) override
+    {
+        Slot *s = (Slot *)slot;
+        if ((send ? !ok : ok) && s->has_value()) {
+            *(T *)data = std::move(**s);
+        }
+        if (s != local) {
+            delete s;
+        }
+    }
+
+private:
+    size_t m_capacity;
+    std::deque<T> m_buffer;
+};
+
+/**
+ * @brief 同时等待多个通道的收发, 完成其中一个
+ * @details 所有分支的通道按地址顺序一起加锁, 先检查是否有立即可以完成的分支,
+ *          都不能完成时在每个通道上挂一个共享唤醒状态的等待节点, 第一个完成的通道唤醒协程.
+ *          等待节点放在栈上(共享栈协程放在堆上), 数据槽分配在堆上, 没有完成的发送分支的值会还给调用方.
+ *          已关闭的通道: 接收分支立即完成且 ok()==false, 发送分支同样立即完成且 ok()==false
+ * @code
+ *   Select sel;
+ *   int v = 0;
+ *   sel.recv(ch1, v).send(ch2, x);
+ *   switch (sel.wait()) { ... }
+ * @endcode
+ */
+class Select : Noncopyable
+{
+public:
+    static const size_t kMaxCases = 8;
+
+    template <class T>
+    Select &recv(Channel<T> &ch, T &out)
+    {
+        return addCase(&ch, false, &out);
+    }
+
+    /**
+     * @brief 发送分支, 完成时 value 被移走
+     */
+    template <class T>
+    Select &send(Channel<T> &ch, T &value)
+    {
+        return addCase(&ch, true, &value);
+    }
+
+    /**
+     * @brief 挂起直到某个分支完成
+     * @return 完成的分支下标(按添加顺序)
+     */
+    int wait() { return select(true); }
+
+    /**
+     * @brief 不挂起, 没有分支可以立即完成时返回 -1
+     */
+    int tryWait() { return select(false); }
+
+    /**
+     * @brief 完成的分支是否成功, false 表示对应通道已关闭
+     */
+    bool ok() const { return m_ok; }
+
+private:
+    struct Case {
+        ChannelBase *ch;
+        bool send;
+        void *data;
+    };
+
+    Select &addCase(ChannelBase *ch, bool send, void *data);
+    int select(bool block);
+
+    /**
+     * @brief 按地址顺序对所有通道加锁/解锁, 同一个通道只加一次
+     */
+    void lockAll();
+    void unlockAll();
+
+private:
+    Case m_cases[kMaxCases];
+    size_t m_count = 0;
+    /// 排序去重后的通道
+    ChannelBase *m_locks[kMaxCases];
+    size_t m_lockCount = 0;
+    bool m_ok = false;
+};
+
+} // namespace base
@@ -0,0 +1,83 @@
+#include "future.h"
+
+namespace base
+{
+
+FutureStateBase::~FutureStateBase()
+{
+    _ASSERT(m_waiters.empty());
+}
+
+void FutureStateBase::finish()
+{
+    std::vector<Callback> cbs;
+    FiberWakeList wakeups;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_ready.store(true, std::memory_order_release);
+        while (FiberWaiter *w = m_waiters.popClaimed()) {
+            w->ok = true;
+            wakeups.push(w);
+        }
+        cbs.swap(m_callbacks);
+    }
+    wakeups.wakeAll();
+    for (auto &i : cbs) {
+        i();
+    }
+}
+
+bool FutureStateBase::setException(std::exception_ptr e)
+{
+    if (!tryBegin()) {
+        return false;
+    }
+    m_error = std::move(e);
+    finish();
+    return true;
+}
+
+void FutureStateBase::wait()
+{
+    if (isReady()) {
+        return;
+    }
+    if (!Scheduler::GetThis()) {
+        // 不在协程中, 阻塞线程
+        Semaphore sem;
+        addCallback([&sem]() { sem.notify(); });
+        sem.wait();
+        return;
+    }
+    FiberParkNode<FiberWaiter> waiter;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (isReady()) {
+            return;
+        }
+        waiter->init();
+        m_waiters.push(waiter.get());
+    }
+    FiberWaiter::Park();
+}
+
+void FutureStateBase::addCallback(Callback cb)
+{
+    {
+        MutexType::Lock lock(m_mutex);
+        if (!isReady()) {
+            m_callbacks.push_back(std::move(cb));
+            return;
+        }
+    }
+    cb();
+}
+
+void FutureStateBase::releasePromise()
+{
+    if (m_promises.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        setException(std::make_exception_ptr(BrokenPromise()));
+    }
+}
+
+} // namespace base
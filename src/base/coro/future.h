@@ -0,0 +1,460 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "base/coro/fiber_sync.h"
+#include "base/coro/iomanager.h"
+#include "base/macro.h"
+#include "base/mutex.h"
+
+namespace base
+{
+
+/**
+ * @brief Future 超时(Future::timeout/waitFor)
+ */
+class FutureTimeout : public std::runtime_error
+{
+public:
+    FutureTimeout() : std::runtime_error("future timeout") {}
+};
+
+/**
+ * @brief 所有 Promise 都已销毁但没有设置结果
+ */
+class BrokenPromise : public std::logic_error
+{
+public:
+    BrokenPromise() : std::logic_error("broken promise") {}
+};
+
+/**
+ * @brief Future 共享状态中与值类型无关的部分
+ * @details 结果只能设置一次: 第一个 tryBegin() 成功的调用者写入结果后调用 finish().
+ *          等待的协程挂在侵入式等待队列上(节点在等待协程的栈上, 共享栈协程在堆上), 非协程线程用信号量等待;
+ *          回调在完成方的上下文中执行
+ */
+class FutureStateBase : Noncopyable
+{
+public:
+    typedef Spinlock MutexType;
+    typedef std::function<void()> Callback;
+
+    ~FutureStateBase();
+
+    bool isReady() const { return m_ready.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 异常结果, 未就绪或者正常完成时为空
+     */
+    const std::exception_ptr &getException() const { return m_error; }
+
+    /**
+     * @brief 抢占设置结果的权利, 只有第一个调用者返回 true
+     */
+    bool tryBegin() { return !m_completing.exchange(true, std::memory_order_acq_rel); }
+
+    /**
+     * @brief 结果已写入, 唤醒所有等待者并执行回调
+     */
+    void finish();
+
+    bool setException(std::exception_ptr e);
+
+    /**
+     * @brief 挂起当前协程(或阻塞当前线程)直到就绪
+     */
+    void wait();
+
+    /**
+     * @brief 就绪时执行 cb, 已经就绪时立即在当前上下文执行
+     */
+    void addCallback(Callback cb);
+
+    void addPromise() { m_promises.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+     * @brief 最后一个 Promise 销毁时还没有结果, 以 BrokenPromise 完成
+     */
+    void releasePromise();
+
+protected:
+    MutexType m_mutex;
+    std::atomic<bool> m_completing = {false};
+    std::atomic<bool> m_ready = {false};
+    std::exception_ptr m_error;
+    std::atomic<int> m_promises = {0};
+    FiberWaiterQueue m_waiters;
+    std::vector<Callback> m_callbacks;
+};
+
+/**
+ * @brief Future<void> 的占位值
+ */
+struct FutureVoid {
+};
+
+template <class T>
+class FutureState : public FutureStateBase
+{
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+    typedef typename std::conditional<std::is_void<T>::value, FutureVoid, T>::type ValueType;
+
+    template <class... Args>
+    bool setValue(Args &&...args)
+    {
+        if (!tryBegin()) {
+            return false;
+        }
+        try {
+            m_value.emplace(std::forward<Args>(args)...);
+        } catch (...) {
+            m_error = std::current_exception();
+        }
+        finish();
+        return true;
+    }
+
+    /**
+     * @brief 就绪后才能访问
+     */
+    const ValueType &value() const { return *m_value; }
+
+private:
+    std::optional<ValueType> m_value;
+};
+
+template <class T>
+class Future;
+
+template <class T>
+class Promise;
+
+template <class T>
+struct IsFuture : std::false_type {
+    typedef T ValueType;
+};
+
+template <class T>
+struct IsFuture<Future<T> > : std::true_type {
+    typedef T ValueType;
+};
+
+/**
+ * @brief Future<T>::get 的返回类型, void 不能构成引用
+ */
+template <class T>
+struct FutureReference {
+    typedef const T &type;
+};
+
+template <>
+struct FutureReference<void> {
+    typedef void type;
+};
+
+/**
+ * @brief 异步结果
+ * @details 可以拷贝, 所有拷贝共享同一个结果(类似 std::shared_future).
+ *          在协程中 get()/wait() 只挂起当前协程, 不阻塞调度线程
+ * @code
+ *   auto f = Async(iom, []() { return 1; })
+ *                .then([](Future<int> f) { return f.get() + 1; })
+ *                .timeout(100);
+ *   int v = f.get(); // 超时抛出 FutureTimeout
+ * @endcode
+ */
+template <class T>
+class Future
+{
+    template <class U>
+    friend class Future;
+    template <class U>
+    friend class Promise;
+
+public:
+    typedef FutureState<T> State;
+    typedef typename FutureReference<T>::type Reference;
+
+    Future() {}
+    explicit Future(typename State::ptr state) : m_state(std::move(state)) {}
+
+    bool valid() const { return m_state != nullptr; }
+    bool isReady() const { return m_state->isReady(); }
+
+    /**
+     * @brief 是否引用同一个结果
+     */
+    bool operator==(const Future &rhs) const { return m_state == rhs.m_state; }
+    bool operator!=(const Future &rhs) const { return m_state != rhs.m_state; }
+
+    /**
+     * @brief 是否以异常完成
+     */
+    bool hasException() const { return isReady() && m_state->getException() != nullptr; }
+    std::exception_ptr getException() const { return m_state->getException(); }
+
+    /**
+     * @brief 挂起直到就绪
+     */
+    void wait() const { m_state->wait(); }
+
+    /**
+     * @brief 最多等待 ms 毫秒
+     * @return 是否就绪
+     */
+    bool waitFor(uint64_t ms, TimerManager *tm = nullptr) const
+    {
+        if (!isReady()) {
+            timeout(ms, tm).wait();
+        }
+        return isReady();
+    }
+
+    /**
+     * @brief 等待并获取结果, 以异常完成时抛出该异常
+     */
+    Reference get() const
+    {
+        wait();
+        if (m_state->getException()) {
+            std::rethrow_exception(m_state->getException());
+        }
+        if constexpr (!std::is_void<T>::value) {
+            return m_state->value();
+        }
+    }
+
+    /**
+     * @brief 就绪时在完成方的上下文中执行 cb, 已经就绪时立即执行
+     * @details cb 中不应有阻塞操作, 耗时的后续处理使用 then
+     */
+    void onReady(std::function<void()> cb) const { m_state->addCallback(std::move(cb)); }
+
+    /**
+     * @brief 就绪后执行 f(Future<T>), 返回 f 结果的 Future
+     * @param[in] f 后续处理, 抛出的异常作为新 Future 的结果; 返回 Future<U> 时结果展开为 Future<U>
+     * @param[in] sc 执行 f 的调度器, 为空时在完成方的上下文中直接执行
+     */
+    template <class F>
+    auto then(F f, Scheduler *sc = Scheduler::GetThis()) const
+        -> Future<typename IsFuture<std::invoke_result_t<F &, Future<T> > >::ValueType>
+    {
+        typedef typename IsFuture<std::invoke_result_t<F &, Future<T> > >::ValueType U;
+        Promise<U> p;
+        Future<U> rt = p.getFuture();
+        Future<T> self = *this;
+        std::function<void()> run = [self, p, f]() mutable { p.setWith(f, self); };
+        if (sc) {
+            m_state->addCallback([sc, run]() { sc->schedule(run); });
+        } else {
+            m_state->addCallback(std::move(run));
+        }
+        return rt;
+    }
+
+    /**
+     * @brief 返回一个 ms 毫秒内没有就绪则以 FutureTimeout 完成的 Future
+     * @param[in] tm 定时器, 为空时使用当前 IOManager
+     */
+    Future<T> timeout(uint64_t ms, TimerManager *tm = nullptr) const
+    {
+        if (!tm) {
+            tm = IOManager::GetThis();
+        }
+        _ASSERT2(tm, "Future::timeout need a TimerManager");
+        Promise<T> p;
+        Future<T> rt = p.getFuture();
+        Timer::ptr timer = tm->addTimer(
+            ms, [p]() mutable { p.setException(std::make_exception_ptr(FutureTimeout())); });
+        Future<T> self = *this;
+        m_state->addCallback([self, p, timer]() mutable {
+            timer->cancel();
+            p.setFrom(self);
+        });
+        return rt;
+    }
+
+private:
+    typename State::ptr m_state;
+};
+
+/**
+ * @brief 设置 Future 的结果
+ * @details 可以拷贝, 所有拷贝共享同一个结果, 只有第一次设置生效.
+ *          所有拷贝都销毁时还没有设置结果, Future 以 BrokenPromise 完成
+ */
+template <class T>
+class Promise
+{
+    template <class U>
+    friend class Future;
+
+public:
+    typedef FutureState<T> State;
+
+    Promise() : m_state(std::make_shared<State>()) { m_state->addPromise(); }
+    Promise(const Promise &o) : m_state(o.m_state)
+    {
+        if (m_state) {
+            m_state->addPromise();
+        }
+    }
+    Promise(Promise &&o) noexcept : m_state(std::move(o.m_state)) {}
+    Promise &operator=(Promise o)
+    {
+        m_state.swap(o.m_state);
+        return *this;
+    }
+    ~Promise()
+    {
+        if (m_state) {
+            m_state->releasePromise();
+        }
+    }
+
+    Future<T> getFuture() const { return Future<T>(m_state); }
+
+    bool isSet() const { return m_state->isReady(); }
+
+    /**
+     * @return 是否是第一次设置
+     */
+    template <class... Args>
+    bool setValue(Args &&...args)
+    {
+        return m_state->setValue(std::forward<Args>(args)...);
+    }
+
+    bool setException(std::exception_ptr e) { return m_state->setException(std::move(e)); }
+
+    /**
+     * @brief 以 f(args...) 的结果设置, 捕获 f 抛出的异常, f 返回 Future 时等它就绪后转发结果
+     */
+    template <class F, class... Args>
+    void setWith(F &f, Args &&...args)
+    {
+        typedef std::invoke_result_t<F &, Args...> R;
+        try {
+            if constexpr (IsFuture<R>::value) {
+                R inner = f(std::forward<Args>(args)...);
+                Promise self = *this;
+                inner.onReady([self, inner]() mutable { self.setFrom(inner); });
+            } else if constexpr (std::is_void<R>::value) {
+                f(std::forward<Args>(args)...);
+                setValue();
+            } else {
+                setValue(f(std::forward<Args>(args)...));
+            }
+        } catch (...) {
+            setException(std::current_exception());
+        }
+    }
+
+    /**
+     * @brief 复制已就绪的 Future 的结果
+     */
+    void setFrom(const Future<T> &f)
+    {
+        if (f.m_state->getException()) {
+            setException(f.m_state->getException());
+        } else if constexpr (std::is_void<T>::value) {
+            setValue();
+        } else {
+            setValue(f.m_state->value());
+        }
+    }
+
+private:
+    typename State::ptr m_state;
+};
+
+/**
+ * @brief 已经就绪的 Future
+ */
+template <class T>
+Future<typename std::decay<T>::type> MakeReadyFuture(T &&v)
+{
+    Promise<typename std::decay<T>::type> p;
+    p.setValue(std::forward<T>(v));
+    return p.getFuture();
+}
+
+inline Future<void> MakeReadyFuture()
+{
+    Promise<void> p;
+    p.setValue();
+    return p.getFuture();
+}
+
+/**
+ * @brief 在调度器中执行 f, 返回结果的 Future
+ */
+template <class F>
+auto Async(Scheduler *sc, F f) -> Future<typename IsFuture<std::invoke_result_t<F &> >::ValueType>
+{
+    typedef typename IsFuture<std::invoke_result_t<F &> >::ValueType R;
+    Promise<R> p;
+    Future<R> rt = p.getFuture();
+    sc->schedule([p, f]() mutable { p.setWith(f); });
+    return rt;
+}
+
+/**
+ * @brief 所有 Future 都就绪(包括以异常完成)时就绪
+ * @return 就绪的输入 Future, 顺序不变, 逐个 get() 获取结果
+ */
+template <class T>
+Future<std::vector<Future<T> > > WhenAll(std::vector<Future<T> > futures)
+{
+    typedef std::vector<Future<T> > Vec;
+    struct Ctx {
+        std::atomic<size_t> left;
+        Vec futures;
+        Promise<Vec> promise;
+    };
+    auto ctx = std::make_shared<Ctx>();
+    Future<Vec> rt = ctx->promise.getFuture();
+    if (futures.empty()) {
+        ctx->promise.setValue(std::move(futures));
+        return rt;
+    }
+    ctx->left = futures.size();
+    ctx->futures = futures;
+    for (auto &i : futures) {
+        i.onReady([ctx]() {
+            if (ctx->left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                ctx->promise.setValue(std::move(ctx->futures));
+            }
+        });
+    }
+    return rt;
+}
+
+/**
+ * @brief 任意一个 Future 就绪时就绪
+ * @return 第一个就绪的 Future 的下标
+ */
+template <class T>
+Future<size_t> WhenAny(const std::vector<Future<T> > &futures)
+{
+    Promise<size_t> p;
+    Future<size_t> rt = p.getFuture();
+    if (futures.empty()) {
+        p.setException(std::make_exception_ptr(std::invalid_argument("WhenAny without futures")));
+        return rt;
+    }
+    for (size_t i = 0; i < futures.size(); ++i) {
+        futures[i].onReady([p, i]() mutable { p.setValue(i); });
+    }
+    return rt;
+}
+
+} // namespace base
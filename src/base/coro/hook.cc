@@ -6,7 +6,15 @@
 #include "fiber.h"
 #include "iomanager.h"
 #include "fd_manager.h"
+#include "io_uring.h"
 #include "base/macro.h"
+#include "base/net/resolver.h"
+#include <arpa/inet.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
 
 base::Logger::ptr g_logger = _LOG_NAME("system");
 namespace base
@@ -16,6 +24,7 @@ static base::ConfigVar<int>::ptr g_tcp_connect_timeout =
     base::Config::Lookup("tcp.connect.timeout", 5000, "tcp connect timeout");
 
 static thread_local bool t_hook_enable = false;
+static thread_local uint64_t t_hook_io_count = 0;
 
 #define HOOK_FUN(XX)                                                                               \
     XX(sleep)                                                                                      \
@@ -24,6 +33,11 @@ static thread_local bool t_hook_enable = false;
     XX(socket)                                                                                     \
     XX(connect)                                                                                    \
     XX(accept)                                                                                     \
+    XX(accept4)                                                                                    \
+    XX(pipe)                                                                                       \
+    XX(pipe2)                                                                                      \
+    XX(eventfd)                                                                                    \
+    XX(timerfd_create)                                                                             \
     XX(read)                                                                                       \
     XX(readv)                                                                                      \
     XX(recv)                                                                                       \
@@ -34,11 +48,18 @@ static thread_local bool t_hook_enable = false;
     XX(send)                                                                                       \
     XX(sendto)                                                                                     \
     XX(sendmsg)                                                                                    \
+    XX(sendfile)                                                                                   \
+    XX(splice)                                                                                     \
+    XX(poll)                                                                                       \
+    XX(select)                                                                                     \
+    XX(epoll_wait)                                                                                 \
     XX(close)                                                                                      \
     XX(fcntl)                                                                                      \
     XX(ioctl)                                                                                      \
     XX(getsockopt)                                                                                 \
-    XX(setsockopt)
+    XX(setsockopt)                                                                                 \
+    XX(getaddrinfo)                                                                                \
+    XX(gethostbyname_r)
 
 bool hook_init()
 {
@@ -79,44 +100,139 @@ void set_hook_enable(bool flag)
     t_hook_enable = flag;
 }
 
+uint64_t get_hook_io_count()
+{
+    return t_hook_io_count;
+}
+
 } // namespace base
 
 struct timer_info {
     int cancelled = 0;
 };
 
-template <typename OriginFun, typename... Args>
-static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t event,
-                     int timeout_so, Args &&...args)
+/**
+ * @brief 准备 io_uring 操作模板
+ */
+static void prep_uring(io_uring_sqe &sqe, uint8_t op, int fd, const void *addr, uint32_t len)
 {
-    if (!base::t_hook_enable) {
-        return fun(fd, std::forward<Args>(args)...);
-    }
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = op;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)addr;
+    sqe.len = len;
+}
+
+/**
+ * @brief 准备等待 fd 可读/可写的 io_uring 操作
+ */
+static void prep_uring_poll(io_uring_sqe &sqe, int fd, uint32_t event)
+{
+    prep_uring(sqe, IORING_OP_POLL_ADD, fd, nullptr, 0);
+    sqe.poll32_events = event == base::IOManager::READ ? POLLIN : POLLOUT;
+}
 
-    base::FdCtx::ptr ctx = base::FdMgr::GetInstance()->get(fd);
+/**
+ * @brief do_io 对 fd 的处理方式
+ */
+enum IoMode {
+    /// 直接调用原函数(不在管理中, 不可等待, 用户要求非阻塞)
+    IO_DIRECT,
+    /// 已关闭
+    IO_CLOSED,
+    /// EAGAIN 时挂起协程等待
+    IO_WAIT,
+};
+
+/**
+ * @brief 在读临界区内取出 do_io 需要的 fd 状态, 之后挂起等待时不再访问 FdCtx
+ * @param[out] is_socket 是否 socket
+ * @param[out] timeout timeout_so 对应的超时时间
+ */
+static IoMode io_mode(int fd, int timeout_so, bool &is_socket, uint64_t &timeout)
+{
+    base::FdManager::ReadGuard guard;
+    base::FdCtx *ctx = base::FdMgr::GetInstance()->get(fd);
     if (!ctx) {
-        return fun(fd, std::forward<Args>(args)...);
+        return IO_DIRECT;
     }
-
     if (ctx->isClose()) {
-        errno = EBADF;
-        return -1;
+        return IO_CLOSED;
+    }
+    if (!ctx->isPollable() || ctx->getUserNonblock()) {
+        return IO_DIRECT;
+    }
+    is_socket = ctx->isSocket();
+    if (!is_socket && !ctx->enableSysNonblock()) {
+        return IO_DIRECT;
     }
+    timeout = ctx->getTimeout(timeout_so);
+    return IO_WAIT;
+}
 
-    if (!ctx->isSocket() || ctx->getUserNonblock()) {
+/**
+ * @param[in] sqe 系统调用返回 EAGAIN 后在 io_uring 上执行的等价操作,
+ *                为空时通过 io_uring 等待 fd 就绪后重试系统调用; 不支持 io_uring 时走 epoll
+ */
+template <typename OriginFun, typename... Args>
+static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t event,
+                     int timeout_so, const io_uring_sqe *sqe, Args &&...args)
+{
+    if (!base::t_hook_enable) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    uint64_t to = ctx->getTimeout(timeout_so);
+    uint64_t to = -1;
+    bool is_socket = false;
+    switch (io_mode(fd, timeout_so, is_socket, to)) {
+        case IO_CLOSED:
+            errno = EBADF;
+            return -1;
+        case IO_DIRECT:
+            return fun(fd, std::forward<Args>(args)...);
+        default:
+            break;
+    }
+    if (!is_socket) {
+        // pipe/eventfd 等不支持 RECV/SEND 等 socket 操作, 等待就绪后重试
+        sqe = nullptr;
+    }
+
     std::shared_ptr<timer_info> tinfo = std::make_shared<timer_info>();
 
 retry:
+    ++base::t_hook_io_count;
     ssize_t n = fun(fd, std::forward<Args>(args)...);
     while (n == -1 && errno == EINTR) {
+        ++base::t_hook_io_count;
         n = fun(fd, std::forward<Args>(args)...);
     }
     if (n == -1 && errno == EAGAIN) {
         base::IOManager *iom = base::IOManager::GetThis();
+        if (iom->canUseIoUring()) {
+            io_uring_sqe poll;
+            if (!sqe) {
+                prep_uring_poll(poll, fd, event);
+            }
+            int res = 0;
+            if (iom->submitIo(sqe ? *sqe : poll, to, res)) {
+                if (res >= 0) {
+                    if (sqe) {
+                        return res;
+                    }
+                    goto retry;
+                }
+                if (res == -EINTR) {
+                    goto retry;
+                }
+                // 内核对非阻塞的 fd 直接返回 EAGAIN 时回退到 epoll
+                if (res != -EAGAIN) {
+                    errno = -res;
+                    return -1;
+                }
+            }
+        }
+
         base::Timer::ptr timer;
         std::weak_ptr<timer_info> winfo(tinfo);
 
@@ -135,7 +251,13 @@ retry:
         }
 
         int rt = iom->addEvent(fd, (base::IOManager::Event)(event));
-        if (_UNLIKELY(rt)) {
+        if (rt == 1) {
+            // 持久注册模式下 fd 已经就绪, 不用挂起
+            if (timer) {
+                timer->cancel();
+            }
+            goto retry;
+        } else if (_UNLIKELY(rt)) {
             _LOG_ERROR(g_logger)
                 << hook_fun_name << " addEvent(" << fd << ", " << event << ")";
             if (timer) {
@@ -158,6 +280,152 @@ retry:
     return n;
 }
 
+/**
+ * @brief 挂起当前协程直到 fd 就绪或者超时
+ * @return 0 就绪(调用方需要重新检查), -1 超时(errno=ETIMEDOUT)或出错
+ */
+static int wait_fd(int fd, base::IOManager::Event event, uint64_t timeout_ms)
+{
+    base::IOManager *iom = base::IOManager::GetThis();
+    if (iom->canUseIoUring()) {
+        io_uring_sqe poll;
+        prep_uring_poll(poll, fd, event);
+        int res = 0;
+        if (iom->submitIo(poll, timeout_ms, res)) {
+            if (res >= 0) {
+                return 0;
+            }
+            if (res != -EAGAIN) {
+                errno = -res;
+                return -1;
+            }
+        }
+    }
+
+    base::Timer::ptr timer;
+    std::shared_ptr<timer_info> tinfo = std::make_shared<timer_info>();
+    std::weak_ptr<timer_info> winfo(tinfo);
+    if (timeout_ms != (uint64_t)-1) {
+        timer = iom->addConditionTimer(
+            timeout_ms,
+            [winfo, fd, iom, event]() {
+                auto t = winfo.lock();
+                if (!t || t->cancelled) {
+                    return;
+                }
+                t->cancelled = ETIMEDOUT;
+                iom->cancelEvent(fd, event);
+            },
+            winfo);
+    }
+    int rt = iom->addEvent(fd, event);
+    if (rt == 0) {
+        base::Fiber::YieldToHold();
+    }
+    if (timer) {
+        timer->cancel();
+    }
+    if (_UNLIKELY(rt < 0)) {
+        _LOG_ERROR(g_logger) << "wait_fd addEvent(" << fd << ", " << event << ")";
+        errno = EINVAL;
+        return -1;
+    }
+    if (tinfo->cancelled) {
+        errno = tinfo->cancelled;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 超时时间转为截止时间, timeout < 0 表示不超时
+ */
+static uint64_t poll_deadline(int timeout)
+{
+    return timeout < 0 ? (uint64_t)-1 : base::GetCurrentMS() + timeout;
+}
+
+/**
+ * @brief 距离截止时间的毫秒数, 已经过期返回 0
+ */
+static uint64_t poll_remain(uint64_t deadline)
+{
+    if (deadline == (uint64_t)-1) {
+        return -1;
+    }
+    uint64_t now = base::GetCurrentMS();
+    return deadline > now ? deadline - now : 0;
+}
+
+/// 每个线程缓存的空闲 epoll fd 数量上限
+static const size_t kMaxPollEpolls = 4;
+
+/**
+ * @brief 多 fd 的 poll 使用的 epoll fd 缓存
+ * @details 同一线程上可能有多个协程同时在 poll, 每次调用独占一个, 用完清空后放回
+ */
+struct PollEpolls {
+    ~PollEpolls()
+    {
+        for (int epfd : free) {
+            close(epfd);
+        }
+    }
+
+    std::vector<int> free;
+};
+
+static thread_local PollEpolls t_poll_epolls;
+
+/**
+ * @brief 取一个空的 epoll fd, 没有缓存时创建
+ */
+static int acquire_poll_epoll()
+{
+    if (!t_poll_epolls.free.empty()) {
+        int epfd = t_poll_epolls.free.back();
+        t_poll_epolls.free.pop_back();
+        return epfd;
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd >= 0) {
+        base::FdMgr::GetInstance()->open(epfd);
+    }
+    return epfd;
+}
+
+/**
+ * @brief 移除本次加入的 fd 后放回缓存
+ * @details 移除失败(例如 fd 在等待期间被关闭)时 epoll 中可能残留注册, 直接关闭
+ */
+static void release_poll_epoll(int epfd, struct pollfd *fds, nfds_t nfds)
+{
+    bool clean = true;
+    for (nfds_t i = 0; i < nfds; ++i) {
+        if (fds[i].fd >= 0 && epoll_ctl(epfd, EPOLL_CTL_DEL, fds[i].fd, nullptr)
+            && errno != ENOENT) {
+            clean = false;
+        }
+    }
+    if (clean && t_poll_epolls.free.size() < kMaxPollEpolls) {
+        t_poll_epolls.free.push_back(epfd);
+    } else {
+        close(epfd);
+    }
+}
+
+/**
+ * @brief 新创建的 fd 纳入管理, 用户要求非阻塞时保持非阻塞语义
+ */
+static void manage_fd(int fd, bool user_nonblock)
+{
+    base::FdManager::ReadGuard guard;
+    base::FdCtx *ctx = base::FdMgr::GetInstance()->open(fd);
+    if (ctx && user_nonblock) {
+        ctx->setUserNonblock(true);
+    }
+}
+
 extern "C"
 {
 #define XX(name) name##_fun name##_f = nullptr;
@@ -221,7 +489,7 @@ extern "C"
         if (fd == -1) {
             return fd;
         }
-        base::FdMgr::GetInstance()->get(fd, true);
+        base::FdMgr::GetInstance()->open(fd);
         return fd;
     }
 
@@ -234,17 +502,17 @@ extern "C"
             setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, optlen);
             return connect_f(fd, addr, addrlen);
         }
-        base::FdCtx::ptr ctx = base::FdMgr::GetInstance()->get(fd);
-        if (!ctx || ctx->isClose()) {
-            errno = EBADF;
-            return -1;
-        }
-
-        if (!ctx->isSocket()) {
-            return connect_f(fd, addr, addrlen);
+        bool direct = false;
+        {
+            base::FdManager::ReadGuard guard;
+            base::FdCtx *ctx = base::FdMgr::GetInstance()->get(fd);
+            if (!ctx || ctx->isClose()) {
+                errno = EBADF;
+                return -1;
+            }
+            direct = !ctx->isSocket() || ctx->getUserNonblock();
         }
-
-        if (ctx->getUserNonblock()) {
+        if (direct) {
             return connect_f(fd, addr, addrlen);
         }
 
@@ -256,39 +524,57 @@ extern "C"
         }
 
         base::IOManager *iom = base::IOManager::GetThis();
-        base::Timer::ptr timer;
-        std::shared_ptr<timer_info> tinfo = std::make_shared<timer_info>();
-        std::weak_ptr<timer_info> winfo(tinfo);
-
-        if (timeout_ms != (uint64_t)-1) {
-            timer = iom->addConditionTimer(
-                timeout_ms,
-                [winfo, fd, iom]() {
-                    auto t = winfo.lock();
-                    if (!t || t->cancelled) {
-                        return;
-                    }
-                    t->cancelled = ETIMEDOUT;
-                    iom->cancelEvent(fd, base::IOManager::WRITE);
-                },
-                winfo);
+        int res = -EAGAIN;
+        if (iom->canUseIoUring()) {
+            io_uring_sqe poll;
+            prep_uring_poll(poll, fd, base::IOManager::WRITE);
+            if (!iom->submitIo(poll, timeout_ms, res)) {
+                res = -EAGAIN;
+            } else if (res < 0 && res != -EAGAIN) {
+                errno = -res;
+                return -1;
+            }
         }
 
-        int rt = iom->addEvent(fd, base::IOManager::WRITE);
-        if (rt == 0) {
-            base::Fiber::YieldToHold();
-            if (timer) {
-                timer->cancel();
-            }
-            if (tinfo->cancelled) {
-                errno = tinfo->cancelled;
-                return -1;
+        if (res == -EAGAIN) {
+            base::Timer::ptr timer;
+            std::shared_ptr<timer_info> tinfo = std::make_shared<timer_info>();
+            std::weak_ptr<timer_info> winfo(tinfo);
+
+            if (timeout_ms != (uint64_t)-1) {
+                timer = iom->addConditionTimer(
+                    timeout_ms,
+                    [winfo, fd, iom]() {
+                        auto t = winfo.lock();
+                        if (!t || t->cancelled) {
+                            return;
+                        }
+                        t->cancelled = ETIMEDOUT;
+                        iom->cancelEvent(fd, base::IOManager::WRITE);
+                    },
+                    winfo);
             }
-        } else {
-            if (timer) {
-                timer->cancel();
+
+            int rt = iom->addEvent(fd, base::IOManager::WRITE);
+            if (rt == 1) {
+                if (timer) {
+                    timer->cancel();
+                }
+            } else if (rt == 0) {
+                base::Fiber::YieldToHold();
+                if (timer) {
+                    timer->cancel();
+                }
+                if (tinfo->cancelled) {
+                    errno = tinfo->cancelled;
+                    return -1;
+                }
+            } else {
+                if (timer) {
+                    timer->cancel();
+                }
+                _LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
             }
-            _LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
         }
 
         int error = 0;
@@ -311,9 +597,61 @@ extern "C"
 
     int accept(int s, struct sockaddr *addr, socklen_t *addrlen)
     {
-        int fd = do_io(s, accept_f, "accept", base::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+        io_uring_sqe sqe;
+        prep_uring(sqe, IORING_OP_ACCEPT, s, addr, 0);
+        sqe.addr2 = (uint64_t)addrlen;
+        int fd = do_io(s, accept_f, "accept", base::IOManager::READ, SO_RCVTIMEO, &sqe, addr,
+                       addrlen);
         if (fd >= 0) {
-            base::FdMgr::GetInstance()->get(fd, true);
+            base::FdMgr::GetInstance()->open(fd);
+        }
+        return fd;
+    }
+
+    int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags)
+    {
+        int fd = do_io(s, accept4_f, "accept4", base::IOManager::READ, SO_RCVTIMEO, nullptr, addr,
+                       addrlen, flags);
+        if (fd >= 0 && base::t_hook_enable) {
+            manage_fd(fd, flags & SOCK_NONBLOCK);
+        }
+        return fd;
+    }
+
+    int pipe(int pipefd[2])
+    {
+        int rt = pipe_f(pipefd);
+        if (rt == 0 && base::t_hook_enable) {
+            manage_fd(pipefd[0], false);
+            manage_fd(pipefd[1], false);
+        }
+        return rt;
+    }
+
+    int pipe2(int pipefd[2], int flags)
+    {
+        int rt = pipe2_f(pipefd, flags);
+        if (rt == 0 && base::t_hook_enable) {
+            manage_fd(pipefd[0], flags & O_NONBLOCK);
+            manage_fd(pipefd[1], flags & O_NONBLOCK);
+        }
+        return rt;
+    }
+
+    int eventfd(unsigned int initval, int flags)
+    {
+        int fd = eventfd_f(initval, flags);
+        if (fd >= 0 && base::t_hook_enable) {
+            manage_fd(fd, flags & EFD_NONBLOCK);
+        }
+        return fd;
+    }
+
+    int timerfd_create(int clockid, int flags)
+    {
+        int fd = timerfd_create_f(clockid, flags);
+        if (fd >= 0 && base::t_hook_enable) {
+            manage_fd(fd, flags & TFD_NONBLOCK);
         }
         return fd;
     }
@@ -322,56 +660,292 @@ extern "C"
     {
         static const bool __hook_init_ = base::hook_init();
         (void)__hook_init_;
-        return do_io(fd, read_f, "read", base::IOManager::READ, SO_RCVTIMEO, buf, count);
+        io_uring_sqe sqe;
+        prep_uring(sqe, IORING_OP_RECV, fd, buf, count);
+        return do_io(fd, read_f, "read", base::IOManager::READ, SO_RCVTIMEO, &sqe, buf, count);
     }
 
     ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
     {
-        return do_io(fd, readv_f, "readv", base::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = iovcnt;
+        io_uring_sqe sqe;
+        prep_uring(sqe, IORING_OP_RECVMSG, fd, &msg, 1);
+        return do_io(fd, readv_f, "readv", base::IOManager::READ, SO_RCVTIMEO, &sqe, iov, iovcnt);
     }
 
     ssize_t recv(int sockfd, void *buf, size_t len, int flags)
     {
-        return do_io(sockfd, recv_f, "recv", base::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+        io_uring_sqe sqe;
+        prep_uring(sqe, IORING_OP_RECV, sockfd, buf, len);
+        sqe.msg_flags = flags;
+        return do_io(sockfd, recv_f, "recv", base::IOManager::READ, SO_RCVTIMEO, &sqe, buf, len,
+                     flags);
     }
 
     ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr,
                      socklen_t *addrlen)
     {
-        return do_io(sockfd, recvfrom_f, "recvfrom", base::IOManager::READ, SO_RCVTIMEO, buf, len,
-                     flags, src_addr, addrlen);
+        return do_io(sockfd, recvfrom_f, "recvfrom", base::IOManager::READ, SO_RCVTIMEO, nullptr,
+                     buf, len, flags, src_addr, addrlen);
     }
 
     ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
     {
-        return do_io(sockfd, recvmsg_f, "recvmsg", base::IOManager::READ, SO_RCVTIMEO, msg, flags);
+        return do_io(sockfd, recvmsg_f, "recvmsg", base::IOManager::READ, SO_RCVTIMEO, nullptr, msg,
+                     flags);
     }
 
     ssize_t write(int fd, const void *buf, size_t count)
     {
-        return do_io(fd, write_f, "write", base::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+        io_uring_sqe sqe;
+        prep_uring(sqe, IORING_OP_SEND, fd, buf, count);
+        return do_io(fd, write_f, "write", base::IOManager::WRITE, SO_SNDTIMEO, &sqe, buf, count);
     }
 
     ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
     {
-        return do_io(fd, writev_f, "writev", base::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = iovcnt;
+        io_uring_sqe sqe;
+        prep_uring(sqe, IORING_OP_SENDMSG, fd, &msg, 1);
+        return do_io(fd, writev_f, "writev", base::IOManager::WRITE, SO_SNDTIMEO, &sqe, iov,
+                     iovcnt);
     }
 
     ssize_t send(int s, const void *msg, size_t len, int flags)
     {
-        return do_io(s, send_f, "send", base::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+        io_uring_sqe sqe;
+        prep_uring(sqe, IORING_OP_SEND, s, msg, len);
+        sqe.msg_flags = flags;
+        return do_io(s, send_f, "send", base::IOManager::WRITE, SO_SNDTIMEO, &sqe, msg, len, flags);
     }
 
     ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to,
                    socklen_t tolen)
     {
-        return do_io(s, sendto_f, "sendto", base::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags,
-                     to, tolen);
+        return do_io(s, sendto_f, "sendto", base::IOManager::WRITE, SO_SNDTIMEO, nullptr, msg, len,
+                     flags, to, tolen);
     }
 
     ssize_t sendmsg(int s, const struct msghdr *msg, int flags)
     {
-        return do_io(s, sendmsg_f, "sendmsg", base::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+        return do_io(s, sendmsg_f, "sendmsg", base::IOManager::WRITE, SO_SNDTIMEO, nullptr, msg,
+                     flags);
+    }
+
+    ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+    {
+        return do_io(out_fd, sendfile_f, "sendfile", base::IOManager::WRITE, SO_SNDTIMEO, nullptr,
+                     in_fd, offset, count);
+    }
+
+    ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len,
+                   unsigned int flags)
+    {
+        if (!base::t_hook_enable || (flags & SPLICE_F_NONBLOCK)) {
+            return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+        }
+        // 两端中有一端是用户要求阻塞的可等待 fd 才需要挂起, 另一端可能是普通文件
+        bool wait_in = false;
+        bool wait_out = false;
+        uint64_t in_timeout = -1;
+        uint64_t out_timeout = -1;
+        {
+            base::FdManager::ReadGuard guard;
+            base::FdCtx *in = base::FdMgr::GetInstance()->get(fd_in);
+            base::FdCtx *out = base::FdMgr::GetInstance()->get(fd_out);
+            wait_in = in && in->isPollable() && !in->getUserNonblock();
+            wait_out = out && out->isPollable() && !out->getUserNonblock();
+            if (wait_in) {
+                in_timeout = in->getTimeout(SO_RCVTIMEO);
+            }
+            if (wait_out) {
+                out_timeout = out->getTimeout(SO_SNDTIMEO);
+            }
+        }
+        if (!wait_in && !wait_out) {
+            return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+        }
+        while (true) {
+            ssize_t n = splice_f(fd_in, off_in, fd_out, off_out, len, flags | SPLICE_F_NONBLOCK);
+            if (n >= 0 || (errno != EAGAIN && errno != EINTR)) {
+                return n;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            // 先等输入端可读, 输入端已经可读时说明是输出端满了
+            struct pollfd pfd = {fd_in, POLLIN, 0};
+            bool in_ready = !wait_in || poll_f(&pfd, 1, 0) > 0;
+            int rt = in_ready ? wait_fd(fd_out, base::IOManager::WRITE, out_timeout)
+                              : wait_fd(fd_in, base::IOManager::READ, in_timeout);
+            if (rt) {
+                return -1;
+            }
+        }
+    }
+
+    int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+    {
+        if (!base::t_hook_enable || timeout == 0) {
+            return poll_f(fds, nfds, timeout);
+        }
+        if (nfds == 0) {
+            if (timeout > 0) {
+                usleep(timeout * 1000);
+                return 0;
+            }
+            return poll_f(fds, nfds, timeout);
+        }
+
+        // 多个 fd 时放到线程缓存的 epoll 中, 在 IOManager 上等待这个 epoll fd;
+        // 不会和其它协程在同一个 fd 上的等待冲突
+        uint64_t deadline = poll_deadline(timeout);
+        base::IOManager *iom = base::IOManager::GetThis();
+        int epfd = -1;
+        int n = 0;
+        while (true) {
+            n = poll_f(fds, nfds, 0);
+            uint64_t remain = poll_remain(deadline);
+            if (n != 0 || remain == 0) {
+                break;
+            }
+            if (nfds == 1 && fds[0].fd >= 0 && iom->canUseIoUring()) {
+                io_uring_sqe sqe;
+                prep_uring(sqe, IORING_OP_POLL_ADD, fds[0].fd, nullptr, 0);
+                sqe.poll32_events = fds[0].events;
+                int res = 0;
+                if (iom->submitIo(sqe, remain, res)) {
+                    if (res < 0 && res != -ETIMEDOUT && res != -EAGAIN && res != -EINTR) {
+                        errno = -res;
+                        n = -1;
+                        break;
+                    }
+                    continue;
+                }
+            }
+            if (epfd < 0) {
+                epfd = acquire_poll_epoll();
+                if (epfd < 0) {
+                    n = -1;
+                    break;
+                }
+                for (nfds_t i = 0; i < nfds; ++i) {
+                    if (fds[i].fd < 0) {
+                        continue;
+                    }
+                    epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = fds[i].events & (EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP);
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i].fd, &ev) && errno == EEXIST) {
+                        // 同一个 fd 出现多次, 合并关注的事件
+                        for (nfds_t j = 0; j < i; ++j) {
+                            if (fds[j].fd == fds[i].fd) {
+                                ev.events |= fds[j].events;
+                            }
+                        }
+                        epoll_ctl(epfd, EPOLL_CTL_MOD, fds[i].fd, &ev);
+                    }
+                }
+            }
+            if (wait_fd(epfd, base::IOManager::READ, remain) && errno != ETIMEDOUT) {
+                n = -1;
+                break;
+            }
+        }
+        if (epfd >= 0) {
+            int err = errno;
+            release_poll_epoll(epfd, fds, nfds);
+            errno = err;
+        }
+        return n;
+    }
+
+    int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+               struct timeval *timeout)
+    {
+        if (!base::t_hook_enable || (timeout && !timeout->tv_sec && !timeout->tv_usec)) {
+            return select_f(nfds, readfds, writefds, exceptfds, timeout);
+        }
+        std::vector<struct pollfd> fds;
+        for (int fd = 0; fd < nfds; ++fd) {
+            short events = 0;
+            if (readfds && FD_ISSET(fd, readfds)) {
+                events |= POLLIN;
+            }
+            if (writefds && FD_ISSET(fd, writefds)) {
+                events |= POLLOUT;
+            }
+            if (exceptfds && FD_ISSET(fd, exceptfds)) {
+                events |= POLLPRI;
+            }
+            if (events) {
+                fds.push_back({fd, events, 0});
+            }
+        }
+        int ms = timeout ? (int)(timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000) : -1;
+        uint64_t start = base::GetCurrentMS();
+        int rt = poll(fds.data(), fds.size(), ms);
+        if (rt < 0) {
+            return rt;
+        }
+        if (timeout) {
+            // 和 Linux 一样返回剩余时间
+            uint64_t used = base::GetCurrentMS() - start;
+            uint64_t left = used < (uint64_t)ms ? ms - used : 0;
+            timeout->tv_sec = left / 1000;
+            timeout->tv_usec = left % 1000 * 1000;
+        }
+        for (fd_set *set : {readfds, writefds, exceptfds}) {
+            if (set) {
+                FD_ZERO(set);
+            }
+        }
+        rt = 0;
+        for (auto &i : fds) {
+            if (i.revents & POLLNVAL) {
+                errno = EBADF;
+                return -1;
+            }
+            if (readfds && (i.events & POLLIN) && (i.revents & (POLLIN | POLLHUP | POLLERR))) {
+                FD_SET(i.fd, readfds);
+                ++rt;
+            }
+            if (writefds && (i.events & POLLOUT) && (i.revents & (POLLOUT | POLLERR))) {
+                FD_SET(i.fd, writefds);
+                ++rt;
+            }
+            if (exceptfds && (i.events & POLLPRI) && (i.revents & POLLPRI)) {
+                FD_SET(i.fd, exceptfds);
+                ++rt;
+            }
+        }
+        return rt;
+    }
+
+    int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+    {
+        if (!base::t_hook_enable || timeout == 0) {
+            return epoll_wait_f(epfd, events, maxevents, timeout);
+        }
+        // epoll fd 本身可读表示有事件就绪
+        base::FdMgr::GetInstance()->get(epfd, true);
+        uint64_t deadline = poll_deadline(timeout);
+        while (true) {
+            int n = epoll_wait_f(epfd, events, maxevents, 0);
+            uint64_t remain = poll_remain(deadline);
+            if (n != 0 || remain == 0) {
+                return n;
+            }
+            if (wait_fd(epfd, base::IOManager::READ, remain) && errno != ETIMEDOUT) {
+                return -1;
+            }
+        }
     }
 
     int close(int fd)
@@ -380,12 +954,24 @@ extern "C"
             return close_f(fd);
         }
 
-        base::FdCtx::ptr ctx = base::FdMgr::GetInstance()->get(fd);
-        if (ctx) {
+        bool managed = false;
+        {
+            base::FdManager::ReadGuard guard;
+            managed = base::FdMgr::GetInstance()->get(fd) != nullptr;
+        }
+        if (managed) {
             auto iom = base::IOManager::GetThis();
             if (iom) {
+                iom->cancelIo(fd);
                 iom->cancelAll(fd);
             }
+            {
+                base::FdManager::ReadGuard guard;
+                base::FdCtx *ctx = base::FdMgr::GetInstance()->get(fd);
+                if (ctx) {
+                    ctx->restoreBlocking();
+                }
+            }
             base::FdMgr::GetInstance()->del(fd);
         }
         return close_f(fd);
@@ -399,23 +985,24 @@ extern "C"
             case F_SETFL: {
                 int arg = va_arg(va, int);
                 va_end(va);
-                base::FdCtx::ptr ctx = base::FdMgr::GetInstance()->get(fd);
-                if (!ctx || ctx->isClose() || !ctx->isSocket()) {
+                base::FdManager::ReadGuard guard;
+                base::FdCtx *ctx = base::FdMgr::GetInstance()->get(fd);
+                if (!ctx || ctx->isClose() || !ctx->isPollable()) {
                     return fcntl_f(fd, cmd, arg);
                 }
                 ctx->setUserNonblock(arg & O_NONBLOCK);
+                // 还没有切换成非阻塞的 pipe/eventfd 按用户的要求设置
                 if (ctx->getSysNonblock()) {
                     arg |= O_NONBLOCK;
-                } else {
-                    arg &= ~O_NONBLOCK;
                 }
                 return fcntl_f(fd, cmd, arg);
             } break;
             case F_GETFL: {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                base::FdCtx::ptr ctx = base::FdMgr::GetInstance()->get(fd);
-                if (!ctx || ctx->isClose() || !ctx->isSocket()) {
+                base::FdManager::ReadGuard guard;
+                base::FdCtx *ctx = base::FdMgr::GetInstance()->get(fd);
+                if (!ctx || ctx->isClose() || !ctx->isPollable()) {
                     return arg;
                 }
                 if (ctx->getUserNonblock()) {
@@ -478,8 +1065,9 @@ extern "C"
 
         if (FIONBIO == request) {
             bool user_nonblock = !!*(int *)arg;
-            base::FdCtx::ptr ctx = base::FdMgr::GetInstance()->get(d);
-            if (!ctx || ctx->isClose() || !ctx->isSocket()) {
+            base::FdManager::ReadGuard guard;
+            base::FdCtx *ctx = base::FdMgr::GetInstance()->get(d);
+            if (!ctx || ctx->isClose() || !ctx->isPollable()) {
                 return ioctl_f(d, request, arg);
             }
             ctx->setUserNonblock(user_nonblock);
@@ -499,7 +1087,8 @@ extern "C"
         }
         if (level == SOL_SOCKET) {
             if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-                base::FdCtx::ptr ctx = base::FdMgr::GetInstance()->get(sockfd);
+                base::FdManager::ReadGuard guard;
+                base::FdCtx *ctx = base::FdMgr::GetInstance()->get(sockfd);
                 if (ctx) {
                     const timeval *v = (const timeval *)optval;
                     ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
@@ -508,4 +1097,124 @@ extern "C"
         }
         return setsockopt_f(sockfd, level, optname, optval, optlen);
     }
+
+    int getaddrinfo(const char *node, const char *service, const struct addrinfo *hints,
+                    struct addrinfo **res)
+    {
+        if (!base::t_hook_enable || !node || !base::Resolver::IsHookEnable()) {
+            return getaddrinfo_f(node, service, hints, res);
+        }
+        int family = hints ? hints->ai_family : AF_UNSPEC;
+        int flags = hints ? hints->ai_flags : 0;
+        if ((flags & AI_NUMERICHOST)
+            || (family != AF_UNSPEC && family != AF_INET && family != AF_INET6)
+            || base::Resolver::IsNumericHost(node)) {
+            return getaddrinfo_f(node, service, hints, res);
+        }
+
+        std::vector<base::IPAddress::ptr> addrs;
+        std::string canon;
+        int rt = base::ResolverMgr::GetInstance()->resolve(node, family, addrs, &canon);
+        if (rt != base::Resolver::OK) {
+            return base::Resolver::ToEaiError(rt);
+        }
+
+        // 用解析到的数字地址调用原始的 getaddrinfo 生成结果, 由它处理 service/socktype,
+        // 结果也可以直接用 freeaddrinfo 释放
+        struct addrinfo h;
+        memset(&h, 0, sizeof(h));
+        if (hints) {
+            h = *hints;
+        }
+        h.ai_flags = (flags | AI_NUMERICHOST) & ~AI_CANONNAME;
+        struct addrinfo *head = nullptr;
+        struct addrinfo **tail = &head;
+        int error = 0;
+        for (auto &i : addrs) {
+            char ip[INET6_ADDRSTRLEN];
+            const void *src = i->getFamily() == AF_INET
+                                  ? (const void *)&((const sockaddr_in *)i->getAddr())->sin_addr
+                                  : (const void *)&((const sockaddr_in6 *)i->getAddr())->sin6_addr;
+            if (!inet_ntop(i->getFamily(), src, ip, sizeof(ip))) {
+                continue;
+            }
+            struct addrinfo *r = nullptr;
+            error = getaddrinfo_f(ip, service, &h, &r);
+            if (error) {
+                continue;
+            }
+            *tail = r;
+            while (*tail) {
+                tail = &(*tail)->ai_next;
+            }
+        }
+        if (!head) {
+            return error ? error : EAI_NONAME;
+        }
+        if (flags & AI_CANONNAME) {
+            head->ai_canonname = strdup(canon.empty() ? node : canon.c_str());
+        }
+        *res = head;
+        return 0;
+    }
+
+    int gethostbyname_r(const char *name, struct hostent *ret, char *buf, size_t buflen,
+                        struct hostent **result, int *h_errnop)
+    {
+        if (!base::t_hook_enable || !name || !base::Resolver::IsHookEnable()
+            || base::Resolver::IsNumericHost(name)) {
+            return gethostbyname_r_f(name, ret, buf, buflen, result, h_errnop);
+        }
+        *result = nullptr;
+        std::vector<base::IPAddress::ptr> addrs;
+        std::string canon;
+        int rt = base::ResolverMgr::GetInstance()->resolve(name, AF_INET, addrs, &canon);
+        switch (rt) {
+            case base::Resolver::OK:
+                break;
+            case base::Resolver::NOT_FOUND:
+            case base::Resolver::BAD_NAME:
+                *h_errnop = HOST_NOT_FOUND;
+                return 0;
+            case base::Resolver::NO_RECORD:
+                *h_errnop = NO_DATA;
+                return 0;
+            default:
+                *h_errnop = TRY_AGAIN;
+                return EAGAIN;
+        }
+        if (canon.empty()) {
+            canon = name;
+        }
+
+        // buf: [h_addr_list][h_aliases][地址][h_name], buf 不一定按指针对齐
+        size_t n = addrs.size();
+        size_t pad = (sizeof(char *) - (uintptr_t)buf % sizeof(char *)) % sizeof(char *);
+        size_t need = pad + sizeof(char *) * (n + 2) + sizeof(in_addr) * n + canon.size() + 1;
+        if (buflen < need) {
+            *h_errnop = NETDB_INTERNAL;
+            errno = ERANGE;
+            return ERANGE;
+        }
+        char **addr_list = (char **)(buf + pad);
+        char **aliases = addr_list + n + 1;
+        char *data = (char *)(aliases + 1);
+        for (size_t i = 0; i < n; ++i) {
+            addr_list[i] = data + sizeof(in_addr) * i;
+            memcpy(addr_list[i], &((const sockaddr_in *)addrs[i]->getAddr())->sin_addr,
+                   sizeof(in_addr));
+        }
+        addr_list[n] = nullptr;
+        aliases[0] = nullptr;
+        char *hname = data + sizeof(in_addr) * n;
+        memcpy(hname, canon.c_str(), canon.size() + 1);
+
+        ret->h_name = hname;
+        ret->h_aliases = aliases;
+        ret->h_addrtype = AF_INET;
+        ret->h_length = sizeof(in_addr);
+        ret->h_addr_list = addr_list;
+        *result = ret;
+        return 0;
+    }
 }
@@ -4,6 +4,10 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
@@ -18,6 +22,10 @@ bool is_hook_enable();
  * @brief 设置当前线程的hook状态
  */
 void set_hook_enable(bool flag);
+/**
+ * @brief 当前线程hook的IO函数实际发起的读写系统调用次数
+ */
+uint64_t get_hook_io_count();
 } // namespace base
 
 extern "C"
@@ -43,6 +51,22 @@ extern "C"
     typedef int (*accept_fun)(int s, struct sockaddr *addr, socklen_t *addrlen);
     extern accept_fun accept_f;
 
+    typedef int (*accept4_fun)(int s, struct sockaddr *addr, socklen_t *addrlen, int flags);
+    extern accept4_fun accept4_f;
+
+    // pipe/eventfd/timerfd, 创建后可以像 socket 一样挂起等待
+    typedef int (*pipe_fun)(int pipefd[2]);
+    extern pipe_fun pipe_f;
+
+    typedef int (*pipe2_fun)(int pipefd[2], int flags);
+    extern pipe2_fun pipe2_f;
+
+    typedef int (*eventfd_fun)(unsigned int initval, int flags);
+    extern eventfd_fun eventfd_f;
+
+    typedef int (*timerfd_create_fun)(int clockid, int flags);
+    extern timerfd_create_fun timerfd_create_f;
+
     // read
     typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
     extern read_fun read_f;
@@ -77,6 +101,25 @@ extern "C"
     typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr *msg, int flags);
     extern sendmsg_fun sendmsg_f;
 
+    typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t *offset, size_t count);
+    extern sendfile_fun sendfile_f;
+
+    typedef ssize_t (*splice_fun)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+                                  size_t len, unsigned int flags);
+    extern splice_fun splice_f;
+
+    // 多路复用, 没有就绪的 fd 时挂起当前协程
+    typedef int (*poll_fun)(struct pollfd *fds, nfds_t nfds, int timeout);
+    extern poll_fun poll_f;
+
+    typedef int (*select_fun)(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+                              struct timeval *timeout);
+    extern select_fun select_f;
+
+    typedef int (*epoll_wait_fun)(int epfd, struct epoll_event *events, int maxevents,
+                                  int timeout);
+    extern epoll_wait_fun epoll_wait_f;
+
     typedef int (*close_fun)(int fd);
     extern close_fun close_f;
 
@@ -95,6 +138,15 @@ extern "C"
                                   socklen_t optlen);
     extern setsockopt_fun setsockopt_f;
 
+    // dns
+    typedef int (*getaddrinfo_fun)(const char *node, const char *service,
+                                   const struct addrinfo *hints, struct addrinfo **res);
+    extern getaddrinfo_fun getaddrinfo_f;
+
+    typedef int (*gethostbyname_r_fun)(const char *name, struct hostent *ret, char *buf,
+                                       size_t buflen, struct hostent **result, int *h_errnop);
+    extern gethostbyname_r_fun gethostbyname_r_f;
+
     extern int connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addrlen,
                                     uint64_t timeout_ms);
 }
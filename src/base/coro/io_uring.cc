@@ -0,0 +1,241 @@
+#include "io_uring.h"
+#include "base/log/log.h"
+#include <algorithm>
+#include <errno.h>
+#include <memory>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace base
+{
+
+static Logger::ptr g_logger = _LOG_NAME("system");
+
+static int io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IOUring::IOUring()
+{
+}
+
+IOUring::~IOUring()
+{
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqPtr && m_cqPtr != m_sqPtr) {
+        munmap(m_cqPtr, m_cqSize);
+    }
+    if (m_sqPtr) {
+        munmap(m_sqPtr, m_sqSize);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IOUring::init(uint32_t entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CLAMP;
+    m_fd = io_uring_setup(entries, &p);
+    if (m_fd < 0) {
+        _LOG_ERROR(g_logger) << "io_uring_setup entries=" << entries << " errno=" << errno << " "
+                             << strerror(errno);
+        return false;
+    }
+    m_features = p.features;
+
+    m_sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+    }
+
+    m_sqPtr = mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+                   IORING_OFF_SQ_RING);
+    if (m_sqPtr == MAP_FAILED) {
+        m_sqPtr = nullptr;
+        _LOG_ERROR(g_logger) << "io_uring mmap sq ring errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    if (single_mmap) {
+        m_cqPtr = m_sqPtr;
+    } else {
+        m_cqPtr = mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+                       IORING_OFF_CQ_RING);
+        if (m_cqPtr == MAP_FAILED) {
+            m_cqPtr = nullptr;
+            _LOG_ERROR(g_logger) << "io_uring mmap cq ring errno=" << errno << " "
+                                 << strerror(errno);
+            return false;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        _LOG_ERROR(g_logger) << "io_uring mmap sqes errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    m_sqes = (io_uring_sqe *)sqes;
+
+    char *sq = (char *)m_sqPtr;
+    m_sqHead = (unsigned *)(sq + p.sq_off.head);
+    m_sqTail = (unsigned *)(sq + p.sq_off.tail);
+    m_sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sqEntries = (unsigned *)(sq + p.sq_off.ring_entries);
+    // SQ 的索引数组固定为恒等映射, SQE 的下标就是 tail & mask
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; ++i) {
+        array[i] = i;
+    }
+    m_sqeTail = *m_sqTail;
+
+    char *cq = (char *)m_cqPtr;
+    m_cqHead = (unsigned *)(cq + p.cq_off.head);
+    m_cqTail = (unsigned *)(cq + p.cq_off.tail);
+    m_cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+bool IOUring::registerEventFd(int fd)
+{
+    if (io_uring_register(m_fd, IORING_REGISTER_EVENTFD, &fd, 1)) {
+        _LOG_ERROR(g_logger) << "io_uring register eventfd=" << fd << " errno=" << errno << " "
+                             << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool IOUring::supportOp(uint8_t op)
+{
+    size_t size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::unique_ptr<char[]> buf(new char[size]());
+    io_uring_probe *probe = (io_uring_probe *)buf.get();
+    if (io_uring_register(m_fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        return false;
+    }
+    return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+uint32_t IOUring::sqSpace() const
+{
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    return *m_sqEntries - (m_sqeTail - head);
+}
+
+io_uring_sqe *IOUring::getSqe()
+{
+    if (!sqSpace()) {
+        return nullptr;
+    }
+    io_uring_sqe *sqe = &m_sqes[m_sqeTail & *m_sqMask];
+    ++m_sqeTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IOUring::submit(unsigned wait_nr)
+{
+    // 上次 io_uring_enter 失败时未被内核消费的 SQE 也要一起重新提交
+    unsigned to_submit = m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (!to_submit && !wait_nr) {
+        return 0;
+    }
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    ++m_enterCount;
+    int rt = 0;
+    do {
+        rt = io_uring_enter(m_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (rt < 0 && errno == EINTR);
+    if (rt < 0) {
+        _LOG_ERROR(g_logger) << "io_uring_enter to_submit=" << to_submit << " errno=" << errno
+                             << " " << strerror(errno);
+        return -errno;
+    }
+    return rt;
+}
+
+/**
+ * @brief 实际探测内核的支持情况
+ */
+static bool ProbeIOUring()
+{
+#ifndef IORING_ASYNC_CANCEL_FD
+    _LOG_WARN(g_logger) << "io_uring headers too old, IORING_ASYNC_CANCEL_FD not defined";
+    return false;
+#else
+    static const uint8_t s_required_ops[] = {
+        IORING_OP_RECV,     IORING_OP_SEND,         IORING_OP_RECVMSG,
+        IORING_OP_SENDMSG,  IORING_OP_ACCEPT,       IORING_OP_POLL_ADD,
+        IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL,
+    };
+
+    IOUring ring;
+    if (!ring.init(4)) {
+        return false;
+    }
+
+    for (auto op : s_required_ops) {
+        if (!ring.supportOp(op)) {
+            _LOG_WARN(g_logger) << "io_uring opcode " << (int)op << " not supported";
+            return false;
+        }
+    }
+    if (!(ring.getFeatures() & IORING_FEAT_NODROP)) {
+        _LOG_WARN(g_logger) << "io_uring IORING_FEAT_NODROP not supported";
+        return false;
+    }
+
+    // 按 fd 取消(IORING_ASYNC_CANCEL_FD)在旧内核上会返回 -EINVAL
+    int efd = eventfd(0, EFD_CLOEXEC);
+    if (efd < 0) {
+        return false;
+    }
+    int res = -EINVAL;
+    {
+        IOUring::MutexType::Lock lock(ring.mutex());
+        io_uring_sqe *sqe = ring.getSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = efd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = 1;
+        ring.submit(1);
+    }
+    ring.reap([&res](const io_uring_cqe &cqe) { res = cqe.res; });
+    close(efd);
+    if (res < 0 && res != -ENOENT) {
+        _LOG_WARN(g_logger) << "io_uring IORING_ASYNC_CANCEL_FD not supported res=" << res;
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool IOUring::Supported()
+{
+    static bool s_supported = ProbeIOUring();
+    return s_supported;
+}
+
+} // namespace base
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <atomic>
+#include <stdint.h>
+#include "base/mutex.h"
+
+namespace base
+{
+
+/**
+ * @brief io_uring 的最小封装
+ * @details 直接使用 io_uring_setup/io_uring_enter 系统调用, 不依赖 liburing.
+ *          提交队列由 mutex() 保护, 任意线程都可以准备 SQE 并提交;
+ *          完成队列只由创建它的调度线程收割.
+ */
+class IOUring : Noncopyable
+{
+public:
+    typedef Spinlock MutexType;
+
+    IOUring();
+    ~IOUring();
+
+    /**
+     * @brief 创建 ring 并映射队列内存
+     * @param[in] entries 提交队列长度, 内核会向上取整为2的幂
+     * @return 是否成功
+     */
+    bool init(uint32_t entries);
+
+    /**
+     * @brief 注册 eventfd, 之后每个完成事件都会写这个 eventfd
+     */
+    bool registerEventFd(int fd);
+
+    /**
+     * @brief 内核是否支持指定的 opcode
+     */
+    bool supportOp(uint8_t op);
+
+    /**
+     * @brief io_uring_setup 返回的 IORING_FEAT_* 标志
+     */
+    uint32_t getFeatures() const { return m_features; }
+
+    /**
+     * @brief 获取一个清零的空闲 SQE(需持有mutex), 队列满时返回 nullptr
+     */
+    io_uring_sqe *getSqe();
+
+    /**
+     * @brief 剩余可用的 SQE 数量(需持有mutex)
+     */
+    uint32_t sqSpace() const;
+
+    /**
+     * @brief 提交所有已准备的 SQE(需持有mutex)
+     * @param[in] wait_nr 阻塞等待至少 wait_nr 个完成事件
+     * @return 提交的数量, 失败返回 -errno
+     */
+    int submit(unsigned wait_nr = 0);
+
+    /**
+     * @brief 收割完成队列
+     * @param[in] fn 对每个 CQE 调用 fn(const io_uring_cqe &)
+     * @return 处理的 CQE 数量
+     */
+    template <class Fn>
+    size_t reap(Fn fn)
+    {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        size_t count = 0;
+        while (head != tail) {
+            fn(m_cqes[head & *m_cqMask]);
+            ++head;
+            ++count;
+        }
+        if (count) {
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        }
+        return count;
+    }
+
+    /**
+     * @brief 提交队列的锁
+     */
+    MutexType &mutex() { return m_mutex; }
+
+    /**
+     * @brief io_uring_enter 的调用次数
+     */
+    uint64_t getEnterCount() const { return m_enterCount; }
+
+    /**
+     * @brief 内核是否支持 IOManager 需要的 io_uring 功能
+     * @details 需要的 opcode 都可用, 并且支持按 fd 取消(5.19+), 结果在进程内缓存
+     */
+    static bool Supported();
+
+private:
+    /// ring 文件句柄
+    int m_fd = -1;
+    /// IORING_FEAT_* 标志
+    uint32_t m_features = 0;
+    /// 提交队列内存
+    void *m_sqPtr = nullptr;
+    size_t m_sqSize = 0;
+    /// 完成队列内存(SINGLE_MMAP 时与提交队列相同)
+    void *m_cqPtr = nullptr;
+    size_t m_cqSize = 0;
+    /// SQE 数组
+    io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned *m_sqMask = nullptr;
+    unsigned *m_sqEntries = nullptr;
+    /// 已准备但还未提交的 SQE 的尾部
+    unsigned m_sqeTail = 0;
+
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned *m_cqMask = nullptr;
+    io_uring_cqe *m_cqes = nullptr;
+
+    /// io_uring_enter 调用次数
+    std::atomic<uint64_t> m_enterCount = {0};
+    /// 提交队列的锁
+    MutexType m_mutex;
+};
+
+} // namespace base
@@ -1,10 +1,16 @@
 #include "iomanager.h"
+#include "io_uring.h"
+#include "base/conf/config.h"
 #include "base/macro.h"
 #include "base/log/log.h"
+#include "hook.h"
+#include "fd_manager.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -13,6 +19,34 @@ namespace base
 
 static base::Logger::ptr g_logger = _LOG_NAME("system");
 
+static ConfigVar<bool>::ptr g_io_uring_enable =
+    Config::Lookup("iomanager.io_uring.enable", false,
+                   "use io_uring for hooked socket io, fallback to epoll when unsupported");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.io_uring.entries", 256, "io_uring entries per thread");
+
+static ConfigVar<bool>::ptr g_persistent_events =
+    Config::Lookup("iomanager.persistent_events", false,
+                   "keep fds registered EPOLLIN|EPOLLOUT|EPOLLET until cancelAll");
+
+/**
+ * @brief 等待 io_uring 完成事件的协程, 放在协程栈上, user_data 指向它
+ * @details 带超时时操作后面链接一个 LINK_TIMEOUT, 它的 user_data 最低位为1,
+ *          两个完成事件都收割后才唤醒协程
+ */
+struct UringWaiter {
+    Fiber::ptr fiber;
+    int res = 0;
+    int pending = 1;
+    bool timedOut = false;
+    __kernel_timespec ts;
+};
+
+/// 当前线程认领的唤醒上下文所属的IOManager及下标
+static thread_local IOManager *t_tickle_owner = nullptr;
+static thread_local int t_tickle_index = -1;
+
 enum EpollCtlOp {};
 
 static std::ostream &operator<<(std::ostream &os, const EpollCtlOp &op)
@@ -105,26 +139,49 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event)
 }
 
 IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, bool hook_enable)
-    : Scheduler(threads, use_caller, name, hook_enable)
+    : Scheduler(threads, use_caller, name, hook_enable), TimerManager(threads)
 {
     m_epfd = epoll_create(5000);
     _ASSERT(m_epfd > 0);
 
-    int rt = pipe(m_tickleFds);
-    _ASSERT(!rt);
-
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
-
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    _ASSERT(!rt);
+    m_tickleContexts.resize(threads);
+    for (auto &ctx : m_tickleContexts) {
+        ctx.reset(new TickleContext);
+        ctx->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        _ASSERT(ctx->eventFd >= 0);
+        ctx->epfd = epoll_create(2);
+        _ASSERT(ctx->epfd > 0);
+
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN;
+        event.data.fd = ctx->eventFd;
+        int rt = epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, ctx->eventFd, &event);
+        _ASSERT(!rt);
+
+        // 共享的 epoll 嵌套在私有 epoll 中, 只有 poller 在私有 epoll 上等待
+        event.data.fd = m_epfd;
+        rt = epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, m_epfd, &event);
+        _ASSERT(!rt);
+    }
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    _ASSERT(!rt);
+    m_persistentEvents = g_persistent_events->getValue();
 
-    contextResize(32);
+    if (g_io_uring_enable->getValue()) {
+        m_uringEnabled = IOUring::Supported();
+        for (size_t i = 0; m_uringEnabled && i < m_tickleContexts.size(); ++i) {
+            TickleContext *ctx = m_tickleContexts[i].get();
+            ctx->ring.reset(new IOUring);
+            m_uringEnabled = ctx->ring->init(g_io_uring_entries->getValue()) &&
+                             ctx->ring->registerEventFd(ctx->eventFd);
+        }
+        if (!m_uringEnabled) {
+            for (auto &ctx : m_tickleContexts) {
+                ctx->ring.reset();
+            }
+            _LOG_WARN(g_logger) << "name=" << name << " io_uring unavailable, fallback to epoll";
+        }
+    }
 
     start();
 }
@@ -132,41 +189,33 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, b
 IOManager::~IOManager()
 {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (m_fdContexts[i]) {
-            delete m_fdContexts[i];
-        }
+    if (t_tickle_owner == this) {
+        t_tickle_owner = nullptr;
     }
+    for (auto &ctx : m_tickleContexts) {
+        ctx->ring.reset();
+        close(ctx->epfd);
+        close(ctx->eventFd);
+    }
+    close(m_epfd);
 }
 
-void IOManager::contextResize(size_t size)
+/**
+ * @brief fd 当前打开的代数, 不在 FdManager 中时返回 0
+ */
+static uint64_t FdGeneration(int fd)
 {
-    m_fdContexts.resize(size);
-
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
-        }
-    }
+    FdManager::ReadGuard guard;
+    FdCtx *ctx = FdMgr::GetInstance()->get(fd);
+    return ctx ? ctx->getGeneration() : 0;
 }
 
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
 {
-    FdContext *fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    FdContext *fd_ctx = m_fdContexts.getOrCreate(fd);
+    if (_UNLIKELY(!fd_ctx)) {
+        _LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+        return -1;
     }
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
@@ -176,18 +225,46 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
         _ASSERT(!(fd_ctx->events & event));
     }
 
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
+    if (m_persistentEvents) {
+        // 持久注册的状态属于 fd 的某一次打开: fd 在别处关闭(close_f, 没有 hook 的线程, 其它 IOManager)时
+        // 内核已经删掉了注册, 同一个 fd 号再打开时重新注册, 之前记下的就绪事件也作废.
+        // 不在 FdManager 中的 fd 无法区分, 每次都重新注册
+        uint64_t generation = FdGeneration(fd);
+        if (!generation || generation != fd_ctx->generation) {
+            fd_ctx->generation = generation;
+            fd_ctx->registered = false;
+            fd_ctx->ready = NONE;
+        }
+    }
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        _LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
-                             << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << " (" << errno
-                             << ") (" << strerror(errno)
-                             << ") fd_ctx->events=" << (EPOLL_EVENTS)fd_ctx->events;
-        return -1;
+    if (m_persistentEvents && (fd_ctx->ready & event)) {
+        // 等待者不在时到达的边沿, 直接交给调用方重试
+        fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+        return 1;
+    }
+
+    if (!m_persistentEvents || !fd_ctx->registered) {
+        int op = fd_ctx->events || fd_ctx->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | (m_persistentEvents ? READ | WRITE : fd_ctx->events | event);
+        epevent.data.ptr = fd_ctx;
+
+        ++m_epollCtlCount;
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if (rt && op == EPOLL_CTL_ADD && errno == EEXIST) {
+            // 同一个打开的 fd 已经注册过(持久注册状态被重置)
+            op = EPOLL_CTL_MOD;
+            ++m_epollCtlCount;
+            rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        }
+        if (rt) {
+            _LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
+                                 << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << " ("
+                                 << errno << ") (" << strerror(errno)
+                                 << ") fd_ctx->events=" << (EPOLL_EVENTS)fd_ctx->events;
+            return -1;
+        }
+        fd_ctx->registered = m_persistentEvents;
     }
 
     ++m_pendingEventCount;
@@ -208,12 +285,10 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
 
 bool IOManager::delEvent(int fd, Event event)
 {
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (_UNLIKELY(!(fd_ctx->events & event))) {
@@ -221,17 +296,20 @@ bool IOManager::delEvent(int fd, Event event)
     }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        _LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
-                             << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << " (" << errno
-                             << ") (" << strerror(errno) << ")";
-        return false;
+    if (!m_persistentEvents) {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        ++m_epollCtlCount;
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if (rt) {
+            _LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
+                                 << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << " ("
+                                 << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     --m_pendingEventCount;
@@ -243,12 +321,10 @@ bool IOManager::delEvent(int fd, Event event)
 
 bool IOManager::cancelEvent(int fd, Event event)
 {
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (_UNLIKELY(!(fd_ctx->events & event))) {
@@ -256,17 +332,20 @@ bool IOManager::cancelEvent(int fd, Event event)
     }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        _LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
-                             << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << " (" << errno
-                             << ") (" << strerror(errno) << ")";
-        return false;
+    if (!m_persistentEvents) {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        ++m_epollCtlCount;
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if (rt) {
+            _LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
+                                 << ", " << (EPOLL_EVENTS)epevent.events << "):" << rt << " ("
+                                 << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     fd_ctx->triggerEvent(event);
@@ -276,23 +355,24 @@ bool IOManager::cancelEvent(int fd, Event event)
 
 bool IOManager::cancelAll(int fd)
 {
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) {
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) {
         return false;
     }
-    FdContext *fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if (!fd_ctx->events) {
+    fd_ctx->ready = NONE;
+    if (!fd_ctx->events && !fd_ctx->registered) {
         return false;
     }
+    fd_ctx->registered = false;
 
     int op = EPOLL_CTL_DEL;
     epoll_event epevent;
     epevent.events = 0;
     epevent.data.ptr = fd_ctx;
 
+    ++m_epollCtlCount;
     int rt = epoll_ctl(m_epfd, op, fd, &epevent);
     if (rt) {
         _LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << (EpollCtlOp)op << ", " << fd
@@ -301,6 +381,9 @@ bool IOManager::cancelAll(int fd)
         return false;
     }
 
+    if (!fd_ctx->events) {
+        return false;
+    }
     if (fd_ctx->events & READ) {
         fd_ctx->triggerEvent(READ);
         --m_pendingEventCount;
@@ -319,13 +402,245 @@ IOManager *IOManager::GetThis()
     return dynamic_cast<IOManager *>(Scheduler::GetThis());
 }
 
-void IOManager::tickle()
+IOManager::TickleContext *IOManager::getTickleContext()
+{
+    if (t_tickle_owner != this) {
+        size_t idx = m_tickleCursor++;
+        _ASSERT(idx < m_tickleContexts.size());
+        t_tickle_owner = this;
+        t_tickle_index = idx;
+        m_tickleContexts[idx]->thread = base::GetThreadId();
+    }
+    return m_tickleContexts[t_tickle_index].get();
+}
+
+bool IOManager::wake(TickleContext *ctx)
 {
-    if (!hasIdleThreads()) {
+    if (!ctx->sleeping || ctx->notified.exchange(true)) {
+        ++m_tickleSuppressed;
+        return false;
+    }
+    uint64_t one = 1;
+    int rt = write(ctx->eventFd, &one, sizeof(one));
+    _ASSERT(rt == sizeof(one));
+    ++m_tickleSent;
+    return true;
+}
+
+void IOManager::tickle(int thread)
+{
+    if (m_stopping) {
+        // 停止时所有睡眠的线程都要检查退出条件
+        for (auto &ctx : m_tickleContexts) {
+            if (ctx->sleeping) {
+                wake(ctx.get());
+            }
+        }
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);
-    _ASSERT(rt == 1);
+
+    if (thread != -1) {
+        for (auto &ctx : m_tickleContexts) {
+            if (ctx->thread == thread) {
+                wake(ctx.get());
+                return;
+            }
+        }
+    }
+
+    // 已经有线程在被唤醒的路上时合并掉, 它回到调度循环后会继续 tickle;
+    // 否则优先唤醒非 poller 的线程, 让 poller 继续等待IO
+    size_t size = m_tickleContexts.size();
+    size_t start = m_wakeCursor++;
+    int poller = m_poller;
+    TickleContext *target = nullptr;
+    for (size_t i = 0; i < size; ++i) {
+        size_t idx = (start + i) % size;
+        TickleContext *ctx = m_tickleContexts[idx].get();
+        if (!ctx->sleeping) {
+            continue;
+        }
+        if (ctx->notified) {
+            target = nullptr;
+            break;
+        }
+        if (!target || (int)idx != poller) {
+            target = ctx;
+        }
+        if ((int)idx != poller) {
+            break;
+        }
+    }
+    if (target) {
+        wake(target);
+    } else {
+        ++m_tickleSuppressed;
+    }
+}
+
+void IOManager::ensurePoller()
+{
+    if (m_poller != -1) {
+        return;
+    }
+    size_t size = m_tickleContexts.size();
+    size_t start = m_wakeCursor++;
+    for (size_t i = 0; i < size; ++i) {
+        TickleContext *ctx = m_tickleContexts[(start + i) % size].get();
+        if (ctx->sleeping) {
+            if (!ctx->notified) {
+                wake(ctx);
+            }
+            return;
+        }
+    }
+}
+
+bool IOManager::canUseIoUring()
+{
+    if (!m_uringEnabled || Scheduler::GetThis() != this) {
+        return false;
+    }
+    return !Fiber::GetThis()->isSharedStack() && getTickleContext()->ring;
+}
+
+bool IOManager::submitIo(const io_uring_sqe &sqe, uint64_t timeout_ms, int &res)
+{
+    TickleContext *ctx = getTickleContext();
+    IOUring *ring = ctx->ring.get();
+    UringWaiter waiter;
+    {
+        IOUring::MutexType::Lock lock(ring->mutex());
+        if (ring->sqSpace() < 2) {
+            ring->submit();
+            if (ring->sqSpace() < 2) {
+                return false;
+            }
+        }
+        io_uring_sqe *op = ring->getSqe();
+        *op = sqe;
+        op->user_data = (uint64_t)&waiter;
+        if (timeout_ms != ~0ull) {
+            op->flags |= IOSQE_IO_LINK;
+            waiter.ts.tv_sec = timeout_ms / 1000;
+            waiter.ts.tv_nsec = timeout_ms % 1000 * 1000 * 1000;
+            waiter.pending = 2;
+
+            io_uring_sqe *timeout = ring->getSqe();
+            timeout->opcode = IORING_OP_LINK_TIMEOUT;
+            timeout->fd = -1;
+            timeout->addr = (uint64_t)&waiter.ts;
+            timeout->len = 1;
+            timeout->user_data = (uint64_t)&waiter | 1;
+        }
+        waiter.fiber = Fiber::GetThis();
+        ctx->inflight += waiter.pending;
+    }
+    ++m_pendingEventCount;
+    Fiber::YieldToHold();
+
+    res = waiter.res;
+    if (res == -ECANCELED) {
+        res = waiter.timedOut ? -ETIMEDOUT : -EBADF;
+    }
+    return true;
+}
+
+void IOManager::cancelIo(int fd)
+{
+    if (!m_uringEnabled) {
+        return;
+    }
+    for (auto &ctx : m_tickleContexts) {
+        if (!ctx->inflight) {
+            continue;
+        }
+        IOUring *ring = ctx->ring.get();
+        IOUring::MutexType::Lock lock(ring->mutex());
+        io_uring_sqe *sqe = ring->getSqe();
+        if (!sqe) {
+            ring->submit();
+            sqe = ring->getSqe();
+        }
+        if (!sqe) {
+            _LOG_ERROR(g_logger) << "cancelIo fd=" << fd << " io_uring sq full";
+            continue;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = 0;
+        ++ctx->inflight;
+        // fd 关闭后就无法再按 fd 匹配, 必须立即提交
+        ring->submit();
+    }
+}
+
+size_t IOManager::reapIo(TickleContext *ctx)
+{
+    return ctx->ring->reap([this, ctx](const io_uring_cqe &cqe) {
+        --ctx->inflight;
+        if (!cqe.user_data) {
+            return;
+        }
+        UringWaiter *waiter = (UringWaiter *)(cqe.user_data & ~1ull);
+        if (cqe.user_data & 1) {
+            waiter->timedOut = cqe.res == -ETIME;
+        } else {
+            waiter->res = cqe.res;
+        }
+        if (--waiter->pending == 0) {
+            ++m_uringOpCount;
+            --m_pendingEventCount;
+            // schedule 之后协程可能马上在其它线程恢复, waiter 随之失效
+            schedule(&waiter->fiber);
+        }
+    });
+}
+
+size_t IOManager::submitAndReap(TickleContext *ctx)
+{
+    {
+        IOUring::MutexType::Lock lock(ctx->ring->mutex());
+        ctx->ring->submit();
+    }
+    return reapIo(ctx);
+}
+
+void IOManager::onThreadStart()
+{
+    claimWheel();
+}
+
+void IOManager::onTaskDone(bool batch_end)
+{
+    if (!m_uringEnabled) {
+        return;
+    }
+    TickleContext *ctx = getTickleContext();
+    if (!ctx->ring || !ctx->inflight) {
+        return;
+    }
+    if (batch_end) {
+        submitAndReap(ctx);
+    } else {
+        reapIo(ctx);
+    }
+}
+
+IOManager::IOStats IOManager::getIOStats() const
+{
+    IOStats stats;
+    stats.epollCtl = m_epollCtlCount;
+    stats.wait = m_waitCount;
+    stats.eventFdRead = m_eventFdReadCount;
+    stats.uringOps = m_uringOpCount;
+    for (auto &ctx : m_tickleContexts) {
+        if (ctx->ring) {
+            stats.uringEnter += ctx->ring->getEnterCount();
+        }
+    }
+    return stats;
 }
 
 bool IOManager::stopping(uint64_t &timeout)
@@ -347,35 +662,92 @@ void IOManager::idle()
     epoll_event *events = new epoll_event[MAX_EVNETS]();
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event *ptr) { delete[] ptr; });
 
+    TickleContext *ctx = getTickleContext();
+    int index = t_tickle_index;
+
     while (true) {
+        // 本线程的协程在上一轮调度中准备的 SQE 在这里批量提交
+        size_t reaped = ctx->ring ? submitAndReap(ctx) : 0;
+
+        // 先标记睡眠再检查任务和定时器, 与 tickle 中先入队再检查 sleeping 配对, 不会丢失唤醒
+        ctx->sleeping = true;
+        int expected = -1;
+        bool is_poller = m_poller.compare_exchange_strong(expected, index);
+
         uint64_t next_timeout = 0;
         if (_UNLIKELY(stopping(next_timeout))) {
+            ctx->sleeping = false;
+            if (is_poller) {
+                m_poller = -1;
+            }
+            tickle();
             _LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
             break;
         }
 
+        static const uint64_t MAX_TIMEOUT = 3000;
+        if (reaped || hasPendingTask()) {
+            next_timeout = 0;
+        } else if (!is_poller || next_timeout > MAX_TIMEOUT) {
+            next_timeout = MAX_TIMEOUT;
+        }
+
         int rt = 0;
-        do {
-            static const int MAX_TIMEOUT = 3000;
-            if (next_timeout != ~0ull) {
-                next_timeout = (int)next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
-            } else {
-                next_timeout = MAX_TIMEOUT;
+        bool io_ready = false;
+        bool notified = false;
+        if (is_poller && !reaped) {
+            ++m_waitCount;
+            do {
+                rt = epoll_wait_f(ctx->epfd, events, MAX_EVNETS, (int)next_timeout);
+            } while (rt < 0 && errno == EINTR);
+            for (int i = 0; i < rt; ++i) {
+                if (events[i].data.fd == m_epfd) {
+                    io_ready = true;
+                } else {
+                    notified = true;
+                }
+            }
+        } else if (next_timeout) {
+            pollfd pfd;
+            pfd.fd = ctx->eventFd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            ++m_waitCount;
+            do {
+                rt = poll_f(&pfd, 1, (int)next_timeout);
+            } while (rt < 0 && errno == EINTR);
+            notified = rt > 0;
+        }
+        ctx->sleeping = false;
+        ctx->notified = false;
+        if (is_poller) {
+            m_poller = -1;
+        }
+        if (notified) {
+            uint64_t dummy;
+            ++m_eventFdReadCount;
+            rt = read(ctx->eventFd, &dummy, sizeof(dummy));
+            if (ctx->ring) {
+                reapIo(ctx);
             }
-            rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
-            if (rt < 0 && errno == EINTR) {
-            } else {
-                break;
+        }
+
+        rt = 0;
+        if (is_poller) {
+            std::vector<std::function<void()> > cbs;
+            listExpiredCb(cbs);
+            if (!cbs.empty()) {
+                // _LOG_DEBUG(g_logger) << "on timer cbs.size=" << cbs.size();
+                schedule(cbs.begin(), cbs.end());
+                cbs.clear();
+            }
+            if (io_ready) {
+                ++m_waitCount;
+                rt = epoll_wait_f(m_epfd, events, MAX_EVNETS, 0);
             }
-        } while (true);
-
-        std::vector<std::function<void()> > cbs;
-        listExpiredCb(cbs);
-        if (!cbs.empty()) {
-            // _LOG_DEBUG(g_logger) << "on timer cbs.size=" << cbs.size();
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
         }
+        // 本线程不再等待IO, 如果还有线程在睡眠, 唤醒一个接替 poller
+        ensurePoller();
 
         // if(_UNLIKELY(rt == MAX_EVNETS)) {
         //     _LOG_INFO(g_logger) << "epoll wait events=" << rt;
@@ -383,17 +755,11 @@ void IOManager::idle()
 
         for (int i = 0; i < rt; ++i) {
             epoll_event &event = events[i];
-            if (event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
-                    ;
-                continue;
-            }
-
             FdContext *fd_ctx = (FdContext *)event.data.ptr;
             FdContext::MutexType::Lock lock(fd_ctx->mutex);
             if (event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+                int interest = m_persistentEvents ? READ | WRITE : fd_ctx->events;
+                event.events |= (EPOLLIN | EPOLLOUT) & interest;
             }
             int real_events = NONE;
             if (event.events & EPOLLIN) {
@@ -403,6 +769,21 @@ void IOManager::idle()
                 real_events |= WRITE;
             }
 
+            if (m_persistentEvents) {
+                // 注册保持不变, 没有等待者的事件记下来留给下一次 addEvent
+                fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fd_ctx->events));
+                real_events &= fd_ctx->events;
+                if (real_events & READ) {
+                    fd_ctx->triggerEvent(READ);
+                    --m_pendingEventCount;
+                }
+                if (real_events & WRITE) {
+                    fd_ctx->triggerEvent(WRITE);
+                    --m_pendingEventCount;
+                }
+                continue;
+            }
+
             if ((fd_ctx->events & real_events) == NONE) {
                 continue;
             }
@@ -411,6 +792,7 @@ void IOManager::idle()
             int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
             event.events = EPOLLET | left_events;
 
+            ++m_epollCtlCount;
             int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
             if (rt2) {
                 _LOG_ERROR(g_logger)
@@ -442,7 +824,27 @@ void IOManager::idle()
 
 void IOManager::onTimerInsertedAtFront()
 {
-    tickle();
+    // 只有 poller 按定时器时间等待, 需要它重新计算超时
+    int poller = m_poller;
+    if (poller != -1) {
+        wake(m_tickleContexts[poller].get());
+    } else {
+        tickle();
+    }
+}
+
+std::ostream &IOManager::dump(std::ostream &os)
+{
+    Scheduler::dump(os);
+    os << std::endl
+       << "    tickle_sent=" << m_tickleSent << " tickle_suppressed=" << m_tickleSuppressed
+       << " poller=" << m_poller;
+    IOStats stats = getIOStats();
+    os << std::endl
+       << "    io_uring=" << m_uringEnabled << " epoll_ctl=" << stats.epollCtl
+       << " wait=" << stats.wait << " eventfd_read=" << stats.eventFdRead
+       << " uring_enter=" << stats.uringEnter << " uring_ops=" << stats.uringOps;
+    return os;
 }
 
 } // namespace base
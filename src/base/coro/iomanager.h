@@ -1,11 +1,16 @@
 #pragma once
 
+#include "base/coro/fd_table.h"
 #include "base/coro/scheduler.h"
 #include "base/coro/timer.h"
 
+struct io_uring_sqe;
+
 namespace base
 {
 
+class IOUring;
+
 /**
  * @brief 基于Epoll的IO协程调度器
  */
@@ -13,9 +18,6 @@ class IOManager : public Scheduler, public TimerManager
 {
 public:
     typedef std::shared_ptr<IOManager> ptr;
-    typedef RWMutex RWMutexType;
-    // typedef NullRWMutex RWMutexType;
-    // typedef RWSpinlock RWMutexType;
 
     /**
      * @brief IO事件
@@ -36,6 +38,9 @@ private:
     struct FdContext {
         // typedef Mutex MutexType;
         typedef Spinlock MutexType;
+
+        FdContext(int fd) : fd(fd) {}
+
         /**
          * @brief 事件上线文类
          */
@@ -75,6 +80,12 @@ private:
         int fd = 0;
         /// 当前的事件
         Event events = NONE;
+        /// 持久注册模式: 已经就绪但还没有等待者消费的事件
+        Event ready = NONE;
+        /// 持久注册模式: 是否已注册到 epoll
+        bool registered = false;
+        /// 持久注册模式: registered/ready 所属的 fd 代数(FdCtx::getGeneration), 0 表示不在 FdManager 中
+        uint64_t generation = 0;
         /// 事件的Mutex
         MutexType mutex;
     };
@@ -99,7 +110,8 @@ public:
      * @param[in] fd socket句柄
      * @param[in] event 事件类型
      * @param[in] cb 事件回调函数
-     * @return 添加成功返回0,失败返回-1
+     * @return 添加成功返回0,失败返回-1;
+     *         持久注册模式下事件已经就绪时不挂起等待, 返回1, 调用方应直接重试IO
      */
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
@@ -121,6 +133,7 @@ public:
 
     /**
      * @brief 取消所有事件
+     * @details 持久注册模式下同时从 epoll 注销, 关闭 fd 之前必须调用
      * @param[in] fd socket句柄
      */
     bool cancelAll(int fd);
@@ -130,17 +143,91 @@ public:
      */
     static IOManager *GetThis();
 
+    /**
+     * @brief 实际发出的唤醒(eventfd write)次数
+     */
+    uint64_t getTickleSent() const { return m_tickleSent; }
+
+    /**
+     * @brief 目标线程未睡眠或已被唤醒而省掉的唤醒次数
+     */
+    uint64_t getTickleSuppressed() const { return m_tickleSuppressed; }
+
+    /**
+     * @brief IO相关系统调用的统计
+     */
+    struct IOStats {
+        /// epoll_ctl 次数
+        uint64_t epollCtl = 0;
+        /// 空闲线程等待(epoll_wait/poll)的次数
+        uint64_t wait = 0;
+        /// 读 eventfd 的次数
+        uint64_t eventFdRead = 0;
+        /// io_uring_enter 次数
+        uint64_t uringEnter = 0;
+        /// 通过 io_uring 完成的IO操作数
+        uint64_t uringOps = 0;
+    };
+
+    /**
+     * @brief 返回IO系统调用的统计
+     */
+    IOStats getIOStats() const;
+
+    /**
+     * @brief 是否启用持久注册模式(iomanager.persistent_events)
+     * @details fd 在第一次等待时以 EPOLLIN|EPOLLOUT|EPOLLET 注册, 直到 cancelAll 或者
+     *          fd 关闭后重新打开(FdCtx 代数变化)才注销/重新注册,
+     *          事件触发后不再 epoll_ctl. 没有等待者时就绪状态记录在 FdContext 中,
+     *          下一次等待直接返回. 等待前必须把 fd 读/写到 EAGAIN, 否则边沿触发会丢失事件
+     */
+    bool isPersistentEvents() const { return m_persistentEvents; }
+
+    /**
+     * @brief 是否启用了 io_uring 后端(iomanager.io_uring.enable 且内核支持)
+     */
+    bool isIoUringEnabled() const { return m_uringEnabled; }
+
+    /**
+     * @brief 当前协程能否通过 io_uring 执行IO
+     * @details 共享栈协程挂起时栈会被拷走, IO缓冲区可能在栈上, 只能走 epoll
+     */
+    bool canUseIoUring();
+
+    /**
+     * @brief 通过当前线程的 io_uring 执行一个IO操作, 挂起当前协程直到完成
+     * @details SQE 在本线程执行完当前这批任务或进入 idle 时批量提交
+     * @param[in] sqe 操作模板, user_data 会被覆盖
+     * @param[in] timeout_ms 超时时间(毫秒), ~0ull 表示不超时
+     * @param[out] res 操作结果, 失败为 -errno, 超时为 -ETIMEDOUT, fd 被关闭为 -EBADF
+     * @return 提交队列已满时返回 false, 调用方应回退到 epoll
+     */
+    bool submitIo(const io_uring_sqe &sqe, uint64_t timeout_ms, int &res);
+
+    /**
+     * @brief 取消所有线程的 io_uring 中 fd 上未完成的操作
+     * @attention 必须在 close(fd) 之前调用
+     */
+    void cancelIo(int fd);
+
+    std::ostream &dump(std::ostream &os) override;
+
 protected:
-    void tickle() override;
+    void tickle(int thread = -1) override;
     bool stopping() override;
     void idle() override;
     void onTimerInsertedAtFront() override;
 
     /**
-     * @brief 重置socket句柄上下文的容器大小
-     * @param[in] size 容量大小
+     * @brief 收割本线程 ring 的完成事件, 一批任务执行完时提交积攒的 SQE
+     * @details 线程一直有任务时不会进入 idle, IO 不能只靠 idle 推进
+     */
+    void onTaskDone(bool batch_end) override;
+
+    /**
+     * @brief 认领本线程的时间轮分片
      */
-    void contextResize(size_t size);
+    void onThreadStart() override;
 
     /**
      * @brief 判断是否可以停止
@@ -149,17 +236,90 @@ protected:
      */
     bool stopping(uint64_t &timeout);
 
+private:
+    /**
+     * @brief 调度线程的唤醒上下文
+     * @details 每个线程一个 eventfd 和一个私有的 epoll, 私有 epoll 中注册了 eventfd 和共享的 m_epfd.
+     *          同一时刻只有一个空闲线程(poller)在私有 epoll 上等待IO和定时器,
+     *          其它空闲线程只在自己的 eventfd 上等待, IO就绪不会惊醒所有线程.
+     *          sleeping/notified 用于合并唤醒: 线程没有睡眠或已经有人唤醒过它时不再写 eventfd.
+     *          启用 io_uring 时每个线程还有一个 ring, 完成事件通过同一个 eventfd 唤醒线程
+     */
+    struct TickleContext {
+        /// 认领的线程id, -1表示还未被线程认领
+        std::atomic<int> thread = {-1};
+        /// 唤醒用的 eventfd
+        int eventFd = -1;
+        /// 线程私有的 epoll
+        int epfd = -1;
+        /// 是否即将或正在睡眠
+        std::atomic<bool> sleeping = {false};
+        /// 睡眠期间是否已经被唤醒过
+        std::atomic<bool> notified = {false};
+        /// 线程的 io_uring, 未启用时为空
+        std::unique_ptr<IOUring> ring;
+        /// ring 中未完成的操作数
+        std::atomic<uint32_t> inflight = {0};
+    };
+
+    /**
+     * @brief 当前线程的唤醒上下文, 第一次调用时认领
+     */
+    TickleContext *getTickleContext();
+
+    /**
+     * @brief 唤醒指定线程, 线程未睡眠或已被唤醒时合并掉
+     * @return 是否写了 eventfd
+     */
+    bool wake(TickleContext *ctx);
+
+    /**
+     * @brief poller 离开后, 唤醒一个睡眠的线程来接替
+     */
+    void ensurePoller();
+
+    /**
+     * @brief 提交本线程 ring 中积攒的 SQE, 并收割完成事件
+     * @return 收割的完成事件数量
+     */
+    size_t submitAndReap(TickleContext *ctx);
+
+    /**
+     * @brief 收割本线程 ring 的完成事件, 唤醒等待的协程
+     */
+    size_t reapIo(TickleContext *ctx);
+
 private:
     /// epoll 文件句柄
     int m_epfd = 0;
-    /// pipe 文件句柄
-    int m_tickleFds[2];
+    /// 每个调度线程的唤醒上下文
+    std::vector<std::unique_ptr<TickleContext> > m_tickleContexts;
+    /// 下一个待认领的唤醒上下文下标
+    std::atomic<size_t> m_tickleCursor = {0};
+    /// 轮询唤醒的起始下标, 分散被唤醒的线程
+    std::atomic<size_t> m_wakeCursor = {0};
+    /// 当前 poller 的唤醒上下文下标, -1表示没有
+    std::atomic<int> m_poller = {-1};
+    /// 发出的唤醒次数
+    std::atomic<uint64_t> m_tickleSent = {0};
+    /// 合并掉的唤醒次数
+    std::atomic<uint64_t> m_tickleSuppressed = {0};
+    /// 是否启用持久注册模式
+    bool m_persistentEvents = false;
+    /// 是否启用 io_uring
+    bool m_uringEnabled = false;
+    /// epoll_ctl 次数
+    std::atomic<uint64_t> m_epollCtlCount = {0};
+    /// 空闲等待次数
+    std::atomic<uint64_t> m_waitCount = {0};
+    /// 读 eventfd 次数
+    std::atomic<uint64_t> m_eventFdReadCount = {0};
+    /// io_uring 完成的操作数
+    std::atomic<uint64_t> m_uringOpCount = {0};
     /// 当前等待执行的事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    /// IOManager的Mutex
-    RWMutexType m_mutex;
-    /// socket事件上下文的容器
-    std::vector<FdContext *> m_fdContexts;
+    /// socket事件上下文的容器, 无锁查找
+    FdTable<FdContext> m_fdContexts;
 };
 
 } // namespace base
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace base
+{
+
+/**
+ * @brief 有界无锁任务队列(单生产者,多消费者)
+ * @details 每个工作线程持有一个, 只有属主线程可以push,
+ *          属主线程和窃取线程都可以pop(通过CAS竞争head).
+ *          FIFO 顺序, 避免 YieldToReady 的协程反复插队饿死其它任务.
+ * @tparam T 元素类型(通常为指针)
+ * @tparam N 容量, 必须是2的幂
+ */
+template <class T, size_t N = 256>
+class RunQueue
+{
+    static_assert((N & (N - 1)) == 0, "RunQueue capacity must be power of 2");
+
+public:
+    RunQueue()
+    {
+        for (size_t i = 0; i < N; ++i) {
+            m_buffer[i].store(T(), std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 入队, 仅属主线程调用
+     * @return 队列满时返回false, 由调用方转入全局队列
+     */
+    bool push(T v)
+    {
+        uint32_t t = m_tail.load(std::memory_order_relaxed);
+        uint32_t h = m_head.load(std::memory_order_acquire);
+        if (t - h >= N) {
+            return false;
+        }
+        m_buffer[t & (N - 1)].store(v, std::memory_order_relaxed);
+        m_tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 出队, 任意线程可调用
+     * @param[out] v 出队的元素
+     * @return 队列为空返回false
+     */
+    bool pop(T &v)
+    {
+        uint32_t h = m_head.load(std::memory_order_acquire);
+        while (true) {
+            uint32_t t = m_tail.load(std::memory_order_acquire);
+            if (t == h) {
+                return false;
+            }
+            v = m_buffer[h & (N - 1)].load(std::memory_order_relaxed);
+            if (m_head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief 近似元素数量
+     */
+    size_t size() const
+    {
+        uint32_t h = m_head.load(std::memory_order_acquire);
+        uint32_t t = m_tail.load(std::memory_order_acquire);
+        return t - h;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    static constexpr size_t capacity() { return N; }
+
+private:
+    /// 消费端位置, 单独占用cache line避免与tail伪共享
+    alignas(64) std::atomic<uint32_t> m_head{0};
+    /// 生产端位置
+    alignas(64) std::atomic<uint32_t> m_tail{0};
+    /// 环形缓冲区
+    alignas(64) std::atomic<T> m_buffer[N];
+};
+
+} // namespace base
@@ -1,7 +1,17 @@
 #include "scheduler.h"
 #include "base/log/log.h"
 #include "base/macro.h"
+#include "base/coro/fiber_pool.h"
 #include "base/coro/hook.h"
+#include "base/conf/config.h"
+#include "base/util.h"
+#include <algorithm>
+#include <execinfo.h>
+#include <set>
+#include <sstream>
+#include <signal.h>
+#include <string.h>
+#include <vector>
 
 namespace base
 {
@@ -10,11 +20,378 @@ static base::Logger::ptr g_logger = _LOG_NAME("system");
 
 static thread_local Scheduler *t_scheduler = nullptr;
 static thread_local Fiber *t_scheduler_fiber = nullptr;
+/// 当前线程认领的Worker所属的调度器及下标(工作窃取模式)
+static thread_local Scheduler *t_worker_owner = nullptr;
+static thread_local size_t t_worker_index = 0;
+/// 工作窃取模式下本线程出队次数, 用于定期检查低优先级队列
+static thread_local uint32_t t_dequeue_rounds = 0;
+
+static ConfigVar<bool>::ptr g_scheduler_work_stealing =
+    Config::Lookup("scheduler.work_stealing", false,
+                   "scheduler use per-thread run queues with work stealing");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_batch_size =
+    Config::Lookup("scheduler.batch_size", (uint32_t)32,
+                   "max tasks a scheduler thread takes per queue lock");
+
+static ConfigVar<bool>::ptr g_scheduler_stats_enable =
+    Config::Lookup("scheduler.stats.enable", false,
+                   "scheduler collect queue wait/run slice histograms per thread");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_long_running_ms =
+    Config::Lookup("scheduler.stats.long_running_ms", (uint32_t)1000,
+                   "log the stack of a fiber running longer than this, 0 disables");
+
+static ConfigVar<bool>::ptr g_scheduler_long_running_stack =
+    Config::Lookup("scheduler.stats.long_running_stack", false,
+                   "capture the long running fiber stack with a SIGURG handler calling backtrace, "
+                   "which is not async-signal-safe");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_starvation_limit =
+    Config::Lookup("scheduler.priority.starvation_limit", (uint32_t)8,
+                   "serve the lowest waiting priority lane first every N global pops, 0 disables");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_preempt_slice_ms =
+    Config::Lookup("scheduler.preempt.slice_ms", (uint32_t)0,
+                   "ask a fiber running longer than this to yield at its next safe point, 0 disables");
+
+/// 看门狗请求调度线程回溯调用栈的信号
+static const int kStackSignal = SIGURG;
+
+/// 所有存活的调度器
+static Mutex &GetSchedulersMutex()
+{
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+static std::set<Scheduler *> &GetSchedulers()
+{
+    static std::set<Scheduler *> s_schedulers;
+    return s_schedulers;
+}
+
+/// 当前调度线程的统计
+static thread_local SchedulerThreadStats *t_thread_stats = nullptr;
+/// 当前调度线程正在执行的任务片段的抢占状态, 不在任务片段中时为 nullptr
+static thread_local SchedulerPreemptSlot *t_preempt_slot = nullptr;
+
+/// 安装 kStackSignal 处理函数之前的处理方式
+static struct sigaction s_prev_stack_action;
+
+/**
+ * @brief 在被检测的调度线程上回溯调用栈
+ * @details 只处理本进程看门狗用 tgkill 发出且本线程确实被请求了的信号, 其它的交给之前的处理函数.
+ *          backtrace 不是异步信号安全的, libgcc 在安装时预先加载, 通常不会再分配内存,
+ *          所以只在配置 scheduler.stats.long_running_stack=true 时才安装
+ */
+static void OnStackSignal(int sig, siginfo_t *info, void *uctx)
+{
+    int saved_errno = errno;
+    SchedulerThreadStats *stats = t_thread_stats;
+    if (info && info->si_code == SI_TKILL && info->si_pid == getpid() && stats
+        && stats->framesRequested.exchange(false, std::memory_order_acq_rel)) {
+        stats->frameSeq = stats->sliceSeq.load(std::memory_order_relaxed);
+        stats->depth = backtrace(stats->frames, SchedulerThreadStats::kMaxFrames);
+        stats->framesReady.store(true, std::memory_order_release);
+        errno = saved_errno;
+        return;
+    }
+    errno = saved_errno;
+    if (s_prev_stack_action.sa_flags & SA_SIGINFO) {
+        if (s_prev_stack_action.sa_sigaction) {
+            s_prev_stack_action.sa_sigaction(sig, info, uctx);
+        }
+    } else if (s_prev_stack_action.sa_handler != SIG_DFL
+               && s_prev_stack_action.sa_handler != SIG_IGN) {
+        s_prev_stack_action.sa_handler(sig);
+    }
+}
+
+/**
+ * @brief 安装回溯调用栈的信号处理函数, 整个进程只安装一次
+ * @return 是否安装成功
+ */
+static bool InstallStackSignal()
+{
+    static bool s_installed = []() {
+        void *dummy[1];
+        backtrace(dummy, 1);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = &OnStackSignal;
+        sa.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(kStackSignal, &sa, &s_prev_stack_action)) {
+            _LOG_ERROR(g_logger) << "sigaction signal=" << kStackSignal << " errno=" << errno
+                                 << " " << strerror(errno);
+            return false;
+        }
+        return true;
+    }();
+    return s_installed;
+}
+
+/// 每次取任务的上限, 也是本地批次数组的长度
+static const size_t kMaxBatchSize = 256;
+/// 每个线程缓存的空闲任务节点上限, 超过后把一半转交给全局中转站
+static const size_t kMaxCachedTasks = 4096;
+/// 线程缓存与中转站之间每次转移的节点数
+static const size_t kTransferTasks = kMaxCachedTasks / 2;
+/// 中转站最多保存的节点链数, 超过后直接释放
+static const size_t kMaxDepotChains = 64;
+
+/**
+ * @brief 空闲任务节点的全局中转站
+ * @details 生产者/消费者分离的场景下节点总在一个线程分配, 在另一个线程释放,
+ *          只靠线程缓存的话生产者每次都要 new. 释放方缓存满时把一整条链交给中转站,
+ *          分配方缓存空时从中转站取一整条链, 一次加锁转移 kTransferTasks 个节点
+ */
+struct TaskDepot {
+    typedef Spinlock MutexType;
+
+    MutexType mutex;
+    std::vector<Task *> chains;
+
+    ~TaskDepot()
+    {
+        for (Task *head : chains) {
+            while (head) {
+                Task *t = head;
+                head = t->next;
+                delete t;
+            }
+        }
+    }
+};
+
+static TaskDepot s_task_depot;
+
+/**
+ * @brief 线程级的空闲任务节点缓存
+ */
+struct TaskCache {
+    Task *head = nullptr;
+    size_t size = 0;
+    bool destroyed = false;
+
+    ~TaskCache()
+    {
+        while (head) {
+            Task *t = head;
+            head = t->next;
+            delete t;
+        }
+        size = 0;
+        destroyed = true;
+    }
+};
+
+static thread_local TaskCache t_task_cache;
+
+/**
+ * @brief 调度线程当前正在执行的一批任务
+ */
+struct TaskBatch {
+    Task *tasks[kMaxBatchSize];
+    size_t size = 0;
+    size_t pos = 0;
+    /// 正在执行回调任务的协程, 只有它可以继续消费本批次后面的回调任务
+    Fiber *cbFiber = nullptr;
+    /// 本线程的统计, 未开启时为 nullptr
+    SchedulerThreadStats *stats = nullptr;
+    /// 本线程的抢占状态, 未开启时为 nullptr
+    SchedulerPreemptSlot *preempt = nullptr;
+    /// 批次所属的调度器
+    Scheduler *scheduler = nullptr;
+};
+
+static thread_local TaskBatch *t_task_batch = nullptr;
+
+/**
+ * @brief 读取当前线程的批次
+ * @details 回调可能切出并在其它线程恢复, 不能让编译器把线程局部变量的地址缓存在调用之间
+ */
+static __attribute__((noinline)) TaskBatch *CurrentTaskBatch()
+{
+    return t_task_batch;
+}
+
+Scheduler::Worker::~Worker()
+{
+    Task *task = nullptr;
+    while (local.pop(task)) {
+        delete task;
+    }
+    while ((task = inbox.pop())) {
+        delete task;
+    }
+}
+
+Task *Scheduler::NewTask()
+{
+    TaskCache &cache = t_task_cache;
+    if (!cache.head && !cache.destroyed) {
+        TaskDepot::MutexType::Lock lock(s_task_depot.mutex);
+        if (!s_task_depot.chains.empty()) {
+            cache.head = s_task_depot.chains.back();
+            cache.size = kTransferTasks;
+            s_task_depot.chains.pop_back();
+        }
+    }
+    Task *t = cache.head;
+    if (t) {
+        cache.head = t->next;
+        --cache.size;
+        t->next = nullptr;
+        return t;
+    }
+    return new Task;
+}
+
+void Scheduler::FreeTask(Task *task)
+{
+    task->reset();
+    TaskCache &cache = t_task_cache;
+    if (cache.destroyed) {
+        delete task;
+        return;
+    }
+    task->next = cache.head;
+    cache.head = task;
+    if (++cache.size < kMaxCachedTasks) {
+        return;
+    }
+
+    // 缓存满了, 把前 kTransferTasks 个节点断开交给中转站
+    Task *chain = cache.head;
+    Task *last = chain;
+    for (size_t i = 1; i < kTransferTasks; ++i) {
+        last = last->next;
+    }
+    cache.head = last->next;
+    cache.size -= kTransferTasks;
+    last->next = nullptr;
+    {
+        TaskDepot::MutexType::Lock lock(s_task_depot.mutex);
+        if (s_task_depot.chains.size() < kMaxDepotChains) {
+            s_task_depot.chains.push_back(chain);
+            chain = nullptr;
+        }
+    }
+    while (chain) {
+        Task *t = chain;
+        chain = t->next;
+        delete t;
+    }
+}
+
+void Scheduler::RunCallback(Task *task)
+{
+    TaskBatch *batch = CurrentTaskBatch();
+    Fiber *self = batch ? batch->cbFiber : nullptr;
+    while (task) {
+        {
+            // 回调抛出异常时也要归还节点
+            // 回调执行期间使用任务继承的局部存储, 结束后清空, 不带给同一协程的下一个任务
+            FiberLocalStorage *locals = FiberLocalStorage::Current();
+            locals->moveFrom(task->locals);
+            struct Guard {
+                Task *task;
+                FiberLocalStorage *locals;
+                ~Guard()
+                {
+                    locals->clear();
+                    FreeTask(task);
+                }
+            } guard{task, locals};
+            task->cb();
+        }
+        task = nullptr;
+
+        // 回调没有切出过(当前线程还在执行本协程)时, 直接在本协程里继续执行批次中
+        // 后面的回调任务, 省掉切回调度协程再重置切入的开销
+        batch = CurrentTaskBatch();
+        if (self && batch && batch->cbFiber == self && batch->pos < batch->size
+            && !batch->tasks[batch->pos]->fiber) {
+            task = batch->tasks[batch->pos++];
+            self->setPriority((Fiber::Priority)task->priority);
+            self->setDeadline(task->deadlineUs);
+            // 每个回调任务单独算一个运行片段, 和调度协程切入任务时的记账一致
+            SchedulerThreadStats *stats = batch->stats;
+            SchedulerPreemptSlot *preempt = batch->preempt;
+            uint64_t now = 0;
+            if (stats || preempt) {
+                now = GetCurrentUS();
+            }
+            if (stats) {
+                stats->endSlice(now);
+            }
+            if (preempt) {
+                preempt->endSlice();
+            }
+            batch->scheduler->recordTaskStart(task, stats, now);
+            if (stats) {
+                stats->beginSlice(stats->fiberId.load(std::memory_order_relaxed), now);
+            }
+            if (preempt) {
+                preempt->beginSlice(now);
+            }
+        }
+    }
+}
+
+void Scheduler::recordTaskStart(Task *task, SchedulerThreadStats *stats, uint64_t now)
+{
+    if (stats) {
+        if (task->enqueueUs) {
+            stats->queueWait.record(now - task->enqueueUs);
+        }
+        LatencyHistogram::Add(stats->tasks, 1);
+    }
+    if (task->deadlineUs && (now ? now : GetCurrentUS()) > task->deadlineUs) {
+        ++m_deadlineMissed[task->priority];
+    }
+}
+
+void Scheduler::StampTask(Task *task)
+{
+    task->enqueueUs = GetCurrentUS();
+}
+
+void Scheduler::SetTaskPriority(Task *task, Fiber::Priority prio, uint64_t deadline_ms)
+{
+    _ASSERT(prio >= 0 && prio < Fiber::kPriorityCount);
+    task->priority = prio;
+    task->deadlineUs = deadline_ms ? GetCurrentUS() + deadline_ms * 1000 : 0;
+    if (task->fiber) {
+        task->fiber->setPriority(prio);
+        task->fiber->setDeadline(task->deadlineUs);
+    }
+}
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name, bool hook_enable) : m_name(name), m_hook_enable(hook_enable)
 {
     _ASSERT(threads > 0);
 
+    static std::atomic<uint64_t> s_scheduler_id = {0};
+    m_id = ++s_scheduler_id;
+    m_workStealing = g_scheduler_work_stealing->getValue();
+    m_sharedStack = Fiber::SharedStackEnabled();
+    m_batchSize = std::max<size_t>(1, std::min<size_t>(g_scheduler_batch_size->getValue(),
+                                                       kMaxBatchSize));
+    m_statsEnabled = g_scheduler_stats_enable->getValue();
+    m_longRunningMs = m_statsEnabled ? g_scheduler_long_running_ms->getValue() : 0;
+    m_starvationLimit = g_scheduler_starvation_limit->getValue();
+    m_preemptSliceMs = g_scheduler_preempt_slice_ms->getValue();
+    if (m_workStealing) {
+        m_workers.resize(threads);
+        for (auto &i : m_workers) {
+            i.reset(new Worker);
+        }
+    }
+
     if (use_caller) {
         base::Fiber::GetThis();
         --threads;
@@ -33,11 +410,18 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name, b
         m_rootThread = -1;
     }
     m_threadCount = threads;
+
+    Mutex::Lock lock(GetSchedulersMutex());
+    GetSchedulers().insert(this);
 }
 
 Scheduler::~Scheduler()
 {
     _ASSERT(m_stopping);
+    {
+        Mutex::Lock lock(GetSchedulersMutex());
+        GetSchedulers().erase(this);
+    }
     if (GetThis() == this) {
         t_scheduler = nullptr;
     }
@@ -68,8 +452,20 @@ void Scheduler::start()
                                                 m_name + "_" + std::to_string(i));
         m_threadIds.push_back(m_threads[i]->getId());
     }
+    if ((m_longRunningMs || m_preemptSliceMs) && !m_watchdog) {
+        if (m_longRunningMs && g_scheduler_long_running_stack->getValue()) {
+            m_longRunningStack = InstallStackSignal();
+        }
+        m_watchdogStop = false;
+        m_watchdog = std::make_shared<Thread>(std::bind(&Scheduler::watchdog, this),
+                                              m_name + "_watchdog");
+    }
     lock.unlock();
 
+    if (!m_placement.empty()) {
+        applyPlacement();
+    }
+
     // if(m_rootFiber) {
     //     //m_rootFiber->swapIn();
     //     m_rootFiber->call();
@@ -132,6 +528,12 @@ void Scheduler::stop()
     }
     // if(exit_on_this_fiber) {
     // }
+
+    if (m_watchdog) {
+        m_watchdogStop = true;
+        m_watchdog->join();
+        m_watchdog.reset();
+    }
 }
 
 void Scheduler::setThis()
@@ -147,68 +549,148 @@ void Scheduler::run()
     if (base::GetThreadId() != m_rootThread) {
         t_scheduler_fiber = Fiber::GetThis().get();
     }
+    if (m_workStealing) {
+        t_worker_index = m_workerCursor++;
+        _ASSERT(t_worker_index < m_workers.size());
+        t_worker_owner = this;
+        m_workers[t_worker_index]->thread = base::GetThreadId();
+    }
+    onThreadStart();
 
     Fiber::ptr idle_fiber(NewFiber(std::bind(&Scheduler::idle, this)), FreeFiber);
     // Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
 
-    FiberAndThread ft;
+    // 一次加锁取出的任务, 在本线程依次执行完再取下一批
+    TaskBatch batch;
+    t_task_batch = &batch;
+    SchedulerThreadStats *stats = nullptr;
+    if (m_statsEnabled) {
+        stats = new SchedulerThreadStats(base::GetThreadId());
+        Spinlock::Lock lock(m_statsMutex);
+        m_threadStats.emplace_back(stats);
+    }
+    batch.stats = stats;
+    t_thread_stats = stats;
+    SchedulerPreemptSlot *preempt = nullptr;
+    if (m_preemptSliceMs) {
+        preempt = new SchedulerPreemptSlot(base::GetThreadId());
+        Spinlock::Lock lock(m_statsMutex);
+        m_preemptSlots.emplace_back(preempt);
+    }
+    batch.preempt = preempt;
+    batch.scheduler = this;
     while (true) {
-        ft.reset();
-        bool tickle_me = false;
-        bool is_active = false;
-        {
-            RWMutexType::WriteLock lock(m_mutex);
-            auto it = m_fibers.begin();
-            while (it != m_fibers.end()) {
-                if (it->thread != -1 && it->thread != base::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;
-                    continue;
+        if (batch.pos == batch.size) {
+            batch.pos = batch.size = 0;
+            bool tickle_me = false;
+            if (m_workStealing) {
+                ++m_activeThreadCount;
+                batch.size = dequeueTasks(batch.tasks, m_batchSize, tickle_me);
+                if (!batch.size) {
+                    --m_activeThreadCount;
+                }
+            } else {
+                RWMutexType::WriteLock lock(m_mutex);
+                batch.size = popGlobalNoLock(batch.tasks, m_batchSize, tickle_me);
+                if (batch.size) {
+                    ++m_activeThreadCount;
                 }
+                tickle_me |= !lanesEmptyNoLock();
+            }
 
-                _ASSERT(it->fiber || it->cb);
-                if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
+            if (tickle_me) {
+                tickle();
+            }
+
+            if (!batch.size) {
+                if (idle_fiber->getState() == Fiber::TERM) {
+                    _LOG_INFO(g_logger) << "idle fiber term";
+                    break;
                 }
 
-                ft = *it;
-                m_fibers.erase(it++);
-                ++m_activeThreadCount;
-                is_active = true;
-                break;
+                ++m_idleThreadCount;
+                if (stats) {
+                    LatencyHistogram::Add(stats->idleSwitches, 1);
+                }
+                idle_fiber->swapIn();
+                --m_idleThreadCount;
+                if (idle_fiber->getState() != Fiber::TERM
+                    && idle_fiber->getState() != Fiber::EXCEPT) {
+                    idle_fiber->m_state = Fiber::HOLD;
+                }
+                continue;
             }
-            // tickle_me |= it != m_fibers.end();
-            tickle_me |= !m_fibers.empty();
         }
 
-        if (tickle_me) {
-            tickle();
+        Task *task = batch.tasks[batch.pos++];
+        uint64_t now = 0;
+        if (stats || preempt) {
+            now = GetCurrentUS();
         }
-
-        if (ft.fiber
-            && (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT)) {
-            ft.fiber->swapIn();
-            --m_activeThreadCount;
-
-            if (ft.fiber->getState() == Fiber::READY) {
-                schedule(ft.fiber);
-            } else if (ft.fiber->getState() != Fiber::TERM
-                       && ft.fiber->getState() != Fiber::EXCEPT) {
-                ft.fiber->m_state = Fiber::HOLD;
+        recordTaskStart(task, stats, now);
+        if (task->fiber) {
+            Fiber::ptr fiber;
+            fiber.swap(task->fiber);
+            FreeTask(task);
+            if (fiber->getState() != Fiber::TERM && fiber->getState() != Fiber::EXCEPT) {
+                if (stats) {
+                    LatencyHistogram::Add(stats->switches, 1);
+                    stats->beginSlice(fiber->getId(), now);
+                }
+                if (preempt) {
+                    preempt->beginSlice(now);
+                    t_preempt_slot = preempt;
+                }
+                fiber->swapIn();
+                if (preempt) {
+                    t_preempt_slot = nullptr;
+                    preempt->endSlice();
+                }
+                if (stats) {
+                    stats->endSlice(GetCurrentUS());
+                }
+                if (fiber->getState() == Fiber::READY) {
+                    schedule(std::move(fiber));
+                } else if (fiber->getState() != Fiber::TERM
+                           && fiber->getState() != Fiber::EXCEPT) {
+                    fiber->m_state = Fiber::HOLD;
+                }
             }
-            ft.reset();
-        } else if (ft.cb) {
+        } else {
+            // 只捕获任务指针, std::function 不会分配内存, 节点由 RunCallback 归还
+            Fiber::Priority prio = (Fiber::Priority)task->priority;
+            uint64_t deadline = task->deadlineUs;
+            std::function<void()> cb = [task]() { RunCallback(task); };
             if (cb_fiber) {
-                cb_fiber->reset(ft.cb);
+                cb_fiber->reset(std::move(cb));
             } else {
-                cb_fiber.reset(NewFiber(ft.cb), FreeFiber);
-                // cb_fiber.reset(new Fiber(ft.cb));
+                cb_fiber.reset(m_sharedStack ? NewSharedStackFiber(std::move(cb))
+                                             : NewFiber(std::move(cb)),
+                               FreeFiber);
+                // cb_fiber.reset(new Fiber(cb));
+            }
+            // 回调切出后重新调度时沿用任务的优先级
+            cb_fiber->setPriority(prio);
+            cb_fiber->setDeadline(deadline);
+            batch.cbFiber = cb_fiber.get();
+            if (stats) {
+                LatencyHistogram::Add(stats->switches, 1);
+                stats->beginSlice(cb_fiber->getId(), now);
+            }
+            if (preempt) {
+                preempt->beginSlice(now);
+                t_preempt_slot = preempt;
             }
-            ft.reset();
             cb_fiber->swapIn();
-            --m_activeThreadCount;
+            if (preempt) {
+                t_preempt_slot = nullptr;
+                preempt->endSlice();
+            }
+            if (stats) {
+                stats->endSlice(GetCurrentUS());
+            }
+            batch.cbFiber = nullptr;
             if (cb_fiber->getState() == Fiber::READY) {
                 schedule(cb_fiber);
                 cb_fiber.reset();
@@ -219,35 +701,229 @@ void Scheduler::run()
                 cb_fiber->m_state = Fiber::HOLD;
                 cb_fiber.reset();
             }
-        } else {
-            if (is_active) {
-                --m_activeThreadCount;
-                continue;
+        }
+
+        onTaskDone(batch.pos == batch.size);
+        if (batch.pos == batch.size) {
+            --m_activeThreadCount;
+        }
+    }
+    t_task_batch = nullptr;
+    t_thread_stats = nullptr;
+}
+
+size_t Scheduler::popGlobalNoLock(Task **tasks, size_t max, bool &tickle_me)
+{
+    // 高优先级持续有任务时, 定期先取一次等待中的最低优先级
+    int first = 0;
+    if (m_starvationLimit && ++m_laneRounds >= m_starvationLimit) {
+        m_laneRounds = 0;
+        for (int i = Fiber::kPriorityCount - 1; i > 0; --i) {
+            if (!m_tasks[i].empty()) {
+                first = i;
+                break;
+            }
+        }
+    }
+
+    size_t threads = m_threadIds.empty() ? 1 : m_threadIds.size();
+    size_t count = 0;
+    for (int n = 0; n < Fiber::kPriorityCount && count < max; ++n) {
+        int lane = n == 0 ? first : (n <= first ? n - 1 : n);
+        TaskLane &queue = m_tasks[lane];
+        size_t limit =
+            count + std::min(max - count, std::max<size_t>(1, queue.size() / threads));
+        size_t begin = count;
+
+        // 指定了其它线程或者还在其它线程上运行的任务留在队列中
+        auto runnable = [&tickle_me](Task *t) {
+            if (t->thread != -1 && t->thread != base::GetThreadId()) {
+                tickle_me = true;
+                return false;
             }
-            if (idle_fiber->getState() == Fiber::TERM) {
-                _LOG_INFO(g_logger) << "idle fiber term";
+            _ASSERT(!t->empty());
+            return !(t->fiber && t->fiber->getState() == Fiber::EXEC);
+        };
+
+        // 先按截止时间先后取有截止时间的任务: 不限线程的和指定本线程的两个集合归并,
+        // 指定其它线程的任务不参与扫描
+        TaskDeadlineSet &deadlines = queue.deadlines();
+        TaskDeadlineSet *own =
+            queue.boundSize() ? queue.boundDeadlines(base::GetThreadId()) : nullptr;
+        size_t own_size = own ? own->size() : 0;
+        auto dit = deadlines.begin();
+        while (count < limit) {
+            if (own && !own->empty()
+                && (dit == deadlines.end() || own->begin()->deadlineUs <= dit->deadlineUs)) {
+                if (runnable(&*own->begin())) {
+                    tasks[count++] = queue.popBound(*own);
+                    --own_size;
+                    continue;
+                }
+                own = nullptr;
+            }
+            if (dit == deadlines.end()) {
                 break;
             }
+            if (runnable(&*dit)) {
+                tasks[count++] = &*dit;
+                dit = deadlines.erase(dit);
+            } else {
+                ++dit;
+            }
+        }
+        if (queue.boundSize() > own_size) {
+            // 还有指定其它线程的任务
+            tickle_me = true;
+        }
 
-            ++m_idleThreadCount;
-            idle_fiber->swapIn();
-            --m_idleThreadCount;
-            if (idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT) {
-                idle_fiber->m_state = Fiber::HOLD;
+        TaskQueue &fifo = queue.fifo();
+        Task *prev = nullptr;
+        Task *it = fifo.front();
+        while (it && count < limit) {
+            if (!runnable(it)) {
+                prev = it;
+                it = it->next;
+                continue;
             }
+            Task *next = it->next;
+            tasks[count++] = fifo.remove(prev);
+            it = next;
+        }
+        m_laneSize[lane] -= count - begin;
+    }
+    return count;
+}
+
+Scheduler::Worker *Scheduler::findWorker(int thread)
+{
+    for (auto &i : m_workers) {
+        if (i->thread == thread) {
+            return i.get();
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::enqueueTask(Task *task)
+{
+    if (!task->isPlain()) {
+        // 带优先级/截止时间的任务统一进入全局分级队列, 由所有线程按优先级取用
+        RWMutexType::WriteLock lock(m_mutex);
+        return scheduleNoLock(task);
+    }
+    if (task->thread != -1) {
+        // 指定线程的任务直接投递到目标线程的inbox, 避免全局队列的线性扫描
+        Worker *w = findWorker(task->thread);
+        if (w) {
+            Worker::MutexType::Lock lock(w->mutex);
+            w->inbox.push(task);
+            ++w->inboxSize;
+            ++m_queuedTaskCount;
+            return true;
+        }
+    } else if (t_worker_owner == this) {
+        Worker &self = *m_workers[t_worker_index];
+        // 本地队列由空变为非空时才唤醒空闲线程来窃取
+        bool was_empty = self.local.empty();
+        if (self.local.push(task)) {
+            ++m_queuedTaskCount;
+            return was_empty && hasIdleThreads();
+        }
+        // 本地队列已满, 转入全局队列
+    }
+
+    RWMutexType::WriteLock lock(m_mutex);
+    bool need_tickle = lanesEmptyNoLock();
+    pushLaneNoLock(task);
+    return need_tickle;
+}
+
+size_t Scheduler::dequeueTasks(Task **tasks, size_t max, bool &tickle_me)
+{
+    _ASSERT(t_worker_owner == this);
+    Worker &self = *m_workers[t_worker_index];
+    size_t count = 0;
+
+    // 全局队列中有 REALTIME 任务, 或者低优先级等待了 m_starvationLimit 轮, 先于本地任务处理
+    bool global_first = m_laneSize[Fiber::REALTIME] > 0;
+    if (m_starvationLimit && ++t_dequeue_rounds >= m_starvationLimit) {
+        t_dequeue_rounds = 0;
+        global_first |= m_laneSize[Fiber::BACKGROUND] > 0 || m_laneSize[Fiber::NORMAL] > 0;
+    }
+    if (global_first) {
+        RWMutexType::WriteLock lock(m_mutex);
+        count = popGlobalNoLock(tasks, max, tickle_me);
+        tickle_me |= !lanesEmptyNoLock();
+    }
+
+    if (!count && self.inboxSize > 0) {
+        Worker::MutexType::Lock lock(self.mutex);
+        while (count < max && !self.inbox.empty()) {
+            tasks[count++] = self.inbox.pop();
+        }
+        self.inboxSize -= count;
+        m_queuedTaskCount -= count;
+    }
+
+    // 本地队列每次只取一个, 剩下的留给其它线程窃取
+    Task *task = nullptr;
+    if (!count && self.local.pop(task)) {
+        tasks[count++] = task;
+        --m_queuedTaskCount;
+    }
+
+    if (!count) {
+        RWMutexType::WriteLock lock(m_mutex);
+        if (!lanesEmptyNoLock()) {
+            count = popGlobalNoLock(tasks, max, tickle_me);
+            tickle_me |= !lanesEmptyNoLock();
         }
     }
+
+    // 从下一个线程开始轮询窃取, 分散窃取者
+    for (size_t i = 1; !count && i < m_workers.size(); ++i) {
+        Worker &victim = *m_workers[(t_worker_index + i) % m_workers.size()];
+        if (victim.local.pop(task)) {
+            tasks[count++] = task;
+            --m_queuedTaskCount;
+        }
+    }
+
+    // 协程还未从其它线程切出, 放回全局队列稍后再试
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (tasks[i]->fiber && tasks[i]->fiber->getState() == Fiber::EXEC) {
+            RWMutexType::WriteLock lock(m_mutex);
+            pushLaneNoLock(tasks[i]);
+            tickle_me = true;
+        } else {
+            tasks[n++] = tasks[i];
+        }
+    }
+    tickle_me |= m_queuedTaskCount > 0;
+    return n;
+}
+
+void Scheduler::tickle(int thread)
+{
+    _LOG_INFO(g_logger) << "tickle thread=" << thread;
 }
 
-void Scheduler::tickle()
+bool Scheduler::hasPendingTask()
 {
-    _LOG_INFO(g_logger) << "tickle";
+    if (m_queuedTaskCount > 0) {
+        return true;
+    }
+    RWMutexType::ReadLock lock(m_mutex);
+    return !lanesEmptyNoLock();
 }
 
 bool Scheduler::stopping()
 {
     RWMutexType::ReadLock lock(m_mutex);
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_autoStop && m_stopping && lanesEmptyNoLock() && m_activeThreadCount == 0
+           && m_queuedTaskCount == 0;
 }
 
 void Scheduler::idle()
@@ -274,17 +950,286 @@ std::ostream &Scheduler::dump(std::ostream &os)
 {
     os << "[Scheduler name=" << m_name << " size=" << m_threadCount
        << " active_count=" << m_activeThreadCount << " idle_count=" << m_idleThreadCount
-       << " stopping=" << m_stopping << " ]" << std::endl
-       << "    ";
+       << " stopping=" << m_stopping << " work_stealing=" << m_workStealing
+       << " batch_size=" << m_batchSize;
+    if (!m_placement.cpus.empty()) {
+        os << " cpus=" << base::Join(m_placement.cpus.begin(), m_placement.cpus.end(), ",")
+           << " pin_per_thread=" << m_placement.pinPerThread;
+    }
+    if (m_placement.memNode >= 0) {
+        os << " mem_node=" << m_placement.memNode;
+    }
+    os << " ]" << std::endl << "    ";
     for (size_t i = 0; i < m_threadIds.size(); ++i) {
         if (i) {
             os << ", ";
         }
         os << m_threadIds[i];
     }
+    os << std::endl << "    lanes=";
+    for (int i = 0; i < Fiber::kPriorityCount; ++i) {
+        os << " [" << Fiber::PriorityToString((Fiber::Priority)i) << " depth=" << m_laneSize[i]
+           << " deadline_missed=" << m_deadlineMissed[i] << "]";
+    }
+    if (m_workStealing) {
+        os << std::endl << "    queued=" << m_queuedTaskCount;
+        for (auto &i : m_workers) {
+            os << " [thread=" << i->thread << " local=" << i->local.size()
+               << " inbox=" << i->inboxSize << "]";
+        }
+    }
     return os;
 }
 
+void Scheduler::getThreadStats(std::vector<SchedulerThreadStats::Snapshot> &stats)
+{
+    Spinlock::Lock lock(m_statsMutex);
+    for (auto &i : m_threadStats) {
+        stats.push_back(i->snapshot());
+    }
+}
+
+void Scheduler::setPlacement(const Placement &v)
+{
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_placement = v;
+    }
+    applyPlacement();
+}
+
+void Scheduler::applyPlacement()
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    Placement placement = m_placement;
+    std::vector<Thread::ptr> threads = m_threads;
+    lock.unlock();
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        std::vector<int> cpus = placement.cpus;
+        if (placement.pinPerThread && !cpus.empty()) {
+            cpus = {placement.cpus[i % placement.cpus.size()]};
+        }
+        threads[i]->setAffinity(cpus);
+        // 内存策略只能由线程自己设置, 之前缓存的栈可能在其它节点上, 一并释放
+        int node = placement.memNode;
+        schedule(
+            [node]() {
+                if (Thread::GetMemoryNode() != node && Thread::SetMemoryNode(node)) {
+                    FiberStackPool::ReleaseThreadCache();
+                }
+            },
+            threads[i]->getId());
+    }
+    _LOG_INFO(g_logger) << "scheduler name=" << m_name << " placement cpus=["
+                        << base::Join(placement.cpus.begin(), placement.cpus.end(), ",")
+                        << "] pin_per_thread=" << placement.pinPerThread
+                        << " mem_node=" << placement.memNode;
+}
+
+size_t Scheduler::getQueueDepth(Fiber::Priority prio) const
+{
+    size_t depth = m_laneSize[prio];
+    if (prio == Fiber::NORMAL) {
+        depth += m_queuedTaskCount;
+    }
+    return depth;
+}
+
+void Scheduler::getLaneStats(LaneStats (&stats)[Fiber::kPriorityCount])
+{
+    RWMutexType::ReadLock lock(m_mutex);
+    for (int i = 0; i < Fiber::kPriorityCount; ++i) {
+        stats[i].depth = getQueueDepth((Fiber::Priority)i);
+        stats[i].maxDepth = m_laneMaxDepth[i];
+        stats[i].deadlineMissed = m_deadlineMissed[i];
+    }
+}
+
+static std::ostream &DumpLatency(std::ostream &os, const char *name,
+                                 const LatencyHistogram::Snapshot &h)
+{
+    os << " " << name << "[count=" << h.count << " avg=" << (h.count ? h.sum / h.count : 0)
+       << "us";
+    for (double q : {0.5, 0.99, 0.999}) {
+        uint64_t v = h.percentile(q);
+        os << " p" << q * 100 << "<=";
+        if (v == UINT64_MAX) {
+            os << "inf";
+        } else {
+            os << v << "us";
+        }
+    }
+    return os << "]";
+}
+
+std::ostream &Scheduler::dumpStats(std::ostream &os)
+{
+    std::vector<SchedulerThreadStats::Snapshot> stats;
+    getThreadStats(stats);
+    PreemptStats preempt = getPreemptStats();
+    os << "[SchedulerStats name=" << m_name << " enabled=" << m_statsEnabled
+       << " long_running_ms=" << m_longRunningMs << " preempt_slice_ms=" << preempt.sliceMs
+       << " preempt_requests=" << preempt.requests << " forced_yields=" << preempt.forcedYields
+       << "]";
+    SchedulerThreadStats::Snapshot total;
+    for (auto &i : stats) {
+        os << std::endl
+           << "    thread=" << i.thread << " tasks=" << i.tasks << " switches=" << i.switches
+           << " idle_switches=" << i.idleSwitches << " long_running=" << i.longRunning;
+        DumpLatency(os, "queue_wait", i.queueWait);
+        DumpLatency(os, "run_slice", i.runSlice);
+        total.tasks += i.tasks;
+        total.switches += i.switches;
+        total.idleSwitches += i.idleSwitches;
+        total.longRunning += i.longRunning;
+        total.queueWait.merge(i.queueWait);
+        total.runSlice.merge(i.runSlice);
+    }
+    if (stats.size() > 1) {
+        os << std::endl
+           << "    total tasks=" << total.tasks << " switches=" << total.switches
+           << " idle_switches=" << total.idleSwitches << " long_running=" << total.longRunning;
+        DumpLatency(os, "queue_wait", total.queueWait);
+        DumpLatency(os, "run_slice", total.runSlice);
+    }
+    return os;
+}
+
+void Scheduler::Visit(std::function<void(Scheduler *)> cb)
+{
+    Mutex::Lock lock(GetSchedulersMutex());
+    for (auto i : GetSchedulers()) {
+        cb(i);
+    }
+}
+
+void Scheduler::watchdog()
+{
+    // 检测周期取阈值的一半, 被检测到的片段实际运行时长在 [阈值, 1.5倍阈值] 之间
+    uint64_t threshold_ms = m_longRunningMs;
+    if (m_preemptSliceMs && (!threshold_ms || m_preemptSliceMs < threshold_ms)) {
+        threshold_ms = m_preemptSliceMs;
+    }
+    uint64_t interval_us = std::max<uint64_t>(1000, threshold_ms * 1000ull / 2);
+    std::vector<uint64_t> reported;
+    uint64_t next_check = GetCurrentUS() + interval_us;
+    while (!m_watchdogStop) {
+        // 分段睡眠, 调度器停止时尽快退出
+        uint64_t now = GetCurrentUS();
+        if (now < next_check) {
+            usleep(std::min<uint64_t>(next_check - now, 10 * 1000));
+            continue;
+        }
+        next_check = now + interval_us;
+
+        std::vector<SchedulerThreadStats *> stats;
+        std::vector<SchedulerPreemptSlot *> slots;
+        {
+            Spinlock::Lock lock(m_statsMutex);
+            for (auto &i : m_threadStats) {
+                stats.push_back(i.get());
+            }
+            for (auto &i : m_preemptSlots) {
+                slots.push_back(i.get());
+            }
+        }
+        for (auto i : slots) {
+            checkPreempt(*i, now);
+        }
+        if (m_longRunningMs) {
+            reported.resize(stats.size(), 0);
+            for (size_t i = 0; i < stats.size(); ++i) {
+                checkLongRunning(*stats[i], now, reported[i]);
+            }
+        }
+    }
+}
+
+void Scheduler::checkLongRunning(SchedulerThreadStats &stats, uint64_t now, uint64_t &reported)
+{
+    uint64_t start = stats.sliceStart.load(std::memory_order_acquire);
+    uint64_t seq = stats.sliceSeq.load(std::memory_order_relaxed);
+    if (!start || now < start || now - start < m_longRunningMs * 1000ull || seq == reported) {
+        return;
+    }
+    reported = seq;
+    stats.longRunning.fetch_add(1, std::memory_order_relaxed);
+    uint64_t fiber_id = stats.fiberId.load(std::memory_order_relaxed);
+
+    // 让目标线程在信号处理函数中回溯自己的调用栈, 最多等待10ms
+    bool captured = false;
+    if (m_longRunningStack) {
+        stats.framesReady.store(false, std::memory_order_release);
+        stats.framesRequested.store(true, std::memory_order_release);
+        if (syscall(SYS_tgkill, getpid(), stats.thread, kStackSignal) == 0) {
+            for (int i = 0; i < 100; ++i) {
+                if (stats.framesReady.load(std::memory_order_acquire)) {
+                    captured = stats.frameSeq == seq;
+                    break;
+                }
+                usleep(100);
+            }
+        }
+        // 超时后迟到的信号交给之前的处理函数
+        stats.framesRequested.store(false, std::memory_order_release);
+    }
+
+    std::stringstream ss;
+    if (captured) {
+        char **symbols = backtrace_symbols(stats.frames, stats.depth);
+        // 跳过信号处理函数和信号跳板
+        for (int i = 2; symbols && i < stats.depth; ++i) {
+            ss << std::endl << "    " << symbols[i];
+        }
+        free(symbols);
+    } else if (m_longRunningStack) {
+        ss << std::endl << "    <stack unavailable, fiber switched out>";
+    } else {
+        ss << std::endl << "    <stack capture disabled, see scheduler.stats.long_running_stack>";
+    }
+    _LOG_WARN(g_logger) << "long running fiber scheduler=" << m_name << " thread=" << stats.thread
+                        << " fiber_id=" << fiber_id << " running_ms=" << (now - start) / 1000
+                        << " threshold_ms=" << m_longRunningMs << ss.str();
+}
+
+void Scheduler::checkPreempt(SchedulerPreemptSlot &slot, uint64_t now)
+{
+    uint64_t start = slot.sliceStart.load(std::memory_order_acquire);
+    uint64_t seq = slot.sliceSeq.load(std::memory_order_relaxed);
+    if (!start || now < start || now - start < m_preemptSliceMs * 1000ull
+        || slot.requestSeq.load(std::memory_order_relaxed) == seq) {
+        return;
+    }
+    // 读取 seq 之后片段可能已经结束, 这时的请求序号对不上新片段, 不会误让出
+    slot.requestSeq.store(seq, std::memory_order_relaxed);
+    slot.requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Scheduler::ConsumePreempt()
+{
+    SchedulerPreemptSlot *slot = t_preempt_slot;
+    if (_LIKELY(!slot || !slot->requested())) {
+        return false;
+    }
+    // 同一个片段只让出一次, 切回后开始新片段
+    slot->requestSeq.store(0, std::memory_order_relaxed);
+    LatencyHistogram::Add(slot->forcedYields, 1);
+    return true;
+}
+
+Scheduler::PreemptStats Scheduler::getPreemptStats()
+{
+    PreemptStats rt;
+    rt.sliceMs = m_preemptSliceMs;
+    Spinlock::Lock lock(m_statsMutex);
+    for (auto &i : m_preemptSlots) {
+        rt.requests += i->requests.load(std::memory_order_relaxed);
+        rt.forcedYields += i->forcedYields.load(std::memory_order_relaxed);
+    }
+    return rt;
+}
+
 SchedulerSwitcher::SchedulerSwitcher(Scheduler *target)
 {
     m_caller = Scheduler::GetThis();
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <vector>
-#include <list>
 #include <iostream>
 #include "base/coro/fiber.h"
+#include "base/coro/run_queue.h"
+#include "base/coro/scheduler_stats.h"
+#include "base/coro/task.h"
 #include "base/thread.h"
 #include "base/mutex.h"
 
@@ -15,6 +18,21 @@ namespace base
  * @brief 协程调度器
  * @details 封装的是N-M的协程调度器
  *          内部有一个线程池,支持协程在线程池里面切换
+ *          配置 scheduler.work_stealing=true 时每个线程拥有独立的无锁任务队列,
+ *          空闲线程从其它线程窃取任务, 指定线程的任务投递到目标线程的inbox
+ *          配置 fiber.shared_stack.enable=true 时回调任务运行在共享栈协程上,
+ *          这类协程绑定在创建它的线程上, 调度时自动指定线程
+ *          任务是侵入式链表节点, 按线程缓存复用; 调度线程每次加锁最多取
+ *          scheduler.batch_size 个任务在本地依次执行
+ *          配置 scheduler.stats.enable=true 时统计每个线程的排队等待/运行片段直方图和切换次数,
+ *          scheduler.stats.long_running_ms 大于0时由看门狗线程报告运行超时的协程,
+ *          scheduler.stats.long_running_stack=true 时再通过 SIGURG 回溯并输出其调用栈
+ *          任务分为 REALTIME/NORMAL/BACKGROUND 三个优先级, 全局队列按优先级分开, 高优先级先执行,
+ *          同一优先级中有截止时间的任务按截止时间先后(EDF)执行. 每取 scheduler.priority.starvation_limit
+ *          批任务先服务一次等待中的最低优先级, 避免饥饿. 带优先级或截止时间的任务不进入线程本地队列
+ *          setPlacement 把调度线程绑定到CPU集合, 并让线程优先从指定NUMA节点分配内存
+ *          scheduler.preempt.slice_ms 大于0时开启协作式抢占: 看门狗线程标记运行超过时间片的协程,
+ *          协程在 Fiber::MaybeYield() 安全点上让出
  */
 class Scheduler
 {
@@ -43,6 +61,16 @@ public:
      */
     const std::string &getName() const { return m_name; }
 
+    /**
+     * @brief 返回进程内唯一的调度器id, 地址被复用时也不会重复
+     */
+    uint64_t getId() const { return m_id; }
+
+    /**
+     * @brief 返回调度线程的id, start() 之后有效
+     */
+    const std::vector<int> &getThreadIds() const { return m_threadIds; }
+
     /**
      * @brief 返回当前协程调度器
      */
@@ -71,19 +99,33 @@ public:
     template <class FiberOrCb>
     void schedule(FiberOrCb fc, int thread = -1)
     {
-        bool need_tickle = false;
-        {
-            RWMutexType::WriteLock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
+        Task *task = NewTask();
+        task->set(std::move(fc), thread);
+        submitTask(task);
+    }
 
-        if (need_tickle) {
-            tickle();
-        }
+    /**
+     * @brief 按优先级和截止时间调度协程
+     * @details 协程会记住优先级和截止时间, 之后 yield/IO 唤醒重新调度时沿用;
+     *          回调任务的优先级作用于执行它的回调协程
+     * @param[in] fc 协程或函数
+     * @param[in] prio 优先级
+     * @param[in] deadline_ms 相对当前时间的截止时间(毫秒), 0表示没有截止时间
+     * @param[in] thread 协程执行的线程id,-1标识任意线程
+     */
+    template <class FiberOrCb>
+    void schedule(FiberOrCb fc, Fiber::Priority prio, uint64_t deadline_ms = 0, int thread = -1)
+    {
+        Task *task = NewTask();
+        task->set(std::move(fc), thread);
+        SetTaskPriority(task, prio, deadline_ms);
+        submitTask(task);
     }
 
     /**
      * @brief 批量调度协程
+     * @details 任务节点在锁外准备好串成链表, 全局队列只加一次锁整段追加, 最多tickle一次.
+     *          指定了线程的任务(共享栈协程)需要单独唤醒目标线程
      * @param[in] begin 协程数组的开始
      * @param[in] end 协程数组的结束
      */
@@ -91,12 +133,43 @@ public:
     void schedule(InputIterator begin, InputIterator end)
     {
         bool need_tickle = false;
-        {
-            RWMutexType::WriteLock lock(m_mutex);
-            while (begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin;
+        std::vector<int> bound_threads;
+        Task *head = nullptr;
+        Task *tail = nullptr;
+        size_t count = 0;
+        for (; begin != end; ++begin) {
+            Task *task = NewTask();
+            task->set(&*begin, -1);
+            if (task->empty()) {
+                FreeTask(task);
+                continue;
             }
+            if (m_statsEnabled) {
+                StampTask(task);
+            }
+            if (task->thread != -1) {
+                bound_threads.push_back(task->thread);
+            }
+            if (m_workStealing || !task->isPlain()) {
+                need_tickle = enqueueTask(task) || need_tickle;
+                continue;
+            }
+            if (tail) {
+                tail->next = task;
+            } else {
+                head = task;
+            }
+            tail = task;
+            ++count;
+        }
+        if (head) {
+            RWMutexType::WriteLock lock(m_mutex);
+            need_tickle = lanesEmptyNoLock() || need_tickle;
+            m_tasks[Fiber::NORMAL].append(head, tail, count);
+            m_laneSize[Fiber::NORMAL] += count;
+        }
+        for (int thread : bound_threads) {
+            tickle(thread);
         }
         if (need_tickle) {
             tickle();
@@ -104,14 +177,108 @@ public:
     }
 
     void switchTo(int thread = -1);
-    std::ostream &dump(std::ostream &os);
+    virtual std::ostream &dump(std::ostream &os);
+
+    /**
+     * @brief 是否开启运行统计
+     */
+    bool isStatsEnabled() const { return m_statsEnabled; }
+
+    /**
+     * @brief 获取每个调度线程的统计快照, 未开启统计时为空
+     */
+    void getThreadStats(std::vector<SchedulerThreadStats::Snapshot> &stats);
+
+    /**
+     * @brief 输出每个调度线程的统计(任务数/切换次数/等待和运行时长分位数)
+     */
+    std::ostream &dumpStats(std::ostream &os);
+
+    /**
+     * @brief 协作式抢占统计
+     */
+    struct PreemptStats {
+        /// 时间片(毫秒), 0表示未开启
+        uint32_t sliceMs = 0;
+        /// 看门狗发出的让出请求数
+        uint64_t requests = 0;
+        /// 在安全点上被强制让出的次数
+        uint64_t forcedYields = 0;
+    };
+
+    /**
+     * @brief 获取协作式抢占统计
+     */
+    PreemptStats getPreemptStats();
+
+    /**
+     * @brief 当前协程的运行片段是否已被看门狗要求让出
+     * @details 由 Fiber::MaybeYield() 调用, 返回 true 时计为一次强制让出并清除请求.
+     *          不在调度线程的任务片段中时总是返回 false
+     */
+    static bool ConsumePreempt();
+
+    /**
+     * @brief 单个优先级的队列统计
+     */
+    struct LaneStats {
+        /// 当前排队的任务数
+        size_t depth = 0;
+        /// 全局队列的历史最大长度
+        size_t maxDepth = 0;
+        /// 开始执行时已经超过截止时间的次数
+        uint64_t deadlineMissed = 0;
+    };
+
+    /**
+     * @brief 当前排队的任务数
+     * @details NORMAL 包含工作窃取模式下线程本地队列和inbox中的任务
+     */
+    size_t getQueueDepth(Fiber::Priority prio) const;
+
+    /**
+     * @brief 获取每个优先级的队列统计, 下标为 Fiber::Priority
+     */
+    void getLaneStats(LaneStats (&stats)[Fiber::kPriorityCount]);
+
+    /**
+     * @brief 调度线程的CPU/NUMA放置策略
+     */
+    struct Placement {
+        /// 可用的CPU, 为空表示不绑定
+        std::vector<int> cpus;
+        /// true: 第i个线程绑定到 cpus[i % cpus.size()]; false: 所有线程共享整个集合
+        bool pinPerThread = false;
+        /// 线程优先从该NUMA节点分配内存(协程栈, FdContext等), -1表示不设置
+        int memNode = -1;
+
+        bool empty() const { return cpus.empty() && memNode < 0; }
+    };
+
+    /**
+     * @brief 设置调度线程的放置策略
+     * @details 可以在 start() 之后调用: CPU绑定立即生效, NUMA内存策略需要在目标线程上设置,
+     *          通过指定线程的任务异步完成. use_caller 的调用线程不受影响
+     */
+    void setPlacement(const Placement &v);
+
+    /**
+     * @brief 返回调度线程的放置策略
+     */
+    const Placement &getPlacement() const { return m_placement; }
+
+    /**
+     * @brief 遍历所有存活的调度器
+     * @details 遍历期间持有全局锁, 回调中不能创建或销毁调度器
+     */
+    static void Visit(std::function<void(Scheduler *)> cb);
 
 protected:
     /**
      * @brief 通知协程调度器有任务了
+     * @param[in] thread 任务指定的线程id, -1表示任意线程
      */
-
-    virtual void tickle();
+    virtual void tickle(int thread = -1);
     /**
      * @brief 协程调度函数
      */
@@ -127,6 +294,17 @@ protected:
      */
     virtual void idle();
 
+    /**
+     * @brief 调度线程每执行完一个任务调用一次, 不能阻塞
+     * @param[in] batch_end 本批任务是否已经执行完
+     */
+    virtual void onTaskDone(bool batch_end) {}
+
+    /**
+     * @brief 调度线程启动时调用, 在执行任何任务之前
+     */
+    virtual void onThreadStart() {}
+
     /**
      * @brief 设置当前的协程调度器
      */
@@ -137,90 +315,244 @@ protected:
      */
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
+    /**
+     * @brief 是否启用工作窃取模式
+     */
+    bool isWorkStealing() const { return m_workStealing; }
+
+    /**
+     * @brief 队列中是否还有待执行的任务
+     * @details 线程进入睡眠前最后检查一次, 与 tickle 配合避免丢失唤醒
+     */
+    bool hasPendingTask();
+
 private:
     /**
-     * @brief 协程调度启动(无锁)
+     * @brief 从当前线程的缓存中取一个空闲的任务节点
      */
-    template <class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread)
+    static Task *NewTask();
+
+    /**
+     * @brief 重置任务节点并放回当前线程的缓存
+     */
+    static void FreeTask(Task *task);
+
+    /**
+     * @brief 在回调协程中执行回调任务, 结束后释放任务节点
+     * @details 回调没有切出时接着执行本批次后续的回调任务
+     */
+    static void RunCallback(Task *task);
+
+    /**
+     * @brief 记录任务的入队时间
+     */
+    static void StampTask(Task *task);
+
+    /**
+     * @brief 设置任务的优先级和截止时间, 协程任务同时记录到协程上
+     */
+    static void SetTaskPriority(Task *task, Fiber::Priority prio, uint64_t deadline_ms);
+
+    /**
+     * @brief 任务入队并按需唤醒线程
+     */
+    void submitTask(Task *task)
     {
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
-        if (ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
+        if (task->empty()) {
+            FreeTask(task);
+            return;
+        }
+        if (m_statsEnabled) {
+            StampTask(task);
+        }
+        // 共享栈协程会被绑定到所在线程, 以构造后的线程为准
+        int thread = task->thread;
+        bool need_tickle = false;
+        if (m_workStealing || !task->isPlain()) {
+            need_tickle = enqueueTask(task);
+        } else {
+            RWMutexType::WriteLock lock(m_mutex);
+            need_tickle = scheduleNoLock(task);
         }
+
+        if (need_tickle) {
+            tickle(thread);
+        }
+    }
+
+    /**
+     * @brief 把 m_placement 应用到已经启动的调度线程
+     */
+    void applyPlacement();
+
+    /**
+     * @brief 看门狗线程, 检测运行超过 scheduler.stats.long_running_ms 的协程,
+     *        以及运行超过 scheduler.preempt.slice_ms 时间片的协程
+     */
+    void watchdog();
+
+    /**
+     * @brief 检查一个调度线程的当前运行片段, 超时时输出协程的调用栈
+     * @param[in,out] reported 已经报告过的片段序号
+     */
+    void checkLongRunning(SchedulerThreadStats &stats, uint64_t now, uint64_t &reported);
+
+    /**
+     * @brief 检查一个调度线程的当前运行片段, 超过时间片时要求它在安全点让出
+     */
+    void checkPreempt(SchedulerPreemptSlot &slot, uint64_t now);
+
+    /**
+     * @brief 调度线程开始执行一个任务时的记账: 排队时间, 任务数和截止时间
+     * @details 调度协程切入任务和回调协程接着执行批次中的回调任务都走这里
+     * @param[in] now 当前时间(微秒), 没有开启统计和抢占时为 0
+     */
+    void recordTaskStart(Task *task, SchedulerThreadStats *stats, uint64_t now);
+
+    /**
+     * @brief 工作窃取模式下每个调度线程的任务队列
+     */
+    struct Worker {
+        typedef Spinlock MutexType;
+
+        ~Worker();
+
+        /// 绑定的线程id, -1表示还未被线程认领
+        std::atomic<int> thread = {-1};
+        /// 本线程产生的任务, 其它线程空闲时从这里窃取
+        RunQueue<Task *> local;
+        /// 指定在本线程执行的任务
+        TaskQueue inbox;
+        /// inbox 中的任务数量
+        std::atomic<size_t> inboxSize = {0};
+        /// inbox 的锁
+        MutexType mutex;
+    };
+
+    /**
+     * @brief 任务放入全局队列(需持有m_mutex)
+     * @return 是否需要tickle
+     */
+    bool scheduleNoLock(Task *task)
+    {
+        // 指定线程的任务需要唤醒目标线程, 不能依赖已经被唤醒的其它线程
+        bool need_tickle = lanesEmptyNoLock() || task->thread != -1;
+        pushLaneNoLock(task);
         return need_tickle;
     }
 
-private:
     /**
-     * @brief 协程/函数/线程组
-     */
-    struct FiberAndThread {
-        /// 协程
-        Fiber::ptr fiber;
-        /// 协程执行函数
-        std::function<void()> cb;
-        /// 线程id
-        int thread;
-
-        /**
-         * @brief 构造函数
-         * @param[in] f 协程
-         * @param[in] thr 线程id
-         */
-        FiberAndThread(Fiber::ptr f, int thr) : fiber(f), thread(thr) {}
-
-        /**
-         * @brief 构造函数
-         * @param[in] f 协程指针
-         * @param[in] thr 线程id
-         * @post *f = nullptr
-         */
-        FiberAndThread(Fiber::ptr *f, int thr) : thread(thr) { fiber.swap(*f); }
-
-        /**
-         * @brief 构造函数
-         * @param[in] f 协程执行函数
-         * @param[in] thr 线程id
-         */
-        FiberAndThread(std::function<void()> f, int thr) : cb(f), thread(thr) {}
-
-        /**
-         * @brief 构造函数
-         * @param[in] f 协程执行函数指针
-         * @param[in] thr 线程id
-         * @post *f = nullptr
-         */
-        FiberAndThread(std::function<void()> *f, int thr) : thread(thr) { cb.swap(*f); }
-
-        /**
-         * @brief 无参构造函数
-         */
-        FiberAndThread() : thread(-1) {}
-
-        /**
-         * @brief 重置数据
-         */
-        void reset()
-        {
-            fiber = nullptr;
-            cb = nullptr;
-            thread = -1;
+     * @brief 任务放入所属优先级的全局队列(需持有m_mutex)
+     */
+    void pushLaneNoLock(Task *task)
+    {
+        TaskLane &lane = m_tasks[task->priority];
+        lane.push(task);
+        ++m_laneSize[task->priority];
+        if (lane.size() > m_laneMaxDepth[task->priority]) {
+            m_laneMaxDepth[task->priority] = lane.size();
         }
-    };
+    }
+
+    /**
+     * @brief 全局队列是否为空(需持有m_mutex)
+     */
+    bool lanesEmptyNoLock() const
+    {
+        for (auto &i : m_tasks) {
+            if (!i.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief 任务入队: 带优先级/截止时间的任务进入全局分级队列, 其余按工作窃取模式入队
+     * @return 是否需要tickle
+     */
+    bool enqueueTask(Task *task);
+
+    /**
+     * @brief 工作窃取模式下的任务出队
+     * @details 依次查找 本线程inbox -> 本地队列 -> 全局队列 -> 窃取其它线程,
+     *          REALTIME 队列非空或者到了防饥饿的轮次时先查全局队列,
+     *          inbox 和全局队列一次加锁最多取 max 个
+     * @param[out] tasks 取到的任务
+     * @param[in] max tasks 的容量
+     * @param[out] tickle_me 是否还有其它任务需要唤醒线程
+     * @return 取到的任务数量
+     */
+    size_t dequeueTasks(Task **tasks, size_t max, bool &tickle_me);
+
+    /**
+     * @brief 从全局队列取出可以在当前线程执行的任务(需持有m_mutex)
+     * @details 按优先级从高到低取, 每个优先级不超过队列长度按线程数平分的份额, 给其它线程留下任务,
+     *          合计最多取 max 个. 每 m_starvationLimit 次先取等待中的最低优先级
+     * @return 取到的任务数量
+     */
+    size_t popGlobalNoLock(Task **tasks, size_t max, bool &tickle_me);
+
+    /**
+     * @brief 查找绑定到指定线程的Worker
+     */
+    Worker *findWorker(int thread);
 
 private:
     /// Mutex
     RWMutexType m_mutex;
     /// 线程池
     std::vector<Thread::ptr> m_threads;
-    /// 待执行的协程队列
-    std::list<FiberAndThread> m_fibers;
+    /// 待执行的任务队列, 下标为优先级
+    TaskLane m_tasks[Fiber::kPriorityCount];
+    /// 每个优先级全局队列的长度, 不加锁读取
+    std::atomic<size_t> m_laneSize[Fiber::kPriorityCount] = {};
+    /// 每个优先级全局队列的历史最大长度(m_mutex保护)
+    size_t m_laneMaxDepth[Fiber::kPriorityCount] = {};
+    /// 每个优先级执行时超过截止时间的次数
+    std::atomic<uint64_t> m_deadlineMissed[Fiber::kPriorityCount] = {};
+    /// 防饥饿: 每取多少次先服务一次最低优先级, 0表示不启用
+    uint32_t m_starvationLimit = 0;
+    /// 防饥饿计数(m_mutex保护)
+    uint32_t m_laneRounds = 0;
     /// use_caller为true时有效, 调度协程
     Fiber::ptr m_rootFiber;
     /// 协程调度器名称
     std::string m_name;
+    /// 调度器id
+    uint64_t m_id = 0;
+    /// 是否启用工作窃取模式
+    bool m_workStealing = false;
+    /// 回调任务是否运行在共享栈协程上
+    bool m_sharedStack = false;
+    /// 每次加锁最多取出的任务数
+    size_t m_batchSize = 1;
+    /// 工作窃取模式下每个线程的队列
+    std::vector<std::unique_ptr<Worker> > m_workers;
+    /// 下一个待认领的Worker下标
+    std::atomic<size_t> m_workerCursor = {0};
+    /// 工作窃取模式下 inbox/本地队列中的任务总数
+    std::atomic<size_t> m_queuedTaskCount = {0};
+    /// 是否开启运行统计
+    bool m_statsEnabled = false;
+    /// 运行片段超过该时长(毫秒)时输出调用栈, 0表示不检测
+    uint32_t m_longRunningMs = 0;
+    /// 是否用信号回溯运行超时协程的调用栈(scheduler.stats.long_running_stack)
+    bool m_longRunningStack = false;
+    /// 每个调度线程的统计
+    std::vector<std::unique_ptr<SchedulerThreadStats> > m_threadStats;
+    /// m_threadStats 的锁
+    Spinlock m_statsMutex;
+    /// 协作式抢占的时间片(毫秒), 0表示不开启
+    uint32_t m_preemptSliceMs = 0;
+    /// 每个调度线程的抢占状态, 由 m_statsMutex 保护
+    std::vector<std::unique_ptr<SchedulerPreemptSlot> > m_preemptSlots;
+    /// 看门狗线程
+    Thread::ptr m_watchdog;
+    /// 通知看门狗线程退出
+    std::atomic<bool> m_watchdogStop = {false};
+    /// 调度线程的放置策略
+    Placement m_placement;
 
 protected:
     /// 协程下的线程id数组
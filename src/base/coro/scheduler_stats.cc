@@ -0,0 +1,63 @@
+#include "scheduler_stats.h"
+
+namespace base
+{
+
+void LatencyHistogram::Snapshot::merge(const Snapshot &o)
+{
+    for (size_t i = 0; i < kBuckets; ++i) {
+        buckets[i] += o.buckets[i];
+    }
+    count += o.count;
+    sum += o.sum;
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double q) const
+{
+    if (!count) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * count);
+    rank = rank ? rank : 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return UpperBound(i);
+        }
+    }
+    return UpperBound(kBuckets - 1);
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (auto &i : m_buckets) {
+        i.store(0, std::memory_order_relaxed);
+    }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot s;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        s.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        s.count += s.buckets[i];
+    }
+    s.sum = m_sum.load(std::memory_order_relaxed);
+    return s;
+}
+
+SchedulerThreadStats::Snapshot SchedulerThreadStats::snapshot() const
+{
+    Snapshot s;
+    s.thread = thread;
+    s.tasks = tasks.load(std::memory_order_relaxed);
+    s.switches = switches.load(std::memory_order_relaxed);
+    s.idleSwitches = idleSwitches.load(std::memory_order_relaxed);
+    s.longRunning = longRunning.load(std::memory_order_relaxed);
+    s.queueWait = queueWait.snapshot();
+    s.runSlice = runSlice.snapshot();
+    return s;
+}
+
+} // namespace base
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "base/noncopyable.h"
+
+namespace base
+{
+
+/**
+ * @brief 按2的幂分桶的微秒延迟直方图
+ * @details 第 i 个桶统计 (2^(i-1), 2^i] 微秒的样本, 第0个桶统计 <=1us, 最后一个桶为 +Inf.
+ *          只由所属的调度线程写入(relaxed原子操作), 读取方拿到的是近似一致的快照
+ */
+class LatencyHistogram : Noncopyable
+{
+public:
+    /// 1us ~ 2^22us(约4.2s), 加一个 +Inf 桶
+    static const size_t kBuckets = 24;
+
+    /**
+     * @brief 直方图快照
+     */
+    struct Snapshot {
+        uint64_t buckets[kBuckets] = {0};
+        uint64_t count = 0;
+        /// 样本总和(微秒)
+        uint64_t sum = 0;
+
+        void merge(const Snapshot &o);
+
+        /**
+         * @brief 估算分位数
+         * @param[in] q 分位(0~1)
+         * @return 分位数所在桶的上界(微秒), 落在 +Inf 桶时返回 UINT64_MAX, 没有样本时返回0
+         */
+        uint64_t percentile(double q) const;
+    };
+
+    LatencyHistogram();
+
+    void record(uint64_t us)
+    {
+        size_t i = us <= 1 ? 0 : 64 - __builtin_clzll(us - 1);
+        if (i >= kBuckets) {
+            i = kBuckets - 1;
+        }
+        Add(m_buckets[i], 1);
+        Add(m_sum, us);
+    }
+
+    /**
+     * @brief 单写者的原子累加, 不需要 lock 前缀的读改写指令
+     */
+    static void Add(std::atomic<uint64_t> &v, uint64_t n)
+    {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const;
+
+    /**
+     * @brief 第 i 个桶的上界(微秒), 最后一个桶返回 UINT64_MAX
+     */
+    static uint64_t UpperBound(size_t i) { return i + 1 < kBuckets ? (1ull << i) : UINT64_MAX; }
+
+private:
+    std::atomic<uint64_t> m_buckets[kBuckets];
+    std::atomic<uint64_t> m_sum = {0};
+};
+
+/**
+ * @brief 调度线程的运行统计
+ * @details 配置 scheduler.stats.enable=true 时每个调度线程一份, 只由所属线程更新.
+ *          当前运行片段的开始时间/序号供长时间运行检测(看门狗线程)读取
+ */
+struct SchedulerThreadStats : Noncopyable {
+    /// 栈回溯的最大深度
+    static const int kMaxFrames = 64;
+
+    /**
+     * @brief 统计快照
+     */
+    struct Snapshot {
+        int thread = -1;
+        /// 执行的任务数
+        uint64_t tasks = 0;
+        /// 切入任务协程的次数
+        uint64_t switches = 0;
+        /// 切入idle协程的次数
+        uint64_t idleSwitches = 0;
+        /// 超过阈值的运行片段数
+        uint64_t longRunning = 0;
+        /// 任务从入队到开始执行的等待时间
+        LatencyHistogram::Snapshot queueWait;
+        /// 任务每次连续运行的时长
+        LatencyHistogram::Snapshot runSlice;
+    };
+
+    explicit SchedulerThreadStats(int thr) : thread(thr) {}
+
+    /**
+     * @brief 开始一个运行片段
+     */
+    void beginSlice(uint64_t fiber_id, uint64_t now)
+    {
+        fiberId.store(fiber_id, std::memory_order_relaxed);
+        LatencyHistogram::Add(sliceSeq, 1);
+        sliceStart.store(now, std::memory_order_release);
+    }
+
+    /**
+     * @brief 结束当前运行片段并记录时长
+     */
+    void endSlice(uint64_t now)
+    {
+        uint64_t start = sliceStart.load(std::memory_order_relaxed);
+        sliceStart.store(0, std::memory_order_release);
+        runSlice.record(now - start);
+    }
+
+    Snapshot snapshot() const;
+
+    /// 线程id
+    const int thread;
+    std::atomic<uint64_t> tasks = {0};
+    std::atomic<uint64_t> switches = {0};
+    std::atomic<uint64_t> idleSwitches = {0};
+    /// 由看门狗线程累加
+    std::atomic<uint64_t> longRunning = {0};
+    LatencyHistogram queueWait;
+    LatencyHistogram runSlice;
+
+    /// 当前运行片段的开始时间(微秒), 0 表示没有在执行任务
+    std::atomic<uint64_t> sliceStart = {0};
+    /// 运行片段序号, 用来区分同一个线程上前后两个片段
+    std::atomic<uint64_t> sliceSeq = {0};
+    /// 当前运行的协程id
+    std::atomic<uint64_t> fiberId = {0};
+
+    /// 看门狗请求的栈回溯, 由信号处理函数在本线程填充
+    void *frames[kMaxFrames];
+    int depth = 0;
+    /// 栈回溯对应的片段序号
+    uint64_t frameSeq = 0;
+    /// 看门狗是否正在等待本线程的栈回溯
+    std::atomic<bool> framesRequested = {false};
+    /// 栈回溯是否已经完成
+    std::atomic<bool> framesReady = {false};
+};
+
+/**
+ * @brief 调度线程的协作式抢占状态
+ * @details 配置 scheduler.preempt.slice_ms 大于0时每个调度线程一份. 调度线程在切入任务时开始新片段,
+ *          看门狗线程发现片段超时后写入 requestSeq, 协程在 Fiber::MaybeYield() 安全点上
+ *          发现 requestSeq 等于当前片段序号时让出
+ */
+struct SchedulerPreemptSlot : Noncopyable {
+    explicit SchedulerPreemptSlot(int thr) : thread(thr) {}
+
+    /**
+     * @brief 开始一个运行片段
+     */
+    void beginSlice(uint64_t now)
+    {
+        sliceSeq.store(sliceSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sliceStart.store(now, std::memory_order_release);
+    }
+
+    /**
+     * @brief 结束当前运行片段
+     */
+    void endSlice() { sliceStart.store(0, std::memory_order_release); }
+
+    /**
+     * @brief 看门狗是否要求当前片段让出
+     */
+    bool requested() const
+    {
+        return requestSeq.load(std::memory_order_relaxed)
+               == sliceSeq.load(std::memory_order_relaxed);
+    }
+
+    /// 线程id
+    const int thread;
+    /// 当前运行片段的开始时间(微秒), 0 表示没有在执行任务
+    std::atomic<uint64_t> sliceStart = {0};
+    /// 运行片段序号, 只由所属线程写入, 从1开始
+    std::atomic<uint64_t> sliceSeq = {0};
+    /// 看门狗要求让出的片段序号
+    std::atomic<uint64_t> requestSeq = {0};
+    /// 看门狗发出的让出请求数
+    std::atomic<uint64_t> requests = {0};
+    /// 在安全点上被强制让出的次数
+    std::atomic<uint64_t> forcedYields = {0};
+};
+
+} // namespace base
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <functional>
+#include <cstddef>
+#include <new>
+#include <stdint.h>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <boost/intrusive/set.hpp>
+#include "base/coro/fiber.h"
+#include "base/noncopyable.h"
+
+namespace base
+{
+
+/**
+ * @brief 带内联缓冲区的回调
+ * @details 可调用对象不超过 kInlineSize 且移动不抛异常时直接构造在内部缓冲区, 否则放到堆上.
+ *          std::function 本身也放得下, 调度 std::function 不会再多一次分配.
+ *          对象的地址在生命周期内不变, 不支持拷贝和移动.
+ */
+class TaskCallback : Noncopyable
+{
+public:
+    static const size_t kInlineSize = 48;
+
+    TaskCallback() {}
+    ~TaskCallback() { reset(); }
+
+    /**
+     * @brief 设置回调, 空的 std::function/函数指针等价于清空
+     */
+    template <class F>
+    void assign(F &&f)
+    {
+        typedef typename std::decay<F>::type Fn;
+        reset();
+        if (IsNull(f)) {
+            return;
+        }
+        if constexpr (sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(std::max_align_t)
+                      && std::is_nothrow_move_constructible<Fn>::value) {
+            new (m_storage) Fn(std::forward<F>(f));
+            m_invoke = &InvokeInline<Fn>;
+            m_destroy = &DestroyInline<Fn>;
+        } else {
+            *(Fn **)m_storage = new Fn(std::forward<F>(f));
+            m_invoke = &InvokeHeap<Fn>;
+            m_destroy = &DestroyHeap<Fn>;
+        }
+    }
+
+    /**
+     * @brief 释放回调持有的资源
+     */
+    void reset()
+    {
+        if (m_destroy) {
+            m_destroy(m_storage);
+        }
+        m_invoke = nullptr;
+        m_destroy = nullptr;
+    }
+
+    void operator()() { m_invoke(m_storage); }
+
+    explicit operator bool() const { return m_invoke != nullptr; }
+
+private:
+    template <class Fn>
+    static void InvokeInline(void *p)
+    {
+        (*(Fn *)p)();
+    }
+    template <class Fn>
+    static void DestroyInline(void *p)
+    {
+        ((Fn *)p)->~Fn();
+    }
+    template <class Fn>
+    static void InvokeHeap(void *p)
+    {
+        (**(Fn **)p)();
+    }
+    template <class Fn>
+    static void DestroyHeap(void *p)
+    {
+        delete *(Fn **)p;
+    }
+
+    template <class Fn>
+    static bool IsNull(const Fn &)
+    {
+        return false;
+    }
+    static bool IsNull(const std::function<void()> &f) { return !f; }
+    template <class R>
+    static bool IsNull(R (*f)())
+    {
+        return f == nullptr;
+    }
+
+private:
+    alignas(std::max_align_t) char m_storage[kInlineSize];
+    void (*m_invoke)(void *) = nullptr;
+    void (*m_destroy)(void *) = nullptr;
+};
+
+/**
+ * @brief 调度器的任务节点
+ * @details 侵入式单链表节点, 由调度器按线程缓存复用, 入队出队都不需要分配内存.
+ *          一个任务要么是协程, 要么是回调. 回调任务继承调度它的协程的局部存储.
+ */
+struct Task : Noncopyable {
+    /// 队列中的下一个任务
+    Task *next = nullptr;
+    /// 协程
+    Fiber::ptr fiber;
+    /// 回调
+    TaskCallback cb;
+    /// 线程id, -1表示任意线程
+    int thread = -1;
+    /// 入队时间(微秒), 只在开启调度统计时记录
+    uint64_t enqueueUs = 0;
+    /// 截止时间(微秒), 0表示没有
+    uint64_t deadlineUs = 0;
+    /// 调度优先级 Fiber::Priority
+    uint8_t priority = Fiber::NORMAL;
+    /// 回调任务从调度它的协程继承的局部存储
+    FiberLocalStorage locals;
+    /// 在 TaskLane 截止时间队列中的挂钩
+    boost::intrusive::set_member_hook<> deadlineHook;
+
+    /**
+     * @brief 设置为协程任务
+     * @details 未指定线程时使用协程绑定的线程(共享栈协程), 优先级和截止时间取自协程
+     */
+    void set(Fiber::ptr f, int thr)
+    {
+        fiber = std::move(f);
+        thread = thr;
+        if (fiber) {
+            if (thread == -1) {
+                thread = fiber->getBindThread();
+            }
+            priority = fiber->getPriority();
+            deadlineUs = fiber->getDeadline();
+        }
+    }
+
+    /**
+     * @brief 设置为协程任务
+     * @post *f = nullptr
+     */
+    void set(Fiber::ptr *f, int thr)
+    {
+        Fiber::ptr tmp;
+        tmp.swap(*f);
+        set(std::move(tmp), thr);
+    }
+
+    /**
+     * @brief 设置为回调任务
+     * @post *f = nullptr
+     */
+    void set(std::function<void()> *f, int thr)
+    {
+        if (*f) {
+            cb.assign(std::move(*f));
+            *f = nullptr;
+        }
+        thread = thr;
+        inheritLocals();
+    }
+
+    /**
+     * @brief 设置为回调任务, 任意可调用对象
+     */
+    template <class F>
+    void set(F &&f, int thr)
+    {
+        cb.assign(std::forward<F>(f));
+        thread = thr;
+        inheritLocals();
+    }
+
+    bool empty() const { return !fiber && !cb; }
+
+    /**
+     * @brief 继承当前协程的可继承槽位
+     * @details 大多数任务没有设置任何 FiberLocal, 这时不复制也不改引用计数
+     */
+    void inheritLocals()
+    {
+        FiberLocalStorage *cur = FiberLocalStorage::Current();
+        if (cur->hasInheritable()) {
+            locals.inherit(*cur);
+        } else if (!locals.empty()) {
+            locals.clear();
+        }
+    }
+
+    /**
+     * @brief 是否走普通FIFO路径(默认优先级且没有截止时间)
+     */
+    bool isPlain() const { return priority == Fiber::NORMAL && !deadlineUs; }
+
+    /**
+     * @brief 重置数据, 释放协程引用和回调
+     */
+    void reset()
+    {
+        next = nullptr;
+        fiber = nullptr;
+        cb.reset();
+        thread = -1;
+        enqueueUs = 0;
+        deadlineUs = 0;
+        priority = Fiber::NORMAL;
+        locals.clear();
+    }
+};
+
+/**
+ * @brief 侵入式任务队列(FIFO), 不加锁, 由使用方保护
+ */
+class TaskQueue : Noncopyable
+{
+public:
+    bool empty() const { return m_head == nullptr; }
+    size_t size() const { return m_size; }
+    Task *front() const { return m_head; }
+
+    void push(Task *t)
+    {
+        t->next = nullptr;
+        if (m_tail) {
+            m_tail->next = t;
+        } else {
+            m_head = t;
+        }
+        m_tail = t;
+        ++m_size;
+    }
+
+    /**
+     * @brief 整段追加一条已经串好的链表 [head, tail]
+     */
+    void append(Task *head, Task *tail, size_t n)
+    {
+        if (!head) {
+            return;
+        }
+        tail->next = nullptr;
+        if (m_tail) {
+            m_tail->next = head;
+        } else {
+            m_head = head;
+        }
+        m_tail = tail;
+        m_size += n;
+    }
+
+    Task *pop()
+    {
+        return remove(nullptr);
+    }
+
+    /**
+     * @brief 摘除 prev 之后的节点, prev 为 nullptr 时摘除队首
+     */
+    Task *remove(Task *prev)
+    {
+        Task *t = prev ? prev->next : m_head;
+        if (!t) {
+            return nullptr;
+        }
+        if (prev) {
+            prev->next = t->next;
+        } else {
+            m_head = t->next;
+        }
+        if (m_tail == t) {
+            m_tail = prev;
+        }
+        t->next = nullptr;
+        --m_size;
+        return t;
+    }
+
+private:
+    Task *m_head = nullptr;
+    Task *m_tail = nullptr;
+    size_t m_size = 0;
+};
+
+/**
+ * @brief 按截止时间排序的侵入式任务集合, 相同截止时间先到先出, 由使用方保护
+ */
+struct TaskDeadlineLess {
+    bool operator()(const Task &a, const Task &b) const { return a.deadlineUs < b.deadlineUs; }
+};
+typedef boost::intrusive::multiset<
+    Task,
+    boost::intrusive::member_hook<Task, boost::intrusive::set_member_hook<>, &Task::deadlineHook>,
+    boost::intrusive::compare<TaskDeadlineLess> >
+    TaskDeadlineSet;
+
+/**
+ * @brief 一个优先级的全局任务队列, 不加锁, 由使用方保护
+ * @details 有截止时间的任务按截止时间升序排列(相同时先到先出), 挂钩在任务节点里, 插入 O(log n)
+ *          且不分配内存. 指定了线程的有截止时间任务按线程分开存放, 不参与其它线程的扫描.
+ *          没有截止时间的任务在 FIFO 队列中, 排在所有有截止时间的任务之后
+ */
+class TaskLane : Noncopyable
+{
+public:
+    ~TaskLane()
+    {
+        m_deadlines.clear();
+        for (auto &i : m_bound) {
+            i.second.clear();
+        }
+    }
+
+    bool empty() const { return m_fifo.empty() && m_deadlines.empty() && !m_boundSize; }
+    size_t size() const { return m_fifo.size() + m_deadlines.size() + m_boundSize; }
+
+    void push(Task *t)
+    {
+        if (!t->deadlineUs) {
+            m_fifo.push(t);
+            return;
+        }
+        t->next = nullptr;
+        // 截止时间大多随时间递增, 从尾部提示插入通常是 O(1)
+        if (t->thread == -1) {
+            m_deadlines.insert(m_deadlines.end(), *t);
+        } else {
+            // 每个线程第一次出现时分配一次, 之后复用
+            TaskDeadlineSet &bound = m_bound[t->thread];
+            bound.insert(bound.end(), *t);
+            ++m_boundSize;
+        }
+    }
+
+    /**
+     * @brief 整段追加一条已经串好的、没有截止时间的任务链表 [head, tail]
+     */
+    void append(Task *head, Task *tail, size_t n) { m_fifo.append(head, tail, n); }
+
+    /**
+     * @brief 不限线程的有截止时间任务
+     */
+    TaskDeadlineSet &deadlines() { return m_deadlines; }
+
+    /**
+     * @brief 指定在 thread 上执行的有截止时间任务, 没有时返回 nullptr
+     */
+    TaskDeadlineSet *boundDeadlines(int thread)
+    {
+        auto it = m_bound.find(thread);
+        return it == m_bound.end() || it->second.empty() ? nullptr : &it->second;
+    }
+
+    /**
+     * @brief 取出 boundDeadlines() 返回的集合中截止时间最早的任务
+     */
+    Task *popBound(TaskDeadlineSet &bound)
+    {
+        Task *t = &*bound.begin();
+        bound.erase(bound.begin());
+        --m_boundSize;
+        return t;
+    }
+
+    /**
+     * @brief 指定了线程的有截止时间任务总数
+     */
+    size_t boundSize() const { return m_boundSize; }
+
+    TaskQueue &fifo() { return m_fifo; }
+
+private:
+    TaskDeadlineSet m_deadlines;
+    /// 线程id -> 指定在该线程执行的有截止时间任务
+    std::unordered_map<int, TaskDeadlineSet> m_bound;
+    size_t m_boundSize = 0;
+    TaskQueue m_fifo;
+};
+
+} // namespace base
@@ -1,28 +1,251 @@
 #include "base/coro/timer.h"
 #include "base/util.h"
+#include <algorithm>
 
 namespace base
 {
 
-bool Timer::Comparator::operator()(const Timer::ptr &lhs, const Timer::ptr &rhs) const
+/// 第0层 256 个槽位, 每个槽位 1ms
+static const uint64_t kNearBits = 8;
+static const uint64_t kNearSize = 1ull << kNearBits;
+static const uint64_t kNearMask = kNearSize - 1;
+/// 第1~4层各 64 个槽位, 每层槽位跨度是下一层的 64 倍
+static const uint64_t kLevelBits = 6;
+static const uint64_t kLevelSize = 1ull << kLevelBits;
+static const uint64_t kLevelMask = kLevelSize - 1;
+static const size_t kLevelCount = 4;
+/// 时间轮能直接表示的最大跨度(约49天), 超出的定时器先挂在最后一层, 级联时重新放置
+static const uint64_t kMaxSpan = 1ull << (kNearBits + kLevelBits * kLevelCount);
+
+/**
+ * @brief 分层时间轮(一个分片)
+ * @details 与 Linux 老版本内核的 timer wheel 相同: 到期时间离当前刻度小于256ms的定时器
+ *          放在第0层对应毫秒的槽位, 更远的按跨度放到上层, 第0层转完一圈时
+ *          把上层对应槽位的定时器重新分配到下层.
+ *          槽位是 Timer 内嵌的双向链表, 添加/删除都是 O(1).
+ *          所有操作都需要持有 m_mutex.
+ */
+class TimerWheel
 {
-    if (!lhs && !rhs) {
-        return false;
+public:
+    typedef Spinlock MutexType;
+
+    TimerWheel(uint64_t now_ms) : m_current(now_ms) {}
+
+    ~TimerWheel()
+    {
+        std::vector<Timer::ptr> timers;
+        takeAll(timers);
     }
-    if (!lhs) {
-        return true;
+
+    /**
+     * @brief 添加定时器, 按 timer->m_next 放到对应的槽位
+     */
+    void add(Timer::ptr timer)
+    {
+        Timer *t = timer.get();
+        uint64_t expires = t->m_next < m_current ? m_current : t->m_next;
+        uint64_t delta = expires - m_current;
+        Timer **slot = nullptr;
+        if (delta < kNearSize) {
+            slot = &m_near[expires & kNearMask];
+            ++m_nearSize;
+        } else {
+            if (delta >= kMaxSpan) {
+                expires = m_current + kMaxSpan - 1;
+                delta = kMaxSpan - 1;
+            }
+            size_t level = 0;
+            while (delta >= (1ull << (kNearBits + kLevelBits * (level + 1)))) {
+                ++level;
+            }
+            slot = &m_levels[level][(expires >> (kNearBits + kLevelBits * level)) & kLevelMask];
+        }
+        t->m_slot = slot;
+        t->m_prev = nullptr;
+        t->m_succ = *slot;
+        if (*slot) {
+            (*slot)->m_prev = t;
+        }
+        *slot = t;
+        t->m_self = std::move(timer);
+        ++m_size;
     }
-    if (!rhs) {
-        return false;
+
+    /**
+     * @brief 从槽位中摘除定时器
+     * @return 时间轮持有的引用, 需要在释放锁之后再析构
+     */
+    Timer::ptr remove(Timer *t)
+    {
+        if (!t->m_slot) {
+            return nullptr;
+        }
+        if (t->m_slot >= m_near && t->m_slot < m_near + kNearSize) {
+            --m_nearSize;
+        }
+        unlink(t);
+        --m_size;
+        return std::move(t->m_self);
     }
-    if (lhs->m_next < rhs->m_next) {
-        return true;
+
+    /**
+     * @brief 推进到 now_ms, 取出所有到期的定时器
+     * @param[in] all 取出全部定时器(时钟回拨时使用)
+     */
+    void expire(uint64_t now_ms, bool all, std::vector<Timer::ptr> &expired)
+    {
+        if (all) {
+            takeAll(expired);
+            m_current = now_ms;
+            return;
+        }
+        while (m_current <= now_ms) {
+            if (m_size == 0) {
+                m_current = now_ms + 1;
+                break;
+            }
+            if ((m_current & kNearMask) == 0) {
+                cascade();
+            }
+            if (m_nearSize == 0) {
+                // 第0层是空的, 直接跳到下一次级联的刻度
+                uint64_t boundary = (m_current | kNearMask) + 1;
+                m_current = boundary <= now_ms ? boundary : now_ms + 1;
+                continue;
+            }
+            Timer *t = m_near[m_current & kNearMask];
+            m_near[m_current & kNearMask] = nullptr;
+            while (t) {
+                Timer *succ = t->m_succ;
+                t->m_slot = nullptr;
+                t->m_prev = t->m_succ = nullptr;
+                expired.push_back(std::move(t->m_self));
+                --m_nearSize;
+                --m_size;
+                t = succ;
+            }
+            ++m_current;
+        }
     }
-    if (rhs->m_next < lhs->m_next) {
-        return false;
+
+    /**
+     * @brief 到下一个需要处理的刻度的时间间隔(毫秒)
+     * @details 第0层的槽位是精确的到期时间; 上层只能给出级联的刻度,
+     *          是实际到期时间的下界, 到时推进一次后会重新计算
+     */
+    uint64_t nextTimeout(uint64_t now_ms) const
+    {
+        if (m_size == 0) {
+            return ~0ull;
+        }
+        uint64_t tick = ~0ull;
+        for (uint64_t i = 0; m_nearSize && i < kNearSize; ++i) {
+            if (m_near[(m_current + i) & kNearMask]) {
+                tick = m_current + i;
+                break;
+            }
+        }
+        for (size_t level = 0; level < kLevelCount; ++level) {
+            uint64_t shift = kNearBits + kLevelBits * level;
+            uint64_t base = m_current >> shift;
+            // 当前刻度正好在本层边界上时, 当前槽位还没有级联, 要从它开始找
+            uint64_t first = (m_current & ((1ull << shift) - 1)) ? 1 : 0;
+            for (uint64_t i = first; i < first + kLevelSize; ++i) {
+                if (m_levels[level][(base + i) & kLevelMask]) {
+                    tick = std::min(tick, (base + i) << shift);
+                    break;
+                }
+            }
+        }
+        return tick > now_ms ? tick - now_ms : 0;
+    }
+
+    size_t size() const { return m_size; }
+
+public:
+    /// 分片锁
+    MutexType m_mutex;
+    /// 调度线程按本分片计算的等待时间点(毫秒), 早于它的定时器需要唤醒
+    std::atomic<uint64_t> m_nextDeadline{~0ull};
+    /// 本分片是否已经触发过onTimerInsertedAtFront
+    std::atomic<bool> m_tickled{false};
+
+private:
+    void unlink(Timer *t)
+    {
+        if (t->m_prev) {
+            t->m_prev->m_succ = t->m_succ;
+        } else {
+            *t->m_slot = t->m_succ;
+        }
+        if (t->m_succ) {
+            t->m_succ->m_prev = t->m_prev;
+        }
+        t->m_slot = nullptr;
+        t->m_prev = t->m_succ = nullptr;
     }
-    return lhs.get() < rhs.get();
-}
+
+    /**
+     * @brief 第0层转完一圈, 把上层当前刻度对应的槽位重新分配到下层
+     */
+    void cascade()
+    {
+        for (size_t level = 0; level < kLevelCount; ++level) {
+            size_t idx = (m_current >> (kNearBits + kLevelBits * level)) & kLevelMask;
+            Timer *t = m_levels[level][idx];
+            m_levels[level][idx] = nullptr;
+            while (t) {
+                Timer *succ = t->m_succ;
+                t->m_slot = nullptr;
+                t->m_prev = t->m_succ = nullptr;
+                --m_size;
+                add(std::move(t->m_self));
+                t = succ;
+            }
+            if (idx) {
+                break;
+            }
+        }
+    }
+
+    void takeAll(std::vector<Timer::ptr> &out)
+    {
+        auto take = [&out](Timer *&head) {
+            Timer *t = head;
+            head = nullptr;
+            while (t) {
+                Timer *succ = t->m_succ;
+                t->m_slot = nullptr;
+                t->m_prev = t->m_succ = nullptr;
+                out.push_back(std::move(t->m_self));
+                t = succ;
+            }
+        };
+        for (auto &slot : m_near) {
+            take(slot);
+        }
+        for (auto &level : m_levels) {
+            for (auto &slot : level) {
+                take(slot);
+            }
+        }
+        m_size = 0;
+        m_nearSize = 0;
+    }
+
+private:
+    /// 第0层槽位
+    Timer *m_near[kNearSize] = {};
+    /// 上层槽位
+    Timer *m_levels[kLevelCount][kLevelSize] = {};
+    /// 当前刻度(毫秒), 小于它的刻度都已处理
+    uint64_t m_current = 0;
+    /// 定时器总数
+    std::atomic<size_t> m_size{0};
+    /// 第0层的定时器数
+    size_t m_nearSize = 0;
+};
 
 Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager)
     : m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager)
@@ -30,17 +253,13 @@ Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager
     m_next = base::GetCurrentMS() + m_ms;
 }
 
-Timer::Timer(uint64_t next) : m_next(next)
-{
-}
-
 bool Timer::cancel()
 {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+    Timer::ptr self;
+    TimerWheel::MutexType::Lock lock(m_wheel->m_mutex);
     if (m_cb) {
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+        self = m_wheel->remove(this);
         return true;
     }
     return false;
@@ -48,17 +267,13 @@ bool Timer::cancel()
 
 bool Timer::refresh()
 {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if (!m_cb) {
+    TimerWheel::MutexType::Lock lock(m_wheel->m_mutex);
+    if (!m_cb || !m_slot) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
-        return false;
-    }
-    m_manager->m_timers.erase(it);
+    Timer::ptr self = m_wheel->remove(this);
     m_next = base::GetCurrentMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    m_wheel->add(std::move(self));
     return true;
 }
 
@@ -67,15 +282,11 @@ bool Timer::reset(uint64_t ms, bool from_now)
     if (ms == m_ms && !from_now) {
         return true;
     }
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if (!m_cb) {
+    TimerWheel::MutexType::Lock lock(m_wheel->m_mutex);
+    if (!m_cb || !m_slot) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
-        return false;
-    }
-    m_manager->m_timers.erase(it);
+    Timer::ptr self = m_wheel->remove(this);
     uint64_t start = 0;
     if (from_now) {
         start = base::GetCurrentMS();
@@ -84,13 +295,21 @@ bool Timer::reset(uint64_t ms, bool from_now)
     }
     m_ms = ms;
     m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(), lock);
+    uint64_t next = m_next;
+    m_wheel->add(std::move(self));
+    lock.unlock();
+    m_manager->onTimerAdded(m_wheel, next);
     return true;
 }
 
-TimerManager::TimerManager()
+TimerManager::TimerManager(size_t shards)
 {
-    m_previouseTime = base::GetCurrentMS();
+    uint64_t now_ms = base::GetCurrentMS();
+    m_previouseTime = now_ms;
+    shards = shards ? shards : 1;
+    for (size_t i = 0; i < shards; ++i) {
+        m_wheels.emplace_back(new TimerWheel(now_ms));
+    }
 }
 
 TimerManager::~TimerManager()
@@ -100,8 +319,14 @@ TimerManager::~TimerManager()
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring)
 {
     Timer::ptr timer = base::protected_make_shared<Timer>(ms, cb, recurring, this);
-    RWMutexType::WriteLock lock(m_mutex);
-    addTimer(timer, lock);
+    TimerWheel *wheel = getWheel();
+    timer->m_wheel = wheel;
+    uint64_t next = timer->m_next;
+    {
+        TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+        wheel->add(timer);
+    }
+    onTimerAdded(wheel, next);
     return timer;
 }
 
@@ -121,88 +346,93 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
 
 uint64_t TimerManager::getNextTimer()
 {
-    RWMutexType::ReadLock lock(m_mutex);
-    m_tickled = false;
-    if (m_timers.empty()) {
-        return ~0ull;
-    }
-
-    const Timer::ptr &next = *m_timers.begin();
     uint64_t now_ms = base::GetCurrentMS();
-    if (now_ms >= next->m_next) {
-        return 0;
-    } else {
-        return next->m_next - now_ms;
+    uint64_t next = ~0ull;
+    for (auto &wheel : m_wheels) {
+        // 计算期间加入本分片的定时器都会触发唤醒, 之后再写入真正的等待时间点
+        wheel->m_nextDeadline = ~0ull;
+        wheel->m_tickled = false;
+        if (!wheel->size()) {
+            continue;
+        }
+        TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+        uint64_t timeout = wheel->nextTimeout(now_ms);
+        if (timeout != ~0ull) {
+            wheel->m_nextDeadline = now_ms + timeout;
+        }
+        next = std::min(next, timeout);
     }
+    return next;
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> > &cbs)
 {
     uint64_t now_ms = base::GetCurrentMS();
+    bool rollover = detectClockRollover(now_ms);
     std::vector<Timer::ptr> expired;
-    {
-        RWMutexType::ReadLock lock(m_mutex);
-        if (m_timers.empty()) {
-            return;
+    for (auto &wheel : m_wheels) {
+        if (!wheel->size() && !rollover) {
+            continue;
+        }
+        TimerWheel::MutexType::Lock lock(wheel->m_mutex);
+        size_t begin = expired.size();
+        wheel->expire(now_ms, rollover, expired);
+        for (size_t i = begin; i < expired.size(); ++i) {
+            Timer *timer = expired[i].get();
+            if (timer->m_recurring) {
+                cbs.push_back(timer->m_cb);
+                timer->m_next = now_ms + timer->m_ms;
+                wheel->add(std::move(expired[i]));
+            } else {
+                cbs.push_back(std::move(timer->m_cb));
+                timer->m_cb = nullptr;
+            }
         }
     }
-    RWMutexType::WriteLock lock(m_mutex);
-    if (m_timers.empty()) {
-        return;
-    }
-    bool rollover = detectClockRollover(now_ms);
-    if (!rollover && ((*m_timers.begin())->m_next > now_ms)) {
-        return;
-    }
+}
 
-    Timer::ptr now_timer = base::protected_make_shared<Timer>(now_ms);
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while (it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
+/// 当前线程认领的分片所属的TimerManager及下标
+static thread_local TimerManager *t_wheel_owner = nullptr;
+static thread_local size_t t_wheel_index = 0;
 
-    for (auto &timer : expired) {
-        cbs.push_back(timer->m_cb);
-        if (timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
-        } else {
-            timer->m_cb = nullptr;
-        }
-    }
+void TimerManager::claimWheel()
+{
+    t_wheel_owner = this;
+    t_wheel_index = m_wheelClaims++ % m_wheels.size();
 }
 
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock &lock)
+TimerWheel *TimerManager::getWheel()
 {
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
-    if (at_front) {
-        m_tickled = true;
+    if (m_wheels.size() == 1) {
+        return m_wheels[0].get();
     }
-    lock.unlock();
+    if (t_wheel_owner == this) {
+        return m_wheels[t_wheel_index].get();
+    }
+    return m_wheels[m_wheelCursor.fetch_add(1, std::memory_order_relaxed) % m_wheels.size()].get();
+}
 
-    if (at_front) {
+void TimerManager::onTimerAdded(TimerWheel *wheel, uint64_t next)
+{
+    if (next < wheel->m_nextDeadline && !wheel->m_tickled.exchange(true)) {
         onTimerInsertedAtFront();
     }
 }
 
 bool TimerManager::detectClockRollover(uint64_t now_ms)
 {
-    bool rollover = false;
-    if (now_ms < m_previouseTime && now_ms < (m_previouseTime - 60 * 60 * 1000)) {
-        rollover = true;
-    }
-    m_previouseTime = now_ms;
-    return rollover;
+    uint64_t previous = m_previouseTime.exchange(now_ms);
+    return now_ms < previous && now_ms < (previous - 60 * 60 * 1000);
 }
 
 bool TimerManager::hasTimer()
 {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    for (auto &wheel : m_wheels) {
+        if (wheel->size()) {
+            return true;
+        }
+    }
+    return false;
 }
 
 } // namespace base
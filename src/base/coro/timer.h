@@ -1,20 +1,23 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
-#include <set>
 #include "base/thread.h"
 
 namespace base
 {
 
 class TimerManager;
+class TimerWheel;
 /**
  * @brief 定时器
  */
 class Timer : public std::enable_shared_from_this<Timer>
 {
     friend class TimerManager;
+    friend class TimerWheel;
 
 public:
     /// 定时器的智能指针类型
@@ -46,11 +49,6 @@ protected:
      * @param[in] manager 定时器管理器
      */
     Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager);
-    /**
-     * @brief 构造函数
-     * @param[in] next 执行的时间戳(毫秒)
-     */
-    Timer(uint64_t next);
 
 private:
     /// 是否循环定时器
@@ -63,36 +61,36 @@ private:
     std::function<void()> m_cb;
     /// 定时器管理器
     TimerManager *m_manager = nullptr;
-
-private:
-    /**
-     * @brief 定时器比较仿函数
-     */
-    struct Comparator {
-        /**
-         * @brief 比较定时器的智能指针的大小(按执行时间排序)
-         * @param[in] lhs 定时器智能指针
-         * @param[in] rhs 定时器智能指针
-         */
-        bool operator()(const Timer::ptr &lhs, const Timer::ptr &rhs) const;
-    };
+    /// 所属的时间轮分片, 创建后不变
+    TimerWheel *m_wheel = nullptr;
+    /// 所在槽位的链表头, 不在时间轮中为nullptr
+    Timer **m_slot = nullptr;
+    /// 槽位链表的前驱
+    Timer *m_prev = nullptr;
+    /// 槽位链表的后继
+    Timer *m_succ = nullptr;
+    /// 在时间轮中时持有自身, 保证槽位中的裸指针有效
+    Timer::ptr m_self;
 };
 
 /**
  * @brief 定时器管理器
+ * @details 定时器存放在分层时间轮中(1ms精度, 256 + 4*64 个槽位, 约覆盖49天),
+ *          添加/取消都是 O(1) 的链表操作.
+ *          时间轮按线程分片, 每个分片一把自旋锁, 线程总是往自己的分片添加定时器,
+ *          hook 的 IO 超时定时器在不同线程间不会互相竞争.
+ *          listExpiredCb 依次推进各个分片, 每个分片只加一次锁批量取出到期的定时器.
  */
 class TimerManager
 {
     friend class Timer;
 
 public:
-    /// 读写锁类型
-    typedef RWMutex RWMutexType;
-
     /**
      * @brief 构造函数
+     * @param[in] shards 时间轮分片数, 一般等于调度线程数
      */
-    TimerManager();
+    TimerManager(size_t shards = 1);
 
     /**
      * @brief 析构函数
@@ -140,25 +138,38 @@ protected:
     virtual void onTimerInsertedAtFront() = 0;
 
     /**
-     * @brief 将定时器添加到管理器中
+     * @brief 当前线程认领一个时间轮分片, 之后本线程添加的定时器都放在这个分片
+     * @details 由调度线程启动时调用, 线程数不超过分片数时各线程的分片互不相同;
+     *          没有认领过的线程轮流使用各分片
      */
-    void addTimer(Timer::ptr val, RWMutexType::WriteLock &lock);
+    void claimWheel();
 
 private:
+    /**
+     * @brief 当前线程对应的时间轮分片
+     */
+    TimerWheel *getWheel();
+
+    /**
+     * @brief 新加入的定时器早于调度线程按该分片计算的等待时间时, 触发onTimerInsertedAtFront
+     * @details 调用时不能持有分片的锁
+     */
+    void onTimerAdded(TimerWheel *wheel, uint64_t next);
+
     /**
      * @brief 检测服务器时间是否被调后了
      */
     bool detectClockRollover(uint64_t now_ms);
 
 private:
-    /// Mutex
-    RWMutexType m_mutex;
-    /// 定时器集合
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    /// 是否触发onTimerInsertedAtFront
-    bool m_tickled = false;
+    /// 时间轮分片
+    std::vector<std::unique_ptr<TimerWheel> > m_wheels;
+    /// 已经被调度线程认领的分片数
+    std::atomic<size_t> m_wheelClaims{0};
+    /// 没有认领分片的线程下一次使用的分片
+    std::atomic<size_t> m_wheelCursor{0};
     /// 上次执行时间
-    uint64_t m_previouseTime = 0;
+    std::atomic<uint64_t> m_previouseTime{0};
 };
 
 } // namespace base
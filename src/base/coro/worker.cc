@@ -1,6 +1,7 @@
 #include "worker.h"
 #include "base/conf/config.h"
 #include "base/util.h"
+#include "base/coro/fiber_local.h"
 
 namespace base
 {
@@ -9,46 +10,267 @@ static base::ConfigVar<std::map<std::string, std::map<std::string, std::string>
     g_worker_config = base::Config::Lookup(
         "workers", std::map<std::string, std::map<std::string, std::string> >(), "worker config");
 
+/**
+ * @brief 任务组的取消状态
+ * @details 任务执行期间放在协程局部存储中, 可以被派生的协程继承. 创建任务组时记录外层任务组的状态,
+ *          外层取消时内层也视为取消
+ */
+struct WorkerGroup::Context : FiberLocalValue {
+    explicit Context(FiberLocalValue *p) : parent(p)
+    {
+        if (parent) {
+            parent->ref();
+        }
+    }
+    ~Context()
+    {
+        if (parent) {
+            parent->unref();
+        }
+    }
+
+    bool isCancelled() const
+    {
+        for (const Context *c = this; c; c = static_cast<const Context *>(c->parent)) {
+            if (c->cancelled.load(std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::atomic<bool> cancelled = {false};
+    FiberLocalValue *parent;
+};
+
+/// 当前任务所在任务组的 Context
+static size_t s_context_slot = FiberLocalStorage::AllocSlot(true);
+
 WorkerGroup::WorkerGroup(uint32_t batch_size, base::Scheduler *s)
-    : m_batchSize(batch_size), m_finish(false), m_scheduler(s), m_sem(batch_size)
+    : m_batchSize(std::max<uint32_t>(batch_size, 1)), m_scheduler(s),
+      m_ctx(new Context(FiberLocalStorage::Current()->get(s_context_slot))),
+      m_limit(m_batchSize)
 {
 }
 
 WorkerGroup::~WorkerGroup()
 {
     waitAll();
+    m_ctx->unref();
 }
 
 void WorkerGroup::schedule(std::function<void()> cb, int thread)
 {
-    m_sem.wait();
-    m_scheduler->schedule(std::bind(&WorkerGroup::doWork, shared_from_this(), cb), thread);
+    submit(std::move(cb), thread, true, true);
 }
 
 void WorkerGroup::schedule(const std::vector<std::function<void()> > &cbs)
 {
-    std::vector<std::function<void()> > cs;
     for (auto &i : cbs) {
-        cs.push_back(std::bind(&WorkerGroup::doWork, shared_from_this(), i));
-        m_sem.wait();
+        submit(i, -1, true, true);
     }
-    m_scheduler->schedule(cs.begin(), cs.end());
 }
 
-void WorkerGroup::doWork(std::function<void()> cb)
+bool WorkerGroup::trySchedule(std::function<void()> cb, int thread)
 {
-    cb();
-    m_sem.notify();
+    return submit(std::move(cb), thread, false, true);
+}
+
+bool WorkerGroup::submit(std::function<void()> cb, int thread, bool block, bool skip_cancelled)
+{
+    FiberParkNode<FiberWaiter> waiter;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (isCancelled()) {
+            ++m_stats.cancelled;
+            return false;
+        }
+        if (m_running < m_limit) {
+            ++m_running;
+            ++m_stats.submitted;
+        } else if (!block) {
+            return false;
+        } else {
+            waiter->init();
+            m_slotWaiters.push(waiter.get());
+            ++m_stats.throttled;
+        }
+    }
+    if (waiter) {
+        // 完成的任务把名额直接交给本协程, 取消时 ok 为 false
+        FiberWaiter::Park();
+        if (!waiter->ok) {
+            return false;
+        }
+    }
+    // 回调可能持有任务组的最后一个外部引用, 任务自己持有一个引用,
+    // doWork 中释放回调时不会在名额归还之前析构任务组
+    m_scheduler->schedule(
+        [self = shared_from_this(), skip_cancelled, cb = std::move(cb)]() mutable {
+            self->doWork(cb, skip_cancelled);
+        },
+        thread);
+    return true;
+}
+
+void WorkerGroup::doWork(std::function<void()> &cb, bool skip_cancelled)
+{
+    bool skipped = skip_cancelled && isCancelled();
+    uint64_t latency = 0;
+    if (!skipped) {
+        FiberLocalStorage *ls = FiberLocalStorage::Current();
+        FiberLocalValue *old = ls->get(s_context_slot);
+        if (old) {
+            old->ref();
+        }
+        m_ctx->ref();
+        ls->set(s_context_slot, m_ctx);
+        uint64_t start = GetCurrentUS();
+        cb();
+        latency = GetCurrentUS() - start;
+        FiberLocalStorage::Current()->set(s_context_slot, old);
+    }
+    // 归还名额之前释放回调, 回调持有的资源不会比任务组活得更久
+    cb = nullptr;
+
+    FiberWakeList wakeups;
+    {
+        MutexType::Lock lock(m_mutex);
+        --m_running;
+        if (skipped) {
+            ++m_stats.cancelled;
+        } else {
+            ++m_stats.completed;
+            m_latency.record(latency);
+            adjustLimit(latency);
+        }
+        collectWakeups(wakeups);
+    }
+    // 释放锁之后不能再访问 this, 等待者醒来后可能析构任务组
+    wakeups.wakeAll();
+}
+
+void WorkerGroup::adjustLimit(uint64_t latency_us)
+{
+    if (!m_targetUs) {
+        return;
+    }
+    if (latency_us > m_targetUs) {
+        uint64_t now = GetCurrentUS();
+        // 一次过载会让一批在途任务都超时, 每个目标时长内只减一次
+        if (m_limit > m_minLimit && now - m_lastDecreaseUs >= m_targetUs) {
+            m_limit = std::max(m_minLimit, m_limit / 2);
+            m_lastDecreaseUs = now;
+            m_increaseCredit = 0;
+            ++m_stats.limitDecreases;
+        }
+    } else if (m_limit < m_batchSize && ++m_increaseCredit >= m_limit) {
+        ++m_limit;
+        m_increaseCredit = 0;
+        ++m_stats.limitIncreases;
+    }
+}
+
+void WorkerGroup::collectWakeups(FiberWakeList &wakeups)
+{
+    while (m_running < m_limit) {
+        FiberWaiter *w = m_slotWaiters.popClaimed();
+        if (!w) {
+            break;
+        }
+        ++m_running;
+        ++m_stats.submitted;
+        w->ok = true;
+        wakeups.push(w);
+    }
+    if (!m_running) {
+        while (FiberWaiter *w = m_idleWaiters.popClaimed()) {
+            w->ok = true;
+            wakeups.push(w);
+        }
+    }
 }
 
 void WorkerGroup::waitAll()
 {
-    if (!m_finish) {
-        m_finish = true;
-        for (uint32_t i = 0; i < m_batchSize; ++i) {
-            m_sem.wait();
+    FiberParkNode<FiberWaiter> waiter;
+    {
+        MutexType::Lock lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        waiter->init();
+        m_idleWaiters.push(waiter.get());
+    }
+    FiberWaiter::Park();
+}
+
+void WorkerGroup::setAdaptive(uint32_t target_latency_ms, uint32_t min_limit)
+{
+    FiberWakeList wakeups;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_targetUs = target_latency_ms * 1000ull;
+        m_minLimit = std::min(std::max<uint32_t>(min_limit, 1), m_batchSize);
+        m_increaseCredit = 0;
+        if (!m_targetUs) {
+            m_limit = m_batchSize;
+        }
+        collectWakeups(wakeups);
+    }
+    wakeups.wakeAll();
+}
+
+void WorkerGroup::cancel()
+{
+    FiberWakeList wakeups;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_ctx->cancelled.store(true, std::memory_order_relaxed);
+        while (FiberWaiter *w = m_slotWaiters.popClaimed()) {
+            w->ok = false;
+            wakeups.push(w);
+            ++m_stats.cancelled;
         }
     }
+    wakeups.wakeAll();
+}
+
+bool WorkerGroup::isCancelled() const
+{
+    return m_ctx->isCancelled();
+}
+
+bool WorkerGroup::IsCancelled()
+{
+    const Context *ctx =
+        static_cast<const Context *>(FiberLocalStorage::Current()->get(s_context_slot));
+    return ctx && ctx->isCancelled();
+}
+
+WorkerGroup::Stats WorkerGroup::getStats()
+{
+    Stats rt;
+    {
+        MutexType::Lock lock(m_mutex);
+        rt = m_stats;
+        rt.running = m_running;
+        rt.limit = m_limit;
+    }
+    rt.latency = m_latency.snapshot();
+    return rt;
+}
+
+std::ostream &WorkerGroup::dump(std::ostream &os)
+{
+    Stats stats = getStats();
+    os << "[WorkerGroup batch_size=" << m_batchSize << " limit=" << stats.limit
+       << " running=" << stats.running << " submitted=" << stats.submitted
+       << " completed=" << stats.completed << " cancelled=" << stats.cancelled
+       << " throttled=" << stats.throttled << " limit_increases=" << stats.limitIncreases
+       << " limit_decreases=" << stats.limitDecreases << " p50_us=" << stats.latency.percentile(0.5)
+       << " p99_us=" << stats.latency.percentile(0.99) << " cancel=" << isCancelled() << "]";
+    return os;
 }
 
 TimedWorkerGroup::ptr TimedWorkerGroup::Create(uint32_t batch_size, uint32_t wait_ms,
@@ -149,12 +371,69 @@ IOManager::ptr WorkerManager::getAsIOManager(const std::string &name)
     return std::dynamic_pointer_cast<IOManager>(get(name));
 }
 
+std::vector<IOManager::ptr> WorkerManager::getAllAsIOManager(const std::string &name)
+{
+    std::vector<IOManager::ptr> rt;
+    auto it = m_datas.find(name);
+    if (it == m_datas.end()) {
+        return rt;
+    }
+    for (auto &i : it->second) {
+        auto iom = std::dynamic_pointer_cast<IOManager>(i);
+        if (iom) {
+            rt.push_back(iom);
+        }
+    }
+    return rt;
+}
+
+/**
+ * @brief 从 workers 配置中解析线程放置策略
+ * @details cpus: CPU列表("0-3,8"); numa_node: 绑定的NUMA节点, 没有配置cpus时使用节点上的所有CPU;
+ *          numa_local_alloc: 线程优先从numa_node(未配置时为CPU所在节点)分配内存;
+ *          pin_mode: set(默认, 线程共享整个CPU集合) 或 thread(每个线程绑定一个CPU)
+ */
+static Scheduler::Placement ParsePlacement(const std::string &name,
+                                           const std::map<std::string, std::string> &conf)
+{
+    static base::Logger::ptr s_logger = _LOG_NAME("system");
+    Scheduler::Placement placement;
+    std::string cpus = base::GetParamValue<std::string>(conf, "cpus", "");
+    int32_t numa_node = base::GetParamValue(conf, "numa_node", -1);
+    if (!cpus.empty()) {
+        placement.cpus = Thread::ParseCpuList(cpus);
+        if (placement.cpus.empty()) {
+            _LOG_ERROR(s_logger) << "worker=" << name << " invalid cpus=" << cpus;
+        }
+    } else if (numa_node >= 0) {
+        placement.cpus = Thread::GetNumaNodeCpus(numa_node);
+        if (placement.cpus.empty()) {
+            _LOG_ERROR(s_logger) << "worker=" << name << " numa_node=" << numa_node
+                                 << " has no cpus";
+        }
+    }
+    placement.pinPerThread = base::GetParamValue<std::string>(conf, "pin_mode", "set") == "thread";
+    if (base::GetParamValue(conf, "numa_local_alloc", 0)) {
+        placement.memNode = numa_node;
+        if (placement.memNode < 0 && !placement.cpus.empty()) {
+            placement.memNode = Thread::GetCpuNumaNode(placement.cpus[0]);
+        }
+    }
+    return placement;
+}
+
 bool WorkerManager::init(const std::map<std::string, std::map<std::string, std::string> > &v)
 {
     for (auto &i : v) {
         std::string name = i.first;
         int32_t thread_num = base::GetParamValue(i.second, "thread_num", 1);
         int32_t worker_num = base::GetParamValue(i.second, "worker_num", 1);
+        Scheduler::Placement placement = ParsePlacement(name, i.second);
+        // per_core: 每个CPU一个IOManager, 忽略 worker_num
+        bool per_core = base::GetParamValue(i.second, "per_core", 0) && !placement.cpus.empty();
+        if (per_core) {
+            worker_num = placement.cpus.size();
+        }
 
         for (int32_t x = 0; x < worker_num; ++x) {
             Scheduler::ptr s;
@@ -163,6 +442,16 @@ bool WorkerManager::init(const std::map<std::string, std::map<std::string, std::
             } else {
                 s = std::make_shared<IOManager>(thread_num, false, name + "-" + std::to_string(x));
             }
+            if (per_core) {
+                Scheduler::Placement core = placement;
+                core.cpus = {placement.cpus[x]};
+                if (core.memNode >= 0 && base::GetParamValue(i.second, "numa_node", -1) < 0) {
+                    core.memNode = Thread::GetCpuNumaNode(core.cpus[0]);
+                }
+                s->setPlacement(core);
+            } else if (!placement.empty()) {
+                s->setPlacement(placement);
+            }
             add(name, s);
         }
     }
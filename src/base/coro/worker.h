@@ -1,17 +1,54 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include "base/mutex.h"
 #include "base/singleton.h"
 #include "base/log/log.h"
 #include "base/coro/iomanager.h"
+#include "base/coro/fiber_sync.h"
+#include "base/coro/scheduler_stats.h"
 
 namespace base
 {
 
+/**
+ * @brief 有并发上限的协程任务组
+ * @details schedule 在运行中的任务数达到上限时挂起调用协程(背压), trySchedule 则直接返回 false.
+ *          setAdaptive 开启后按任务执行耗时用 AIMD 调整上限: 耗时不超过目标时每完成约 limit 个任务
+ *          上限加1, 超过目标时上限减半(每个目标时长内最多减一次), 范围是 [min_limit, batch_size].
+ *          cancel 之后未开始的任务被跳过, 新任务不再接受; 运行中的任务和它们派生的协程、任务组
+ *          通过 WorkerGroup::IsCancelled() 观察到取消
+ */
 class WorkerGroup : Noncopyable, public std::enable_shared_from_this<WorkerGroup>
 {
 public:
     typedef std::shared_ptr<WorkerGroup> ptr;
+    typedef Spinlock MutexType;
+
+    /**
+     * @brief 任务组统计
+     */
+    struct Stats {
+        /// 接受的任务数
+        uint64_t submitted = 0;
+        /// 执行完成的任务数
+        uint64_t completed = 0;
+        /// 因取消被跳过或拒绝的任务数
+        uint64_t cancelled = 0;
+        /// 因达到并发上限而挂起的次数
+        uint64_t throttled = 0;
+        /// 自适应上限增加/减少的次数
+        uint64_t limitIncreases = 0;
+        uint64_t limitDecreases = 0;
+        /// 已接受还未完成的任务数
+        uint32_t running = 0;
+        /// 当前并发上限
+        uint32_t limit = 0;
+        /// 任务执行耗时
+        LatencyHistogram::Snapshot latency;
+    };
+
     static WorkerGroup::ptr Create(uint32_t batch_size,
                                    base::Scheduler *s = base::Scheduler::GetThis())
     {
@@ -21,18 +58,161 @@ public:
     WorkerGroup(uint32_t batch_size, base::Scheduler *s = base::Scheduler::GetThis());
     ~WorkerGroup();
 
+    /**
+     * @brief 提交任务, 达到并发上限时挂起直到有任务完成
+     * @details 已取消时任务被丢弃
+     */
     void schedule(std::function<void()> cb, int thread = -1);
     void schedule(const std::vector<std::function<void()> > &cbs);
+
+    /**
+     * @brief 不挂起的提交
+     * @return 达到并发上限或已取消时返回 false, 任务没有被提交
+     */
+    bool trySchedule(std::function<void()> cb, int thread = -1);
+
+    /**
+     * @brief 等待所有已提交的任务完成, 之后任务组可以继续使用
+     */
     void waitAll();
 
+    /**
+     * @brief 开启按执行耗时自适应调整并发上限(AIMD)
+     * @param[in] target_latency_ms 目标执行耗时, 0 关闭自适应并恢复为 batch_size
+     * @param[in] min_limit 并发上限的下限
+     */
+    void setAdaptive(uint32_t target_latency_ms, uint32_t min_limit = 1);
+
+    /**
+     * @brief 取消任务组, 唤醒等待提交的协程
+     */
+    void cancel();
+
+    bool isCancelled() const;
+
+    /**
+     * @brief 当前任务所在的任务组(或外层任务组)是否已取消
+     * @details 在 WorkerGroup 的任务以及它派生的协程中有效, 其它地方返回 false
+     */
+    static bool IsCancelled();
+
+    /**
+     * @brief 把 [begin, end) 切成大小为 grain 的块并行执行 fn(i), 等待全部完成
+     * @details 块数受任务组的并发上限约束. grain 为0时按并发上限的4倍切块.
+     *          取消后未开始的块被跳过, 运行中的块在下一个下标前停止
+     * @return 全部执行完返回 true, 被取消返回 false
+     */
+    template <class Fn>
+    bool parallelFor(size_t begin, size_t end, Fn fn, size_t grain = 0)
+    {
+        if (begin >= end) {
+            return !isCancelled();
+        }
+        size_t n = end - begin;
+        if (!grain) {
+            grain = std::max<size_t>(1, (n + m_batchSize * 4 - 1) / (m_batchSize * 4));
+        }
+        WaitGroup wg;
+        std::atomic<bool> stopped = {false};
+        for (size_t i = begin; i < end; i += grain) {
+            size_t last = std::min(end, i + grain);
+            wg.add(1);
+            auto chunk = [&fn, &wg, &stopped, i, last]() {
+                for (size_t x = i; x < last; ++x) {
+                    if (IsCancelled()) {
+                        stopped = true;
+                        break;
+                    }
+                    fn(x);
+                }
+                wg.done();
+            };
+            // 块在取消后也要执行, 由块内检查取消并 done
+            if (!submit(chunk, -1, true, false)) {
+                wg.done();
+                stopped = true;
+                break;
+            }
+        }
+        wg.wait();
+        return !stopped;
+    }
+
+    /**
+     * @brief 对 in 中每个元素并行执行 fn, 按原顺序返回结果
+     * @details 被取消时未执行的元素保持默认值, ok 不为空时写入是否全部执行完
+     */
+    template <class T, class Fn>
+    auto parallelMap(const std::vector<T> &in, Fn fn, size_t grain = 0, bool *ok = nullptr)
+        -> std::vector<typename std::decay<decltype(fn(in[0]))>::type>
+    {
+        std::vector<typename std::decay<decltype(fn(in[0]))>::type> rt(in.size());
+        bool done = parallelFor(0, in.size(), [&](size_t i) { rt[i] = fn(in[i]); }, grain);
+        if (ok) {
+            *ok = done;
+        }
+        return rt;
+    }
+
+    Stats getStats();
+    std::ostream &dump(std::ostream &os);
+
+    uint32_t getBatchSize() const { return m_batchSize; }
+
 private:
-    void doWork(std::function<void()> cb);
+    /**
+     * @brief 占用一个并发名额并调度任务
+     * @param[in] block 达到上限时是否挂起
+     * @param[in] skip_cancelled 开始执行时任务组已取消是否跳过
+     * @return 被拒绝(已取消或不挂起且已满)时返回 false
+     */
+    bool submit(std::function<void()> cb, int thread, bool block, bool skip_cancelled);
+
+    /**
+     * @brief 执行任务并归还并发名额
+     */
+    void doWork(std::function<void()> &cb, bool skip_cancelled);
+
+    /**
+     * @brief 按一次执行耗时调整并发上限(AIMD)
+     * @pre 持有 m_mutex
+     */
+    void adjustLimit(uint64_t latency_us);
+
+    /**
+     * @brief 取出可以得到并发名额的提交者, 以及任务全部完成时 waitAll 的等待者
+     * @pre 持有 m_mutex
+     * @param[out] wakeups 待唤醒的等待者, 释放锁后再唤醒
+     */
+    void collectWakeups(FiberWakeList &wakeups);
 
 private:
+    struct Context;
+
+    /// 最大并发数
     uint32_t m_batchSize;
-    bool m_finish;
     Scheduler *m_scheduler;
-    FiberSemaphore m_sem;
+    /// 取消状态, 任务执行期间放在协程局部存储中
+    Context *m_ctx;
+    MutexType m_mutex;
+    /// 当前并发上限
+    uint32_t m_limit;
+    /// 已接受还未完成的任务数
+    uint32_t m_running = 0;
+    /// 自适应的目标耗时(微秒), 0表示不开启
+    uint64_t m_targetUs = 0;
+    /// 自适应上限的下限
+    uint32_t m_minLimit = 1;
+    /// 加法增加的计数, 达到 m_limit 时上限加1
+    uint32_t m_increaseCredit = 0;
+    /// 最近一次减小上限的时间(微秒)
+    uint64_t m_lastDecreaseUs = 0;
+    /// 等待并发名额的协程
+    FiberWaiterQueue m_slotWaiters;
+    /// waitAll 中等待的协程
+    FiberWaiterQueue m_idleWaiters;
+    Stats m_stats;
+    LatencyHistogram m_latency;
 };
 
 class TimedWorkerGroup : Noncopyable, public std::enable_shared_from_this<TimedWorkerGroup>
@@ -71,6 +251,10 @@ public:
     void add(Scheduler::ptr s);
     Scheduler::ptr get(const std::string &name);
     IOManager::ptr getAsIOManager(const std::string &name);
+    /**
+     * @brief 返回同名的所有IOManager(worker_num/per_core 创建的多个实例)
+     */
+    std::vector<IOManager::ptr> getAllAsIOManager(const std::string &name);
 
     template <class FiberOrCb>
     void schedule(const std::string &name, FiberOrCb fc, int thread = -1)
@@ -8,6 +8,7 @@
 #include "base/util.h"
 #include "base/macro.h"
 #include "base/application/env.h"
+#include "base/coro/fiber_local.h"
 
 namespace base
 {
@@ -170,6 +171,18 @@ public:
     }
 };
 
+class RequestIdFormatItem : public LogFormatter::FormatItem
+{
+public:
+    RequestIdFormatItem(const std::string &str = "") {}
+    void format(std::ostream &os, Logger::ptr logger, LogLevel::Level level,
+                LogEvent::ptr event) override
+    {
+        const RequestContext *ctx = RequestContext::Get();
+        os << (ctx && !ctx->requestId.empty() ? ctx->requestId : "-");
+    }
+};
+
 class ThreadNameFormatItem : public LogFormatter::FormatItem
 {
 public:
@@ -603,6 +616,7 @@ void LogFormatter::init()
             XX(T, TabFormatItem),        // T:Tab
             XX(F, FiberIdFormatItem),    // F:协程id
             XX(N, ThreadNameFormatItem), // N:线程名称
+            XX(R, RequestIdFormatItem),  // R:请求id(RequestContext)
 #undef XX
         };
 
@@ -310,6 +310,7 @@ public:
      *  %T 制表符
      *  %F 协程id
      *  %N 线程名称
+     *  %R 请求id(RequestContext)
      *
      *  默认格式 "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
      */
@@ -173,11 +173,14 @@ namespace http
                                  << " size=" << body.size();
             if (strcasecmp(content_encoding.c_str(), "gzip") == 0) {
                 auto zs = ZlibStream::CreateGzip(false);
+                // 局部对象, 解压大响应时允许在输出块之间让出
+                zs->setPreemptible(true);
                 zs->write(body.c_str(), body.size());
                 zs->flush();
                 zs->getResult().swap(body);
             } else if (strcasecmp(content_encoding.c_str(), "deflate") == 0) {
                 auto zs = ZlibStream::CreateDeflate(false);
+                zs->setPreemptible(true);
                 zs->write(body.c_str(), body.size());
                 zs->flush();
                 zs->getResult().swap(body);
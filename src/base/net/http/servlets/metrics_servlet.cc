@@ -1,11 +1,172 @@
 #include "metrics_servlet.h"
+#include "base/coro/scheduler.h"
 #include <prometheus/text_serializer.h>
+#include <set>
 
 namespace base
 {
 namespace http
 {
 
+    /**
+     * @brief 累加计数器, 本次快照比上次小(线程id被复用)时按从0开始计算
+     */
+    static void IncrementDelta(prometheus::Counter *counter, uint64_t cur, uint64_t last)
+    {
+        if (counter) {
+            counter->Increment(cur >= last ? cur - last : cur);
+        }
+    }
+
+    /**
+     * @brief 把直方图快照的增量同步到 prometheus 的直方图
+     */
+    static void ObserveDelta(prometheus::Histogram *histogram, const LatencyHistogram::Snapshot &cur,
+                             const LatencyHistogram::Snapshot &last)
+    {
+        if (!histogram) {
+            return;
+        }
+        bool reset = cur.count < last.count;
+        std::vector<double> increments(LatencyHistogram::kBuckets);
+        for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i) {
+            increments[i] = reset ? cur.buckets[i] : cur.buckets[i] - last.buckets[i];
+        }
+        double sum = reset ? cur.sum : cur.sum - last.sum;
+        histogram->ObserveMultiple(increments, sum / 1000000.0);
+    }
+
+    /**
+     * @brief 删除本轮没有出现的调度器留下的上次快照
+     * @param[in] last 按 (调度器id, 子键) 保存的上次快照
+     * @param[in] alive 本轮出现的调度器id
+     */
+    template <class T>
+    static void PruneStopped(std::map<std::pair<uint64_t, std::string>, T> &last,
+                             const std::set<uint64_t> &alive)
+    {
+        for (auto it = last.begin(); it != last.end();) {
+            if (alive.count(it->first.first)) {
+                ++it;
+            } else {
+                it = last.erase(it);
+            }
+        }
+    }
+
+    /**
+     * @brief 导出所有开启了统计的调度器的每线程指标
+     * @details 上次快照按调度器id保存, 调度器停止销毁后在下一次采集时删除
+     */
+    static void CollectSchedulerMetrics(PrometheusRegistry &registry)
+    {
+        // 只在 PrometheusRegistry::collect 中串行调用
+        static std::map<std::pair<uint64_t, std::string>, SchedulerThreadStats::Snapshot> s_last;
+        static std::vector<double> s_buckets;
+        if (s_buckets.empty()) {
+            for (size_t i = 0; i + 1 < LatencyHistogram::kBuckets; ++i) {
+                s_buckets.push_back(LatencyHistogram::UpperBound(i) / 1000000.0);
+            }
+        }
+
+        registry.addHistogram("scheduler_queue_wait_seconds",
+                              "time a task waits in the scheduler queue before running", {});
+        registry.addHistogram("scheduler_run_slice_seconds",
+                              "time a fiber runs before switching back to the scheduler", {});
+        registry.addCounter("scheduler_tasks_total", "tasks executed by the scheduler thread", {});
+        registry.addCounter("scheduler_context_switches_total",
+                            "switches from the scheduler fiber into task fibers", {});
+        registry.addCounter("scheduler_idle_switches_total",
+                            "switches from the scheduler fiber into the idle fiber", {});
+        registry.addCounter("scheduler_long_running_total",
+                            "run slices longer than scheduler.stats.long_running_ms", {});
+
+        struct SchedulerSnapshot {
+            uint64_t id;
+            std::string name;
+            std::vector<SchedulerThreadStats::Snapshot> threads;
+        };
+        std::vector<SchedulerSnapshot> all;
+        std::set<uint64_t> alive;
+        Scheduler::Visit([&all, &alive](Scheduler *sc) {
+            alive.insert(sc->getId());
+            if (sc->isStatsEnabled()) {
+                all.push_back({sc->getId(), sc->getName(), {}});
+                sc->getThreadStats(all.back().threads);
+            }
+        });
+        PruneStopped(s_last, alive);
+
+        for (auto &sc : all) {
+            for (auto &cur : sc.threads) {
+                std::string thread = std::to_string(cur.thread);
+                std::map<std::string, std::string> labels = {{"scheduler", sc.name},
+                                                             {"thread", thread}};
+                auto &last = s_last[{sc.id, thread}];
+                ObserveDelta(registry.addHistogramLabels("scheduler_queue_wait_seconds", labels,
+                                                         s_buckets),
+                             cur.queueWait, last.queueWait);
+                ObserveDelta(registry.addHistogramLabels("scheduler_run_slice_seconds", labels,
+                                                         s_buckets),
+                             cur.runSlice, last.runSlice);
+                IncrementDelta(registry.addCounterLabels("scheduler_tasks_total", labels),
+                               cur.tasks, last.tasks);
+                IncrementDelta(
+                    registry.addCounterLabels("scheduler_context_switches_total", labels),
+                    cur.switches, last.switches);
+                IncrementDelta(registry.addCounterLabels("scheduler_idle_switches_total", labels),
+                               cur.idleSwitches, last.idleSwitches);
+                IncrementDelta(registry.addCounterLabels("scheduler_long_running_total", labels),
+                               cur.longRunning, last.longRunning);
+                last = cur;
+            }
+        }
+
+        // 优先级队列统计不依赖 scheduler.stats.enable, 导出所有调度器
+        registry.addGauge("scheduler_lane_depth", "tasks waiting in the scheduler priority lane", {});
+        registry.addCounter("scheduler_deadline_missed_total",
+                            "tasks that started after their deadline", {});
+        static std::map<std::pair<uint64_t, std::string>, uint64_t> s_last_missed;
+        PruneStopped(s_last_missed, alive);
+        Scheduler::Visit([&registry](Scheduler *sc) {
+            Scheduler::LaneStats lanes[Fiber::kPriorityCount];
+            sc->getLaneStats(lanes);
+            for (int i = 0; i < Fiber::kPriorityCount; ++i) {
+                std::string lane = Fiber::PriorityToString((Fiber::Priority)i);
+                std::map<std::string, std::string> labels = {{"scheduler", sc->getName()},
+                                                             {"lane", lane}};
+                prometheus::Gauge *gauge = registry.addGaugeLabels("scheduler_lane_depth", labels);
+                if (gauge) {
+                    gauge->Set(lanes[i].depth);
+                }
+                auto &last = s_last_missed[{sc->getId(), lane}];
+                IncrementDelta(registry.addCounterLabels("scheduler_deadline_missed_total", labels),
+                               lanes[i].deadlineMissed, last);
+                last = lanes[i].deadlineMissed;
+            }
+        });
+
+        registry.addCounter("scheduler_preempt_requests_total",
+                            "run slices longer than scheduler.preempt.slice_ms", {});
+        registry.addCounter("scheduler_forced_yields_total",
+                            "fibers yielded at a safe point after a preempt request", {});
+        static std::map<std::pair<uint64_t, std::string>, Scheduler::PreemptStats> s_last_preempt;
+        PruneStopped(s_last_preempt, alive);
+        Scheduler::Visit([&registry](Scheduler *sc) {
+            Scheduler::PreemptStats cur = sc->getPreemptStats();
+            if (!cur.sliceMs) {
+                return;
+            }
+            std::map<std::string, std::string> labels = {{"scheduler", sc->getName()}};
+            auto &last = s_last_preempt[{sc->getId(), std::string()}];
+            IncrementDelta(registry.addCounterLabels("scheduler_preempt_requests_total", labels),
+                           cur.requests, last.requests);
+            IncrementDelta(registry.addCounterLabels("scheduler_forced_yields_total", labels),
+                           cur.forcedYields, last.forcedYields);
+            last = cur;
+        });
+    }
+
     MetricsServlet::MetricsServlet() : Servlet("MetricsServlet")
     {
     }
@@ -24,7 +185,11 @@ namespace http
 
     PrometheusRegistry::ptr GetPrometheusRegistry()
     {
-        static PrometheusRegistry::ptr s_instance = std::make_shared<PrometheusRegistry>();
+        static PrometheusRegistry::ptr s_instance = []() {
+            auto registry = std::make_shared<PrometheusRegistry>();
+            registry->addCollector("scheduler", &CollectSchedulerMetrics);
+            return registry;
+        }();
         return s_instance;
     }
 
@@ -3,6 +3,8 @@
 #include "base/application/module.h"
 #include "base/application/application.h"
 #include "base/coro/worker.h"
+#include "base/coro/scheduler.h"
+#include "base/coro/fiber_pool.h"
 
 namespace base
 {
@@ -92,12 +94,20 @@ namespace http
         ss << "===================================================" << std::endl;
         XX("fiber_type") << GetFiberTypeStr() << std::endl;
         XX("fibers") << base::Fiber::TotalFibers() << std::endl;
+        XX("fiber_stack_pool") << base::FiberStackPool::GetStats().toString() << std::endl;
         ss << "===================================================" << std::endl;
         ss << "<Logger>" << std::endl;
         ss << base::LoggerMgr::GetInstance()->toYamlString() << std::endl;
         ss << "===================================================" << std::endl;
         ss << "<Woker>" << std::endl;
         base::WorkerMgr::GetInstance()->dump(ss) << std::endl;
+        ss << "===================================================" << std::endl;
+        ss << "<Scheduler>" << std::endl;
+        base::Scheduler::Visit([&ss](base::Scheduler *sc) {
+            if (sc->isStatsEnabled()) {
+                sc->dumpStats(ss) << std::endl;
+            }
+        });
 
         std::map<std::string, std::vector<TcpServer::ptr> > servers;
         base::Application::GetInstance()->listAllServer(servers);
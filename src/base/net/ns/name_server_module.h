@@ -1,6 +1,7 @@
 #ifndef __BASE_NET_NS_NAME_SERVER_MODULE_H__
 #define __BASE_NET_NS_NAME_SERVER_MODULE_H__
 
+#include <set>
 #include "base/application/module.h"
 #include "ns_protocol.h"
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <set>
 #include "base/net/rock/rock_stream.h"
 #include "ns_protocol.h"
 
@@ -11,7 +11,8 @@ class Message
 {
 public:
     typedef std::shared_ptr<Message> ptr;
-    enum MessageType { REQUEST = 1, RESPONSE = 2, NOTIFY = 3 };
+    /// FRAME: 多路复用流的控制/数据帧
+    enum MessageType { REQUEST = 1, RESPONSE = 2, NOTIFY = 3, FRAME = 4 };
     virtual ~Message() {}
 
     virtual ByteArray::ptr toByteArray();
@@ -0,0 +1,214 @@
+#include "recv_buffer.h"
+#include "base/conf/config.h"
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <string.h>
+#include <vector>
+
+namespace base
+{
+
+static ConfigVar<uint32_t>::ptr g_recv_block_size = Config::Lookup(
+    "recv_buffer.block_size", (uint32_t)(64 * 1024), "pooled receive buffer block size");
+
+static ConfigVar<uint32_t>::ptr g_recv_pool_max =
+    Config::Lookup("recv_buffer.pool_max", (uint32_t)64, "max cached receive blocks per thread");
+
+static std::atomic<uint64_t> s_alloc{0};
+static std::atomic<uint64_t> s_reuse{0};
+static std::atomic<uint64_t> s_copied_bytes{0};
+
+/// Alloc 小于块大小的申请按 2 的幂分级, 最小一级 256 字节
+static const size_t kMinClassShift = 8;
+static const size_t kClassCount = 16;
+
+/**
+ * @brief 小于块大小的申请所在的级别
+ * @return 级别下标, 不小于块大小时返回 -1
+ */
+static int SizeClass(size_t size, size_t block_size)
+{
+    size_t shift = kMinClassShift;
+    while (((size_t)1 << shift) < size) {
+        ++shift;
+    }
+    if (((size_t)1 << shift) >= block_size || shift - kMinClassShift >= kClassCount) {
+        return -1;
+    }
+    return shift - kMinClassShift;
+}
+
+static size_t ClassSize(int idx)
+{
+    return (size_t)1 << (idx + kMinClassShift);
+}
+
+/**
+ * @brief 线程本地的空闲块
+ */
+struct RecvBlockCache : Noncopyable {
+    ~RecvBlockCache()
+    {
+        for (auto i : blocks) {
+            delete[] i;
+        }
+        for (auto &list : classes) {
+            for (auto i : list) {
+                delete[] i;
+            }
+        }
+    }
+
+    /// 空闲块(LIFO, 优先复用刚释放的热内存)
+    std::vector<char *> blocks;
+    /// 缓存中块的大小, 配置修改后旧块不再复用
+    size_t blockSize = 0;
+    /// 各级别的空闲内存
+    std::vector<char *> classes[kClassCount];
+};
+
+/// 线程退出后缓存已析构, 之后的释放直接 delete
+static thread_local bool t_cache_destroyed = false;
+
+struct RecvBlockCacheHolder {
+    ~RecvBlockCacheHolder() { t_cache_destroyed = true; }
+    RecvBlockCache cache;
+};
+
+static RecvBlockCache *GetThreadCache()
+{
+    if (t_cache_destroyed) {
+        return nullptr;
+    }
+    static thread_local RecvBlockCacheHolder s_holder;
+    return &s_holder.cache;
+}
+
+/**
+ * @brief 大小为 size 的内存在线程缓存中的空闲列表, 不缓存时返回 nullptr
+ */
+static std::vector<char *> *FreeList(RecvBlockCache *cache, size_t size)
+{
+    if (!cache) {
+        return nullptr;
+    }
+    if (size == cache->blockSize) {
+        return &cache->blocks;
+    }
+    int idx = SizeClass(size, g_recv_block_size->getValue());
+    if (idx >= 0 && ClassSize(idx) == size) {
+        return &cache->classes[idx];
+    }
+    return nullptr;
+}
+
+static void FreeBlock(char *ptr, size_t size)
+{
+    RecvBlockCache *cache = GetThreadCache();
+    if (cache && size == g_recv_block_size->getValue() && cache->blockSize != size) {
+        for (auto i : cache->blocks) {
+            delete[] i;
+        }
+        cache->blocks.clear();
+        cache->blockSize = size;
+    }
+    std::vector<char *> *list = FreeList(cache, size);
+    if (list && list->size() < g_recv_pool_max->getValue()) {
+        list->push_back(ptr);
+        return;
+    }
+    delete[] ptr;
+}
+
+static std::shared_ptr<char> AllocBlock(size_t size)
+{
+    ++s_alloc;
+    char *ptr = nullptr;
+    std::vector<char *> *list = FreeList(GetThreadCache(), size);
+    if (list && !list->empty()) {
+        ptr = list->back();
+        list->pop_back();
+        ++s_reuse;
+    } else {
+        ptr = new char[size];
+    }
+    return std::shared_ptr<char>(ptr, [size](char *p) { FreeBlock(p, size); });
+}
+
+std::string RecvBuffer::Stats::toString() const
+{
+    std::stringstream ss;
+    ss << "alloc=" << alloc << " reuse=" << reuse << " copied_bytes=" << copiedBytes;
+    return ss.str();
+}
+
+RecvBuffer::RecvBuffer()
+{
+}
+
+int RecvBuffer::fill(Stream::ptr stream, size_t n)
+{
+    while (readable() < n) {
+        if (m_rpos + n > m_capacity) {
+            grow(n);
+        }
+        int rt = stream->read(m_block.get() + m_wpos, m_capacity - m_wpos);
+        if (rt <= 0) {
+            return rt;
+        }
+        m_wpos += rt;
+    }
+    return readable();
+}
+
+void RecvBuffer::grow(size_t n)
+{
+    size_t left = readable();
+    if (m_block && m_block.use_count() == 1 && n <= m_capacity) {
+        // 没有消息引用这个块, 原地把尾部移到开头
+        memmove(m_block.get(), m_block.get() + m_rpos, left);
+    } else {
+        size_t size = std::max<size_t>(n, g_recv_block_size->getValue());
+        std::shared_ptr<char> block = AllocBlock(size);
+        if (left) {
+            memcpy(block.get(), m_block.get() + m_rpos, left);
+        }
+        m_block.swap(block);
+        m_capacity = size;
+    }
+    s_copied_bytes += left;
+    m_rpos = 0;
+    m_wpos = left;
+}
+
+void RecvBuffer::reset()
+{
+    m_rpos = m_wpos = 0;
+    if (m_block && m_block.use_count() > 1) {
+        m_block.reset();
+        m_capacity = 0;
+    }
+}
+
+std::shared_ptr<char> RecvBuffer::Alloc(size_t size)
+{
+    size_t block_size = g_recv_block_size->getValue();
+    int idx = SizeClass(size, block_size);
+    if (idx >= 0) {
+        return AllocBlock(ClassSize(idx));
+    }
+    // 不超过块大小时按整块申请以便复用, 超过时按实际大小
+    return AllocBlock(std::max<size_t>(size, block_size));
+}
+
+RecvBuffer::Stats RecvBuffer::GetStats()
+{
+    Stats rt;
+    rt.alloc = s_alloc;
+    rt.reuse = s_reuse;
+    rt.copiedBytes = s_copied_bytes;
+    return rt;
+}
+
+} // namespace base
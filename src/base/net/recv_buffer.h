@@ -0,0 +1,90 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "base/net/stream.h"
+#include "base/noncopyable.h"
+
+namespace base
+{
+
+/**
+ * @brief 连接的接收缓存
+ * @details 数据按块存放, 每次从流中尽量读满当前块, 一次 recv 可以读到多条消息.
+ *          解析方直接在块内解析帧, 通过 hold() 持有块来引用其中的消息体, 不需要复制.
+ *          块被引用时不会被覆盖: 剩余空间放不下下一帧时换一个新块, 只复制未解析完的尾部.
+ *          recv_buffer.block_size 大小的块从线程本地池中分配, 最后一个引用释放时放回释放线程的池;
+ *          超过块大小的帧单独分配
+ */
+class RecvBuffer : Noncopyable
+{
+public:
+    /**
+     * @brief 内存池统计(所有线程汇总)
+     */
+    struct Stats {
+        /// 申请块的次数
+        uint64_t alloc = 0;
+        /// 命中线程池的次数
+        uint64_t reuse = 0;
+        /// 换块时复制的字节数
+        uint64_t copiedBytes = 0;
+
+        std::string toString() const;
+    };
+
+    RecvBuffer();
+
+    /**
+     * @brief 保证至少有 n 字节连续可读, 不足时从 stream 读取
+     * @return >0 成功; 其它为 stream->read 的返回值
+     */
+    int fill(Stream::ptr stream, size_t n);
+
+    /**
+     * @brief 可读数据的起始地址
+     */
+    const char *peek() const { return m_block.get() + m_rpos; }
+
+    size_t readable() const { return m_wpos - m_rpos; }
+
+    /**
+     * @brief 丢弃 n 字节已解析的数据
+     */
+    void consume(size_t n) { m_rpos += n; }
+
+    /**
+     * @brief 持有当前块, 引用 peek() 返回的内存的对象用它延长块的生命周期
+     */
+    std::shared_ptr<const char> hold() const { return m_block; }
+
+    /**
+     * @brief 丢弃所有数据(连接重建时调用)
+     */
+    void reset();
+
+    static Stats GetStats();
+
+    /**
+     * @brief 从线程本地池申请一块至少 size 字节的内存
+     * @details 用于解压后的消息体等需要和接收块一样原地解析的数据. 小于块大小的按 2 的幂分级复用,
+     *          最多浪费一半, 小消息不会占住整块; 超过块大小一半的按块大小申请, 超过块大小的按实际大小
+     */
+    static std::shared_ptr<char> Alloc(size_t size);
+
+private:
+    /**
+     * @brief 换一个至少 n 字节的块, 把未解析的数据复制过去
+     */
+    void grow(size_t n);
+
+private:
+    std::shared_ptr<char> m_block;
+    size_t m_capacity = 0;
+    size_t m_rpos = 0;
+    size_t m_wpos = 0;
+};
+
+} // namespace base
@@ -0,0 +1,859 @@
+#include "resolver.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/net/socket.h"
+#include "base/util.h"
+
+namespace base
+{
+
+static base::Logger::ptr g_logger = _LOG_NAME("system");
+
+static base::ConfigVar<bool>::ptr g_resolver_hook = base::Config::Lookup(
+    "dns.resolver.hook", true, "route hooked getaddrinfo/gethostbyname_r to base::Resolver");
+
+static base::ConfigVar<uint32_t>::ptr g_resolver_cache_size =
+    base::Config::Lookup("dns.resolver.cache_size", (uint32_t)10000, "dns resolver cache size");
+
+static base::ConfigVar<uint32_t>::ptr g_resolver_max_ttl =
+    base::Config::Lookup("dns.resolver.max_ttl", (uint32_t)3600, "dns resolver max ttl(s)");
+
+static base::ConfigVar<uint32_t>::ptr g_resolver_negative_ttl = base::Config::Lookup(
+    "dns.resolver.negative_ttl", (uint32_t)30, "dns resolver max negative cache ttl(s)");
+
+/// resolv.conf/hosts 修改检查间隔
+static const uint64_t s_conf_check_interval = 5000;
+
+static const uint16_t QTYPE_A = 1;
+static const uint16_t QTYPE_CNAME = 5;
+static const uint16_t QTYPE_SOA = 6;
+static const uint16_t QTYPE_AAAA = 28;
+static const uint16_t QCLASS_IN = 1;
+
+static uint16_t RandomId()
+{
+    static thread_local std::mt19937 s_rng(std::random_device{}());
+    return (uint16_t)s_rng();
+}
+
+static uint16_t ReadUint16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t ReadUint32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void AppendUint16(std::string &buf, uint16_t v)
+{
+    buf.push_back((char)(v >> 8));
+    buf.push_back((char)(v & 0xff));
+}
+
+/**
+ * @brief 域名是否合法, name 已经去掉末尾的 '.'
+ */
+static bool IsValidName(const std::string &name)
+{
+    if (name.empty() || name.size() > 253) {
+        return false;
+    }
+    size_t begin = 0;
+    while (begin <= name.size()) {
+        size_t end = name.find('.', begin);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        if (end == begin || end - begin > 63) {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
+
+static void EncodeQuery(std::string &buf, uint16_t id, const std::string &name, uint16_t qtype)
+{
+    buf.clear();
+    buf.reserve(12 + name.size() + 6);
+    AppendUint16(buf, id);
+    // RD
+    AppendUint16(buf, 0x0100);
+    AppendUint16(buf, 1);
+    AppendUint16(buf, 0);
+    AppendUint16(buf, 0);
+    AppendUint16(buf, 0);
+    size_t begin = 0;
+    while (begin < name.size()) {
+        size_t end = name.find('.', begin);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        buf.push_back((char)(end - begin));
+        buf.append(name, begin, end - begin);
+        begin = end + 1;
+    }
+    buf.push_back(0);
+    AppendUint16(buf, qtype);
+    AppendUint16(buf, QCLASS_IN);
+}
+
+/**
+ * @brief 读取(可能压缩的)域名, 转为小写
+ * @param[in,out] off 读取位置, 返回时指向域名之后
+ */
+static bool ReadName(const uint8_t *data, size_t len, size_t &off, std::string *out)
+{
+    size_t pos = off;
+    bool jumped = false;
+    int hops = 0;
+    if (out) {
+        out->clear();
+    }
+    while (true) {
+        if (pos >= len) {
+            return false;
+        }
+        uint8_t c = data[pos];
+        if (c == 0) {
+            if (!jumped) {
+                off = pos + 1;
+            }
+            return true;
+        }
+        if ((c & 0xC0) == 0xC0) {
+            if (pos + 1 >= len || ++hops > 64) {
+                return false;
+            }
+            if (!jumped) {
+                off = pos + 2;
+            }
+            jumped = true;
+            pos = (size_t)(c & 0x3F) << 8 | data[pos + 1];
+            continue;
+        }
+        if ((c & 0xC0) || pos + 1 + c > len) {
+            return false;
+        }
+        if (out) {
+            if (!out->empty()) {
+                out->push_back('.');
+            }
+            for (size_t i = pos + 1; i < pos + 1 + c; ++i) {
+                out->push_back((char)::tolower(data[i]));
+            }
+        }
+        pos += 1 + c;
+    }
+}
+
+namespace
+{
+    struct ResourceRecord {
+        std::string name;
+        uint16_t type;
+        uint16_t cls;
+        uint32_t ttl;
+        size_t rdata;
+        uint16_t rdlen;
+    };
+} // namespace
+
+static bool ReadRecord(const uint8_t *data, size_t len, size_t &off, ResourceRecord &rr)
+{
+    if (!ReadName(data, len, off, &rr.name) || off + 10 > len) {
+        return false;
+    }
+    rr.type = ReadUint16(data + off);
+    rr.cls = ReadUint16(data + off + 2);
+    rr.ttl = ReadUint32(data + off + 4);
+    rr.rdlen = ReadUint16(data + off + 8);
+    rr.rdata = off + 10;
+    off = rr.rdata + rr.rdlen;
+    return off <= len;
+}
+
+/**
+ * @brief 解析响应
+ * @param[out] truncated 响应被截断(TC), 需要改用 TCP
+ * @return -1 不是这个查询的响应, 否则为 Resolver::Error
+ */
+static int ParseResponse(const uint8_t *data, size_t len, uint16_t id, const std::string &name,
+                         uint16_t qtype, Resolver::Answer &answer, bool &truncated)
+{
+    if (len < 12 || ReadUint16(data) != id || !(data[2] & 0x80)) {
+        return -1;
+    }
+    truncated = data[2] & 0x02;
+    int rcode = data[3] & 0x0F;
+    uint16_t qdcount = ReadUint16(data + 4);
+    uint16_t ancount = ReadUint16(data + 6);
+    uint16_t nscount = ReadUint16(data + 8);
+    if (qdcount != 1) {
+        return -1;
+    }
+    size_t off = 12;
+    std::string qname;
+    if (!ReadName(data, len, off, &qname) || off + 4 > len || qname != name
+        || ReadUint16(data + off) != qtype || ReadUint16(data + off + 2) != QCLASS_IN) {
+        return -1;
+    }
+    off += 4;
+    if (truncated) {
+        return Resolver::OK;
+    }
+    if (rcode != 0 && rcode != 3) {
+        return Resolver::SERVER_FAIL;
+    }
+
+    std::vector<ResourceRecord> answers(ancount);
+    for (auto &i : answers) {
+        if (!ReadRecord(data, len, off, i)) {
+            return Resolver::SERVER_FAIL;
+        }
+    }
+
+    // 否定缓存时间取 SOA 的 TTL 和 MINIMUM 中较小的一个
+    uint32_t negative_ttl = g_resolver_negative_ttl->getValue();
+    for (uint16_t i = 0; i < nscount; ++i) {
+        ResourceRecord rr;
+        if (!ReadRecord(data, len, off, rr)) {
+            break;
+        }
+        if (rr.type != QTYPE_SOA) {
+            continue;
+        }
+        size_t pos = rr.rdata;
+        if (ReadName(data, len, pos, nullptr) && ReadName(data, len, pos, nullptr)
+            && pos + 20 <= rr.rdata + rr.rdlen) {
+            negative_ttl = std::min({negative_ttl, rr.ttl, ReadUint32(data + pos + 16)});
+        }
+        break;
+    }
+
+    if (rcode == 3) {
+        answer.error = Resolver::NOT_FOUND;
+        answer.ttl = negative_ttl;
+        return answer.error;
+    }
+
+    // 沿着 CNAME 链找到最终的名字
+    uint32_t ttl = g_resolver_max_ttl->getValue();
+    std::string target = name;
+    for (int hop = 0; hop < 16; ++hop) {
+        bool found = false;
+        for (auto &i : answers) {
+            if (i.type == QTYPE_CNAME && i.cls == QCLASS_IN && i.name == target) {
+                size_t pos = i.rdata;
+                if (!ReadName(data, len, pos, &target)) {
+                    return Resolver::SERVER_FAIL;
+                }
+                answer.canon = target;
+                ttl = std::min(ttl, i.ttl);
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            break;
+        }
+    }
+
+    for (auto &i : answers) {
+        if (i.type != qtype || i.cls != QCLASS_IN || i.name != target) {
+            continue;
+        }
+        if (qtype == QTYPE_A && i.rdlen == 4) {
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            memcpy(&addr.sin_addr, data + i.rdata, 4);
+            answer.addrs.push_back(std::make_shared<IPv4Address>(addr));
+        } else if (qtype == QTYPE_AAAA && i.rdlen == 16) {
+            sockaddr_in6 addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin6_family = AF_INET6;
+            memcpy(&addr.sin6_addr, data + i.rdata, 16);
+            answer.addrs.push_back(std::make_shared<IPv6Address>(addr));
+        } else {
+            continue;
+        }
+        ttl = std::min(ttl, i.ttl);
+    }
+
+    if (answer.addrs.empty()) {
+        answer.error = Resolver::NO_RECORD;
+        answer.ttl = negative_ttl;
+    } else {
+        answer.error = Resolver::OK;
+        answer.ttl = ttl;
+    }
+    return answer.error;
+}
+
+static bool SendAll(Socket::ptr sock, const char *buf, size_t len)
+{
+    while (len > 0) {
+        int rt = sock->send(buf, len);
+        if (rt <= 0) {
+            return false;
+        }
+        buf += rt;
+        len -= rt;
+    }
+    return true;
+}
+
+static bool RecvAll(Socket::ptr sock, char *buf, size_t len)
+{
+    while (len > 0) {
+        int rt = sock->recv(buf, len);
+        if (rt <= 0) {
+            return false;
+        }
+        buf += rt;
+        len -= rt;
+    }
+    return true;
+}
+
+/**
+ * @brief TCP 查询, 报文前加两字节长度
+ */
+static bool TcpRoundTrip(IPAddress::ptr server, const std::string &req, uint64_t timeout_ms,
+                         std::string &rsp)
+{
+    Socket::ptr sock = Socket::CreateTCP(server);
+    if (!sock->connect(server, timeout_ms)) {
+        return false;
+    }
+    sock->setSendTimeout(timeout_ms);
+    sock->setRecvTimeout(timeout_ms);
+    std::string buf;
+    AppendUint16(buf, (uint16_t)req.size());
+    buf += req;
+    uint8_t len[2];
+    if (!SendAll(sock, buf.data(), buf.size()) || !RecvAll(sock, (char *)len, 2)) {
+        return false;
+    }
+    rsp.resize(ReadUint16(len));
+    return RecvAll(sock, &rsp[0], rsp.size());
+}
+
+static IPAddress::ptr CloneWithPort(IPAddress::ptr addr, uint16_t port)
+{
+    IPAddress::ptr rt =
+        std::dynamic_pointer_cast<IPAddress>(Address::Create(addr->getAddr(), addr->getAddrLen()));
+    if (rt && port) {
+        rt->setPort(port);
+    }
+    return rt;
+}
+
+static time_t GetMtime(const std::string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st)) {
+        return 0;
+    }
+    return st.st_mtime;
+}
+
+Resolver::Resolver(bool load_system) : m_loadSystem(load_system)
+{
+    if (m_loadSystem) {
+        loadResolvConf();
+        loadHosts();
+        m_lastCheck = GetCurrentMS();
+    }
+}
+
+int Resolver::resolve(const std::string &name, int family, std::vector<IPAddress::ptr> &result,
+                      std::string *canon)
+{
+    if (family != AF_UNSPEC && family != AF_INET && family != AF_INET6) {
+        return NO_RECORD;
+    }
+    if (IsNumericHost(name.c_str())) {
+        IPAddress::ptr addr = IPAddress::Create(name.c_str());
+        if (!addr) {
+            return BAD_NAME;
+        }
+        if (family != AF_UNSPEC && addr->getFamily() != family) {
+            return NO_RECORD;
+        }
+        result.push_back(addr);
+        return OK;
+    }
+
+    std::string n = ToLower(name);
+    bool absolute = !n.empty() && n.back() == '.';
+    if (absolute) {
+        n.pop_back();
+    }
+    if (!IsValidName(n)) {
+        return BAD_NAME;
+    }
+
+    checkSystemConf();
+    std::vector<std::string> names;
+    {
+        RWMutexType::ReadLock lock(m_confMutex);
+        for (auto hosts : {&m_staticHosts, &m_hosts}) {
+            auto it = hosts->find(n);
+            if (it == hosts->end()) {
+                continue;
+            }
+            size_t size = result.size();
+            for (auto &i : it->second) {
+                if (family == AF_UNSPEC || i->getFamily() == family) {
+                    result.push_back(i);
+                }
+            }
+            if (result.size() > size) {
+                if (canon) {
+                    *canon = n;
+                }
+                return OK;
+            }
+        }
+
+        size_t dots = std::count(n.begin(), n.end(), '.');
+        if (absolute || m_search.empty()) {
+            names.push_back(n);
+        } else {
+            if ((int)dots >= m_ndots) {
+                names.push_back(n);
+            }
+            for (auto &i : m_search) {
+                names.push_back(n + "." + i);
+            }
+            if ((int)dots < m_ndots) {
+                names.push_back(n);
+            }
+        }
+    }
+
+    // AF_UNSPEC 时 A 在新协程中查询, AAAA 在当前协程中查询
+    IOManager *iom = family == AF_UNSPEC ? IOManager::GetThis() : nullptr;
+    int error = NOT_FOUND;
+    for (auto &i : names) {
+        if (!IsValidName(i)) {
+            continue;
+        }
+        Future<Answer> futures[2];
+        if (family != AF_INET6) {
+            futures[0] = lookup(i, QTYPE_A, iom);
+        }
+        if (family != AF_INET) {
+            futures[1] = lookup(i, QTYPE_AAAA, nullptr);
+        }
+        int rt = NOT_FOUND;
+        bool found = false;
+        for (auto &f : futures) {
+            if (!f.valid()) {
+                continue;
+            }
+            const Answer &a = f.get();
+            if (a.error == OK) {
+                result.insert(result.end(), a.addrs.begin(), a.addrs.end());
+                if (canon && !found) {
+                    *canon = a.canon.empty() ? i : a.canon;
+                }
+                found = true;
+            } else if (rt == NOT_FOUND || a.error == NO_RECORD) {
+                rt = a.error;
+            }
+        }
+        if (found) {
+            return OK;
+        }
+        if (error == NOT_FOUND) {
+            error = rt;
+        }
+    }
+    return error;
+}
+
+Future<Resolver::Answer> Resolver::lookup(const std::string &name, uint16_t qtype, IOManager *iom)
+{
+    std::string key = name + (qtype == QTYPE_A ? "/A" : "/AAAA");
+    std::function<void()> run;
+    Future<Answer> rt;
+    {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_cache.find(key);
+        if (it != m_cache.end()) {
+            if (it->second.expire > GetCurrentMS()) {
+                ++m_cacheHits;
+                return MakeReadyFuture(it->second.answer);
+            }
+            m_cache.erase(it);
+        }
+        auto fit = m_inflight.find(key);
+        if (fit != m_inflight.end()) {
+            ++m_coalesced;
+            return fit->second;
+        }
+        Promise<Answer> p;
+        rt = p.getFuture();
+        m_inflight.emplace(key, rt);
+        run = [this, name, qtype, key, p]() mutable {
+            Answer a = query(name, qtype);
+            bool cacheable = a.ttl > 0 && (a.error == OK || a.error == NOT_FOUND || a.error == NO_RECORD);
+            p.setValue(std::move(a));
+            Future<Answer> f = p.getFuture();
+            MutexType::Lock lock(m_mutex);
+            if (cacheable) {
+                uint64_t now = GetCurrentMS();
+                if (m_cache.size() >= g_resolver_cache_size->getValue()) {
+                    for (auto it = m_cache.begin(); it != m_cache.end();) {
+                        if (it->second.expire <= now) {
+                            it = m_cache.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
+                    if (m_cache.size() >= g_resolver_cache_size->getValue()) {
+                        m_cache.erase(m_cache.begin());
+                    }
+                }
+                CacheItem &item = m_cache[key];
+                item.answer = f.get();
+                item.expire = now + (uint64_t)item.answer.ttl * 1000;
+            }
+            m_inflight.erase(key);
+        };
+    }
+    if (iom) {
+        iom->schedule(run);
+    } else {
+        run();
+    }
+    return rt;
+}
+
+Resolver::Answer Resolver::query(const std::string &name, uint16_t qtype)
+{
+    std::vector<IPAddress::ptr> servers;
+    uint32_t timeout;
+    int attempts;
+    {
+        RWMutexType::ReadLock lock(m_confMutex);
+        servers = m_nameservers;
+        timeout = m_timeout;
+        attempts = m_attempts;
+    }
+    Answer answer;
+    if (servers.empty()) {
+        answer.error = NO_SERVER;
+        return answer;
+    }
+    answer.error = TIMEOUT;
+    for (int i = 0; i < attempts; ++i) {
+        for (auto &s : servers) {
+            Answer a;
+            int rt = exchange(s, name, qtype, timeout, a);
+            if (rt < 0) {
+                continue;
+            }
+            if (rt == SERVER_FAIL) {
+                _LOG_DEBUG(g_logger) << "Resolver query " << name << " server=" << s->toString()
+                                     << " server fail";
+                answer.error = SERVER_FAIL;
+                continue;
+            }
+            return a;
+        }
+    }
+    _LOG_WARN(g_logger) << "Resolver query " << name << " qtype=" << qtype
+                        << " fail: " << ErrorToString(answer.error);
+    return answer;
+}
+
+int Resolver::exchange(IPAddress::ptr server, const std::string &name, uint16_t qtype,
+                       uint64_t timeout_ms, Answer &answer)
+{
+    uint16_t id = RandomId();
+    std::string req;
+    EncodeQuery(req, id, name, qtype);
+
+    Socket::ptr sock = Socket::CreateUDP(server);
+    if (!sock->connect(server)) {
+        return -1;
+    }
+    ++m_queries;
+    if (sock->send(req.data(), req.size()) != (int)req.size()) {
+        return -1;
+    }
+    uint64_t deadline = GetCurrentMS() + timeout_ms;
+    std::string buf;
+    buf.resize(4096);
+    while (true) {
+        uint64_t now = GetCurrentMS();
+        if (now >= deadline) {
+            return -1;
+        }
+        sock->setRecvTimeout(deadline - now);
+        int n = sock->recv(&buf[0], buf.size());
+        if (n <= 0) {
+            return -1;
+        }
+        bool truncated = false;
+        int rt = ParseResponse((const uint8_t *)buf.data(), n, id, name, qtype, answer, truncated);
+        if (rt < 0) {
+            // 迟到的或者伪造的响应
+            continue;
+        }
+        if (!truncated) {
+            return rt;
+        }
+        _LOG_DEBUG(g_logger) << "Resolver " << name << " truncated, retry with tcp";
+        now = GetCurrentMS();
+        if (now >= deadline || !TcpRoundTrip(server, req, deadline - now, buf)) {
+            return -1;
+        }
+        rt = ParseResponse((const uint8_t *)buf.data(), buf.size(), id, name, qtype, answer,
+                           truncated);
+        return rt < 0 || truncated ? SERVER_FAIL : rt;
+    }
+}
+
+void Resolver::setNameservers(const std::vector<IPAddress::ptr> &v)
+{
+    std::vector<IPAddress::ptr> servers;
+    for (auto &i : v) {
+        auto addr = CloneWithPort(i, i->getPort() ? 0 : 53);
+        if (addr) {
+            servers.push_back(addr);
+        }
+    }
+    RWMutexType::WriteLock lock(m_confMutex);
+    m_nameservers.swap(servers);
+    m_customNameservers = true;
+}
+
+std::vector<IPAddress::ptr> Resolver::getNameservers()
+{
+    RWMutexType::ReadLock lock(m_confMutex);
+    return m_nameservers;
+}
+
+void Resolver::setSearch(const std::vector<std::string> &v, int ndots)
+{
+    RWMutexType::WriteLock lock(m_confMutex);
+    m_search.clear();
+    for (auto &i : v) {
+        m_search.push_back(ToLower(i));
+    }
+    m_ndots = ndots;
+}
+
+void Resolver::setTimeout(uint32_t ms, int attempts)
+{
+    RWMutexType::WriteLock lock(m_confMutex);
+    m_timeout = ms;
+    m_attempts = std::max(attempts, 1);
+}
+
+void Resolver::addHost(const std::string &name, IPAddress::ptr addr)
+{
+    RWMutexType::WriteLock lock(m_confMutex);
+    m_staticHosts[ToLower(name)].push_back(addr);
+}
+
+bool Resolver::loadResolvConf(const std::string &path)
+{
+    std::ifstream ifs(path);
+    if (!ifs) {
+        _LOG_WARN(g_logger) << "Resolver open " << path << " fail";
+        return false;
+    }
+    std::vector<IPAddress::ptr> servers;
+    std::vector<std::string> search;
+    int ndots = 1;
+    uint32_t timeout = 5000;
+    int attempts = 2;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        line = line.substr(0, line.find_first_of("#;"));
+        std::istringstream iss(line);
+        std::string key;
+        if (!(iss >> key)) {
+            continue;
+        }
+        std::string value;
+        if (key == "nameserver") {
+            if (iss >> value) {
+                auto addr = IPAddress::Create(value.c_str(), 53);
+                if (addr) {
+                    servers.push_back(addr);
+                }
+            }
+        } else if (key == "search" || key == "domain") {
+            search.clear();
+            while (iss >> value) {
+                if (value.back() == '.') {
+                    value.pop_back();
+                }
+                search.push_back(ToLower(value));
+            }
+        } else if (key == "options") {
+            while (iss >> value) {
+                size_t pos = value.find(':');
+                if (pos == std::string::npos) {
+                    continue;
+                }
+                std::string opt = value.substr(0, pos);
+                int v = atoi(value.c_str() + pos + 1);
+                if (opt == "ndots") {
+                    ndots = std::min(v, 15);
+                } else if (opt == "timeout") {
+                    timeout = std::max(v, 1) * 1000;
+                } else if (opt == "attempts") {
+                    attempts = std::min(std::max(v, 1), 5);
+                }
+            }
+        }
+    }
+    if (servers.empty()) {
+        servers.push_back(IPAddress::Create("127.0.0.1", 53));
+    }
+
+    RWMutexType::WriteLock lock(m_confMutex);
+    if (!m_customNameservers) {
+        m_nameservers.swap(servers);
+    }
+    m_search.swap(search);
+    m_ndots = ndots;
+    m_timeout = timeout;
+    m_attempts = attempts;
+    m_resolvMtime = GetMtime(path);
+    return true;
+}
+
+bool Resolver::loadHosts(const std::string &path)
+{
+    std::ifstream ifs(path);
+    if (!ifs) {
+        _LOG_WARN(g_logger) << "Resolver open " << path << " fail";
+        return false;
+    }
+    std::unordered_map<std::string, std::vector<IPAddress::ptr> > hosts;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        std::string ip;
+        if (!(iss >> ip)) {
+            continue;
+        }
+        auto addr = IPAddress::Create(ip.c_str());
+        if (!addr) {
+            continue;
+        }
+        std::string name;
+        while (iss >> name) {
+            hosts[ToLower(name)].push_back(addr);
+        }
+    }
+
+    RWMutexType::WriteLock lock(m_confMutex);
+    m_hosts.swap(hosts);
+    m_hostsMtime = GetMtime(path);
+    return true;
+}
+
+void Resolver::checkSystemConf()
+{
+    if (!m_loadSystem) {
+        return;
+    }
+    uint64_t now = GetCurrentMS();
+    time_t resolv_mtime;
+    time_t hosts_mtime;
+    {
+        RWMutexType::WriteLock lock(m_confMutex);
+        if (now < m_lastCheck + s_conf_check_interval) {
+            return;
+        }
+        m_lastCheck = now;
+        resolv_mtime = m_resolvMtime;
+        hosts_mtime = m_hostsMtime;
+    }
+    if (GetMtime("/etc/resolv.conf") != resolv_mtime) {
+        _LOG_INFO(g_logger) << "Resolver reload /etc/resolv.conf";
+        loadResolvConf();
+    }
+    if (GetMtime("/etc/hosts") != hosts_mtime) {
+        _LOG_INFO(g_logger) << "Resolver reload /etc/hosts";
+        loadHosts();
+    }
+}
+
+void Resolver::clearCache()
+{
+    MutexType::Lock lock(m_mutex);
+    m_cache.clear();
+}
+
+const char *Resolver::ErrorToString(int error)
+{
+    switch (error) {
+#define XX(name)                                                                                   \
+    case name:                                                                                     \
+        return #name;
+        XX(OK);
+        XX(NOT_FOUND);
+        XX(NO_RECORD);
+        XX(TIMEOUT);
+        XX(SERVER_FAIL);
+        XX(BAD_NAME);
+        XX(NO_SERVER);
+#undef XX
+        default:
+            return "UNKNOWN";
+    }
+}
+
+int Resolver::ToEaiError(int error)
+{
+    switch (error) {
+        case OK:
+            return 0;
+        case NOT_FOUND:
+        case BAD_NAME:
+            return EAI_NONAME;
+        case NO_RECORD:
+            return EAI_NODATA;
+        default:
+            return EAI_AGAIN;
+    }
+}
+
+bool Resolver::IsNumericHost(const char *name)
+{
+    // 域名中不会有 ':', 带 scope 的 IPv6 地址也交给系统处理
+    if (strchr(name, ':')) {
+        return true;
+    }
+    in_addr addr;
+    return inet_aton(name, &addr) != 0;
+}
+
+bool Resolver::IsHookEnable()
+{
+    return g_resolver_hook->getValue();
+}
+
+} // namespace base
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "base/coro/future.h"
+#include "base/mutex.h"
+#include "base/net/address.h"
+#include "base/singleton.h"
+
+namespace base
+{
+
+/**
+ * @brief 协程友好的 DNS 解析器
+ * @details 自己构造 DNS 查询, 通过 hook 过的 socket 发送 UDP(截断时改用 TCP),
+ *          等待响应时只挂起当前协程. 读取 /etc/resolv.conf(nameserver/search/ndots/timeout/attempts)
+ *          和 /etc/hosts, 文件修改后自动重新加载.
+ *          结果按 TTL 缓存, NXDOMAIN/NODATA 按 SOA 最小 TTL 做否定缓存;
+ *          同一个名字的并发查询只发送一次, 其他调用者等待同一个 Future.
+ *          开启 hook 时 getaddrinfo/gethostbyname_r 会转到这里
+ */
+class Resolver : Noncopyable
+{
+public:
+    typedef std::shared_ptr<Resolver> ptr;
+    typedef RWMutex RWMutexType;
+    typedef Mutex MutexType;
+
+    enum Error {
+        /// 成功
+        OK = 0,
+        /// 域名不存在(NXDOMAIN)
+        NOT_FOUND = 1,
+        /// 域名存在但没有对应类型的记录
+        NO_RECORD = 2,
+        /// 所有 nameserver 都超时
+        TIMEOUT = 3,
+        /// nameserver 返回错误或者响应无法解析
+        SERVER_FAIL = 4,
+        /// 域名不合法
+        BAD_NAME = 5,
+        /// 没有可用的 nameserver
+        NO_SERVER = 6,
+    };
+
+    /**
+     * @brief 单个名字单个类型的查询结果
+     */
+    struct Answer {
+        int error = OK;
+        std::vector<IPAddress::ptr> addrs;
+        /// CNAME 链的最终名字, 没有 CNAME 时为空
+        std::string canon;
+        /// 缓存时间(秒)
+        uint32_t ttl = 0;
+    };
+
+    /**
+     * @param[in] load_system 是否加载 /etc/resolv.conf 和 /etc/hosts
+     */
+    Resolver(bool load_system = true);
+
+    /**
+     * @brief 解析域名
+     * @param[in] name 域名, 数字地址直接返回
+     * @param[in] family AF_INET/AF_INET6/AF_UNSPEC, AF_UNSPEC 时 A 和 AAAA 并行查询, IPv4 在前
+     * @param[out] result 解析到的地址, 端口为 0
+     * @param[out] canon 规范名, 可以为空
+     * @return Error
+     */
+    int resolve(const std::string &name, int family, std::vector<IPAddress::ptr> &result,
+                std::string *canon = nullptr);
+
+    /**
+     * @brief 设置 nameserver, 之后不再从 resolv.conf 更新
+     * @details 地址没有端口时使用 53
+     */
+    void setNameservers(const std::vector<IPAddress::ptr> &v);
+    std::vector<IPAddress::ptr> getNameservers();
+
+    void setSearch(const std::vector<std::string> &v, int ndots = 1);
+
+    /**
+     * @brief 单次查询的超时时间(毫秒)和每个 nameserver 的尝试次数
+     */
+    void setTimeout(uint32_t ms, int attempts);
+
+    /**
+     * @brief 添加静态解析(优先于 DNS), 同 /etc/hosts 中的一行
+     */
+    void addHost(const std::string &name, IPAddress::ptr addr);
+
+    bool loadResolvConf(const std::string &path = "/etc/resolv.conf");
+    bool loadHosts(const std::string &path = "/etc/hosts");
+
+    void clearCache();
+
+    /**
+     * @brief 实际发送的查询次数(不包括缓存命中和合并的查询)
+     */
+    uint64_t getQueryCount() const { return m_queries; }
+    uint64_t getCacheHitCount() const { return m_cacheHits; }
+    uint64_t getCoalescedCount() const { return m_coalesced; }
+
+    static const char *ErrorToString(int error);
+
+    /**
+     * @brief Error 转为 getaddrinfo 的 EAI_* 错误码
+     */
+    static int ToEaiError(int error);
+
+    /**
+     * @brief name 是否是数字地址(不需要查询)
+     */
+    static bool IsNumericHost(const char *name);
+
+    /**
+     * @brief hook 的 getaddrinfo/gethostbyname_r 是否使用 Resolver, 配置 dns.resolver.hook
+     */
+    static bool IsHookEnable();
+
+private:
+    struct CacheItem {
+        Answer answer;
+        uint64_t expire = 0;
+    };
+
+    /**
+     * @brief 查询一个名字的一种记录, 先查缓存, 相同的查询正在进行时等待它的结果
+     * @param[in] iom 不为空时在 iom 中新开协程发送查询
+     */
+    Future<Answer> lookup(const std::string &name, uint16_t qtype, IOManager *iom);
+
+    /**
+     * @brief 依次询问每个 nameserver
+     */
+    Answer query(const std::string &name, uint16_t qtype);
+
+    /**
+     * @brief 发送一次查询并解析响应
+     * @return -1 没有有效响应(超时/网络错误), 否则为 Error
+     */
+    int exchange(IPAddress::ptr server, const std::string &name, uint16_t qtype,
+                 uint64_t timeout_ms, Answer &answer);
+
+    /**
+     * @brief 距上次检查超过一定时间时, 检查 resolv.conf/hosts 是否被修改
+     */
+    void checkSystemConf();
+
+private:
+    RWMutexType m_confMutex;
+    std::vector<IPAddress::ptr> m_nameservers;
+    std::vector<std::string> m_search;
+    int m_ndots = 1;
+    uint32_t m_timeout = 5000;
+    int m_attempts = 2;
+    bool m_customNameservers = false;
+    bool m_loadSystem;
+    std::unordered_map<std::string, std::vector<IPAddress::ptr> > m_hosts;
+    /// 通过 addHost 添加的, 重新加载 hosts 时保留
+    std::unordered_map<std::string, std::vector<IPAddress::ptr> > m_staticHosts;
+    uint64_t m_lastCheck = 0;
+    time_t m_resolvMtime = 0;
+    time_t m_hostsMtime = 0;
+
+    MutexType m_mutex;
+    std::unordered_map<std::string, CacheItem> m_cache;
+    std::unordered_map<std::string, Future<Answer> > m_inflight;
+
+    std::atomic<uint64_t> m_queries = {0};
+    std::atomic<uint64_t> m_cacheHits = {0};
+    std::atomic<uint64_t> m_coalesced = {0};
+};
+
+typedef base::Singleton<Resolver> ResolverMgr;
+
+} // namespace base
@@ -0,0 +1,61 @@
+#include "rock_channel.h"
+#include "rock_stream.h"
+
+namespace base
+{
+
+RockChannel::RockChannel(std::shared_ptr<RockStream> stream, uint32_t id, uint32_t cmd,
+                         const std::string &meta)
+    : m_stream(stream), m_id(id), m_cmd(cmd), m_meta(meta)
+{
+}
+
+RockChannel::~RockChannel()
+{
+}
+
+int32_t RockChannel::write(const void *data, size_t length, bool fin)
+{
+    auto stream = m_stream.lock();
+    if (!stream) {
+        return -(int32_t)CLOSED;
+    }
+    return stream->channelWrite(*this, (const char *)data, length, fin);
+}
+
+bool RockChannel::read(std::string &chunk)
+{
+    auto stream = m_stream.lock();
+    if (!stream) {
+        return false;
+    }
+    return stream->channelRead(*this, chunk);
+}
+
+bool RockChannel::readAll(std::string &data)
+{
+    std::string chunk;
+    while (read(chunk)) {
+        data.append(chunk);
+    }
+    return getError() == OK;
+}
+
+void RockChannel::cancel(uint32_t error)
+{
+    auto stream = m_stream.lock();
+    if (stream) {
+        stream->channelCancel(*this, error);
+    }
+}
+
+uint32_t RockChannel::getError()
+{
+    auto stream = m_stream.lock();
+    if (!stream) {
+        return m_error ? m_error : (uint32_t)CLOSED;
+    }
+    return stream->channelError(*this);
+}
+
+} // namespace base
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include "base/coro/fiber_sync.h"
+#include "base/net/rock/rock_protocol.h"
+
+namespace base
+{
+
+class RockStream;
+
+/**
+ * @brief Rock v2 连接上的一个多路复用流
+ * @details 由 RockStream::openStream 打开或由对端打开后交给流处理函数. 数据按帧分块发送,
+ *          发送受流和连接两级窗口(信用)限制: 没有窗口时 write 挂起, 对端读走数据后通过
+ *          WINDOW_UPDATE 归还窗口. 所有状态由所属 RockStream 的流锁保护
+ */
+class RockChannel : public std::enable_shared_from_this<RockChannel>
+{
+    friend class RockStream;
+
+public:
+    typedef std::shared_ptr<RockChannel> ptr;
+
+    enum Error {
+        OK = 0,
+        /// 被本端或对端取消
+        CANCELLED = 1,
+        /// 对端没有处理这个命令的流处理函数
+        NO_HANDLER = 2,
+        /// 对端发送超过了窗口
+        FLOW_CONTROL = 3,
+        /// 帧不合法
+        PROTOCOL = 4,
+        /// 连接断开
+        CLOSED = 5,
+    };
+
+    RockChannel(std::shared_ptr<RockStream> stream, uint32_t id, uint32_t cmd,
+                const std::string &meta);
+    ~RockChannel();
+
+    uint32_t getId() const { return m_id; }
+    uint32_t getCmd() const { return m_cmd; }
+    const std::string &getMeta() const { return m_meta; }
+
+    /**
+     * @brief 发送数据, 按最大帧长切块, 没有窗口时挂起
+     * @param[in] fin 发送完这些数据后结束本端发送
+     * @return 成功返回 length, 流已出错返回 -错误码
+     */
+    int32_t write(const void *data, size_t length, bool fin = false);
+    int32_t write(const std::string &data, bool fin = false)
+    {
+        return write(data.data(), data.size(), fin);
+    }
+
+    /**
+     * @brief 结束本端发送
+     */
+    bool finish() { return write(nullptr, 0, true) >= 0; }
+
+    /**
+     * @brief 读取一个数据块, 没有数据时挂起
+     * @return 对端结束发送且数据已读完, 或流出错时返回 false
+     */
+    bool read(std::string &chunk);
+
+    /**
+     * @brief 读取直到对端结束发送
+     * @return 流出错时返回 false
+     */
+    bool readAll(std::string &data);
+
+    /**
+     * @brief 取消流, 通知对端并唤醒挂起的读写
+     */
+    void cancel(uint32_t error = CANCELLED);
+
+    /**
+     * @brief 错误码, 正常时为 OK
+     */
+    uint32_t getError();
+
+private:
+    std::weak_ptr<RockStream> m_stream;
+    uint32_t m_id;
+    uint32_t m_cmd;
+    std::string m_meta;
+
+    /// 剩余发送窗口
+    int64_t m_sendWindow = 0;
+    /// 本端还允许对端发送的字节数
+    int64_t m_recvAvailable = 0;
+    /// 已读走还没有归还给对端的字节数
+    uint32_t m_recvConsumed = 0;
+    /// 收到还没有读走的数据帧
+    std::deque<RockFrame::ptr> m_frames;
+    bool m_localFin = false;
+    bool m_remoteFin = false;
+    uint32_t m_error = OK;
+    /// 等待数据的读者
+    FiberConditionVariable m_readCond;
+};
+
+} // namespace base
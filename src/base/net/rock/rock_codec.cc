@@ -0,0 +1,378 @@
+#include "rock_codec.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/mutex.h"
+#include "base/net/streams/zlib_stream.h"
+#include <fstream>
+#include <lz4frame.h>
+#include <sstream>
+#include <string.h>
+#include <zstd.h>
+
+namespace base
+{
+
+static base::Logger::ptr g_logger = _LOG_NAME("system");
+
+static base::ConfigVar<int32_t>::ptr g_lz4_level =
+    base::Config::Lookup("rock.codec.lz4_level", (int32_t)0, "rock lz4 compression level");
+
+static base::ConfigVar<int32_t>::ptr g_zstd_level =
+    base::Config::Lookup("rock.codec.zstd_level", (int32_t)1, "rock zstd compression level");
+
+static base::ConfigVar<std::string>::ptr g_zstd_dict = base::Config::Lookup(
+    "rock.codec.zstd_dict", std::string(""),
+    "rock zstd dictionary file (zstd --train), empty for none");
+
+/// 压缩器每次输入的最大长度
+static const size_t kCompressChunk = 64 * 1024;
+
+namespace
+{
+
+class GzipCodec : public RockCodec
+{
+public:
+    GzipCodec() : RockCodec(GZIP, "gzip") {}
+
+    bool compress(ByteArray::ptr in, ByteArray::ptr out) override
+    {
+        auto zstream = base::ZlibStream::CreateGzip(true);
+        if (zstream->write(in, -1) != Z_OK || zstream->flush() != Z_OK) {
+            return false;
+        }
+        std::string rt = zstream->getResult();
+        out->write(rt.data(), rt.size());
+        return true;
+    }
+
+    bool decompress(const char *in, size_t in_len, char *out, size_t out_len) override
+    {
+        auto zstream = base::ZlibStream::CreateGzip(false);
+        if (zstream->write(in, in_len) != Z_OK || zstream->flush() != Z_OK) {
+            return false;
+        }
+        std::string rt = zstream->getResult();
+        if (rt.size() != out_len) {
+            return false;
+        }
+        memcpy(out, rt.data(), out_len);
+        return true;
+    }
+};
+
+struct Lz4Ctx {
+    Lz4Ctx()
+    {
+        LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+        LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    }
+    ~Lz4Ctx()
+    {
+        LZ4F_freeCompressionContext(cctx);
+        LZ4F_freeDecompressionContext(dctx);
+    }
+    LZ4F_cctx *cctx = nullptr;
+    LZ4F_dctx *dctx = nullptr;
+};
+
+static Lz4Ctx &GetLz4Ctx()
+{
+    static thread_local Lz4Ctx s_ctx;
+    return s_ctx;
+}
+
+class Lz4Codec : public RockCodec
+{
+public:
+    Lz4Codec() : RockCodec(LZ4, "lz4") {}
+
+    bool compress(ByteArray::ptr in, ByteArray::ptr out) override
+    {
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = g_lz4_level->getValue();
+        prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+        prefs.frameInfo.contentSize = in->getReadSize();
+
+        // 整帧先压缩到局部缓存, 用完线程本地的上下文之后才写 out
+        std::string buf;
+        size_t pos = 0;
+        buf.resize(LZ4F_HEADER_SIZE_MAX);
+        LZ4F_cctx *cctx = GetLz4Ctx().cctx;
+        size_t n = LZ4F_compressBegin(cctx, &buf[0], buf.size(), &prefs);
+        if (LZ4F_isError(n)) {
+            _LOG_ERROR(g_logger) << "LZ4F_compressBegin error: " << LZ4F_getErrorName(n);
+            return false;
+        }
+        pos += n;
+
+        std::vector<iovec> iovs;
+        in->getReadBuffers(iovs);
+        for (auto &i : iovs) {
+            for (size_t off = 0; off < i.iov_len; off += kCompressChunk) {
+                size_t len = std::min(kCompressChunk, i.iov_len - off);
+                buf.resize(pos + LZ4F_compressBound(len, &prefs));
+                n = LZ4F_compressUpdate(cctx, &buf[pos], buf.size() - pos,
+                                        (const char *)i.iov_base + off, len, nullptr);
+                if (LZ4F_isError(n)) {
+                    _LOG_ERROR(g_logger) << "LZ4F_compressUpdate error: " << LZ4F_getErrorName(n);
+                    return false;
+                }
+                pos += n;
+            }
+        }
+        buf.resize(pos + LZ4F_compressBound(0, &prefs));
+        n = LZ4F_compressEnd(cctx, &buf[pos], buf.size() - pos, nullptr);
+        if (LZ4F_isError(n)) {
+            _LOG_ERROR(g_logger) << "LZ4F_compressEnd error: " << LZ4F_getErrorName(n);
+            return false;
+        }
+        pos += n;
+        out->write(buf.data(), pos);
+        return true;
+    }
+
+    bool decompress(const char *in, size_t in_len, char *out, size_t out_len) override
+    {
+        // 输出是调用方的连续内存, 使用上下文期间不会切换协程
+        LZ4F_dctx *dctx = GetLz4Ctx().dctx;
+        LZ4F_resetDecompressionContext(dctx);
+        size_t in_pos = 0;
+        size_t out_pos = 0;
+        while (true) {
+            size_t src = in_len - in_pos;
+            size_t dst = out_len - out_pos;
+            size_t rt = LZ4F_decompress(dctx, out + out_pos, &dst, in + in_pos, &src, nullptr);
+            if (LZ4F_isError(rt)) {
+                _LOG_ERROR(g_logger) << "LZ4F_decompress error: " << LZ4F_getErrorName(rt);
+                return false;
+            }
+            in_pos += src;
+            out_pos += dst;
+            if (rt == 0) {
+                break;
+            }
+            if (src == 0 && dst == 0) {
+                // 数据不完整或比声明的原始长度长
+                return false;
+            }
+        }
+        return in_pos == in_len && out_pos == out_len;
+    }
+};
+
+struct ZstdCtx {
+    ZstdCtx() : cctx(ZSTD_createCCtx()), dctx(ZSTD_createDCtx()) {}
+    ~ZstdCtx()
+    {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+};
+
+static ZstdCtx &GetZstdCtx()
+{
+    static thread_local ZstdCtx s_ctx;
+    return s_ctx;
+}
+
+class ZstdCodec : public RockCodec
+{
+public:
+    ZstdCodec() : RockCodec(ZSTD, "zstd") {}
+
+    /**
+     * @brief 使用字典
+     */
+    ZstdCodec(const std::string &dict, int level)
+        : RockCodec(ZSTD_DICT, "zstd_dict"),
+          m_cdict(ZSTD_createCDict(dict.data(), dict.size(), level)),
+          m_ddict(ZSTD_createDDict(dict.data(), dict.size()))
+    {
+    }
+
+    ~ZstdCodec()
+    {
+        if (m_cdict) {
+            ZSTD_freeCDict(m_cdict);
+        }
+        if (m_ddict) {
+            ZSTD_freeDDict(m_ddict);
+        }
+    }
+
+    bool isValid() const { return getType() == ZSTD || (m_cdict && m_ddict); }
+
+    bool compress(ByteArray::ptr in, ByteArray::ptr out) override
+    {
+        size_t src_len = in->getReadSize();
+        // 整帧先压缩到局部缓存, 用完线程本地的上下文之后才写 out
+        std::string buf;
+        buf.resize(ZSTD_compressBound(src_len));
+        ZSTD_outBuffer output = {&buf[0], buf.size(), 0};
+
+        ZSTD_CCtx *cctx = GetZstdCtx().cctx;
+        ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+        if (m_cdict) {
+            ZSTD_CCtx_refCDict(cctx, m_cdict);
+        } else {
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, g_zstd_level->getValue());
+        }
+        ZSTD_CCtx_setPledgedSrcSize(cctx, src_len);
+
+        std::vector<iovec> iovs;
+        in->getReadBuffers(iovs);
+        for (auto &i : iovs) {
+            ZSTD_inBuffer input = {i.iov_base, i.iov_len, 0};
+            while (input.pos < input.size) {
+                size_t rt = ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_continue);
+                if (ZSTD_isError(rt)) {
+                    _LOG_ERROR(g_logger) << "ZSTD_compressStream2 error: " << ZSTD_getErrorName(rt);
+                    return false;
+                }
+            }
+        }
+        ZSTD_inBuffer input = {nullptr, 0, 0};
+        size_t left = 0;
+        do {
+            left = ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_end);
+            if (ZSTD_isError(left)) {
+                _LOG_ERROR(g_logger) << "ZSTD_compressStream2 end error: "
+                                     << ZSTD_getErrorName(left);
+                return false;
+            }
+            if (left && output.pos == output.size) {
+                buf.resize(buf.size() + ZSTD_CStreamOutSize());
+                output.dst = &buf[0];
+                output.size = buf.size();
+            }
+        } while (left);
+        out->write(buf.data(), output.pos);
+        return true;
+    }
+
+    bool decompress(const char *in, size_t in_len, char *out, size_t out_len) override
+    {
+        // 一次调用完成, 使用上下文期间不会切换协程
+        ZSTD_DCtx *dctx = GetZstdCtx().dctx;
+        size_t rt = m_ddict ? ZSTD_decompress_usingDDict(dctx, out, out_len, in, in_len, m_ddict)
+                            : ZSTD_decompressDCtx(dctx, out, out_len, in, in_len);
+        if (ZSTD_isError(rt)) {
+            _LOG_ERROR(g_logger) << "ZSTD_decompress error: " << ZSTD_getErrorName(rt);
+            return false;
+        }
+        return rt == out_len;
+    }
+
+private:
+    ZSTD_CDict *m_cdict = nullptr;
+    ZSTD_DDict *m_ddict = nullptr;
+};
+
+struct CodecRegistry {
+    RWMutex mutex;
+    RockCodec::ptr codecs[RockCodec::kFlagMask + 1];
+    uint32_t zstdDictId = 0;
+};
+
+static CodecRegistry &GetRegistry()
+{
+    static CodecRegistry s_registry;
+    return s_registry;
+}
+
+static void LoadZstdDict(const std::string &path)
+{
+    CodecRegistry &registry = GetRegistry();
+    RockCodec::ptr codec;
+    uint32_t dict_id = 0;
+    if (!path.empty()) {
+        std::ifstream ifs(path, std::ios::binary);
+        std::stringstream ss;
+        ss << ifs.rdbuf();
+        std::string dict = ss.str();
+        auto zstd = std::make_shared<ZstdCodec>(dict, g_zstd_level->getValue());
+        dict_id = ZSTD_getDictID_fromDict(dict.data(), dict.size());
+        if (!ifs || dict.empty() || !zstd->isValid() || !dict_id) {
+            _LOG_ERROR(g_logger) << "load rock.codec.zstd_dict " << path << " fail";
+            dict_id = 0;
+        } else {
+            codec = zstd;
+            _LOG_INFO(g_logger) << "load rock.codec.zstd_dict " << path << " dict_id=" << dict_id
+                                << " size=" << dict.size();
+        }
+    }
+    RWMutex::WriteLock lock(registry.mutex);
+    registry.codecs[RockCodec::ZSTD_DICT] = codec;
+    registry.zstdDictId = dict_id;
+}
+
+struct _RockCodecIniter {
+    _RockCodecIniter()
+    {
+        RockCodec::Register(std::make_shared<GzipCodec>());
+        RockCodec::Register(std::make_shared<Lz4Codec>());
+        RockCodec::Register(std::make_shared<ZstdCodec>());
+        LoadZstdDict(g_zstd_dict->getValue());
+        g_zstd_dict->addListener(
+            [](const std::string &ov, const std::string &nv) { LoadZstdDict(nv); });
+    }
+};
+
+static _RockCodecIniter s_initer;
+
+} // namespace
+
+void RockCodec::Register(RockCodec::ptr codec)
+{
+    CodecRegistry &registry = GetRegistry();
+    RWMutex::WriteLock lock(registry.mutex);
+    registry.codecs[codec->getType() & kFlagMask] = codec;
+}
+
+RockCodec::ptr RockCodec::Get(uint8_t type)
+{
+    if (type == NONE || type > kFlagMask) {
+        return nullptr;
+    }
+    CodecRegistry &registry = GetRegistry();
+    RWMutex::ReadLock lock(registry.mutex);
+    return registry.codecs[type];
+}
+
+RockCodec::ptr RockCodec::GetByName(const std::string &name)
+{
+    CodecRegistry &registry = GetRegistry();
+    RWMutex::ReadLock lock(registry.mutex);
+    for (auto &i : registry.codecs) {
+        if (i && i->getName() == name) {
+            return i;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t RockCodec::GetSupportedMask()
+{
+    CodecRegistry &registry = GetRegistry();
+    RWMutex::ReadLock lock(registry.mutex);
+    uint32_t mask = 0;
+    for (size_t i = 0; i <= kFlagMask; ++i) {
+        if (registry.codecs[i]) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+uint32_t RockCodec::GetZstdDictId()
+{
+    CodecRegistry &registry = GetRegistry();
+    RWMutex::ReadLock lock(registry.mutex);
+    return registry.zstdDictId;
+}
+
+} // namespace base
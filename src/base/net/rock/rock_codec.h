@@ -0,0 +1,74 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include "base/bytearray.h"
+
+namespace base
+{
+
+/**
+ * @brief Rock 消息体的压缩算法
+ * @details 帧头 flag 的低3位是算法id. GZIP 沿用 v1 的格式(flag=0x1, 消息体为 gzip 流);
+ *          其它算法的消息体为 原始长度(F32) + 压缩数据, 接收方按原始长度从接收缓存池申请
+ *          一块内存一次解压, 解压后的消息体仍然在块内原地解析.
+ *          除 GZIP 外的算法只在 v2 握手中对端声明支持后才会使用
+ */
+class RockCodec
+{
+public:
+    typedef std::shared_ptr<RockCodec> ptr;
+
+    enum Type {
+        NONE = 0,
+        GZIP = 1,
+        LZ4 = 2,
+        ZSTD = 3,
+        /// 使用 rock.codec.zstd_dict 字典的 zstd, 双方字典id相同时才可用
+        ZSTD_DICT = 4,
+    };
+
+    /// 帧头 flag 中算法id占用的位
+    static const uint8_t kFlagMask = 0x07;
+
+    RockCodec(uint8_t type, const std::string &name) : m_type(type), m_name(name) {}
+    virtual ~RockCodec() {}
+
+    uint8_t getType() const { return m_type; }
+    const std::string &getName() const { return m_name; }
+
+    /**
+     * @brief 压缩 in 从当前位置开始的全部数据, 追加到 out
+     * @details 按 in 的内存块分段送入压缩器, 不把输入拼成连续内存
+     */
+    virtual bool compress(ByteArray::ptr in, ByteArray::ptr out) = 0;
+
+    /**
+     * @brief 解压, 解压后的长度必须恰好为 out_len
+     */
+    virtual bool decompress(const char *in, size_t in_len, char *out, size_t out_len) = 0;
+
+    /**
+     * @brief 注册算法, 同 id 的算法被替换
+     */
+    static void Register(RockCodec::ptr codec);
+    static RockCodec::ptr Get(uint8_t type);
+    static RockCodec::ptr GetByName(const std::string &name);
+
+    /**
+     * @brief 本端支持的算法位图(第 id 位)
+     */
+    static uint32_t GetSupportedMask();
+
+    /**
+     * @brief 本端 zstd 字典的id, 没有字典时为0
+     */
+    static uint32_t GetZstdDictId();
+
+private:
+    uint8_t m_type;
+    std::string m_name;
+};
+
+} // namespace base
@@ -3,6 +3,7 @@
 #include "base/conf/config.h"
 #include "base/endian.h"
 #include "base/net/streams/zlib_stream.h"
+#include "rock_codec.h"
 #include "base/macro.h"
 
 namespace base
@@ -16,15 +17,45 @@ static base::ConfigVar<uint32_t>::ptr g_rock_protocol_max_length = base::Config:
 static base::ConfigVar<uint32_t>::ptr g_rock_protocol_gzip_min_length = base::Config::Lookup(
     "rock.protocol.gzip_min_length", (uint32_t)(1024 * 1024 * 64), "rock protocol gizp min length");
 
+static base::ConfigVar<uint32_t>::ptr g_rock_protocol_compress_min_length =
+    base::Config::Lookup("rock.protocol.compress_min_length", (uint32_t)1024,
+                         "rock protocol min length compressed by the negotiated codec");
+
+std::string RockBody::getBody() const
+{
+    std::string_view body = getBodyView();
+    return std::string(body.data(), body.size());
+}
+
 bool RockBody::serializeToByteArray(ByteArray::ptr bytearray)
 {
-    bytearray->writeStringF32(m_body);
+    std::string_view body = getBodyView();
+    bytearray->writeFuint32(body.size());
+    bytearray->write(body.data(), body.size());
     return true;
 }
 
 bool RockBody::parseFromByteArray(ByteArray::ptr bytearray)
 {
-    m_body = bytearray->readStringF32();
+    if (!m_holder) {
+        m_body = bytearray->readStringF32();
+        return true;
+    }
+    uint32_t len = bytearray->readFuint32();
+    if (bytearray->getReadSize() < len) {
+        throw std::out_of_range("not enough len");
+    }
+    std::vector<iovec> iovs;
+    bytearray->getReadBuffers(iovs, len);
+    if (iovs.size() == 1) {
+        // 消息体在接收缓存中是连续的, 直接引用
+        m_view = std::string_view((const char *)iovs[0].iov_base, len);
+        bytearray->setPosition(bytearray->getPosition() + len);
+    } else {
+        m_holder.reset();
+        m_body.resize(len);
+        bytearray->read(&m_body[0], len);
+    }
     return true;
 }
 
@@ -39,7 +70,7 @@ std::shared_ptr<RockResponse> RockRequest::createResponse()
 std::string RockRequest::toString() const
 {
     std::stringstream ss;
-    ss << "[RockRequest sn=" << m_sn << " cmd=" << m_cmd << " body.length=" << m_body.size() << "]";
+    ss << "[RockRequest sn=" << m_sn << " cmd=" << m_cmd << " body.length=" << getBodySize() << "]";
     return ss.str();
 }
 
@@ -84,7 +115,7 @@ std::string RockResponse::toString() const
 {
     std::stringstream ss;
     ss << "[RockResponse sn=" << m_sn << " cmd=" << m_cmd << " result=" << m_result
-       << " result_msg=" << m_resultStr << " body.length=" << m_body.size() << "]";
+       << " result_msg=" << m_resultStr << " body.length=" << getBodySize() << "]";
     return ss.str();
 }
 
@@ -128,7 +159,7 @@ bool RockResponse::parseFromByteArray(ByteArray::ptr bytearray)
 std::string RockNotify::toString() const
 {
     std::stringstream ss;
-    ss << "[RockNotify notify=" << m_notify << " body.length=" << m_body.size() << "]";
+    ss << "[RockNotify notify=" << m_notify << " body.length=" << getBodySize() << "]";
     return ss.str();
 }
 
@@ -169,6 +200,54 @@ bool RockNotify::parseFromByteArray(ByteArray::ptr bytearray)
     return false;
 }
 
+std::string RockFrame::toString() const
+{
+    std::stringstream ss;
+    ss << "[RockFrame type=" << (int)m_frameType << " stream_id=" << m_streamId
+       << " value=" << m_value << " fin=" << isFin() << " body.length=" << getBodySize() << "]";
+    return ss.str();
+}
+
+const std::string &RockFrame::getName() const
+{
+    static const std::string &s_name = "RockFrame";
+    return s_name;
+}
+
+int32_t RockFrame::getType() const
+{
+    return Message::FRAME;
+}
+
+bool RockFrame::serializeToByteArray(ByteArray::ptr bytearray)
+{
+    try {
+        bytearray->writeFuint8(getType());
+        bytearray->writeFuint8(m_frameType);
+        bytearray->writeFuint8(m_flags);
+        bytearray->writeFuint32(m_streamId);
+        bytearray->writeFuint32(m_value);
+        return RockBody::serializeToByteArray(bytearray);
+    } catch (...) {
+        _LOG_ERROR(g_logger) << "RockFrame serializeToByteArray error";
+    }
+    return false;
+}
+
+bool RockFrame::parseFromByteArray(ByteArray::ptr bytearray)
+{
+    try {
+        m_frameType = bytearray->readFuint8();
+        m_flags = bytearray->readFuint8();
+        m_streamId = bytearray->readFuint32();
+        m_value = bytearray->readFuint32();
+        return RockBody::parseFromByteArray(bytearray);
+    } catch (...) {
+        _LOG_ERROR(g_logger) << "RockFrame parseFromByteArray error";
+    }
+    return false;
+}
+
 static const uint8_t s_rock_magic[2] = {0x12, 0x21};
 
 RockMsgHeader::RockMsgHeader()
@@ -180,20 +259,22 @@ Message::ptr RockMessageDecoder::parseFrom(Stream::ptr stream)
 {
     try {
         RockMsgHeader header;
-        int rt = stream->readFixSize(&header, sizeof(header));
+        int rt = m_buffer.fill(stream, sizeof(header));
         if (rt <= 0) {
             _LOG_DEBUG(g_logger) << "RockMessageDecoder decode head error rt=" << rt << " "
                                  << strerror(errno);
             return nullptr;
         }
+        memcpy(&header, m_buffer.peek(), sizeof(header));
 
         if (memcmp(header.magic, s_rock_magic, sizeof(s_rock_magic))) {
             _LOG_ERROR(g_logger) << "RockMessageDecoder head.magic error";
             return nullptr;
         }
 
-        if (header.version != 0x1) {
-            _LOG_ERROR(g_logger) << "RockMessageDecoder head.version != 0x1";
+        if (header.version != 0x1 && header.version != 0x2) {
+            _LOG_ERROR(g_logger) << "RockMessageDecoder head.version(" << (int)header.version
+                                 << ") not supported";
             return nullptr;
         }
 
@@ -203,17 +284,26 @@ Message::ptr RockMessageDecoder::parseFrom(Stream::ptr stream)
                                  << ") >=" << g_rock_protocol_max_length->getValue();
             return nullptr;
         }
-        base::ByteArray::ptr ba = std::make_shared<base::ByteArray>();
-        rt = stream->readFixSize(ba, header.length);
+        if (header.length <= 0) {
+            _LOG_ERROR(g_logger) << "RockMessageDecoder empty body";
+            return nullptr;
+        }
+        rt = m_buffer.fill(stream, sizeof(header) + header.length);
         if (rt <= 0) {
             _LOG_ERROR(g_logger) << "RockMessageDecoder read body fail length=" << header.length
                                  << " rt=" << rt << " errno=" << errno << " - " << strerror(errno);
             return nullptr;
         }
 
-        ba->setPosition(0);
+        // 消息体直接引用接收缓存, holder 让缓存块活到消息析构
+        std::shared_ptr<const char> holder = m_buffer.hold();
+        const char *data = m_buffer.peek() + sizeof(header);
+        base::ByteArray::ptr ba =
+            std::make_shared<base::ByteArray>((void *)data, header.length, false);
+        m_buffer.consume(sizeof(header) + header.length);
         // _LOG_INFO(g_logger) << ba->toHexString();
-        if (header.flag & 0x1) { // gizp
+        uint8_t codec = header.flag & RockCodec::kFlagMask;
+        if (codec == RockCodec::GZIP) { // gizp
             auto zstream = base::ZlibStream::CreateGzip(false);
             if (zstream->write(ba, -1) != Z_OK) {
                 _LOG_ERROR(g_logger) << "RockMessageDecoder ungzip error";
@@ -224,23 +314,68 @@ Message::ptr RockMessageDecoder::parseFrom(Stream::ptr stream)
                 return nullptr;
             }
             ba = zstream->getByteArray();
+            holder.reset();
+        } else if (codec != RockCodec::NONE) {
+            // 原始长度 + 压缩数据, 解压到池中的块内, 消息体引用这个块
+            auto c = RockCodec::Get(codec);
+            if (!c) {
+                _LOG_ERROR(g_logger) << "RockMessageDecoder unknow codec=" << (int)codec;
+                return nullptr;
+            }
+            uint32_t raw_length = ba->readFuint32();
+            if (raw_length == 0 || raw_length >= g_rock_protocol_max_length->getValue()) {
+                _LOG_ERROR(g_logger) << "RockMessageDecoder invalid raw length=" << raw_length;
+                return nullptr;
+            }
+            std::shared_ptr<char> block = RecvBuffer::Alloc(raw_length);
+            if (!c->decompress(data + sizeof(uint32_t), header.length - sizeof(uint32_t),
+                               block.get(), raw_length)) {
+                _LOG_ERROR(g_logger) << "RockMessageDecoder " << c->getName()
+                                     << " decompress error";
+                return nullptr;
+            }
+            ba = std::make_shared<base::ByteArray>(block.get(), raw_length, false);
+            holder = block;
         }
         uint8_t type = ba->readFuint8();
         Message::ptr msg;
+        RockBody *body = nullptr;
         switch (type) {
-            case Message::REQUEST:
-                msg = std::make_shared<RockRequest>();
+            case Message::REQUEST: {
+                auto req = std::make_shared<RockRequest>();
+                body = req.get();
+                msg = req;
                 break;
-            case Message::RESPONSE:
-                msg = std::make_shared<RockResponse>();
+            }
+            case Message::RESPONSE: {
+                auto rsp = std::make_shared<RockResponse>();
+                body = rsp.get();
+                msg = rsp;
                 break;
-            case Message::NOTIFY:
-                msg = std::make_shared<RockNotify>();
+            }
+            case Message::NOTIFY: {
+                auto nty = std::make_shared<RockNotify>();
+                body = nty.get();
+                msg = nty;
+                break;
+            }
+            case Message::FRAME: {
+                if (header.version != 0x2) {
+                    _LOG_ERROR(g_logger) << "RockMessageDecoder frame in version 1 header";
+                    return nullptr;
+                }
+                auto frame = std::make_shared<RockFrame>();
+                body = frame.get();
+                msg = frame;
                 break;
+            }
             default:
                 _LOG_ERROR(g_logger) << "RockMessageDecoder invalid type=" << (int)type;
                 return nullptr;
         }
+        if (holder) {
+            body->setBodyHolder(holder);
+        }
 
         if (!msg->parseFromByteArray(ba)) {
             _LOG_ERROR(g_logger) << "RockMessageDecoder parseFromByteArray fail type=" << (int)type;
@@ -255,21 +390,43 @@ Message::ptr RockMessageDecoder::parseFrom(Stream::ptr stream)
     return nullptr;
 }
 
-int32_t RockMessageDecoder::serializeTo(Stream::ptr stream, Message::ptr msg)
+ByteArray::ptr RockMessageDecoder::encode(Message::ptr msg, RockMsgHeader &header)
 {
-    RockMsgHeader header;
     auto ba = msg->toByteArray();
+    if (!ba) {
+        return nullptr;
+    }
     ba->setPosition(0);
     header.length = ba->getSize();
-    if ((uint32_t)header.length >= g_rock_protocol_gzip_min_length->getValue()) {
+    if (msg->getType() == Message::FRAME) {
+        header.version = 0x2;
+    }
+    uint8_t codec = m_codec;
+    if (codec != RockCodec::NONE && codec != RockCodec::GZIP
+        && (uint32_t)header.length >= g_rock_protocol_compress_min_length->getValue()) {
+        auto c = RockCodec::Get(codec);
+        base::ByteArray::ptr out = std::make_shared<base::ByteArray>();
+        out->writeFuint32(header.length);
+        if (c && c->compress(ba, out) && out->getSize() < (size_t)header.length) {
+            out->setPosition(0);
+            ba = out;
+            header.flag |= codec;
+            header.length = ba->getSize();
+        } else {
+            // 压缩失败或没有变小, 原样发送
+            ba->setPosition(0);
+        }
+    } else if ((uint32_t)header.length >= (codec == RockCodec::GZIP
+                                               ? g_rock_protocol_compress_min_length->getValue()
+                                               : g_rock_protocol_gzip_min_length->getValue())) {
         auto zstream = base::ZlibStream::CreateGzip(true);
         if (zstream->write(ba, -1) != Z_OK) {
             _LOG_ERROR(g_logger) << "RockMessageDecoder serializeTo gizp error";
-            return -1;
+            return nullptr;
         }
         if (zstream->flush() != Z_OK) {
             _LOG_ERROR(g_logger) << "RockMessageDecoder serializeTo gizp flush error";
-            return -2;
+            return nullptr;
         }
 
         ba = zstream->getByteArray();
@@ -277,6 +434,16 @@ int32_t RockMessageDecoder::serializeTo(Stream::ptr stream, Message::ptr msg)
         header.length = ba->getSize();
     }
     header.length = base::byteswapOnLittleEndian(header.length);
+    return ba;
+}
+
+int32_t RockMessageDecoder::serializeTo(Stream::ptr stream, Message::ptr msg)
+{
+    RockMsgHeader header;
+    auto ba = encode(msg, header);
+    if (!ba) {
+        return -1;
+    }
     int rt = stream->writeFixSize(&header, sizeof(header));
     if (rt <= 0) {
         _LOG_ERROR(g_logger) << "RockMessageDecoder serializeTo write header fail rt=" << rt
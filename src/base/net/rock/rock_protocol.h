@@ -1,19 +1,50 @@
 #pragma once
 
 #include "base/net/protocol.h"
+#include "base/net/recv_buffer.h"
 #include "google/protobuf/message.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include <atomic>
+#include <string_view>
 
 namespace base
 {
 
+/**
+ * @brief Rock 消息体
+ * @details 从连接上解析出的消息体直接引用接收缓存(RecvBuffer)中的内存, 不复制;
+ *          getBodyView/getAsPB 不产生复制, getBody 每次返回一份复制. 读取接口都不修改对象,
+ *          多个线程可以同时读取同一条消息
+ */
 class RockBody
 {
 public:
     typedef std::shared_ptr<RockBody> ptr;
     virtual ~RockBody() {}
 
-    void setBody(const std::string &v) { m_body = v; }
-    const std::string &getBody() const { return m_body; }
+    void setBody(const std::string &v)
+    {
+        m_body = v;
+        m_view = std::string_view();
+        m_holder.reset();
+    }
+
+    /**
+     * @brief 消息体的复制, 不释放引用的接收缓存, 之前取得的 getBodyView 仍然有效
+     */
+    std::string getBody() const;
+
+    /**
+     * @brief 消息体视图, 在消息对象存活且没有 setBody/setAsPB 之前有效, 调用 getBody 不影响
+     */
+    std::string_view getBodyView() const { return m_holder ? m_view : std::string_view(m_body); }
+
+    size_t getBodySize() const { return getBodyView().size(); }
+
+    /**
+     * @brief 解析之前由解码器设置, 消息体引用 holder 持有的内存
+     */
+    void setBodyHolder(std::shared_ptr<const char> v) { m_holder = std::move(v); }
 
     virtual bool serializeToByteArray(ByteArray::ptr bytearray);
     virtual bool parseFromByteArray(ByteArray::ptr bytearray);
@@ -23,7 +54,9 @@ public:
     {
         try {
             std::shared_ptr<T> data = std::make_shared<T>();
-            if (data->ParseFromString(m_body)) {
+            std::string_view body = getBodyView();
+            google::protobuf::io::ArrayInputStream input(body.data(), body.size());
+            if (data->ParseFromZeroCopyStream(&input)) {
                 return data;
             }
         } catch (...) {
@@ -35,6 +68,8 @@ public:
     bool setAsPB(const T &v)
     {
         try {
+            m_view = std::string_view();
+            m_holder.reset();
             return v.SerializeToString(&m_body);
         } catch (...) {
         }
@@ -43,6 +78,10 @@ public:
 
 protected:
     std::string m_body;
+    /// 引用接收缓存时的消息体
+    std::string_view m_view;
+    /// 持有 m_view 引用的接收缓存块
+    std::shared_ptr<const char> m_holder;
 };
 
 class RockResponse;
@@ -87,6 +126,57 @@ public:
     virtual bool parseFromByteArray(ByteArray::ptr bytearray) override;
 };
 
+/**
+ * @brief Rock v2 多路复用流的帧
+ * @details 帧头 version=2, 消息体依次为 类型(FRAME) 帧类型 标志 流id 参数 数据.
+ *          只在双方协商出 v2 之后发送, v1 的请求/响应/通知仍然使用 version=1 的帧
+ */
+class RockFrame : public Message, public RockBody
+{
+public:
+    typedef std::shared_ptr<RockFrame> ptr;
+
+    enum FrameType {
+        /// 打开流, 参数为命令字, 数据为元信息
+        OPEN = 1,
+        /// 数据块
+        DATA = 2,
+        /// 增加发送窗口, 参数为增量, 流id为0表示整个连接
+        WINDOW_UPDATE = 3,
+        /// 取消流, 参数为错误码
+        CANCEL = 4,
+    };
+
+    enum Flag {
+        /// 发送方不再发送数据
+        END_STREAM = 0x1,
+    };
+
+    RockFrame(uint8_t type = 0, uint32_t stream_id = 0, uint32_t value = 0)
+        : m_frameType(type), m_flags(0), m_streamId(stream_id), m_value(value)
+    {
+    }
+
+    uint8_t getFrameType() const { return m_frameType; }
+    uint32_t getStreamId() const { return m_streamId; }
+    uint32_t getValue() const { return m_value; }
+    bool isFin() const { return m_flags & END_STREAM; }
+    void setFin(bool v) { m_flags = v ? (m_flags | END_STREAM) : (m_flags & ~END_STREAM); }
+
+    virtual std::string toString() const override;
+    virtual const std::string &getName() const override;
+    virtual int32_t getType() const override;
+
+    virtual bool serializeToByteArray(ByteArray::ptr bytearray) override;
+    virtual bool parseFromByteArray(ByteArray::ptr bytearray) override;
+
+private:
+    uint8_t m_frameType;
+    uint8_t m_flags;
+    uint32_t m_streamId;
+    uint32_t m_value;
+};
+
 struct RockMsgHeader {
     RockMsgHeader();
     uint8_t magic[2];
@@ -100,8 +190,38 @@ class RockMessageDecoder : public MessageDecoder
 public:
     typedef std::shared_ptr<RockMessageDecoder> ptr;
 
+    /**
+     * @brief 从流中解析一条消息
+     * @details 数据读入本解码器的接收缓存, 一次读取可能包含多条消息, 所以一个解码器只能对应一个连接.
+     *          帧头在缓存中解析, 未压缩的消息体直接引用缓存
+     */
     virtual Message::ptr parseFrom(Stream::ptr stream) override;
     virtual int32_t serializeTo(Stream::ptr stream, Message::ptr msg) override;
+
+    /**
+     * @brief 丢弃接收缓存中的数据, 连接重建后调用
+     */
+    void reset() { m_buffer.reset(); }
+
+    /**
+     * @brief 编码消息, 不写入流
+     * @param[out] header 帧头(length 已转为网络字节序)
+     * @return 消息体, 位置在0; 失败返回 nullptr
+     */
+    ByteArray::ptr encode(Message::ptr msg, RockMsgHeader &header);
+
+    /**
+     * @brief 发送使用的压缩算法(RockCodec::Type)
+     * @details NONE 时只按 rock.protocol.gzip_min_length 使用 gzip(兼容 v1);
+     *          其它算法对不小于 rock.protocol.compress_min_length 的消息生效,
+     *          压缩后没有变小的消息不压缩发送. 解码不受影响, 按帧头识别算法
+     */
+    void setCodec(uint8_t v) { m_codec = v; }
+    uint8_t getCodec() const { return m_codec; }
+
+private:
+    RecvBuffer m_buffer;
+    std::atomic<uint8_t> m_codec{0};
 };
 
 } // namespace base
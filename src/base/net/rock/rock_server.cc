@@ -52,6 +52,23 @@ void RockServer::handleClient(Socket::ptr client)
         });
         return rt;
     });
+    session->setStreamHandler([](base::RockChannel::ptr channel, base::RockStream::ptr conn) {
+        bool rt = false;
+        // 第一个返回 true 的模块接管这个流
+        ModuleMgr::GetInstance()->foreach (Module::ROCK, [&rt, channel, conn](Module::ptr m) {
+            if (rt) {
+                return;
+            }
+            auto rm = std::dynamic_pointer_cast<RockModule>(m);
+            if (rm) {
+                rt = rm->handleRockStream(channel, conn);
+            }
+        });
+        if (!rt) {
+            _LOG_WARN(g_logger) << "unhandle stream cmd=" << channel->getCmd();
+            channel->cancel(base::RockChannel::NO_HANDLER);
+        }
+    });
     session->start();
 }
 
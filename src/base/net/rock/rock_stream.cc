@@ -4,6 +4,7 @@
 #include "base/coro/worker.h"
 #include "logserver.pb.h"
 #include "base/application/module.h"
+#include "rock_codec.h"
 
 namespace base
 {
@@ -16,6 +17,26 @@ static base::ConfigVar<
         std::unordered_map<std::string, std::unordered_map<std::string, std::string> >(),
         "rock_services");
 
+static base::ConfigVar<bool>::ptr g_rock_protocol_v2 =
+    base::Config::Lookup("rock.protocol.v2", true, "rock client negotiate protocol v2 streams");
+
+static base::ConfigVar<uint32_t>::ptr g_rock_hello_timeout =
+    base::Config::Lookup("rock.protocol.hello_timeout_ms", (uint32_t)1000,
+                         "rock protocol v2 negotiation timeout");
+
+static base::ConfigVar<uint32_t>::ptr g_rock_stream_window = base::Config::Lookup(
+    "rock.stream.window", (uint32_t)(256 * 1024), "rock v2 per stream receive window");
+
+static base::ConfigVar<uint32_t>::ptr g_rock_stream_conn_window = base::Config::Lookup(
+    "rock.stream.conn_window", (uint32_t)(1024 * 1024), "rock v2 per connection receive window");
+
+static base::ConfigVar<uint32_t>::ptr g_rock_stream_max_frame = base::Config::Lookup(
+    "rock.stream.max_frame", (uint32_t)(64 * 1024), "rock v2 max data frame size");
+
+static base::ConfigVar<std::string>::ptr g_rock_protocol_codec =
+    base::Config::Lookup("rock.protocol.codec", std::string("lz4"),
+                         "rock v2 compression codec: none, gzip, lz4, zstd, zstd_dict");
+
 // static base::ConfigVar<std::unordered_map<std::string
 //     ,std::unordered_map<std::string, std::string> > >::ptr g_rock_services =
 //     base::Config::Lookup("rock_services", std::unordered_map<std::string
@@ -67,10 +88,8 @@ RockResult::ptr RockStream::request(RockRequest::ptr req, uint32_t timeout_ms)
         ctx->timeout = timeout_ms;
         ctx->scheduler = base::Scheduler::GetThis();
         ctx->fiber = base::Fiber::GetThis();
-        addCtx(ctx);
         uint64_t ts = base::GetCurrentMS();
-        ctx->timer = base::IOManager::GetThis()->addTimer(
-            timeout_ms, std::bind(&RockStream::onTimeOut, shared_from_this(), ctx));
+        addCtx(ctx);
         enqueue(ctx);
         base::Fiber::YieldToHold();
         auto rt = std::make_shared<RockResult>(ctx->result, ctx->resultStr,
@@ -86,6 +105,45 @@ RockResult::ptr RockStream::request(RockRequest::ptr req, uint32_t timeout_ms)
     }
 }
 
+Future<RockResult::ptr> RockStream::requestAsync(RockRequest::ptr req, uint32_t timeout_ms)
+{
+    if (!isConnected()) {
+        auto rt = std::make_shared<RockResult>(AsyncSocketStream::NOT_CONNECT,
+                                               "not_connect " + getRemoteAddressString(), 0,
+                                               nullptr, req);
+        rt->server = getRemoteAddressString();
+        return MakeReadyFuture(rt);
+    }
+    if (req->getSn() == 0) {
+        req->setSn(base::Atomic::addFetch(m_sn));
+    }
+    base::IOManager *iom = base::IOManager::GetThis();
+    if (!iom) {
+        iom = m_iomanager;
+    }
+    RockCtx::ptr ctx = std::make_shared<RockCtx>();
+    ctx->request = req;
+    ctx->sn = req->getSn();
+    ctx->timeout = timeout_ms;
+    // 没有等待的协程, scheduler 只用来保证结果只处理一次
+    ctx->scheduler = iom;
+    ctx->promise.reset(new Promise<RockResult::ptr>());
+    ctx->startMs = base::GetCurrentMS();
+    ctx->server = getRemoteAddressString();
+    Future<RockResult::ptr> rt = ctx->promise->getFuture();
+    addCtx(ctx);
+    enqueue(ctx);
+    return rt;
+}
+
+void RockStream::RockCtx::onAsyncRsp()
+{
+    auto rt = std::make_shared<RockResult>(result, resultStr, base::GetCurrentMS() - startMs,
+                                           response, request);
+    rt->server = server;
+    promise->setValue(rt);
+}
+
 bool RockStream::RockSendCtx::doSend(AsyncSocketStream::ptr stream)
 {
     return std::dynamic_pointer_cast<RockStream>(stream)->m_decoder->serializeTo(stream, msg) > 0;
@@ -97,6 +155,429 @@ bool RockStream::RockCtx::doSend(AsyncSocketStream::ptr stream)
            > 0;
 }
 
+int32_t RockStream::RockSendCtx::serializeTo(AsyncSocketStream::ptr stream, SendBuffer &buf)
+{
+    return std::static_pointer_cast<RockStream>(stream)->appendMessage(buf, msg);
+}
+
+int32_t RockStream::RockCtx::serializeTo(AsyncSocketStream::ptr stream, SendBuffer &buf)
+{
+    return std::static_pointer_cast<RockStream>(stream)->appendMessage(buf, request);
+}
+
+int32_t RockStream::appendMessage(SendBuffer &buf, Message::ptr msg)
+{
+    RockMsgHeader header;
+    auto ba = m_decoder->encode(msg, header);
+    if (!ba) {
+        return -1;
+    }
+    int32_t len = sizeof(header) + ba->getReadSize();
+    buf.append(&header, sizeof(header));
+    buf.append(ba);
+    return len;
+}
+
+void RockStream::startRead()
+{
+    m_decoder->reset();
+    bool send_hello = false;
+    {
+        FiberMutex::Lock lock(m_channelMutex);
+        m_channels.clear();
+        m_nextStreamId = m_client ? 1 : 2;
+        m_localStreamWindow = std::max<uint32_t>(g_rock_stream_window->getValue(), 1024);
+        m_localConnWindow = std::max<uint32_t>(g_rock_stream_conn_window->getValue(), 1024);
+        m_localMaxFrame = std::max<uint32_t>(g_rock_stream_max_frame->getValue(), 1024);
+        m_connRecvAvailable = m_localConnWindow;
+        m_connRecvConsumed = 0;
+        m_connSendWindow = 0;
+        m_peerStreamWindow = 0;
+        m_peerMaxFrame = 0;
+        m_decoder->setCodec(RockCodec::NONE);
+        // 读协程启动之前准备好本次连接的握手状态, 之后只在锁内取用
+        m_hello = Promise<bool>();
+        m_helloFuture = m_hello.getFuture();
+        send_hello = m_client && g_rock_protocol_v2->getValue();
+        if (send_hello) {
+            m_peerVersion = 0;
+        } else {
+            m_peerVersion = 1;
+            m_hello.setValue(false);
+        }
+    }
+    AsyncSocketStream::startRead();
+    if (send_hello) {
+        sendHello();
+    }
+}
+
+void RockStream::onClose()
+{
+    FiberMutex::Lock lock(m_channelMutex);
+    auto channels = std::move(m_channels);
+    m_channels.clear();
+    for (auto &i : channels) {
+        cancelLocked(*i.second, RockChannel::CLOSED, false);
+    }
+    m_peerVersion = m_client && g_rock_protocol_v2->getValue() ? 0 : 1;
+    m_hello.setValue(false);
+    m_creditCond.notifyAll();
+}
+
+void RockStream::sendHello()
+{
+    auto rsp = std::make_shared<RockResponse>();
+    rsp->setSn(0);
+    rsp->setCmd(kHelloCmd);
+    rsp->setResult(0);
+    rsp->setResultStr("rock_v2");
+    base::ByteArray ba;
+    ba.writeFuint8(2);
+    ba.writeFuint32(m_localStreamWindow);
+    ba.writeFuint32(m_localConnWindow);
+    ba.writeFuint32(m_localMaxFrame);
+    ba.writeFuint32(RockCodec::GetSupportedMask());
+    ba.writeFuint32(RockCodec::GetZstdDictId());
+    ba.setPosition(0);
+    rsp->setBody(ba.toString());
+    sendMessage(rsp);
+}
+
+void RockStream::handleHello(RockResponse::ptr rsp)
+{
+    uint8_t version = 0;
+    uint32_t stream_window = 0;
+    uint32_t conn_window = 0;
+    uint32_t max_frame = 0;
+    // 没有带压缩算法的握手只认 gzip
+    uint32_t codecs = 1u << RockCodec::GZIP;
+    uint32_t dict_id = 0;
+    try {
+        base::ByteArray ba;
+        ba.write(rsp->getBodyView().data(), rsp->getBodySize());
+        ba.setPosition(0);
+        version = ba.readFuint8();
+        stream_window = ba.readFuint32();
+        conn_window = ba.readFuint32();
+        max_frame = ba.readFuint32();
+        if (ba.getReadSize() >= 8) {
+            codecs = ba.readFuint32();
+            dict_id = ba.readFuint32();
+        }
+    } catch (...) {
+        _LOG_WARN(g_logger) << "RockStream invalid hello " << rsp->toString();
+        return;
+    }
+    bool reply = false;
+    Promise<bool> hello;
+    {
+        FiberMutex::Lock lock(m_channelMutex);
+        if (version < 2 || (!m_client && m_peerVersion == 2) || max_frame == 0) {
+            _LOG_WARN(g_logger) << "RockStream ignore hello version=" << (int)version
+                                << " peer_version=" << (int)m_peerVersion;
+            return;
+        }
+        m_peerStreamWindow = stream_window;
+        m_connSendWindow = conn_window;
+        m_peerMaxFrame = max_frame;
+        m_decoder->setCodec(selectCodec(codecs, dict_id));
+        m_peerVersion = 2;
+        reply = !m_client;
+        // startRead 在锁内替换 m_hello, 拿到本次连接的 Promise 后在锁外设置
+        hello = m_hello;
+    }
+    // 先回复握手, 之后服务端才可能在这个连接上打开流
+    if (reply) {
+        sendHello();
+    }
+    hello.setValue(true);
+    m_creditCond.notifyAll();
+}
+
+uint8_t RockStream::selectCodec(uint32_t peer_codecs, uint32_t peer_dict_id) const
+{
+    auto codec = RockCodec::GetByName(m_codecName.empty() ? g_rock_protocol_codec->getValue()
+                                                          : m_codecName);
+    if (!codec || !(peer_codecs & (1u << codec->getType()))) {
+        return RockCodec::NONE;
+    }
+    if (codec->getType() == RockCodec::ZSTD_DICT
+        && peer_dict_id != RockCodec::GetZstdDictId()) {
+        return RockCodec::NONE;
+    }
+    return codec->getType();
+}
+
+uint8_t RockStream::getCodec() const
+{
+    return m_decoder->getCodec();
+}
+
+RockChannel::ptr RockStream::openStream(uint32_t cmd, const std::string &meta)
+{
+    if (!isConnected()) {
+        return nullptr;
+    }
+    Future<bool> hello;
+    uint8_t version = 0;
+    {
+        FiberMutex::Lock lock(m_channelMutex);
+        hello = m_helloFuture;
+        version = m_peerVersion;
+    }
+    if (version == 0 && hello.valid() && !hello.waitFor(g_rock_hello_timeout->getValue())) {
+        // 对端没有回复握手(v1 服务端), 本次连接按 v1 处理, 之后的 openStream 不再等待.
+        // 期间重连过时握手状态已经属于新连接, 不能改
+        FiberMutex::Lock lock(m_channelMutex);
+        if (m_helloFuture == hello && m_peerVersion == 0) {
+            m_peerVersion = 1;
+            m_hello.setValue(false);
+        }
+    }
+
+    FiberMutex::Lock lock(m_channelMutex);
+    if (m_peerVersion != 2) {
+        return nullptr;
+    }
+    uint32_t id = m_nextStreamId;
+    m_nextStreamId += 2;
+    auto ch = std::make_shared<RockChannel>(
+        std::static_pointer_cast<RockStream>(shared_from_this()), id, cmd, meta);
+    ch->m_sendWindow = m_peerStreamWindow;
+    ch->m_recvAvailable = m_localStreamWindow;
+    m_channels[id] = ch;
+    if (!sendFrame(RockFrame::OPEN, id, cmd, false, meta.data(), meta.size())) {
+        m_channels.erase(id);
+        return nullptr;
+    }
+    return ch;
+}
+
+bool RockStream::sendFrame(uint8_t type, uint32_t stream_id, uint32_t value, bool fin,
+                           const char *data, size_t length)
+{
+    auto frame = std::make_shared<RockFrame>(type, stream_id, value);
+    frame->setFin(fin);
+    if (length) {
+        frame->setBody(std::string(data, length));
+    }
+    return sendMessage(frame) > 0;
+}
+
+int32_t RockStream::channelWrite(RockChannel &ch, const char *data, size_t length, bool fin)
+{
+    FiberMutex::Lock lock(m_channelMutex);
+    if (ch.m_error) {
+        return -(int32_t)ch.m_error;
+    }
+    if (ch.m_localFin) {
+        return -(int32_t)RockChannel::PROTOCOL;
+    }
+    size_t offset = 0;
+    do {
+        while (!ch.m_error && offset < length
+               && (ch.m_sendWindow <= 0 || m_connSendWindow <= 0)) {
+            m_creditCond.wait(m_channelMutex);
+        }
+        if (ch.m_error) {
+            return -(int32_t)ch.m_error;
+        }
+        size_t n = std::min<int64_t>(
+            {(int64_t)(length - offset), ch.m_sendWindow, m_connSendWindow, (int64_t)m_peerMaxFrame});
+        ch.m_sendWindow -= n;
+        m_connSendWindow -= n;
+        bool last = fin && offset + n == length;
+        if (!sendFrame(RockFrame::DATA, ch.m_id, 0, last, data + offset, n)) {
+            cancelLocked(ch, RockChannel::CLOSED, false);
+            return -(int32_t)RockChannel::CLOSED;
+        }
+        offset += n;
+    } while (offset < length);
+    if (fin) {
+        ch.m_localFin = true;
+        removeIfDone(ch);
+    }
+    return length;
+}
+
+bool RockStream::channelRead(RockChannel &ch, std::string &chunk)
+{
+    FiberMutex::Lock lock(m_channelMutex);
+    while (ch.m_frames.empty() && !ch.m_remoteFin && !ch.m_error) {
+        ch.m_readCond.wait(m_channelMutex);
+    }
+    if (ch.m_error || ch.m_frames.empty()) {
+        return false;
+    }
+    auto frame = ch.m_frames.front();
+    ch.m_frames.pop_front();
+    chunk.assign(frame->getBodyView().data(), frame->getBodySize());
+    releaseCredit(&ch, chunk.size());
+    return true;
+}
+
+void RockStream::channelCancel(RockChannel &ch, uint32_t error)
+{
+    FiberMutex::Lock lock(m_channelMutex);
+    cancelLocked(ch, error ? error : (uint32_t)RockChannel::CANCELLED, true);
+}
+
+uint32_t RockStream::channelError(RockChannel &ch)
+{
+    FiberMutex::Lock lock(m_channelMutex);
+    return ch.m_error;
+}
+
+void RockStream::cancelLocked(RockChannel &ch, uint32_t error, bool notify_peer)
+{
+    if (ch.m_error) {
+        return;
+    }
+    ch.m_error = error;
+    eraseChannel(ch);
+    // 没读走的数据不会再读, 归还连接窗口
+    size_t left = 0;
+    for (auto &i : ch.m_frames) {
+        left += i->getBodySize();
+    }
+    ch.m_frames.clear();
+    if (error != RockChannel::CLOSED) {
+        releaseCredit(nullptr, left);
+    }
+    if (notify_peer && !(ch.m_localFin && ch.m_remoteFin)) {
+        sendFrame(RockFrame::CANCEL, ch.m_id, error);
+    }
+    ch.m_readCond.notifyAll();
+    m_creditCond.notifyAll();
+}
+
+void RockStream::removeIfDone(RockChannel &ch)
+{
+    if (ch.m_localFin && ch.m_remoteFin) {
+        eraseChannel(ch);
+    }
+}
+
+void RockStream::eraseChannel(RockChannel &ch)
+{
+    // 重连后流id从头分配, 旧连接的流不能删掉新连接上同id的流
+    auto it = m_channels.find(ch.m_id);
+    if (it != m_channels.end() && it->second.get() == &ch) {
+        m_channels.erase(it);
+    }
+}
+
+void RockStream::releaseCredit(RockChannel *ch, size_t n)
+{
+    if (ch && !ch->m_remoteFin) {
+        ch->m_recvConsumed += n;
+        if (ch->m_recvConsumed >= m_localStreamWindow / 2) {
+            ch->m_recvAvailable += ch->m_recvConsumed;
+            sendFrame(RockFrame::WINDOW_UPDATE, ch->m_id, ch->m_recvConsumed);
+            ch->m_recvConsumed = 0;
+        }
+    }
+    m_connRecvConsumed += n;
+    if (m_connRecvConsumed >= m_localConnWindow / 2) {
+        m_connRecvAvailable += m_connRecvConsumed;
+        sendFrame(RockFrame::WINDOW_UPDATE, 0, m_connRecvConsumed);
+        m_connRecvConsumed = 0;
+    }
+}
+
+void RockStream::handleFrame(RockFrame::ptr frame)
+{
+    uint32_t id = frame->getStreamId();
+    RockChannel::ptr opened;
+    {
+        FiberMutex::Lock lock(m_channelMutex);
+        auto it = m_channels.find(id);
+        RockChannel *ch = it == m_channels.end() ? nullptr : it->second.get();
+        switch (frame->getFrameType()) {
+            case RockFrame::OPEN: {
+                // 对端打开的流 id 奇偶性与本端相反
+                bool peer_id = id && (id & 1) == (m_client ? 0 : 1);
+                if (m_peerVersion != 2 || ch || !peer_id) {
+                    _LOG_WARN(g_logger) << "RockStream invalid open " << frame->toString();
+                    sendFrame(RockFrame::CANCEL, id, RockChannel::PROTOCOL);
+                    break;
+                }
+                opened = std::make_shared<RockChannel>(
+                    std::static_pointer_cast<RockStream>(shared_from_this()), id,
+                    frame->getValue(), frame->getBody());
+                opened->m_sendWindow = m_peerStreamWindow;
+                opened->m_recvAvailable = m_localStreamWindow;
+                m_channels[id] = opened;
+                break;
+            }
+            case RockFrame::DATA: {
+                size_t n = frame->getBodySize();
+                m_connRecvAvailable -= n;
+                if (m_connRecvAvailable < 0) {
+                    _LOG_WARN(g_logger) << "RockStream connection window overflow "
+                                        << frame->toString();
+                    m_connRecvAvailable += n;
+                    if (ch) {
+                        cancelLocked(*ch, RockChannel::FLOW_CONTROL, true);
+                    }
+                    break;
+                }
+                if (!ch || ch->m_remoteFin) {
+                    // 流已经结束或取消, 直接归还连接窗口
+                    releaseCredit(nullptr, n);
+                    break;
+                }
+                if ((int64_t)n > ch->m_recvAvailable) {
+                    _LOG_WARN(g_logger) << "RockStream stream window overflow "
+                                        << frame->toString();
+                    releaseCredit(nullptr, n);
+                    cancelLocked(*ch, RockChannel::FLOW_CONTROL, true);
+                    break;
+                }
+                ch->m_recvAvailable -= n;
+                if (n) {
+                    ch->m_frames.push_back(frame);
+                }
+                if (frame->isFin()) {
+                    ch->m_remoteFin = true;
+                    removeIfDone(*ch);
+                }
+                ch->m_readCond.notifyAll();
+                break;
+            }
+            case RockFrame::WINDOW_UPDATE:
+                if (id == 0) {
+                    m_connSendWindow += frame->getValue();
+                } else if (ch) {
+                    ch->m_sendWindow += frame->getValue();
+                }
+                m_creditCond.notifyAll();
+                break;
+            case RockFrame::CANCEL:
+                if (ch) {
+                    cancelLocked(*ch, frame->getValue() ? frame->getValue()
+                                                        : (uint32_t)RockChannel::CANCELLED,
+                                 false);
+                }
+                break;
+            default:
+                _LOG_WARN(g_logger) << "RockStream unknow frame " << frame->toString();
+                break;
+        }
+    }
+    if (opened) {
+        auto self = std::static_pointer_cast<RockStream>(shared_from_this());
+        if (m_streamHandler) {
+            auto handler = m_streamHandler;
+            m_worker->schedule([handler, opened, self]() { handler(opened, self); });
+        } else {
+            _LOG_WARN(g_logger) << "unhandle stream cmd=" << opened->getCmd();
+            opened->cancel(RockChannel::NO_HANDLER);
+        }
+    }
+}
+
 AsyncSocketStream::Ctx::ptr RockStream::doRecv()
 {
     //_LOG_INFO(g_logger) << "doRecv " << this;
@@ -114,6 +595,10 @@ AsyncSocketStream::Ctx::ptr RockStream::doRecv()
                                 << msg->toString();
             return nullptr;
         }
+        if (rsp->getSn() == 0 && rsp->getCmd() == kHelloCmd) {
+            handleHello(rsp);
+            return nullptr;
+        }
         RockCtx::ptr ctx = getAndDelCtxAs<RockCtx>(rsp->getSn());
         if (!ctx) {
             _LOG_WARN(g_logger) << "RockStream request timeout reponse=" << rsp->toString();
@@ -150,6 +635,13 @@ AsyncSocketStream::Ctx::ptr RockStream::doRecv()
         } else {
             _LOG_WARN(g_logger) << "unhandle notify " << nty->toString();
         }
+    } else if (type == Message::FRAME) {
+        auto frame = std::dynamic_pointer_cast<RockFrame>(msg);
+        if (!frame) {
+            _LOG_WARN(g_logger) << "RockStream doRecv frame not RockFrame: " << msg->toString();
+            return nullptr;
+        }
+        handleFrame(frame);
     } else {
         _LOG_WARN(g_logger) << "RockStream recv unknow type=" << type
                             << " msg: " << msg->toString();
@@ -185,6 +677,7 @@ RockSession::RockSession(Socket::ptr sock) : RockStream(sock)
 RockConnection::RockConnection() : RockStream(nullptr)
 {
     m_autoConnect = true;
+    m_client = true;
 }
 
 bool RockConnection::connect(base::Address::ptr addr)
@@ -286,4 +779,42 @@ RockResult::ptr RockSDLoadBalance::request(const std::string &domain, const std:
     return r;
 }
 
+Future<RockResult::ptr> RockSDLoadBalance::requestAsync(const std::string &domain,
+                                                        const std::string &service,
+                                                        RockRequest::ptr req, uint32_t timeout_ms,
+                                                        uint64_t idx)
+{
+    auto lb = get(domain, service);
+    if (!lb) {
+        return MakeReadyFuture(
+            std::make_shared<RockResult>(ILoadBalance::NO_SERVICE, "no_service", 0, nullptr, req));
+    }
+    auto conn = lb->get(idx);
+    if (!conn) {
+        return MakeReadyFuture(std::make_shared<RockResult>(
+            ILoadBalance::NO_CONNECTION, "no_connection", 0, nullptr, req));
+    }
+    uint64_t ts = base::GetCurrentMS();
+    auto &stats = conn->get(ts / 1000);
+    stats.incDoing(1);
+    stats.incTotal(1);
+    // 统计很轻, 直接在设置结果的上下文中更新
+    return conn->getStreamAs<RockStream>()->requestAsync(req, timeout_ms).then(
+        [conn, ts](Future<RockResult::ptr> f) {
+            auto r = f.get();
+            auto &stats = conn->get(ts / 1000);
+            if (r->result == 0) {
+                stats.incOks(1);
+                stats.incUsedTime(base::GetCurrentMS() - ts);
+            } else if (r->result == AsyncSocketStream::TIMEOUT) {
+                stats.incTimeouts(1);
+            } else if (r->result < 0) {
+                stats.incErrs(1);
+            }
+            stats.decDoing(1);
+            return r;
+        },
+        nullptr);
+}
+
 } // namespace base
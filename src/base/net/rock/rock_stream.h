@@ -2,9 +2,12 @@
 
 #include "base/net/streams/async_socket_stream.h"
 #include "rock_protocol.h"
+#include "rock_channel.h"
 #include "base/net/streams/load_balance.h"
+#include "base/coro/future.h"
 #include "base/singleton.h"
 #include <boost/any.hpp>
+#include <atomic>
 
 namespace base
 {
@@ -29,12 +32,19 @@ struct RockResult {
 
 class RockStream : public base::AsyncSocketStream
 {
+    friend class RockChannel;
+
 public:
     typedef std::shared_ptr<RockStream> ptr;
     typedef std::function<bool(base::RockRequest::ptr, base::RockResponse::ptr,
                                base::RockStream::ptr)>
         request_handler;
     typedef std::function<bool(base::RockNotify::ptr, base::RockStream::ptr)> notify_handler;
+    /// 对端打开的流, 在 worker 中执行, 处理完后需要 finish 或 cancel
+    typedef std::function<void(base::RockChannel::ptr, base::RockStream::ptr)> stream_handler;
+
+    /// v2 握手使用的命令字(以 sn=0 的响应发送, v1 的对端只会打印一条日志)
+    static const uint32_t kHelloCmd = 0xFFFFFF01;
 
     RockStream(Socket::ptr sock);
     ~RockStream();
@@ -42,11 +52,46 @@ public:
     int32_t sendMessage(Message::ptr msg);
     RockResult::ptr request(RockRequest::ptr req, uint32_t timeout_ms);
 
+    /**
+     * @brief 异步请求, 不挂起当前协程
+     * @details 响应/超时/连接断开时在读协程或定时器中设置结果, 不需要为每个请求创建协程.
+     *          多个请求可以通过 WhenAll/WhenAny 组合等待
+     */
+    Future<RockResult::ptr> requestAsync(RockRequest::ptr req, uint32_t timeout_ms);
+
+    /**
+     * @brief 打开一个多路复用流(Rock v2)
+     * @details 握手还没有完成时最多等待 rock.protocol.hello_timeout_ms 毫秒
+     * @param[in] cmd 命令字, 对端据此选择处理函数
+     * @param[in] meta 随 OPEN 帧发送的元信息
+     * @return 连接断开或对端只支持 v1 时返回 nullptr
+     */
+    RockChannel::ptr openStream(uint32_t cmd, const std::string &meta = "");
+
+    /**
+     * @brief 对端是否支持 v2 的多路复用流
+     */
+    bool isV2() const { return m_peerVersion == 2; }
+
+    /**
+     * @brief 指定本连接发送使用的压缩算法名, 为空时使用 rock.protocol.codec
+     * @details 在 v2 握手时生效, 对端不支持时不压缩(仍按 rock.protocol.gzip_min_length 使用 gzip)
+     */
+    void setCodecName(const std::string &v) { m_codecName = v; }
+    const std::string &getCodecName() const { return m_codecName; }
+
+    /**
+     * @brief 协商出的压缩算法(RockCodec::Type)
+     */
+    uint8_t getCodec() const;
+
     request_handler getRequestHandler() const { return m_requestHandler; }
     notify_handler getNotifyHandler() const { return m_notifyHandler; }
+    stream_handler getStreamHandler() const { return m_streamHandler; }
 
     void setRequestHandler(request_handler v) { m_requestHandler = v; }
     void setNotifyHandler(notify_handler v) { m_notifyHandler = v; }
+    void setStreamHandler(stream_handler v) { m_streamHandler = v; }
 
     template <class T>
     void setData(const T &v)
@@ -70,6 +115,7 @@ protected:
         Message::ptr msg;
 
         virtual bool doSend(AsyncSocketStream::ptr stream) override;
+        virtual int32_t serializeTo(AsyncSocketStream::ptr stream, SendBuffer &buf) override;
     };
 
     struct RockCtx : public Ctx {
@@ -77,20 +123,99 @@ protected:
         RockRequest::ptr request;
         RockResponse::ptr response;
 
+        /// 异步请求的结果
+        std::unique_ptr<Promise<RockResult::ptr> > promise;
+        uint64_t startMs = 0;
+        std::string server;
+
         virtual bool doSend(AsyncSocketStream::ptr stream) override;
+        virtual int32_t serializeTo(AsyncSocketStream::ptr stream, SendBuffer &buf) override;
+        virtual void onAsyncRsp() override;
     };
 
     virtual Ctx::ptr doRecv() override;
 
+    /**
+     * @brief 连接(重新)建立后丢弃上一个连接残留在接收缓存中的数据, 重置流状态,
+     *        主动连接的一端发起 v2 握手
+     */
+    virtual void startRead() override;
+
+    /**
+     * @brief 连接断开, 以 CLOSED 结束所有流
+     */
+    virtual void onClose() override;
+
+    /**
+     * @brief 把一条消息的帧头和消息体追加到合并发送缓存
+     */
+    int32_t appendMessage(SendBuffer &buf, Message::ptr msg);
+
     void handleRequest(base::RockRequest::ptr req);
     void handleNotify(base::RockNotify::ptr nty);
 
+    void sendHello();
+    void handleHello(RockResponse::ptr rsp);
+    void handleFrame(RockFrame::ptr frame);
+    /**
+     * @brief 按本端偏好和对端声明的算法选出发送使用的压缩算法
+     */
+    uint8_t selectCodec(uint32_t peer_codecs, uint32_t peer_dict_id) const;
+
+    /// 以下由 RockChannel 调用
+    int32_t channelWrite(RockChannel &ch, const char *data, size_t length, bool fin);
+    bool channelRead(RockChannel &ch, std::string &chunk);
+    void channelCancel(RockChannel &ch, uint32_t error);
+    uint32_t channelError(RockChannel &ch);
+
+    /// 以下需要持有 m_channelMutex
+    bool sendFrame(uint8_t type, uint32_t stream_id, uint32_t value, bool fin = false,
+                   const char *data = nullptr, size_t length = 0);
+    void cancelLocked(RockChannel &ch, uint32_t error, bool notify_peer);
+    void removeIfDone(RockChannel &ch);
+    void eraseChannel(RockChannel &ch);
+    /**
+     * @brief 读走 n 字节后累计待归还的窗口, 超过半个窗口时发送 WINDOW_UPDATE
+     */
+    void releaseCredit(RockChannel *ch, size_t n);
+
+protected:
+    /// 主动连接的一端, 发起握手, 使用奇数流id
+    bool m_client = false;
+
 private:
     RockMessageDecoder::ptr m_decoder;
     request_handler m_requestHandler;
     notify_handler m_notifyHandler;
+    stream_handler m_streamHandler;
     boost::any m_data;
     uint32_t m_sn = 0;
+    std::string m_codecName;
+
+    /// 对端协议版本: 0 握手中, 1 只支持 v1, 2 支持多路复用流; 只在 m_channelMutex 内修改
+    std::atomic<uint8_t> m_peerVersion{1};
+    /// 保护以下所有流状态及 RockChannel 的成员
+    FiberMutex m_channelMutex;
+    /// 等待发送窗口的写者
+    FiberConditionVariable m_creditCond;
+    /// 本次连接的握手结果, startRead 在锁内替换, 其它地方在锁内复制后使用
+    Promise<bool> m_hello;
+    Future<bool> m_helloFuture;
+    std::unordered_map<uint32_t, RockChannel::ptr> m_channels;
+    uint32_t m_nextStreamId = 1;
+    /// 本端通告的窗口和最大帧
+    uint32_t m_localStreamWindow = 0;
+    uint32_t m_localConnWindow = 0;
+    uint32_t m_localMaxFrame = 0;
+    /// 对端通告的单流初始窗口和最大帧
+    uint32_t m_peerStreamWindow = 0;
+    uint32_t m_peerMaxFrame = 0;
+    /// 连接级剩余发送窗口
+    int64_t m_connSendWindow = 0;
+    /// 连接级还允许对端发送的字节数
+    int64_t m_connRecvAvailable = 0;
+    /// 连接级已读走还没有归还的字节数
+    uint32_t m_connRecvConsumed = 0;
 };
 
 class RockSession : public RockStream
@@ -121,6 +246,13 @@ public:
 
     RockResult::ptr request(const std::string &domain, const std::string &service,
                             RockRequest::ptr req, uint32_t timeout_ms, uint64_t idx = -1);
+
+    /**
+     * @brief 异步请求, 统计在结果就绪时更新
+     */
+    Future<RockResult::ptr> requestAsync(const std::string &domain, const std::string &service,
+                                         RockRequest::ptr req, uint32_t timeout_ms,
+                                         uint64_t idx = -1);
 };
 
 } // namespace base
@@ -5,6 +5,7 @@
 #include "base/macro.h"
 #include "base/coro/hook.h"
 #include <limits.h>
+#include <linux/filter.h>
 
 namespace base
 {
@@ -81,7 +82,8 @@ bool Socket::checkConnected()
 
 int64_t Socket::getSendTimeout()
 {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdManager::ReadGuard guard;
+    FdCtx *ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) {
         return ctx->getTimeout(SO_SNDTIMEO);
     }
@@ -96,7 +98,8 @@ void Socket::setSendTimeout(int64_t v)
 
 int64_t Socket::getRecvTimeout()
 {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdManager::ReadGuard guard;
+    FdCtx *ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) {
         return ctx->getTimeout(SO_RCVTIMEO);
     }
@@ -149,8 +152,13 @@ Socket::ptr Socket::accept()
 
 bool Socket::init(int sock)
 {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
-    if (ctx && ctx->isSocket() && !ctx->isClose()) {
+    bool is_socket = false;
+    {
+        FdManager::ReadGuard guard;
+        FdCtx *ctx = FdMgr::GetInstance()->get(sock);
+        is_socket = ctx && ctx->isSocket() && !ctx->isClose();
+    }
+    if (is_socket) {
         m_sock = sock;
         m_isConnected = true;
         initSock();
@@ -195,6 +203,46 @@ bool Socket::bind(const Address::ptr addr)
     return true;
 }
 
+bool Socket::setReusePort()
+{
+    if (!isValid()) {
+        newSock();
+        if (_UNLIKELY(!isValid())) {
+            return false;
+        }
+    }
+    int val = 1;
+    if (!setOption(SOL_SOCKET, SO_REUSEPORT, val)) {
+        _LOG_ERROR(g_logger) << "setsockopt SO_REUSEPORT sock=" << m_sock << " errno=" << errno
+                             << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool Socket::attachReusePortCpuSteering()
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    // A = 当前CPU; return A, 内核按 A % 组大小 选择socket
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(m_sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog))) {
+        _LOG_ERROR(g_logger) << "setsockopt SO_ATTACH_REUSEPORT_CBPF sock=" << m_sock
+                             << " errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+#else
+    _LOG_ERROR(g_logger) << "SO_ATTACH_REUSEPORT_CBPF not supported";
+    return false;
+#endif
+}
+
 bool Socket::reconnect(uint64_t timeout_ms)
 {
     if (!m_remoteAddress) {
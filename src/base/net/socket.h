@@ -161,6 +161,20 @@ public:
      */
     virtual bool bind(const Address::ptr addr);
 
+    /**
+     * @brief 设置 SO_REUSEPORT, 需要在 bind 之前调用
+     * @details 同一地址上的多个监听socket组成一组, 内核在组内分发新连接
+     */
+    bool setReusePort();
+
+    /**
+     * @brief 给 SO_REUSEPORT 组挂载 CBPF 程序, 按处理数据包的CPU选择监听socket
+     * @details 新连接进入组内第 (cpu % 组大小) 个socket(按 bind 的先后顺序),
+     *          挂载到组内任意一个socket即可
+     * @pre 已经 bind
+     */
+    bool attachReusePortCpuSteering();
+
     /**
      * @brief 连接地址
      * @param[in] addr 目标地址
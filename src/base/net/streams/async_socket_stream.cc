@@ -2,12 +2,63 @@
 #include "base/util.h"
 #include "base/log/log.h"
 #include "base/macro.h"
+#include "base/conf/config.h"
+#include <algorithm>
+#include <limits.h>
 
 namespace base
 {
 
 static base::Logger::ptr g_logger = _LOG_NAME("system");
 
+static base::ConfigVar<bool>::ptr g_write_batch = base::Config::Lookup(
+    "async_socket_stream.write_batch", true, "merge queued messages into one writev");
+
+static base::ConfigVar<uint32_t>::ptr g_write_delay_us =
+    base::Config::Lookup("async_socket_stream.write_delay_us", (uint32_t)0,
+                         "wait for more messages before a batched write, 0 disables");
+
+static base::ConfigVar<uint32_t>::ptr g_write_batch_bytes =
+    base::Config::Lookup("async_socket_stream.write_batch_bytes", (uint32_t)(1024 * 1024),
+                         "flush a batched write once it reaches this size");
+
+static base::ConfigVar<uint32_t>::ptr g_pending_slots = base::Config::Lookup(
+    "async_socket_stream.pending_slots", (uint32_t)16384,
+    "max pending request slots per connection, rounded up to a power of 2");
+
+/// 槽数组的初始大小, 在途请求多时按需扩容
+static const uint32_t kInitialSlots = 64;
+
+static base::ConfigVar<uint32_t>::ptr g_timeout_tick_ms =
+    base::Config::Lookup("async_socket_stream.timeout_tick_ms", (uint32_t)10,
+                         "request timeout check interval");
+
+AsyncSocketStream::SendBuffer::SendBuffer() : scratch(std::make_shared<ByteArray>())
+{
+}
+
+void AsyncSocketStream::SendBuffer::append(const void *data, size_t len)
+{
+    // ByteArray 扩容只追加节点, 之前取出的 iovec 仍然有效
+    scratch->getWriteBuffers(iovs, len);
+    scratch->write(data, len);
+    size += len;
+}
+
+void AsyncSocketStream::SendBuffer::append(ByteArray::ptr ba)
+{
+    size += ba->getReadBuffers(iovs);
+    buffers.push_back(ba);
+}
+
+void AsyncSocketStream::SendBuffer::clear()
+{
+    iovs.clear();
+    buffers.clear();
+    scratch->clear();
+    size = 0;
+}
+
 AsyncSocketStream::Ctx::Ctx() : sn(0), timeout(0), result(0), timed(false), scheduler(nullptr)
 {
 }
@@ -19,7 +70,7 @@ void AsyncSocketStream::Ctx::doRsp()
         return;
     }
     _LOG_DEBUG(g_logger) << "scd=" << scd << " fiber=" << fiber;
-    if (!scd || !fiber) {
+    if (!scd) {
         return;
     }
     if (timer) {
@@ -31,13 +82,29 @@ void AsyncSocketStream::Ctx::doRsp()
         result = TIMEOUT;
         resultStr = "timeout";
     }
-    scd->schedule(&fiber);
+    if (fiber) {
+        scd->schedule(&fiber);
+    } else {
+        onAsyncRsp();
+    }
 }
 
 AsyncSocketStream::AsyncSocketStream(Socket::ptr sock, bool owner)
     : SocketStream(sock, owner), m_waitSem(2), m_sn(0), m_autoConnect(false), m_tryConnectCount(0),
-      m_iomanager(nullptr), m_worker(nullptr)
+      m_iomanager(nullptr), m_worker(nullptr), m_writeBatch(g_write_batch->getValue()),
+      m_writeDelayUs(g_write_delay_us->getValue())
+{
+}
+
+AsyncSocketStream::~AsyncSocketStream()
 {
+    Ctx *head = m_timeoutHead.exchange(nullptr);
+    while (head) {
+        Ctx *next = head->timeNext;
+        head->timeSelf.reset();
+        head = next;
+    }
+    delete m_slots.load();
 }
 
 bool AsyncSocketStream::start()
@@ -127,11 +194,25 @@ void AsyncSocketStream::doWrite()
     try {
         while (isConnected()) {
             m_sem.wait();
+            if (m_writeDelayUs) {
+                // 唤醒写协程的是第一条消息, 稍等一下让后续消息进入同一批
+                if (m_writeDelayUs < 1000) {
+                    Fiber::YieldToReady();
+                } else {
+                    usleep(m_writeDelayUs);
+                }
+            }
             std::list<SendCtx::ptr> ctxs;
             {
                 RWMutexType::WriteLock lock(m_queueMutex);
                 m_queue.swap(ctxs);
             }
+            if (m_writeBatch) {
+                if (!sendBatch(ctxs)) {
+                    innerClose();
+                }
+                continue;
+            }
             auto self = shared_from_this();
             for (auto &i : ctxs) {
                 if (!i->doSend(self)) {
@@ -151,6 +232,65 @@ void AsyncSocketStream::doWrite()
     m_waitSem.notify();
 }
 
+bool AsyncSocketStream::sendBatch(std::list<SendCtx::ptr> &ctxs)
+{
+    auto self = shared_from_this();
+    SendBuffer &buf = m_sendBuffer;
+    uint64_t max_bytes = g_write_batch_bytes->getValue();
+    bool ok = true;
+    for (auto &i : ctxs) {
+        int32_t rt = i->serializeTo(self, buf);
+        if (rt < 0) {
+            ok = false;
+            break;
+        }
+        if (rt == 0) {
+            // 保持发送顺序, 先发出之前合并的数据
+            if (!flushSendBuffer(buf) || !i->doSend(self)) {
+                ok = false;
+                break;
+            }
+        } else if (buf.size >= max_bytes && !flushSendBuffer(buf)) {
+            ok = false;
+            break;
+        }
+    }
+    if (ok) {
+        ok = flushSendBuffer(buf);
+    }
+    buf.clear();
+    return ok;
+}
+
+bool AsyncSocketStream::flushSendBuffer(SendBuffer &buf)
+{
+    size_t idx = 0;
+    while (idx < buf.iovs.size()) {
+        size_t n = std::min<size_t>(buf.iovs.size() - idx, IOV_MAX);
+        int rt = m_socket->send(&buf.iovs[idx], n);
+        if (rt <= 0) {
+            _LOG_DEBUG(g_logger) << "flushSendBuffer fail rt=" << rt << " errno=" << errno
+                                 << " - " << strerror(errno);
+            return false;
+        }
+        // 部分写: 跳过已发送的段, 调整第一个未发完的段
+        size_t left = rt;
+        while (left > 0) {
+            iovec &iov = buf.iovs[idx];
+            if (iov.iov_len <= left) {
+                left -= iov.iov_len;
+                ++idx;
+            } else {
+                iov.iov_base = (char *)iov.iov_base + left;
+                iov.iov_len -= left;
+                left = 0;
+            }
+        }
+    }
+    buf.clear();
+    return true;
+}
+
 void AsyncSocketStream::startRead()
 {
     m_iomanager->schedule(std::bind(&AsyncSocketStream::doRead, shared_from_this()));
@@ -164,40 +304,254 @@ void AsyncSocketStream::startWrite()
 void AsyncSocketStream::onTimeOut(Ctx::ptr ctx)
 {
     _LOG_DEBUG(g_logger) << "onTimeOut " << ctx;
-    {
-        RWMutexType::WriteLock lock(m_mutex);
-        m_ctxs.erase(ctx->sn);
+    // 已经收到响应或者连接断开时请求不在表中
+    if (!findCtx(ctx->sn, true, ctx.get())) {
+        return;
     }
     ctx->timed = true;
     ctx->doRsp();
 }
 
-AsyncSocketStream::Ctx::ptr AsyncSocketStream::getCtx(uint32_t sn)
+AsyncSocketStream::SlotTable::SlotTable(uint32_t size, SlotTable *prev)
+    : mask(size - 1), slots(new PendingSlot[size]), prev(prev)
 {
-    RWMutexType::ReadLock lock(m_mutex);
-    auto it = m_ctxs.find(sn);
-    return it != m_ctxs.end() ? it->second : nullptr;
 }
 
-AsyncSocketStream::Ctx::ptr AsyncSocketStream::getAndDelCtx(uint32_t sn)
+uint32_t AsyncSocketStream::getPendingSlots() const
+{
+    SlotTable *table = m_slots.load(std::memory_order_acquire);
+    return table ? table->mask + 1 : 0;
+}
+
+AsyncSocketStream::SlotTable *AsyncSocketStream::getSlots()
+{
+    SlotTable *table = m_slots.load(std::memory_order_acquire);
+    if (_LIKELY(table)) {
+        return table;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    table = m_slots.load(std::memory_order_acquire);
+    if (!table) {
+        uint32_t size = 1;
+        while (size < std::min(g_pending_slots->getValue(), kInitialSlots)) {
+            size <<= 1;
+        }
+        table = new SlotTable(size, nullptr);
+        m_slots.store(table, std::memory_order_release);
+    }
+    return table;
+}
+
+bool AsyncSocketStream::growSlots(SlotTable *table)
+{
+    RWMutexType::WriteLock lock(m_mutex);
+    if (m_slots.load(std::memory_order_acquire) != table) {
+        return true;
+    }
+    uint32_t size = table->mask + 1;
+    if (size >= g_pending_slots->getValue() || size >= (1u << 30)) {
+        return false;
+    }
+
+    // 新数组发布前只有本线程访问; 新掩码多一位, 旧数组一个槽里的请求在新数组中也不会冲突
+    SlotTable *fresh = new SlotTable(size << 1, table);
+    const uint64_t moved = PendingSlot::Tag(0, PendingSlot::MOVED);
+    for (uint32_t i = 0; i < size; ++i) {
+        PendingSlot &slot = table->slots[i];
+        uint64_t tag = slot.tag.load(std::memory_order_acquire);
+        while (true) {
+            uint32_t state = tag & 0x3;
+            if (state == PendingSlot::FREE) {
+                if (slot.tag.compare_exchange_weak(tag, moved, std::memory_order_acq_rel)) {
+                    break;
+                }
+            } else if (state == PendingSlot::USED) {
+                if (slot.tag.compare_exchange_weak(tag, tag - PendingSlot::USED + PendingSlot::BUSY,
+                                                   std::memory_order_acquire)) {
+                    uint32_t sn = tag >> 2;
+                    PendingSlot &dst = fresh->slots[sn & fresh->mask];
+                    dst.ctx.swap(slot.ctx);
+                    dst.tag.store(tag, std::memory_order_relaxed);
+                    slot.tag.store(moved, std::memory_order_release);
+                    break;
+                }
+            } else {
+                // 另一个线程正在读写这个请求, 临界区很短, 等它结束
+                tag = slot.tag.load(std::memory_order_acquire);
+            }
+        }
+    }
+    m_slots.store(fresh, std::memory_order_release);
+    return true;
+}
+
+AsyncSocketStream::Ctx::ptr AsyncSocketStream::findCtx(uint32_t sn, bool del, Ctx *expect)
 {
+    SlotTable *table = m_slots.load(std::memory_order_acquire);
+    const uint64_t used = PendingSlot::Tag(sn, PendingSlot::USED);
+    const uint64_t busy = PendingSlot::Tag(sn, PendingSlot::BUSY);
+    while (table) {
+        PendingSlot &slot = table->slots[sn & table->mask];
+        uint64_t tag = used;
+        if (slot.tag.compare_exchange_weak(tag, busy, std::memory_order_acquire)) {
+            Ctx::ptr ctx;
+            if (expect && slot.ctx.get() != expect) {
+                slot.tag.store(used, std::memory_order_release);
+                break;
+            }
+            if (del) {
+                ctx.swap(slot.ctx);
+                slot.tag.store(PendingSlot::Tag(sn, PendingSlot::FREE), std::memory_order_release);
+            } else {
+                ctx = slot.ctx;
+                slot.tag.store(used, std::memory_order_release);
+            }
+            return ctx;
+        }
+        if ((tag & 0x3) == PendingSlot::MOVED) {
+            // 扩容中或已经扩容, 等迁移结束后到新数组里找
+            RWMutexType::ReadLock lock(m_mutex);
+            table = m_slots.load(std::memory_order_acquire);
+            continue;
+        }
+        // 另一个线程正在读写这个请求, 临界区很短, 等它结束
+        if (tag != busy && tag != used) {
+            break;
+        }
+    }
+    if (m_overflow.load(std::memory_order_acquire) == 0) {
+        return nullptr;
+    }
     Ctx::ptr ctx;
     RWMutexType::WriteLock lock(m_mutex);
     auto it = m_ctxs.find(sn);
-    if (it != m_ctxs.end()) {
+    if (it != m_ctxs.end() && (!expect || it->second.get() == expect)) {
         ctx = it->second;
-        m_ctxs.erase(it);
+        if (del) {
+            m_ctxs.erase(it);
+            --m_overflow;
+        }
     }
     return ctx;
 }
 
+AsyncSocketStream::Ctx::ptr AsyncSocketStream::getCtx(uint32_t sn)
+{
+    return findCtx(sn, false);
+}
+
+AsyncSocketStream::Ctx::ptr AsyncSocketStream::getAndDelCtx(uint32_t sn)
+{
+    return findCtx(sn, true);
+}
+
 bool AsyncSocketStream::addCtx(Ctx::ptr ctx)
 {
-    RWMutexType::WriteLock lock(m_mutex);
-    m_ctxs.insert(std::make_pair(ctx->sn, ctx));
+    SlotTable *table = getSlots();
+    while (true) {
+        PendingSlot &slot = table->slots[ctx->sn & table->mask];
+        uint64_t tag = slot.tag.load(std::memory_order_relaxed);
+        uint32_t state = tag & 0x3;
+        if (state == PendingSlot::FREE) {
+            if (slot.tag.compare_exchange_strong(tag, PendingSlot::Tag(ctx->sn, PendingSlot::BUSY),
+                                                 std::memory_order_acquire)) {
+                slot.ctx = ctx;
+                slot.tag.store(PendingSlot::Tag(ctx->sn, PendingSlot::USED),
+                               std::memory_order_release);
+                break;
+            }
+            continue;
+        }
+        if (state == PendingSlot::BUSY) {
+            continue;
+        }
+        // 槽被更早的请求占用(在途请求超过槽数)时扩容, 扩容中或已经扩容时到新数组重试
+        if (state == PendingSlot::MOVED || growSlots(table)) {
+            RWMutexType::ReadLock lock(m_mutex);
+            table = m_slots.load(std::memory_order_acquire);
+            continue;
+        }
+        // 已经达到上限
+        RWMutexType::WriteLock lock(m_mutex);
+        if (m_ctxs.insert(std::make_pair(ctx->sn, ctx)).second) {
+            ++m_overflow;
+        }
+        break;
+    }
+    if (ctx->timeout) {
+        addTimeout(ctx);
+    }
     return true;
 }
 
+void AsyncSocketStream::addTimeout(Ctx::ptr ctx)
+{
+    ctx->deadline = base::GetCurrentMS() + ctx->timeout;
+    Ctx *node = ctx.get();
+    node->timeSelf = ctx;
+    Ctx *head = m_timeoutHead.load(std::memory_order_relaxed);
+    do {
+        node->timeNext = head;
+    } while (!m_timeoutHead.compare_exchange_weak(head, node, std::memory_order_release,
+                                                  std::memory_order_relaxed));
+    if (!m_timeoutChecking.exchange(true)) {
+        scheduleTimeoutCheck(std::min<uint64_t>(ctx->timeout, g_timeout_tick_ms->getValue()));
+    }
+}
+
+void AsyncSocketStream::scheduleTimeoutCheck(uint64_t ms)
+{
+    base::IOManager *iom = m_iomanager ? m_iomanager : base::IOManager::GetThis();
+    // 定时器持有连接, 与每个请求一个定时器时一样, 等待中的请求超时前连接不会析构
+    iom->addTimer(std::max<uint64_t>(ms, 1),
+                  std::bind(&AsyncSocketStream::checkTimeout, shared_from_this()));
+}
+
+void AsyncSocketStream::checkTimeout()
+{
+    Ctx *head = m_timeoutHead.exchange(nullptr, std::memory_order_acquire);
+    while (head) {
+        Ctx::ptr ctx = std::move(head->timeSelf);
+        head = head->timeNext;
+        ctx->timeNext = nullptr;
+        m_deadlines.push_back(Deadline{ctx->deadline, ctx});
+        std::push_heap(m_deadlines.begin(), m_deadlines.end(), DeadlineCompare());
+    }
+
+    // 收到响应的请求在堆里只剩下失效的弱引用, 堆增长一倍时清理一次, 均摊到每次登记是 O(1)
+    if (m_deadlines.size() > std::max<size_t>(m_deadlinesCompacted * 2, 1024)) {
+        m_deadlines.erase(std::remove_if(m_deadlines.begin(), m_deadlines.end(),
+                                         [](const Deadline &d) { return d.ctx.expired(); }),
+                          m_deadlines.end());
+        std::make_heap(m_deadlines.begin(), m_deadlines.end(), DeadlineCompare());
+        m_deadlinesCompacted = m_deadlines.size();
+    }
+
+    uint64_t now = base::GetCurrentMS();
+    while (!m_deadlines.empty() && m_deadlines.front().deadline <= now) {
+        std::pop_heap(m_deadlines.begin(), m_deadlines.end(), DeadlineCompare());
+        Ctx::ptr ctx = m_deadlines.back().ctx.lock();
+        m_deadlines.pop_back();
+        // scheduler 为空说明已经处理过响应
+        if (ctx && ctx->scheduler) {
+            onTimeOut(ctx);
+        }
+    }
+
+    if (m_deadlines.empty()) {
+        m_timeoutChecking = false;
+        // 与 addTimeout 竞争: 对方看到检查在运行就不会再启动
+        if (!m_timeoutHead.load(std::memory_order_acquire) || m_timeoutChecking.exchange(true)) {
+            return;
+        }
+    }
+    uint64_t next = g_timeout_tick_ms->getValue();
+    if (!m_deadlines.empty()) {
+        next = std::min<uint64_t>(next, m_deadlines.front().deadline - now);
+    }
+    scheduleTimeoutCheck(next);
+}
+
 bool AsyncSocketStream::enqueue(SendCtx::ptr ctx)
 {
     _ASSERT(ctx);
@@ -220,19 +574,37 @@ bool AsyncSocketStream::innerClose()
     onClose();
     SocketStream::close();
     m_sem.notify();
-    std::unordered_map<uint32_t, Ctx::ptr> ctxs;
+    std::vector<Ctx::ptr> ctxs;
+    SlotTable *table = nullptr;
+    // 扫描期间其它线程登记请求可能触发扩容, 扩容后再扫一遍新数组
+    while (table != m_slots.load(std::memory_order_acquire)) {
+        table = m_slots.load(std::memory_order_acquire);
+        for (uint32_t i = 0; table && i <= table->mask; ++i) {
+            uint64_t tag = table->slots[i].tag.load(std::memory_order_acquire);
+            if ((tag & 0x3) == PendingSlot::USED) {
+                auto ctx = findCtx(tag >> 2, true);
+                if (ctx) {
+                    ctxs.push_back(ctx);
+                }
+            }
+        }
+    }
     {
         RWMutexType::WriteLock lock(m_mutex);
-        ctxs.swap(m_ctxs);
+        for (auto &i : m_ctxs) {
+            ctxs.push_back(i.second);
+        }
+        m_ctxs.clear();
+        m_overflow = 0;
     }
     {
         RWMutexType::WriteLock lock(m_queueMutex);
         m_queue.clear();
     }
     for (auto &i : ctxs) {
-        i.second->result = IO_ERROR;
-        i.second->resultStr = "io_error";
-        i.second->doRsp();
+        i->result = IO_ERROR;
+        i->resultStr = "io_error";
+        i->doRsp();
     }
     return true;
 }
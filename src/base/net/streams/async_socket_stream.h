@@ -1,8 +1,11 @@
 #pragma once
 
 #include "socket_stream.h"
+#include <atomic>
 #include <list>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 #include <boost/any.hpp>
 
 namespace base
@@ -18,6 +21,7 @@ public:
     typedef std::function<void(AsyncSocketStream::ptr)> disconnect_callback;
 
     AsyncSocketStream(Socket::ptr sock, bool owner = true);
+    ~AsyncSocketStream();
 
     virtual bool start();
     virtual void close() override;
@@ -30,6 +34,52 @@ public:
         NOT_CONNECT = -3,
     };
 
+    /**
+     * @brief 合并发送的数据
+     * @details iovs 指向 buffers 中各 ByteArray 的内存, 发送完成前由 buffers 保持有效.
+     *          帧头这类小块数据复制到 scratch 中, scratch 在各批次之间复用
+     */
+    struct SendBuffer {
+        SendBuffer();
+
+        /**
+         * @brief 复制一段数据
+         */
+        void append(const void *data, size_t len);
+
+        /**
+         * @brief 引用 ba 从当前位置开始的全部可读数据, 不复制
+         */
+        void append(ByteArray::ptr ba);
+
+        void clear();
+
+        std::vector<iovec> iovs;
+        std::vector<ByteArray::ptr> buffers;
+        ByteArray::ptr scratch;
+        /// 总字节数
+        uint64_t size = 0;
+    };
+
+    /**
+     * @brief 是否把发送队列合并成 writev 发送
+     */
+    bool isWriteBatch() const { return m_writeBatch; }
+    void setWriteBatch(bool v) { m_writeBatch = v; }
+
+    /**
+     * @brief 写协程被唤醒后等待更多消息入队的时间(微秒)
+     * @details 0 不等待; 小于1000时让出一次, 同线程上就绪的协程可以先把消息入队;
+     *          否则按毫秒定时器等待
+     */
+    uint32_t getWriteDelayUs() const { return m_writeDelayUs; }
+    void setWriteDelayUs(uint32_t v) { m_writeDelayUs = v; }
+
+    /**
+     * @brief 当前等待响应的请求槽数, 还没有登记过请求时为0
+     */
+    uint32_t getPendingSlots() const;
+
 protected:
     struct SendCtx {
     public:
@@ -37,6 +87,12 @@ protected:
         virtual ~SendCtx() {}
 
         virtual bool doSend(AsyncSocketStream::ptr stream) = 0;
+
+        /**
+         * @brief 把要发送的数据追加到 buf, 由 doWrite 和队列中的其它消息合并发送
+         * @return >0 追加的字节数; 0 不支持合并, 由 doSend 单独发送; <0 出错
+         */
+        virtual int32_t serializeTo(AsyncSocketStream::ptr stream, SendBuffer &buf) { return 0; }
     };
 
     struct Ctx : public SendCtx {
@@ -56,8 +112,17 @@ protected:
 
         std::string resultStr = "ok";
 
+        /// 超时时间点(毫秒), addCtx 时按 timeout 计算
+        uint64_t deadline = 0;
+        /// 待加入超时堆的无锁链表, 链表中的节点由 timeSelf 保持引用
+        Ctx *timeNext = nullptr;
+        Ctx::ptr timeSelf;
+
         /// 获取到响应后，重新把Fiber添加到调度器
         virtual void doRsp();
+
+        /// 没有等待的Fiber(异步请求)时, 由子类在doRsp中处理结果
+        virtual void onAsyncRsp() {}
     };
 
 public:
@@ -96,6 +161,9 @@ protected:
     virtual void doWrite();
     virtual void startRead();
     virtual void startWrite();
+    /**
+     * @brief 请求超时, 请求仍在等待响应时以 TIMEOUT 结束
+     */
     virtual void onTimeOut(Ctx::ptr ctx);
     virtual Ctx::ptr doRecv() = 0;
     virtual void onClose() {}
@@ -123,19 +191,113 @@ protected:
         return nullptr;
     }
 
+    /**
+     * @brief 登记等待响应的请求, timeout 不为0时同时登记超时
+     * @details 请求放在按 sn 取模的槽中(无锁), 槽被更早的请求占用时放入 m_ctxs
+     */
     bool addCtx(Ctx::ptr ctx);
     bool enqueue(SendCtx::ptr ctx);
 
     bool innerClose();
     bool waitFiber();
 
+    /**
+     * @brief 把 ctxs 合并成 iovec 链发送, 不支持合并的消息在原位置单独发送
+     */
+    bool sendBatch(std::list<SendCtx::ptr> &ctxs);
+
+    /**
+     * @brief 用 sendmsg 发送 buf 并清空, 每次最多 IOV_MAX 段, 处理部分写
+     */
+    bool flushSendBuffer(SendBuffer &buf);
+
+private:
+    /**
+     * @brief 等待响应的请求槽
+     * @details tag 高位是 sn, 低2位是状态. sn 的低位是槽下标, 高位相当于槽的代数:
+     *          超时后才到的响应 sn 和槽中新请求的 sn 不同, 不会取错请求
+     */
+    struct PendingSlot {
+        enum State {
+            FREE = 0,
+            /// 正在写入或取出 ctx
+            BUSY = 1,
+            USED = 2,
+            /// 槽数组已经扩容, 请求迁移到了新数组
+            MOVED = 3,
+        };
+        static uint64_t Tag(uint32_t sn, State state) { return ((uint64_t)sn << 2) | state; }
+
+        std::atomic<uint64_t> tag{0};
+        Ctx::ptr ctx;
+    };
+
+    /**
+     * @brief 槽数组
+     * @details 第一次登记请求时按较小的大小分配, 槽被更早的请求占用时扩容一倍,
+     *          最大到 async_socket_stream.pending_slots. 扩容时旧数组中的每个槽都标记为 MOVED,
+     *          旧数组挂在新数组上直到连接析构, 拿着旧数组的线程看到 MOVED 后到新数组中重试
+     */
+    struct SlotTable {
+        SlotTable(uint32_t size, SlotTable *prev);
+
+        uint32_t mask;
+        std::unique_ptr<PendingSlot[]> slots;
+        std::unique_ptr<SlotTable> prev;
+    };
+
+    /**
+     * @brief 超时堆中的请求, 只持有弱引用, 收到响应的请求不会被堆留到超时
+     */
+    struct Deadline {
+        uint64_t deadline;
+        std::weak_ptr<Ctx> ctx;
+    };
+
+    struct DeadlineCompare {
+        bool operator()(const Deadline &a, const Deadline &b) const
+        {
+            return a.deadline > b.deadline;
+        }
+    };
+
+    /**
+     * @brief 槽数组, 第一次登记请求时分配
+     */
+    SlotTable *getSlots();
+
+    /**
+     * @brief 把 table 扩容一倍(需要 table 仍是当前的槽数组)
+     * @return 是否已经有更大的槽数组, 已经达到上限时返回 false
+     */
+    bool growSlots(SlotTable *table);
+
+    /**
+     * @brief 取出 sn 对应的请求
+     * @param[in] del 是否同时删除
+     * @param[in] expect 不为空时只取这个请求
+     */
+    Ctx::ptr findCtx(uint32_t sn, bool del, Ctx *expect = nullptr);
+
+    /**
+     * @brief 登记超时, 没有超时检查在运行时启动
+     */
+    void addTimeout(Ctx::ptr ctx);
+
+    /**
+     * @brief 超时检查, 同一时间只有一个在运行, 还有等待的请求时继续定时
+     */
+    void checkTimeout();
+    void scheduleTimeoutCheck(uint64_t ms);
+
 protected:
     base::FiberSemaphore m_sem;
     base::FiberSemaphore m_waitSem;
     RWMutexType m_queueMutex;
     std::list<SendCtx::ptr> m_queue;
     RWMutexType m_mutex;
-    std::unordered_map<uint32_t, Ctx::ptr> m_ctxs;  // 存储请求上下文，key 为 sn
+    /// 槽被占用时溢出的请求上下文，key 为 sn
+    std::unordered_map<uint32_t, Ctx::ptr> m_ctxs;
 
     uint32_t m_sn;
     bool m_autoConnect;
@@ -149,6 +311,24 @@ protected:
 
     boost::any m_data;
 
+    bool m_writeBatch;
+    uint32_t m_writeDelayUs;
+    /// 写协程使用的合并缓存
+    SendBuffer m_sendBuffer;
+
+private:
+    std::atomic<SlotTable *> m_slots{nullptr};
+    /// m_ctxs 中的请求数, 为0时不需要加锁查找
+    std::atomic<uint32_t> m_overflow{0};
+    /// 新登记的超时
+    std::atomic<Ctx *> m_timeoutHead{nullptr};
+    /// 是否有超时检查在运行
+    std::atomic<bool> m_timeoutChecking{false};
+    /// 按超时时间排序的请求(最小堆), 只由超时检查访问
+    std::vector<Deadline> m_deadlines;
+    /// m_deadlines 上次清理后的大小, 增长一倍时清理已经收到响应的请求
+    size_t m_deadlinesCompacted = 0;
+
 public:
     bool recving = false;
 };
@@ -1,5 +1,6 @@
 #include "zlib_stream.h"
 #include "base/macro.h"
+#include "base/coro/fiber.h"
 
 namespace base
 {
@@ -30,7 +31,7 @@ ZlibStream::ptr ZlibStream::Create(bool encode, uint32_t buff_size, Type type, i
 }
 
 ZlibStream::ZlibStream(bool encode, uint32_t buff_size)
-    : m_buffSize(buff_size), m_encode(encode), m_free(true)
+    : m_buffSize(buff_size), m_encode(encode), m_free(true), m_preemptible(false)
 {
 }
 
@@ -148,6 +149,10 @@ int ZlibStream::encode(const iovec *v, const uint64_t &size, bool finish)
                 return ret;
             }
             ivc->iov_len = m_buffSize - m_zstream.avail_out;
+            // 每压缩一个输出块检查一次抢占
+            if (m_preemptible) {
+                Fiber::MaybeYield();
+            }
         } while (m_zstream.avail_out == 0);
     }
     if (flush == Z_FINISH) {
@@ -186,6 +191,10 @@ int ZlibStream::decode(const iovec *v, const uint64_t &size, bool finish)
                 return ret;
             }
             ivc->iov_len = m_buffSize - m_zstream.avail_out;
+            // 每解压一个输出块检查一次抢占
+            if (m_preemptible) {
+                Fiber::MaybeYield();
+            }
         } while (m_zstream.avail_out == 0);
     }
 
@@ -58,6 +58,13 @@ public:
     bool isEncode() const { return m_encode; }
     void setEndcode(bool v) { m_encode = v; }
 
+    /**
+     * @brief 是否在每个输出块之后检查抢占(Fiber::MaybeYield), 默认关闭
+     * @details 只有调用方没有持有线程锁, 对象也不被其它协程共享时才能开启
+     */
+    bool isPreemptible() const { return m_preemptible; }
+    void setPreemptible(bool v) { m_preemptible = v; }
+
     std::vector<iovec> &getBuffers() { return m_buffs; }
     std::string getResult() const;
     base::ByteArray::ptr getByteArray();
@@ -74,6 +81,7 @@ private:
     uint32_t m_buffSize;
     bool m_encode;
     bool m_free;
+    bool m_preemptible;
     std::vector<iovec> m_buffs;
 };
 
@@ -42,47 +42,97 @@ bool TcpServer::bind(const std::vector<Address::ptr> &addrs, std::vector<Address
                      bool ssl)
 {
     m_ssl = ssl;
+    std::vector<int> threads;
+    if (m_reusePort) {
+        threads = m_ioWorker->getThreadIds();
+    }
     for (auto &addr : addrs) {
-        Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
-        if (!sock->bind(addr)) {
-            _LOG_ERROR(g_logger) << "bind fail errno=" << errno << " errstr=" << strerror(errno)
-                                 << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        // 多接收者模式下每个 io_worker 线程一个监听socket, unix socket 不支持 SO_REUSEPORT
+        size_t count = 1;
+        if (m_reusePort && !std::dynamic_pointer_cast<UnixAddress>(addr)) {
+            count = std::max<size_t>(1, threads.size());
         }
-        if (!sock->listen()) {
-            _LOG_ERROR(g_logger) << "listen fail errno=" << errno << " errstr=" << strerror(errno)
-                                 << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        for (size_t n = 0; n < count; ++n) {
+            Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
+            if (count > 1 && !sock->setReusePort()) {
+                fails.push_back(addr);
+                break;
+            }
+            if (!sock->bind(addr)) {
+                _LOG_ERROR(g_logger) << "bind fail errno=" << errno
+                                     << " errstr=" << strerror(errno) << " addr=["
+                                     << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if (count > 1 && m_cpuSteering && !n) {
+                sock->attachReusePortCpuSteering();
+            }
+            if (!sock->listen()) {
+                _LOG_ERROR(g_logger) << "listen fail errno=" << errno
+                                     << " errstr=" << strerror(errno) << " addr=["
+                                     << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            m_socks.push_back(sock);
+            m_acceptThreads.push_back(m_reusePort && !threads.empty() ? threads[n % threads.size()]
+                                                                      : -1);
         }
-        m_socks.push_back(sock);
     }
 
     if (!fails.empty()) {
         m_socks.clear();
+        m_acceptThreads.clear();
         return false;
     }
 
     for (auto &i : m_socks) {
         _LOG_INFO(g_logger) << "type=" << m_type << " name=" << m_name << " ssl=" << m_ssl
-                            << " server bind success: " << *i;
+                            << " reuse_port=" << m_reusePort << " server bind success: " << *i;
     }
     return true;
 }
 
 void TcpServer::startAccept(Socket::ptr sock)
 {
+    // 多接收者模式下接收协程在监听socket所属的线程上启动, 绑定到该线程,
+    // 否则 accept 的 EAGAIN 等待被唤醒后可能在任意线程继续执行
+    int thread = base::GetThreadId();
+    Fiber::ptr fiber = Fiber::GetThis();
+    bool rebind = m_reusePort && !fiber->isSharedStack();
+    int old_bind = fiber->getBindThread();
+    if (rebind) {
+        fiber->setBindThread(thread);
+    }
     while (!m_isStop) {
         Socket::ptr client = sock->accept();
         if (client) {
             client->setRecvTimeout(m_recvTimeout);
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
+            if (m_reusePort) {
+                // 多接收者模式下连接留在接收它的线程, 唤醒自己不需要系统调用
+                m_ioWorker->schedule(
+                    std::bind(&TcpServer::handleClient, shared_from_this(), client), thread);
+                continue;
+            }
+            IOManager *io_worker = m_ioWorker;
+#ifdef SO_INCOMING_CPU
+            int cpu = -1;
+            if (!m_cpuIOWorkers.empty() && client->getOption(SOL_SOCKET, SO_INCOMING_CPU, cpu)
+                && cpu >= 0 && (size_t)cpu < m_cpuIOWorkers.size() && m_cpuIOWorkers[cpu]) {
+                io_worker = m_cpuIOWorkers[cpu];
+            }
+#endif
+            io_worker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
         } else {
             _LOG_ERROR(g_logger) << "accept errno=" << sock->getError()
                                  << " errstr=" << strerror(sock->getError());
         }
     }
+    // 回调协程会被复用, 恢复原来的绑定
+    if (rebind) {
+        fiber->setBindThread(old_bind);
+    }
 }
 
 bool TcpServer::start()
@@ -91,8 +141,14 @@ bool TcpServer::start()
         return true;
     }
     m_isStop = false;
-    for (auto &sock : m_socks) {
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+    for (size_t i = 0; i < m_socks.size(); ++i) {
+        if (m_reusePort) {
+            m_ioWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]),
+                                 m_acceptThreads[i]);
+        } else {
+            m_acceptWorker->schedule(
+                std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]));
+        }
     }
     return true;
 }
@@ -101,15 +157,35 @@ void TcpServer::stop()
 {
     m_isStop = true;
     auto self = shared_from_this();
-    m_acceptWorker->schedule([this, self]() {
+    IOManager *accept_worker = m_reusePort ? m_ioWorker : m_acceptWorker;
+    accept_worker->schedule([this, self]() {
         for (auto &sock : m_socks) {
             sock->cancelAll();
             sock->close();
         }
         m_socks.clear();
+        m_acceptThreads.clear();
     });
 }
 
+void TcpServer::setIOWorkerShards(const std::vector<IOManager *> &workers)
+{
+    m_cpuIOWorkers.clear();
+    for (auto iom : workers) {
+        for (int cpu : iom->getPlacement().cpus) {
+            if ((size_t)cpu >= m_cpuIOWorkers.size()) {
+                m_cpuIOWorkers.resize(cpu + 1);
+            }
+            // 多个IOManager共享同一个CPU时取第一个
+            if (!m_cpuIOWorkers[cpu]) {
+                m_cpuIOWorkers[cpu] = iom;
+            }
+        }
+    }
+    _LOG_INFO(g_logger) << "name=" << m_name << " io worker shards=" << workers.size()
+                        << " cpus=" << m_cpuIOWorkers.size();
+}
+
 void TcpServer::handleClient(Socket::ptr client)
 {
     _LOG_INFO(g_logger) << "handleClient: " << *client;
@@ -134,6 +210,7 @@ std::string TcpServer::toString(const std::string &prefix)
     ss << prefix << "[type=" << m_type << " name=" << m_name << " ssl=" << m_ssl
        << " worker=" << (m_worker ? m_worker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
+       << " reuse_port=" << m_reusePort
        << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
     for (auto &i : m_socks) {
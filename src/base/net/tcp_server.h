@@ -25,6 +25,12 @@ struct TcpServerConf {
     std::string accept_worker;
     std::string io_worker;
     std::string process_worker;
+    /// 按接收连接的CPU把连接分给绑定在该CPU上的 io_worker 实例
+    int io_shard_by_cpu = 0;
+    /// io_worker 每个线程一个 SO_REUSEPORT 监听socket, 在本线程接收并处理连接
+    int reuse_port = 0;
+    /// reuse_port 模式下挂载CBPF程序, 按处理数据包的CPU选择监听socket
+    int reuse_port_cpu_steering = 0;
     std::map<std::string, std::string> args;
 
     bool isValid() const { return !address.empty(); }
@@ -35,6 +41,8 @@ struct TcpServerConf {
                && name == oth.name && ssl == oth.ssl && cert_file == oth.cert_file
                && key_file == oth.key_file && accept_worker == oth.accept_worker
                && io_worker == oth.io_worker && process_worker == oth.process_worker
+               && io_shard_by_cpu == oth.io_shard_by_cpu && reuse_port == oth.reuse_port
+               && reuse_port_cpu_steering == oth.reuse_port_cpu_steering
                && args == oth.args && id == oth.id && type == oth.type;
     }
 };
@@ -58,6 +66,10 @@ public:
         conf.accept_worker = node["accept_worker"].as<std::string>();
         conf.io_worker = node["io_worker"].as<std::string>();
         conf.process_worker = node["process_worker"].as<std::string>();
+        conf.io_shard_by_cpu = node["io_shard_by_cpu"].as<int>(conf.io_shard_by_cpu);
+        conf.reuse_port = node["reuse_port"].as<int>(conf.reuse_port);
+        conf.reuse_port_cpu_steering =
+            node["reuse_port_cpu_steering"].as<int>(conf.reuse_port_cpu_steering);
         conf.args = LexicalCast<std::string, std::map<std::string, std::string> >()(
             node["args"].as<std::string>(""));
         if (node["address"].IsDefined()) {
@@ -87,6 +99,9 @@ public:
         node["accept_worker"] = conf.accept_worker;
         node["io_worker"] = conf.io_worker;
         node["process_worker"] = conf.process_worker;
+        node["io_shard_by_cpu"] = conf.io_shard_by_cpu;
+        node["reuse_port"] = conf.reuse_port;
+        node["reuse_port_cpu_steering"] = conf.reuse_port_cpu_steering;
         node["args"] =
             YAML::Load(LexicalCast<std::map<std::string, std::string>, std::string>()(conf.args));
         for (auto &i : conf.address) {
@@ -179,6 +194,31 @@ public:
     virtual std::string toString(const std::string &prefix = "");
 
     std::vector<Socket::ptr> getSocks() const { return m_socks; }
+
+    /**
+     * @brief 设置按CPU分片的 io_worker
+     * @details 新连接按 SO_INCOMING_CPU(内核处理该连接数据包的CPU)分给绑定在该CPU上的IOManager,
+     *          没有匹配的IOManager时使用 m_ioWorker
+     * @param[in] workers 通过 Scheduler::setPlacement 绑定了CPU的IOManager
+     */
+    void setIOWorkerShards(const std::vector<IOManager *> &workers);
+
+    /**
+     * @brief 设置多接收者模式, 需要在 bind 之前调用
+     * @details io_worker 的每个线程在同一地址上拥有一个 SO_REUSEPORT 监听socket,
+     *          由内核在这些socket间分发新连接, 连接在接收它的线程上处理, 不再跨线程调度.
+     *          此时不使用 accept_worker
+     * @param[in] v 是否开启
+     * @param[in] cpu_steering 是否按处理数据包的CPU选择监听socket(CBPF),
+     *            配合 io_worker 按线程绑定CPU(pin_mode=thread, cpus=0-N)使用
+     */
+    void setReusePort(bool v, bool cpu_steering = false)
+    {
+        m_reusePort = v;
+        m_cpuSteering = cpu_steering;
+    }
+
+    bool isReusePort() const { return m_reusePort; }
     bool isSSL() const { return m_ssl; }
 
 protected:
@@ -201,6 +241,14 @@ protected:
     IOManager *m_ioWorker;
     /// 服务器Socket接收连接的调度器
     IOManager *m_acceptWorker;
+    /// 按CPU编号索引的 io_worker, 为空表示不分片
+    std::vector<IOManager *> m_cpuIOWorkers;
+    /// 多接收者模式: 监听socket在 m_socks 中的下标对应 io_worker 的线程下标
+    std::vector<int> m_acceptThreads;
+    /// 是否开启 SO_REUSEPORT 多接收者模式
+    bool m_reusePort = false;
+    /// 是否挂载按CPU选择监听socket的CBPF程序
+    bool m_cpuSteering = false;
     /// 接收超时时间(毫秒)
     uint64_t m_recvTimeout;
     /// 服务器名称
@@ -92,6 +92,7 @@ namespace pack
         v.clear();                                                                                 \
         auto size = m_value->readUint32();                                                         \
         for (uint32_t i = 0; i < size; ++i) {                                                      \
+            MaybeYield(flag);                                                                      \
             T t;                                                                                   \
             decode(t, flag);                                                                       \
             v.fun(t);                                                                              \
@@ -104,6 +105,7 @@ namespace pack
         v.clear();                                                                                 \
         auto size = m_value->readUint32();                                                         \
         for (uint32_t i = 0; i < size; ++i) {                                                      \
+            MaybeYield(flag);                                                                      \
             T t;                                                                                   \
             decode(t, flag);                                                                       \
             v.fun(t);                                                                              \
@@ -124,6 +126,7 @@ namespace pack
         v.clear();                                                                                 \
         auto size = m_value->readUint32();                                                         \
         for (uint32_t i = 0; i < size; ++i) {                                                      \
+            MaybeYield(flag);                                                                      \
             K tk;                                                                                  \
             V tv;                                                                                  \
             decode(tk, flag);                                                                      \
@@ -138,6 +141,7 @@ namespace pack
         v.clear();                                                                                 \
         auto size = m_value->readUint32();                                                         \
         for (uint32_t i = 0; i < size; ++i) {                                                      \
+            MaybeYield(flag);                                                                      \
             K tk;                                                                                  \
             V tv;                                                                                  \
             decode(tk, flag);                                                                      \
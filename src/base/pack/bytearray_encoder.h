@@ -90,6 +90,7 @@ namespace pack
     {                                                                                              \
         m_value->writeUint32(v.size());                                                            \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             encode(i, flag);                                                                       \
         }                                                                                          \
         return true;                                                                               \
@@ -99,6 +100,7 @@ namespace pack
     {                                                                                              \
         m_value->writeUint32(v.size());                                                            \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             encode(i, flag);                                                                       \
         }                                                                                          \
         return true;                                                                               \
@@ -115,6 +117,7 @@ namespace pack
     {                                                                                              \
         m_value->writeUint32(v.size());                                                            \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             encode(i.first, flag);                                                                 \
             encode(i.second, flag);                                                                \
         }                                                                                          \
@@ -125,6 +128,7 @@ namespace pack
     {                                                                                              \
         m_value->writeUint32(v.size());                                                            \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             encode(i.first, flag);                                                                 \
             encode(i.second, flag);                                                                \
         }                                                                                          \
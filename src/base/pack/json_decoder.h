@@ -179,6 +179,7 @@ namespace pack
                 auto cur = m_cur;
                 int idx = 0;
                 for (auto &x : tmp) {
+                    MaybeYield(flag);
                     m_cur = &x;
                     decode(v[idx], flag);
                     ++idx;
@@ -198,6 +199,7 @@ namespace pack
                 auto cur = m_cur;
                 int idx = 0;
                 for (auto &x : tmp) {
+                    MaybeYield(flag);
                     m_cur = &x;
                     decode(v[idx], flag);
                     ++idx;
@@ -273,6 +275,7 @@ namespace pack
         if (tmp.isArray()) {                                                                       \
             auto cur = m_cur;                                                                      \
             for (auto &x : tmp) {                                                                  \
+                MaybeYield(flag);                                                                  \
                 m_cur = &x;                                                                        \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -291,6 +294,7 @@ namespace pack
         if (tmp.isArray()) {                                                                       \
             auto cur = m_cur;                                                                      \
             for (auto &x : tmp) {                                                                  \
+                MaybeYield(flag);                                                                  \
                 m_cur = &x;                                                                        \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -321,6 +325,7 @@ namespace pack
         if (tmp.isObject()) {                                                                      \
             auto cur = m_cur;                                                                      \
             for (auto it = tmp.begin(); it != tmp.end(); ++it) {                                   \
+                MaybeYield(flag);                                                                  \
                 m_cur = &(*it);                                                                    \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -339,6 +344,7 @@ namespace pack
         if (tmp.isObject()) {                                                                      \
             auto cur = m_cur;                                                                      \
             for (auto it = tmp.begin(); it != tmp.end(); ++it) {                                   \
+                MaybeYield(flag);                                                                  \
                 m_cur = &(*it);                                                                    \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
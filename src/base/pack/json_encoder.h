@@ -65,6 +65,7 @@ namespace pack
             auto cur = m_cur;
             auto &mm = (*cur)[name];
             for (int i = 0; i < N; ++i) {
+                MaybeYield(flag);
                 Json::Value t;
                 m_cur = &t;
                 encode(v[i], flag);
@@ -79,6 +80,7 @@ namespace pack
         {
             auto cur = m_cur;
             for (auto &i : v) {
+                MaybeYield(flag);
                 Json::Value t;
                 m_cur = &t;
                 encode(i, flag);
@@ -223,6 +225,7 @@ namespace pack
         auto cur = m_cur;                                                                          \
         auto &mm = (*cur)[name];                                                                   \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             Json::Value t;                                                                         \
             m_cur = &t;                                                                            \
             encode(i, flag);                                                                       \
@@ -236,6 +239,7 @@ namespace pack
     {                                                                                              \
         auto cur = m_cur;                                                                          \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             Json::Value t;                                                                         \
             m_cur = &t;                                                                            \
             encode(i, flag);                                                                       \
@@ -258,6 +262,7 @@ namespace pack
         auto cur = m_cur;                                                                          \
         auto &mm = (*cur)[name];                                                                   \
         for (auto it = v.begin(); it != v.end(); ++it) {                                           \
+            MaybeYield(flag);                                                                      \
             m_cur = &mm[it->first];                                                                \
             encode(it->second, flag);                                                              \
         }                                                                                          \
@@ -269,6 +274,7 @@ namespace pack
     {                                                                                              \
         auto cur = m_cur;                                                                          \
         for (auto it = v.begin(); it != v.end(); ++it) {                                           \
+            MaybeYield(flag);                                                                      \
             Json::Value t;                                                                         \
             m_cur = &(*cur)[it->first];                                                            \
             encode(it->second, flag);                                                              \
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "macro.h"
+#include "base/coro/fiber.h"
 #include <stdint.h>
 #include <type_traits>
 
@@ -13,12 +14,25 @@ namespace pack
         PackFlag(uint64_t f) : flag(f) {}
 
         enum Flag {
-
+            /// 编解码容器时在每个元素前检查抢占(Fiber::MaybeYield), 调用方持有线程锁时不能打开
+            PREEMPTIBLE = 1 << 0,
         };
 
+        bool isPreemptible() const { return flag & PREEMPTIBLE; }
+
         uint64_t flag;
     };
 
+    /**
+     * @brief 编解码器的抢占安全点, 只有 flag 带 PackFlag::PREEMPTIBLE 时才会让出
+     */
+    inline void MaybeYield(const PackFlag &flag)
+    {
+        if (flag.isPreemptible()) {
+            Fiber::MaybeYield();
+        }
+    }
+
     template <class T>
     struct is__pack_type {
         typedef char YES;
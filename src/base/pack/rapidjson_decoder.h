@@ -157,6 +157,7 @@ namespace pack
                 auto cur = m_cur;
                 int idx = 0;
                 for (auto it = tmp->Begin(); it != tmp->End(); ++it) {
+                    MaybeYield(flag);
                     m_cur = &*it;
                     decode(v[idx], flag);
                     ++idx;
@@ -175,6 +176,7 @@ namespace pack
                 auto cur = m_cur;
                 int idx = 0;
                 for (auto it = cur->Begin(); it != cur->End(); ++it) {
+                    MaybeYield(flag);
                     m_cur = &*it;
                     decode(v[idx], flag);
                     ++idx;
@@ -252,6 +254,7 @@ namespace pack
         if (tmp->IsArray()) {                                                                      \
             auto cur = m_cur;                                                                      \
             for (auto it = tmp->Begin(); it != tmp->End(); ++it) {                                 \
+                MaybeYield(flag);                                                                  \
                 m_cur = &*it;                                                                      \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -269,6 +272,7 @@ namespace pack
         if (m_cur->IsArray()) {                                                                    \
             auto cur = m_cur;                                                                      \
             for (auto it = cur->Begin(); it != cur->End(); ++it) {                                 \
+                MaybeYield(flag);                                                                  \
                 m_cur = &*it;                                                                      \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -299,6 +303,7 @@ namespace pack
         if (tmp->IsObject()) {                                                                     \
             auto cur = m_cur;                                                                      \
             for (auto it = tmp->MemberBegin(); it != tmp->MemberEnd(); ++it) {                     \
+                MaybeYield(flag);                                                                  \
                 m_cur = &(it->value);                                                              \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -316,6 +321,7 @@ namespace pack
         if (m_cur->IsObject()) {                                                                   \
             auto cur = m_cur;                                                                      \
             for (auto it = cur->MemberBegin(); it != cur->MemberEnd(); ++it) {                     \
+                MaybeYield(flag);                                                                  \
                 m_cur = &(it->value);                                                              \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -94,6 +94,7 @@ namespace pack
             m_writer.Key(name.c_str());
             m_writer.StartArray();
             for (size_t i = 0; i < N; ++i) {
+                MaybeYield(flag);
                 encode(v[i], flag);
             }
             m_writer.EndArray();
@@ -105,6 +106,7 @@ namespace pack
         {
             m_writer.StartArray();
             for (size_t i = 0; i < N; ++i) {
+                MaybeYield(flag);
                 encode(v[i], flag);
             }
             m_writer.EndArray();
@@ -230,6 +232,7 @@ namespace pack
         m_writer.Key(name.c_str());                                                                \
         m_writer.StartArray();                                                                     \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             encode(i, flag);                                                                       \
         }                                                                                          \
         m_writer.EndArray();                                                                       \
@@ -240,6 +243,7 @@ namespace pack
     {                                                                                              \
         m_writer.StartArray();                                                                     \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             encode(i, flag);                                                                       \
         }                                                                                          \
         m_writer.EndArray();                                                                       \
@@ -259,6 +263,7 @@ namespace pack
         m_writer.Key(name.c_str());                                                                \
         m_writer.StartObject();                                                                    \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             encode(i.first, i.second, flag);                                                       \
         }                                                                                          \
         m_writer.EndObject();                                                                      \
@@ -269,6 +274,7 @@ namespace pack
     {                                                                                              \
         m_writer.StartObject();                                                                    \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             encode(i.first, i.second, flag);                                                       \
         }                                                                                          \
         m_writer.EndObject();                                                                      \
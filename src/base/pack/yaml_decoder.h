@@ -140,6 +140,7 @@ namespace pack
                 auto cur = m_cur;
                 int idx = 0;
                 for (auto it = n.begin(); it != n.end(); ++it) {
+                    MaybeYield(flag);
                     m_cur.reset(*it);
                     decode(v[idx], flag);
                     ++idx;
@@ -158,6 +159,7 @@ namespace pack
                 auto cur = m_cur;
                 int idx = 0;
                 for (auto it = cur.begin(); it != cur.end(); ++it) {
+                    MaybeYield(flag);
                     m_cur.reset(*it);
                     decode(v[idx], flag);
                     ++idx;
@@ -263,6 +265,7 @@ namespace pack
         if (n.IsSequence()) {                                                                      \
             auto cur = m_cur;                                                                      \
             for (auto it = n.begin(); it != n.end(); ++it) {                                       \
+                MaybeYield(flag);                                                                  \
                 m_cur.reset(*it);                                                                  \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -281,6 +284,7 @@ namespace pack
         if (m_cur.IsSequence()) {                                                                  \
             auto cur = m_cur;                                                                      \
             for (auto it = cur.begin(); it != cur.end(); ++it) {                                   \
+                MaybeYield(flag);                                                                  \
                 m_cur.reset(*it);                                                                  \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -310,6 +314,7 @@ namespace pack
         if (n.IsMap()) {                                                                           \
             auto cur = m_cur;                                                                      \
             for (auto it = n.begin(); it != n.end(); ++it) {                                       \
+                MaybeYield(flag);                                                                  \
                 m_cur.reset(it->second);                                                           \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -328,6 +333,7 @@ namespace pack
         if (m_cur.IsMap()) {                                                                       \
             auto cur = m_cur;                                                                      \
             for (auto it = cur.begin(); it != cur.end(); ++it) {                                   \
+                MaybeYield(flag);                                                                  \
                 m_cur.reset(it->second);                                                           \
                 T t;                                                                               \
                 decode(t, flag);                                                                   \
@@ -53,6 +53,7 @@ namespace pack
             auto cur = m_cur;
             auto mm = cur[name];
             for (int i = 0; i < N; ++i) {
+                MaybeYield(flag);
                 m_cur.reset();
                 encode(v[i], flag);
                 mm.push_back(m_cur);
@@ -66,6 +67,7 @@ namespace pack
         {
             auto cur = m_cur;
             for (size_t i = 0; i < N; ++i) {
+                MaybeYield(flag);
                 m_cur.reset();
                 encode(v[i], flag);
                 cur.push_back(m_cur);
@@ -197,6 +199,7 @@ namespace pack
         auto cur = m_cur;                                                                          \
         auto mm = cur[name];                                                                       \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             m_cur.reset();                                                                         \
             encode(i, flag);                                                                       \
             mm.push_back(m_cur);                                                                   \
@@ -209,6 +212,7 @@ namespace pack
     {                                                                                              \
         auto cur = m_cur;                                                                          \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             m_cur.reset();                                                                         \
             encode(i, flag);                                                                       \
             cur.push_back(m_cur);                                                                  \
@@ -230,6 +234,7 @@ namespace pack
         auto cur = m_cur;                                                                          \
         auto mm = cur[name];                                                                       \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             m_cur.reset();                                                                         \
             encode(i.second, flag);                                                                \
             mm[i.first] = m_cur;                                                                   \
@@ -242,6 +247,7 @@ namespace pack
     {                                                                                              \
         auto cur = m_cur;                                                                          \
         for (auto &i : v) {                                                                        \
+            MaybeYield(flag);                                                                      \
             m_cur.reset();                                                                         \
             encode(i.second, flag);                                                                \
             cur[i.first] = m_cur;                                                                  \
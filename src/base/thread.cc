@@ -1,12 +1,19 @@
 #include "thread.h"
 #include "base/log/log.h"
 #include "base/util.h"
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
 
 namespace base
 {
 
 static thread_local Thread *t_thread = nullptr;
 static thread_local std::string t_thread_name = "UNKNOW";
+static thread_local int t_memory_node = -1;
 
 static base::Logger::ptr g_logger = _LOG_NAME("system");
 
@@ -63,6 +70,154 @@ void Thread::join()
     }
 }
 
+/**
+ * @brief 把CPU列表转换为 cpu_set_t, 为空时包含所有CPU
+ */
+static void ToCpuSet(const std::vector<int> &cpus, cpu_set_t &set)
+{
+    CPU_ZERO(&set);
+    if (cpus.empty()) {
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            CPU_SET(i, &set);
+        }
+        return;
+    }
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+}
+
+bool Thread::setAffinity(const std::vector<int> &cpus)
+{
+    if (!m_thread) {
+        return false;
+    }
+    cpu_set_t set;
+    ToCpuSet(cpus, set);
+    int rt = pthread_setaffinity_np(m_thread, sizeof(set), &set);
+    if (rt) {
+        _LOG_ERROR(g_logger) << "pthread_setaffinity_np fail, rt=" << rt << " name=" << m_name;
+        return false;
+    }
+    return true;
+}
+
+bool Thread::SetAffinity(const std::vector<int> &cpus)
+{
+    cpu_set_t set;
+    ToCpuSet(cpus, set);
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rt) {
+        _LOG_ERROR(g_logger) << "pthread_setaffinity_np fail, rt=" << rt
+                             << " name=" << t_thread_name;
+        return false;
+    }
+    return true;
+}
+
+int Thread::GetCpu()
+{
+    return sched_getcpu();
+}
+
+bool Thread::SetMemoryNode(int node)
+{
+    long rt = 0;
+    if (node < 0) {
+        rt = syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+    } else {
+        unsigned long mask[16] = {0};
+        if ((size_t)node >= sizeof(mask) * 8) {
+            return false;
+        }
+        mask[node / (sizeof(unsigned long) * 8)] |= 1ul << (node % (sizeof(unsigned long) * 8));
+        rt = syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8);
+    }
+    if (rt) {
+        _LOG_ERROR(g_logger) << "set_mempolicy fail, node=" << node << " errno=" << errno
+                             << " errstr=" << strerror(errno);
+        return false;
+    }
+    t_memory_node = node;
+    return true;
+}
+
+int Thread::GetMemoryNode()
+{
+    return t_memory_node;
+}
+
+bool Thread::BindMemory(void *addr, size_t len, int node)
+{
+    unsigned long mask[16] = {0};
+    if (node < 0 || (size_t)node >= sizeof(mask) * 8) {
+        return false;
+    }
+    mask[node / (sizeof(unsigned long) * 8)] |= 1ul << (node % (sizeof(unsigned long) * 8));
+    if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0)) {
+        _LOG_WARN(g_logger) << "mbind fail, node=" << node << " len=" << len
+                            << " errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+std::vector<int> Thread::ParseCpuList(const std::string &v)
+{
+    std::vector<int> cpus;
+    for (auto &item : base::split(v, ',')) {
+        std::string s = base::StringUtil::Trim(item);
+        if (s.empty()) {
+            continue;
+        }
+        char *end = nullptr;
+        long begin = strtol(s.c_str(), &end, 10);
+        long last = begin;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+        if (*end || begin < 0 || last < begin || last >= CPU_SETSIZE) {
+            return {};
+        }
+        for (long i = begin; i <= last; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+std::vector<int> Thread::GetNumaNodeCpus(int node)
+{
+    std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string line;
+    if (node < 0 || !std::getline(ifs, line)) {
+        return {};
+    }
+    return ParseCpuList(line);
+}
+
+int Thread::GetCpuNumaNode(int cpu)
+{
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR *dir = opendir(path.c_str());
+    if (!dir) {
+        return -1;
+    }
+    int node = -1;
+    while (struct dirent *dp = readdir(dir)) {
+        if (!strncmp(dp->d_name, "node", 4) && isdigit(dp->d_name[4])) {
+            node = atoi(dp->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
 void *Thread::run(void *arg)
 {
     Thread *thread = (Thread *)arg;
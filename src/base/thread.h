@@ -2,6 +2,7 @@
 
 #include "base/mutex.h"
 #include <string>
+#include <vector>
 
 namespace base
 {
@@ -42,6 +43,13 @@ public:
      */
     void join();
 
+    /**
+     * @brief 把线程绑定到指定的CPU集合, 可以在其它线程调用
+     * @param[in] cpus CPU编号, 为空时恢复为所有CPU
+     * @return 是否成功
+     */
+    bool setAffinity(const std::vector<int> &cpus);
+
     /**
      * @brief 获取当前的线程指针
      */
@@ -58,6 +66,53 @@ public:
      */
     static void SetName(const std::string &name);
 
+    /**
+     * @brief 把当前线程绑定到指定的CPU集合
+     * @param[in] cpus CPU编号, 为空时恢复为所有CPU
+     * @return 是否成功
+     */
+    static bool SetAffinity(const std::vector<int> &cpus);
+
+    /**
+     * @brief 返回当前线程正在运行的CPU, 失败返回-1
+     */
+    static int GetCpu();
+
+    /**
+     * @brief 设置当前线程优先从指定NUMA节点分配内存(MPOL_PREFERRED)
+     * @details 之后当前线程首次访问的页(堆内存, 协程栈等)落在该节点上
+     * @param[in] node NUMA节点, -1 表示恢复默认策略
+     * @return 是否成功
+     */
+    static bool SetMemoryNode(int node);
+
+    /**
+     * @brief 返回 SetMemoryNode 设置的NUMA节点, 没有设置时返回-1
+     */
+    static int GetMemoryNode();
+
+    /**
+     * @brief 让一段已映射的内存优先从指定NUMA节点分配(mbind MPOL_PREFERRED)
+     * @details 不依赖访问内存的线程, 适合会在线程间迁移的协程栈
+     */
+    static bool BindMemory(void *addr, size_t len, int node);
+
+    /**
+     * @brief 解析CPU列表, 格式同 /sys 下的 cpulist, 例如 "0-3,8,10-11"
+     * @return 升序去重后的CPU编号, 格式错误时返回空
+     */
+    static std::vector<int> ParseCpuList(const std::string &v);
+
+    /**
+     * @brief 返回NUMA节点上的CPU, 节点不存在时返回空
+     */
+    static std::vector<int> GetNumaNodeCpus(int node);
+
+    /**
+     * @brief 返回CPU所在的NUMA节点, 未知时返回-1
+     */
+    static int GetCpuNumaNode(int cpu);
+
 private:
     /**
      * @brief 线程执行函数
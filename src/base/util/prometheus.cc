@@ -200,8 +200,34 @@ PrometheusRegistry::addSummaryLabels(const std::string &name,
     return rt;
 }
 
-std::string PrometheusRegistry::toString() const
+void PrometheusRegistry::addCollector(const std::string &name, Collector cb)
 {
+    base::RWMutex::WriteLock lock(m_mutex);
+    m_collectors[name] = cb;
+}
+
+void PrometheusRegistry::delCollector(const std::string &name)
+{
+    base::RWMutex::WriteLock lock(m_mutex);
+    m_collectors.erase(name);
+}
+
+void PrometheusRegistry::collect()
+{
+    base::RWMutex::ReadLock lock(m_mutex);
+    auto collectors = m_collectors;
+    lock.unlock();
+
+    // 采集函数内部会调用 addXXX 注册指标, 不能持有 m_mutex
+    base::Mutex::Lock collect_lock(m_collectMutex);
+    for (auto &i : collectors) {
+        i.second(*this);
+    }
+}
+
+std::string PrometheusRegistry::toString()
+{
+    collect();
     prometheus::TextSerializer ts;
     return ts.Serialize(m_register->Collect());
 }
@@ -2,6 +2,7 @@
 
 #include "base/pack/pack.h"
 #include "base/mutex.h"
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
@@ -32,6 +33,8 @@ class PrometheusRegistry
 {
 public:
     typedef std::shared_ptr<PrometheusRegistry> ptr;
+    /// 导出前调用的采集函数, 用于把运行时内部的统计同步到指标中
+    typedef std::function<void(PrometheusRegistry &)> Collector;
     PrometheusRegistry();
 
     prometheus::Family<prometheus::Counter> *
@@ -58,11 +61,28 @@ public:
                                           const std::map<std::string, std::string> &labels,
                                           const prometheus::Summary::Quantiles &quantiles);
 
-    std::string toString() const;
+    /**
+     * @brief 注册采集函数, 同名覆盖
+     */
+    void addCollector(const std::string &name, Collector cb);
+    void delCollector(const std::string &name);
+
+    /**
+     * @brief 依次调用所有采集函数
+     */
+    void collect();
+
+    /**
+     * @brief 采集并序列化为文本格式
+     */
+    std::string toString();
 
 private:
     base::RWMutex m_mutex;
     std::shared_ptr<prometheus::Registry> m_register;
+    std::map<std::string, Collector> m_collectors;
+    /// 串行化采集函数的调用
+    base::Mutex m_collectMutex;
     std::map<std::string, prometheus::Family<prometheus::Counter> *> m_counters;
     std::map<std::string, prometheus::Family<prometheus::Gauge> *> m_gauges;
     std::map<std::string, prometheus::Family<prometheus::Histogram> *> m_histograms;
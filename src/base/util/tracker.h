@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <unordered_map>
 #include "base/coro/iomanager.h"
 #include "base/singleton.h"
@@ -0,0 +1,136 @@
+#include "base/coro/fd_manager.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/thread.h"
+#include "base/util.h"
+#include <atomic>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static std::atomic<bool> s_stop{false};
+static std::atomic<uint64_t> s_opened{0};
+static std::atomic<uint64_t> s_lookups{0};
+
+/**
+ * 打开一个 socket 或普通文件, 同一个 fd 号会在两种类型之间反复复用
+ */
+static int open_fd(bool socket_fd)
+{
+    return socket_fd ? socket(AF_INET, SOCK_STREAM, 0) : open("/dev/null", O_RDONLY);
+}
+
+/**
+ * fd 关闭后重新打开, 旧的上下文保持关闭状态, 不会变成新句柄的状态
+ */
+static void test_generation()
+{
+    // 读临界区内摘下的上下文不会被释放
+    base::FdManager::ReadGuard guard;
+    int fd = open_fd(true);
+    base::FdCtx *old_ctx = base::FdMgr::GetInstance()->get(fd, true);
+    _ASSERT(old_ctx && old_ctx->isSocket());
+    base::FdMgr::GetInstance()->del(fd);
+    close(fd);
+    _ASSERT(!base::FdMgr::GetInstance()->get(fd));
+
+    int fd2 = open_fd(false);
+    _ASSERT(fd2 == fd);
+    base::FdCtx *ctx = base::FdMgr::GetInstance()->get(fd2, true);
+    _ASSERT(ctx && ctx != old_ctx);
+    _ASSERT(ctx->getGeneration() > old_ctx->getGeneration());
+    _ASSERT(!ctx->isSocket() && !ctx->isClose());
+    _ASSERT(old_ctx->isSocket() && old_ctx->isClose());
+    base::FdMgr::GetInstance()->del(fd2);
+    close(fd2);
+}
+
+/**
+ * 反复打开/关闭, 每次交替 socket 和普通文件
+ */
+static void open_close(int id)
+{
+    bool socket_fd = id & 1;
+    while (!s_stop) {
+        int fd = open_fd(socket_fd);
+        _ASSERT(fd >= 0);
+        {
+            base::FdManager::ReadGuard guard;
+            base::FdCtx *ctx = base::FdMgr::GetInstance()->get(fd, true);
+            _ASSERT(ctx);
+            _ASSERT2(ctx->isSocket() == socket_fd, "fd=" << fd);
+        }
+        // 保持打开一小段时间, 让查找线程能看到
+        usleep(10);
+        base::FdMgr::GetInstance()->del(fd);
+        close(fd);
+        socket_fd = !socket_fd;
+        ++s_opened;
+    }
+}
+
+/**
+ * 无锁查找, 拿到的上下文在读临界区内不会被重新初始化或释放
+ */
+static void lookup(int max_fd)
+{
+    uint64_t count = 0;
+    while (!s_stop) {
+        for (int fd = 0; fd < max_fd; ++fd) {
+            base::FdManager::ReadGuard guard;
+            base::FdCtx *ctx = base::FdMgr::GetInstance()->get(fd);
+            if (!ctx) {
+                continue;
+            }
+            bool is_socket = ctx->isSocket();
+            uint64_t timeout = ctx->getTimeout(SO_RCVTIMEO);
+            for (int i = 0; i < 16; ++i) {
+                _ASSERT2(ctx->isSocket() == is_socket, "fd=" << fd);
+                _ASSERT2(ctx->getTimeout(SO_RCVTIMEO) == timeout, "fd=" << fd);
+            }
+            ++count;
+        }
+    }
+    s_lookups += count;
+}
+
+/**
+ * 用法: test_fd_manager [seconds] [open_threads] [lookup_threads]
+ */
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 1;
+    int openers = argc > 2 ? atoi(argv[2]) : 4;
+    int readers = argc > 3 ? atoi(argv[3]) : 4;
+
+    test_generation();
+
+    std::vector<base::Thread::ptr> thrs;
+    for (int i = 0; i < openers; ++i) {
+        thrs.push_back(std::make_shared<base::Thread>(std::bind(&open_close, i),
+                                                      "open_" + std::to_string(i)));
+    }
+    for (int i = 0; i < readers; ++i) {
+        thrs.push_back(std::make_shared<base::Thread>(std::bind(&lookup, openers + 64),
+                                                      "lookup_" + std::to_string(i)));
+    }
+    sleep(seconds);
+    s_stop = true;
+    for (auto &i : thrs) {
+        i->join();
+    }
+    // 没有读者后, 下一批摘下的上下文触发回收, 等待回收的数量不会一直增长
+    for (int i = 0; i < 64; ++i) {
+        int fd = open_fd(true);
+        base::FdMgr::GetInstance()->get(fd, true);
+        base::FdMgr::GetInstance()->del(fd);
+        close(fd);
+    }
+    size_t retired = base::FdMgr::GetInstance()->getRetiredCount();
+    _ASSERT2(retired < 64, "retired=" << retired);
+    _LOG_INFO(g_logger) << "opened=" << s_opened << " lookups=" << s_lookups
+                        << " retired=" << retired;
+    return 0;
+}
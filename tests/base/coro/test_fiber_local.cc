@@ -0,0 +1,121 @@
+#include "base/coro/fiber_local.h"
+#include "base/coro/iomanager.h"
+#include "base/coro/worker.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static base::FiberLocal<int> s_user_id;
+static base::FiberLocal<std::string, false> s_private;
+
+/**
+ * 回调任务和新建的协程继承可继承的槽位, 不可继承的槽位不传递
+ */
+static void test_inherit()
+{
+    std::atomic<int> done{0};
+    {
+        base::IOManager iom(2, false, "fiber_local");
+        iom.schedule([&iom, &done]() {
+            _ASSERT(!s_user_id.get());
+            s_user_id.set(42);
+            s_private.set("private");
+            base::RequestContext ctx;
+            ctx.requestId = "req-1";
+            ctx.deadlineMs = base::GetCurrentMS() + 1000;
+            base::RequestContext::Set(ctx);
+            _LOG_INFO(g_logger) << "request id in log";
+
+            iom.schedule([&done]() {
+                _ASSERT(s_user_id.get() && *s_user_id.get() == 42);
+                _ASSERT(!s_private.get());
+                _ASSERT(base::RequestContext::Get()->requestId == "req-1");
+                _ASSERT(base::RequestContext::RemainingMs() <= 1000);
+                // 修改只影响自己
+                s_user_id.set(43);
+                ++done;
+            });
+
+            base::Fiber::ptr fiber(base::NewFiber([&done]() {
+                _ASSERT(s_user_id.get() && *s_user_id.get() == 42);
+                ++done;
+            }), base::FreeFiber);
+            iom.schedule(fiber);
+
+            auto wg = base::WorkerGroup::Create(2);
+            for (int i = 0; i < 4; ++i) {
+                wg->schedule([&done]() {
+                    _ASSERT(s_user_id.get() && *s_user_id.get() == 42);
+                    ++done;
+                });
+            }
+            wg->waitAll();
+            _ASSERT(*s_user_id.get() == 42);
+            _ASSERT(*s_private.get() == "private");
+            ++done;
+        });
+        while (done < 7) {
+            usleep(1000);
+        }
+
+        // 同一个回调协程执行的下一个任务看不到上一个任务的值
+        iom.schedule([&done]() {
+            _ASSERT(!s_user_id.get());
+            _ASSERT(!base::RequestContext::Get());
+            ++done;
+        });
+        while (done < 8) {
+            usleep(1000);
+        }
+    }
+    _LOG_INFO(g_logger) << "test_inherit ok";
+}
+
+static void test_scope()
+{
+    _ASSERT(!s_user_id.get());
+    {
+        base::FiberLocal<int>::Scope scope(s_user_id, 1);
+        _ASSERT(*s_user_id.get() == 1);
+        {
+            base::FiberLocal<int>::Scope inner(s_user_id, 2);
+            _ASSERT(*s_user_id.get() == 2);
+        }
+        _ASSERT(*s_user_id.get() == 1);
+    }
+    _ASSERT(!s_user_id.get());
+    _LOG_INFO(g_logger) << "test_scope ok";
+}
+
+/**
+ * 读取的开销
+ */
+static void bench_get(uint64_t n)
+{
+    s_user_id.set(1);
+    uint64_t sum = 0;
+    uint64_t start = base::GetCurrentUS();
+    for (uint64_t i = 0; i < n; ++i) {
+        sum += *s_user_id.get();
+    }
+    uint64_t used = base::GetCurrentUS() - start;
+    _ASSERT(sum == n);
+    s_user_id.reset();
+    _LOG_INFO(g_logger) << "get n=" << n << " used=" << used << "us ns/op="
+                        << (n ? used * 1000.0 / n : 0);
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+    g_logger->setFormatter("%d{%H:%M:%S}%T%t%T%F%T[%R]%T%m%n");
+
+    test_scope();
+    test_inherit();
+    bench_get(argc > 1 ? atoi(argv[1]) : 10000000);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include "base/coro/fiber.h"
+#include "base/coro/fiber_pool.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/util.h"
+#include <string.h>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static void churn(uint32_t count, bool pool)
+{
+    base::Config::Lookup<bool>("fiber.stack_pool.enable")->setValue(pool);
+    auto before = base::FiberStackPool::GetStats();
+    uint64_t start = base::GetCurrentUS();
+    for (uint32_t i = 0; i < count; ++i) {
+        base::Fiber::ptr fiber(base::NewFiber([]() {}, 0, true), base::FreeFiber);
+        fiber->call();
+    }
+    uint64_t used = base::GetCurrentUS() - start;
+    auto after = base::FiberStackPool::GetStats();
+    _LOG_INFO(g_logger) << "pool=" << pool << " fibers=" << count << " used=" << used << "us "
+                        << (uint64_t)(count * 1000000.0 / (used ? used : 1)) << " fiber/s"
+                        << " mmap=" << (after.mmap - before.mmap)
+                        << " reuse=" << (after.reuse - before.reuse);
+}
+
+static int __attribute__((noinline)) overflow(int depth)
+{
+    volatile char buf[1024];
+    buf[0] = depth;
+    return overflow(depth + 1) + buf[0];
+}
+
+int main(int argc, char **argv)
+{
+    _LOG_NAME("system")->setLevel(base::LogLevel::INFO);
+    base::Fiber::GetThis();
+
+    if (argc > 1 && strcmp(argv[1], "overflow") == 0) {
+        // 栈溢出应当命中保护页直接 SIGSEGV
+        base::Fiber::ptr fiber(base::NewFiber([]() { overflow(0); }, 32 * 1024, true),
+                               base::FreeFiber);
+        fiber->call();
+        return 0;
+    }
+
+    uint32_t count = argc > 1 ? atoi(argv[1]) : 200000;
+    churn(count, false);
+    churn(count, true);
+    _LOG_INFO(g_logger) << base::FiberStackPool::GetStats().toString();
+    return 0;
+}
@@ -0,0 +1,311 @@
+#include "base/coro/fiber_sync.h"
+#include "base/coro/iomanager.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+#include <string.h>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static void test_mutex_cond()
+{
+    base::FiberMutex mutex;
+    base::FiberConditionVariable cond;
+    base::WaitGroup wg;
+    uint64_t counter = 0;
+    std::deque<int> queue;
+    bool finished = false;
+    uint64_t consumed = 0;
+    {
+        base::IOManager iom(4, false, "mutex");
+        iom.schedule([&]() {
+            // 消费者, 等待条件变量
+            wg.add(1);
+            base::FiberMutex::Lock lock(mutex);
+            while (true) {
+                cond.wait(mutex, [&]() { return !queue.empty() || finished; });
+                if (queue.empty()) {
+                    break;
+                }
+                consumed += queue.front();
+                queue.pop_front();
+            }
+            wg.done();
+        });
+        wg.add(64);
+        for (int i = 0; i < 64; ++i) {
+            iom.schedule([&, i]() {
+                for (int j = 0; j < 1000; ++j) {
+                    base::FiberMutex::Lock lock(mutex);
+                    ++counter;
+                    queue.push_back(1);
+                    cond.notifyOne();
+                    if (j % 100 == i % 100) {
+                        // 持有锁时切出, 其它协程只能排队
+                        base::Fiber::YieldToReady();
+                    }
+                }
+                wg.done();
+            });
+        }
+        iom.schedule([&]() {
+            while (true) {
+                {
+                    base::FiberMutex::Lock lock(mutex);
+                    if (counter == 64 * 1000) {
+                        finished = true;
+                        cond.notifyAll();
+                        break;
+                    }
+                }
+                usleep(1000);
+            }
+        });
+        iom.schedule([&]() {
+            usleep(10 * 1000);
+            wg.wait();
+            _LOG_INFO(g_logger) << "wait group done";
+        });
+    }
+    _ASSERT(counter == 64 * 1000);
+    _ASSERT(consumed == 64 * 1000);
+    _LOG_INFO(g_logger) << "test_mutex_cond counter=" << counter << " consumed=" << consumed;
+}
+
+static void test_channel(size_t capacity)
+{
+    base::Channel<uint64_t> ch(capacity);
+    base::WaitGroup producers;
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> count{0};
+    const int kProducers = 8;
+    const int kConsumers = 4;
+    const uint64_t kItems = 20000;
+    {
+        base::IOManager iom(4, false, "channel");
+        producers.add(kProducers);
+        for (int p = 0; p < kProducers; ++p) {
+            iom.schedule([&]() {
+                for (uint64_t i = 1; i <= kItems; ++i) {
+                    _ASSERT(ch.send(i));
+                }
+                producers.done();
+            });
+        }
+        for (int c = 0; c < kConsumers; ++c) {
+            iom.schedule([&]() {
+                uint64_t v = 0;
+                while (ch.recv(v)) {
+                    sum += v;
+                    ++count;
+                }
+            });
+        }
+        iom.schedule([&]() {
+            producers.wait();
+            ch.close();
+            _ASSERT(!ch.send(1));
+        });
+    }
+    _ASSERT(count == kProducers * kItems);
+    _ASSERT(sum == kProducers * kItems * (kItems + 1) / 2);
+    _LOG_INFO(g_logger) << "test_channel capacity=" << capacity << " count=" << count;
+}
+
+static void test_select()
+{
+    base::Channel<int> a(0);
+    base::Channel<std::string> b(4);
+    base::Channel<int> quit(0);
+    int from_a = 0;
+    int from_b = 0;
+    {
+        base::IOManager iom(2, false, "select");
+        iom.schedule([&]() {
+            for (int i = 0; i < 1000; ++i) {
+                a.send(i);
+            }
+            a.close();
+        });
+        iom.schedule([&]() {
+            for (int i = 0; i < 1000; ++i) {
+                b.send(std::to_string(i));
+            }
+            b.close();
+        });
+        iom.schedule([&]() {
+            int iv = 0;
+            std::string sv;
+            bool a_open = true;
+            bool b_open = true;
+            while (a_open || b_open) {
+                base::Select sel;
+                if (a_open) {
+                    sel.recv(a, iv);
+                }
+                if (b_open) {
+                    sel.recv(b, sv);
+                }
+                int idx = sel.wait();
+                bool is_a = a_open && idx == 0;
+                if (!sel.ok()) {
+                    (is_a ? a_open : b_open) = false;
+                    continue;
+                }
+                ++(is_a ? from_a : from_b);
+            }
+            // 没有就绪分支时 tryWait 立即返回
+            base::Select sel;
+            int x = 0;
+            sel.recv(quit, x);
+            _ASSERT(sel.tryWait() == -1);
+        });
+    }
+    _ASSERT(from_a == 1000 && from_b == 1000);
+    _LOG_INFO(g_logger) << "test_select from_a=" << from_a << " from_b=" << from_b;
+}
+
+/**
+ * 共享栈协程在互斥锁, 通道和 WaitGroup 上挂起, 切出后栈内容被其它协程覆盖,
+ * 其它线程上的唤醒方不能访问挂起协程的栈
+ */
+static void test_shared_stack()
+{
+    base::Config::Lookup<bool>("fiber.shared_stack.enable")->setValue(true);
+    base::FiberMutex mutex;
+    base::Channel<std::string> ch(0);
+    base::WaitGroup wg;
+    uint64_t counter = 0;
+    std::atomic<uint64_t> sum{0};
+    const int kFibers = 32;
+    const int kItems = 200;
+    {
+        base::IOManager iom(4, false, "shared_sync");
+        wg.add(kFibers * 2);
+        for (int i = 0; i < kFibers; ++i) {
+            iom.schedule([&, i]() {
+                _ASSERT(base::Fiber::GetThis()->isSharedStack());
+                // 占用一段栈, 后切入的协程会覆盖共享栈上的这部分内容
+                char frame[4096];
+                memset(frame, i, sizeof(frame));
+                for (int j = 0; j < kItems; ++j) {
+                    {
+                        base::FiberMutex::Lock lock(mutex);
+                        ++counter;
+                        base::Fiber::YieldToReady();
+                    }
+                    _ASSERT(ch.send(std::to_string(i * kItems + j + 1)));
+                }
+                _ASSERT(frame[sizeof(frame) - 1] == (char)i);
+                wg.done();
+            });
+            iom.schedule([&]() {
+                char frame[4096];
+                memset(frame, 0x5a, sizeof(frame));
+                std::string v;
+                for (int j = 0; j < kItems; ++j) {
+                    _ASSERT(ch.recv(v));
+                    sum += atoi(v.c_str());
+                }
+                _ASSERT(frame[0] == 0x5a);
+                wg.done();
+            });
+        }
+        iom.schedule([&]() {
+            wg.wait();
+            ch.close();
+        });
+    }
+    base::Config::Lookup<bool>("fiber.shared_stack.enable")->setValue(false);
+    const uint64_t n = kFibers * kItems;
+    _ASSERT(counter == n);
+    _ASSERT(sum == n * (n + 1) / 2);
+    _LOG_INFO(g_logger) << "test_shared_stack counter=" << counter << " sum=" << sum;
+}
+
+/**
+ * 多个协程竞争同一把锁, 对比 FiberMutex 和 FiberSemaphore(1)
+ */
+template <class Lock, class Unlock>
+static double bench_lock(const char *name, size_t threads, int fibers, int loops, Lock lock_fn,
+                         Unlock unlock_fn)
+{
+    uint64_t counter = 0;
+    std::atomic<int> done{0};
+    uint64_t start = base::GetCurrentUS();
+    {
+        base::IOManager iom(threads, false, name);
+        for (int i = 0; i < fibers; ++i) {
+            iom.schedule([&]() {
+                for (int j = 0; j < loops; ++j) {
+                    lock_fn();
+                    ++counter;
+                    if ((j & 63) == 0) {
+                        base::Fiber::YieldToReady();
+                    }
+                    unlock_fn();
+                }
+                ++done;
+            });
+        }
+    }
+    uint64_t used = base::GetCurrentUS() - start;
+    _ASSERT(counter == (uint64_t)fibers * loops);
+    double rate = counter * 1000000.0 / (used ? used : 1);
+    std::cout << name << " threads=" << threads << " fibers=" << fibers
+              << " lock/s=" << (uint64_t)rate << std::endl;
+    return rate;
+}
+
+static void bench_channel(size_t threads, size_t capacity, uint64_t items)
+{
+    base::Channel<uint64_t> ch(capacity);
+    uint64_t start = base::GetCurrentUS();
+    {
+        base::IOManager iom(threads, false, "bench_channel");
+        iom.schedule([&]() {
+            for (uint64_t i = 0; i < items; ++i) {
+                ch.send(i);
+            }
+            ch.close();
+        });
+        iom.schedule([&]() {
+            uint64_t v = 0;
+            while (ch.recv(v)) {
+            }
+        });
+    }
+    uint64_t used = base::GetCurrentUS() - start;
+    std::cout << "channel capacity=" << capacity
+              << " msg/s=" << (uint64_t)(items * 1000000.0 / (used ? used : 1)) << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    test_mutex_cond();
+    test_channel(0);
+    test_channel(16);
+    test_channel(base::Channel<uint64_t>::Unbounded);
+    test_select();
+    test_shared_stack();
+
+    size_t threads = argc > 1 ? atoi(argv[1]) : 1;
+    int fibers = argc > 2 ? atoi(argv[2]) : 64;
+    int loops = argc > 3 ? atoi(argv[3]) : 20000;
+    base::FiberMutex mutex;
+    bench_lock("fiber_mutex", threads, fibers, loops, [&]() { mutex.lock(); },
+               [&]() { mutex.unlock(); });
+    base::FiberSemaphore sem(1);
+    bench_lock("fiber_semaphore", threads, fibers, loops, [&]() { sem.wait(); },
+               [&]() { sem.notify(); });
+
+    for (size_t cap : {(size_t)0, (size_t)128}) {
+        bench_channel(threads, cap, 1000000);
+    }
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "base/coro/future.h"
+#include "base/coro/iomanager.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+#include <thread>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static void test_then()
+{
+    base::IOManager iom(2, false, "then");
+    iom.schedule([&iom]() {
+        auto f = base::Async(&iom, []() { return 20; })
+                     .then([](base::Future<int> f) { return f.get() + 1; })
+                     .then([](base::Future<int> f) { return std::to_string(f.get() * 2); });
+        _ASSERT(f.get() == "42");
+
+        // 异常沿着 then 链传递
+        auto e = base::Async(&iom, []() -> int { throw std::runtime_error("oops"); })
+                     .then([](base::Future<int> f) { return f.get() + 1; });
+        bool caught = false;
+        try {
+            e.get();
+        } catch (std::runtime_error &ex) {
+            caught = std::string(ex.what()) == "oops";
+        }
+        _ASSERT(caught && e.hasException());
+
+        // 返回 Future 的后续处理会被展开
+        auto nested = base::MakeReadyFuture(1).then([&iom](base::Future<int> f) {
+            int v = f.get();
+            return base::Async(&iom, [v]() {
+                usleep(1000);
+                return v + 1;
+            });
+        });
+        _ASSERT(nested.get() == 2);
+
+        // void
+        std::atomic<int> n{0};
+        auto v = base::Async(&iom, [&n]() { ++n; }).then([&n](base::Future<void> f) {
+            f.get();
+            ++n;
+        });
+        v.get();
+        _ASSERT(n == 2);
+        _LOG_INFO(g_logger) << "test_then ok";
+    });
+}
+
+static void test_timeout()
+{
+    base::IOManager iom(1, false, "timeout");
+    iom.schedule([&iom]() {
+        base::Promise<int> p;
+        auto f = p.getFuture();
+        uint64_t start = base::GetCurrentMS();
+        _ASSERT(!f.waitFor(50));
+        _ASSERT(base::GetCurrentMS() - start >= 40);
+
+        auto t = f.timeout(50);
+        bool timeout = false;
+        try {
+            t.get();
+        } catch (base::FutureTimeout &) {
+            timeout = true;
+        }
+        _ASSERT(timeout);
+
+        // 超时之前完成
+        auto t2 = f.timeout(1000);
+        iom.addTimer(10, [p]() mutable { p.setValue(7); });
+        _ASSERT(t2.get() == 7);
+        _ASSERT(f.waitFor(10) && f.get() == 7);
+        _LOG_INFO(g_logger) << "test_timeout ok";
+    });
+}
+
+static void test_when()
+{
+    base::IOManager iom(2, false, "when");
+    iom.schedule([&iom]() {
+        std::vector<base::Future<int> > fs;
+        for (int i = 0; i < 10; ++i) {
+            fs.push_back(base::Async(&iom, [i]() {
+                usleep((10 - i) * 1000);
+                if (i == 3) {
+                    throw std::logic_error("3");
+                }
+                return i;
+            }));
+        }
+        auto all = base::WhenAll(fs).get();
+        _ASSERT(all.size() == 10);
+        int sum = 0;
+        for (size_t i = 0; i < all.size(); ++i) {
+            if (i == 3) {
+                _ASSERT(all[i].hasException());
+                continue;
+            }
+            sum += all[i].get();
+        }
+        _ASSERT(sum == 45 - 3);
+
+        // 慢的后端和快的后端, 取先返回的
+        std::vector<base::Future<std::string> > backends;
+        backends.push_back(base::Async(&iom, []() {
+            usleep(200 * 1000);
+            return std::string("slow");
+        }));
+        backends.push_back(base::Async(&iom, []() {
+            usleep(5 * 1000);
+            return std::string("fast");
+        }));
+        size_t idx = base::WhenAny(backends).get();
+        _ASSERT(idx == 1 && backends[idx].get() == "fast");
+        _LOG_INFO(g_logger) << "test_when ok";
+    });
+}
+
+static void test_thread_wait()
+{
+    // 非协程线程阻塞等待, Promise 全部销毁时以 BrokenPromise 完成
+    base::Future<int> f;
+    base::Future<int> broken;
+    {
+        base::Promise<int> p;
+        f = p.getFuture();
+        base::Promise<int> p2;
+        broken = p2.getFuture();
+        std::thread th([p]() mutable {
+            usleep(10 * 1000);
+            p.setValue(5);
+        });
+        th.detach();
+    }
+    _ASSERT(f.get() == 5);
+    _ASSERT(broken.isReady());
+    bool is_broken = false;
+    try {
+        broken.get();
+    } catch (base::BrokenPromise &) {
+        is_broken = true;
+    }
+    _ASSERT(is_broken);
+    _LOG_INFO(g_logger) << "test_thread_wait ok";
+}
+
+/**
+ * 扇出 n 个请求再等待全部完成, 对比每个请求一个协程 + WorkerGroup 式的信号量等待
+ */
+static void bench_fanout(uint64_t rounds, int fanout)
+{
+    base::IOManager iom(1, false, "bench");
+    iom.schedule([&]() {
+        uint64_t start = base::GetCurrentUS();
+        for (uint64_t r = 0; r < rounds; ++r) {
+            std::vector<base::Promise<int> > ps(fanout);
+            std::vector<base::Future<int> > fs;
+            for (auto &p : ps) {
+                fs.push_back(p.getFuture());
+            }
+            // 模拟在读协程中陆续收到响应
+            iom.schedule([ps]() mutable {
+                for (size_t i = 0; i < ps.size(); ++i) {
+                    ps[i].setValue(i);
+                }
+            });
+            base::WhenAll(fs).wait();
+        }
+        uint64_t used = base::GetCurrentUS() - start;
+        std::cout << "fanout=" << fanout << " rounds=" << rounds
+                  << " us/round=" << (double)used / rounds << std::endl;
+    });
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    test_then();
+    test_timeout();
+    test_when();
+    test_thread_wait();
+    bench_fanout(argc > 1 ? atoi(argv[1]) : 10000, 8);
+    return 0;
+}
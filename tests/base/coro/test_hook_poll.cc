@@ -0,0 +1,341 @@
+#include "base/conf/config.h"
+#include "base/coro/fiber_sync.h"
+#include "base/coro/hook.h"
+#include "base/coro/iomanager.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <thread>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+/**
+ * 单线程 IOManager, 任何一个 hook 函数阻塞线程都会导致其它协程无法运行
+ */
+static void test_poll()
+{
+    base::IOManager iom(1, false, "poll");
+    iom.schedule([&iom]() {
+        // 多个协程同时 poll 各自的 pipe
+        const int N = 16;
+        base::WaitGroup wg;
+        std::atomic<int> ok{0};
+        wg.add(N * 2);
+        for (int i = 0; i < N; ++i) {
+            int fds[2];
+            _ASSERT(pipe(fds) == 0);
+            iom.schedule([fds, &wg, &ok]() {
+                pollfd pfd = {fds[0], POLLIN, 0};
+                if (poll(&pfd, 1, -1) == 1 && (pfd.revents & POLLIN)) {
+                    char c;
+                    if (read(fds[0], &c, 1) == 1) {
+                        ++ok;
+                    }
+                }
+                close(fds[0]);
+                wg.done();
+            });
+            iom.schedule([fds, i, &wg]() {
+                usleep((i % 4 + 1) * 5000);
+                _ASSERT(write(fds[1], "x", 1) == 1);
+                close(fds[1]);
+                wg.done();
+            });
+        }
+        wg.wait();
+        _ASSERT(ok == N);
+
+        // 超时期间其它协程仍然可以运行
+        int fds[2];
+        _ASSERT(pipe(fds) == 0);
+        std::atomic<int> ticks{0};
+        bool stop = false;
+        wg.add(1);
+        iom.schedule([&]() {
+            while (!stop) {
+                ++ticks;
+                usleep(5000);
+            }
+            wg.done();
+        });
+        pollfd pfd = {fds[0], POLLIN, 0};
+        uint64_t start = base::GetCurrentMS();
+        _ASSERT(poll(&pfd, 1, 50) == 0);
+        _ASSERT(base::GetCurrentMS() - start >= 45 && ticks >= 3);
+
+        // 多个 fd, 只有写入的那个就绪
+        int fds2[2];
+        _ASSERT(pipe(fds2) == 0);
+        iom.schedule([&]() {
+            usleep(10 * 1000);
+            _ASSERT(write(fds2[1], "y", 1) == 1);
+        });
+        pollfd pfds[3] = {{fds[0], POLLIN, 0}, {fds2[0], POLLIN, 0}, {-1, POLLIN, 0}};
+        _ASSERT(poll(pfds, 3, 1000) == 1);
+        _ASSERT(pfds[0].revents == 0 && (pfds[1].revents & POLLIN) && pfds[2].revents == 0);
+        stop = true;
+        wg.wait();
+        for (int fd : {fds[0], fds[1], fds2[0], fds2[1]}) {
+            close(fd);
+        }
+        _LOG_INFO(g_logger) << "test_poll ok";
+    });
+}
+
+static void test_select_epoll()
+{
+    base::IOManager iom(1, false, "select");
+    iom.schedule([&iom]() {
+        int fds[2];
+        _ASSERT(pipe(fds) == 0);
+        iom.schedule([&]() {
+            usleep(10 * 1000);
+            _ASSERT(write(fds[1], "x", 1) == 1);
+        });
+        fd_set rset;
+        FD_ZERO(&rset);
+        FD_SET(fds[0], &rset);
+        timeval tv = {1, 0};
+        _ASSERT(select(fds[0] + 1, &rset, nullptr, nullptr, &tv) == 1 && FD_ISSET(fds[0], &rset));
+        _ASSERT(tv.tv_sec == 0 && tv.tv_usec > 0);
+        char c;
+        _ASSERT(read(fds[0], &c, 1) == 1);
+
+        FD_ZERO(&rset);
+        FD_SET(fds[0], &rset);
+        tv = {0, 20 * 1000};
+        _ASSERT(select(fds[0] + 1, &rset, nullptr, nullptr, &tv) == 0 && !FD_ISSET(fds[0], &rset));
+
+        // 用户自己的 epoll + eventfd
+        int efd = eventfd(0, 0);
+        int epfd = epoll_create1(0);
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = efd;
+        _ASSERT(epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev) == 0);
+        iom.schedule([efd]() {
+            usleep(10 * 1000);
+            uint64_t v = 1;
+            _ASSERT(write(efd, &v, sizeof(v)) == sizeof(v));
+        });
+        epoll_event out[4];
+        _ASSERT(epoll_wait(epfd, out, 4, 1000) == 1 && out[0].data.fd == efd);
+        uint64_t v = 0;
+        _ASSERT(read(efd, &v, sizeof(v)) == sizeof(v) && v == 1);
+        _ASSERT(epoll_wait(epfd, out, 4, 20) == 0);
+
+        // eventfd 阻塞读, 由另一个协程写入
+        iom.schedule([efd]() {
+            usleep(10 * 1000);
+            uint64_t v = 7;
+            _ASSERT(write(efd, &v, sizeof(v)) == sizeof(v));
+        });
+        _ASSERT(read(efd, &v, sizeof(v)) == sizeof(v) && v == 7);
+
+        // timerfd 阻塞读
+        int tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+        itimerspec its;
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_nsec = 20 * 1000 * 1000;
+        _ASSERT(timerfd_settime(tfd, 0, &its, nullptr) == 0);
+        uint64_t start = base::GetCurrentMS();
+        _ASSERT(read(tfd, &v, sizeof(v)) == sizeof(v) && v == 1);
+        _ASSERT(base::GetCurrentMS() - start >= 15);
+
+        // 用户要求的非阻塞语义保持不变
+        int nfds[2];
+        _ASSERT(pipe2(nfds, O_NONBLOCK) == 0);
+        _ASSERT(read(nfds[0], &c, 1) == -1 && errno == EAGAIN);
+
+        for (int fd : {fds[0], fds[1], efd, epfd, tfd, nfds[0], nfds[1]}) {
+            close(fd);
+        }
+        _LOG_INFO(g_logger) << "test_select_epoll ok";
+    });
+}
+
+/**
+ * pipe 创建时不修改文件描述的阻塞模式, 第一次在协程里阻塞读写时才切换, 关闭时恢复
+ */
+static void test_pipe_nonblock()
+{
+    base::IOManager iom(1, false, "pipe");
+    iom.schedule([&iom]() {
+        int fds[2];
+        _ASSERT(pipe(fds) == 0);
+        _ASSERT(!(fcntl_f(fds[0], F_GETFL, 0) & O_NONBLOCK));
+        _ASSERT(!(fcntl_f(fds[1], F_GETFL, 0) & O_NONBLOCK));
+        // 没有 hook 的 dup, 模拟传给子进程的同一个文件描述
+        int shared = dup(fds[0]);
+
+        iom.schedule([fds]() {
+            usleep(10 * 1000);
+            _ASSERT(write(fds[1], "z", 1) == 1);
+        });
+        char c = 0;
+        _ASSERT(read(fds[0], &c, 1) == 1 && c == 'z');
+        _ASSERT(fcntl_f(shared, F_GETFL, 0) & O_NONBLOCK);
+        // 用户看到的仍然是阻塞模式
+        _ASSERT(!(fcntl(fds[0], F_GETFL) & O_NONBLOCK));
+
+        close(fds[0]);
+        _ASSERT(!(fcntl_f(shared, F_GETFL, 0) & O_NONBLOCK));
+        close(fds[1]);
+        close_f(shared);
+        _LOG_INFO(g_logger) << "test_pipe_nonblock ok";
+    });
+}
+
+/**
+ * 常驻注册模式下, fd 在没有 hook 的线程里被关闭后复用, 旧的注册和就绪状态不能被沿用
+ */
+static void test_persistent_reuse()
+{
+    auto persistent = base::Config::Lookup<bool>("iomanager.persistent_events");
+    persistent->setValue(true);
+    std::atomic<bool> finished{false};
+    std::thread watchdog([&finished]() {
+        uint64_t start = base::GetCurrentMS();
+        while (!finished && base::GetCurrentMS() - start < 5000) {
+            usleep(10 * 1000);
+        }
+        _ASSERT2(finished, "persistent fd reuse hang");
+    });
+    {
+        base::IOManager iom(1, false, "persistent");
+        _ASSERT(iom.isPersistentEvents());
+        iom.schedule([&iom, &finished]() {
+            int fds[2];
+            _ASSERT(pipe(fds) == 0);
+            iom.schedule([fds]() {
+                usleep(10 * 1000);
+                _ASSERT(write(fds[1], "a", 1) == 1);
+            });
+            char c = 0;
+            _ASSERT(read(fds[0], &c, 1) == 1 && c == 'a');
+            // 没有读者时到来的数据让读事件在 IOManager 里记为就绪
+            _ASSERT(write(fds[1], "b", 1) == 1);
+            usleep(10 * 1000);
+
+            // 没有 hook 的线程关闭读端, IOManager 和 FdManager 都不知道
+            int old = fds[0];
+            std::thread([old]() { _ASSERT(close(old) == 0); }).join();
+            close(fds[1]);
+
+            _ASSERT(pipe(fds) == 0);
+            _ASSERT(fds[0] == old);
+            iom.schedule([fds]() {
+                usleep(20 * 1000);
+                _ASSERT(write(fds[1], "c", 1) == 1);
+            });
+            uint64_t start = base::GetCurrentMS();
+            c = 0;
+            _ASSERT(read(fds[0], &c, 1) == 1 && c == 'c');
+            _ASSERT(base::GetCurrentMS() - start >= 15);
+            close(fds[0]);
+            close(fds[1]);
+            finished = true;
+            _LOG_INFO(g_logger) << "test_persistent_reuse ok";
+        });
+    }
+    watchdog.join();
+    persistent->setValue(false);
+}
+
+static void test_accept4_sendfile_splice()
+{
+    base::IOManager iom(1, false, "accept4");
+    iom.schedule([&iom]() {
+        int lfd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        _ASSERT(bind(lfd, (sockaddr *)&addr, sizeof(addr)) == 0 && listen(lfd, 16) == 0);
+        socklen_t len = sizeof(addr);
+        _ASSERT(getsockname(lfd, (sockaddr *)&addr, &len) == 0);
+
+        // 文件内容通过 sendfile 发送
+        char path[] = "/tmp/test_hook_poll_XXXXXX";
+        int file = mkstemp(path);
+        std::string data(256 * 1024, 'a');
+        _ASSERT(write(file, data.data(), data.size()) == (ssize_t)data.size());
+
+        base::WaitGroup wg;
+        wg.add(1);
+        iom.schedule([&]() {
+            usleep(10 * 1000);
+            int cfd = socket(AF_INET, SOCK_STREAM, 0);
+            _ASSERT(connect(cfd, (sockaddr *)&addr, sizeof(addr)) == 0);
+            off_t off = 0;
+            size_t left = data.size();
+            while (left > 0) {
+                ssize_t n = sendfile(cfd, file, &off, left);
+                _ASSERT(n > 0);
+                left -= n;
+            }
+            close(cfd);
+            wg.done();
+        });
+        int fd = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+        _ASSERT(fd >= 0);
+
+        // socket -> pipe -> pipe, 读端在数据到达前挂起
+        int p1[2];
+        int p2[2];
+        _ASSERT(pipe(p1) == 0 && pipe(p2) == 0);
+        size_t received = 0;
+        wg.add(1);
+        iom.schedule([&]() {
+            std::string buf(4096, '\0');
+            while (true) {
+                ssize_t n = read(p2[0], &buf[0], buf.size());
+                if (n <= 0) {
+                    break;
+                }
+                received += n;
+            }
+            wg.done();
+        });
+        while (true) {
+            ssize_t n = splice(fd, nullptr, p1[1], nullptr, 65536, 0);
+            _ASSERT(n >= 0);
+            if (n == 0) {
+                break;
+            }
+            while (n > 0) {
+                ssize_t m = splice(p1[0], nullptr, p2[1], nullptr, n, 0);
+                _ASSERT(m > 0);
+                n -= m;
+            }
+        }
+        close(p2[1]);
+        wg.wait();
+        _ASSERT(received == data.size());
+
+        for (int i : {fd, lfd, file, p1[0], p1[1], p2[0]}) {
+            close(i);
+        }
+        unlink(path);
+        _LOG_INFO(g_logger) << "test_accept4_sendfile_splice ok";
+    });
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    test_poll();
+    test_select_epoll();
+    test_pipe_nonblock();
+    test_persistent_reuse();
+    test_accept4_sendfile_splice();
+    return 0;
+}
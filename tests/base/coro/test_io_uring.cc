@@ -0,0 +1,192 @@
+#include "base/coro/hook.h"
+#include "base/coro/iomanager.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static const size_t MSG_SIZE = 64;
+
+static int s_port = 0;
+static std::vector<uint64_t> s_rtts;
+static base::IOManager::IOStats s_stats;
+static uint64_t s_hook_io = 0;
+
+static void read_full(int fd, char *buf, size_t len)
+{
+    size_t offset = 0;
+    while (offset < len) {
+        int rt = read(fd, buf + offset, len - offset);
+        _ASSERT(rt > 0);
+        offset += rt;
+    }
+}
+
+static void write_full(int fd, const char *buf, size_t len)
+{
+    size_t offset = 0;
+    while (offset < len) {
+        int rt = write(fd, buf + offset, len - offset);
+        _ASSERT(rt > 0);
+        offset += rt;
+    }
+}
+
+static void run_client(base::IOManager *iom, uint32_t rounds);
+
+static void run_server(base::IOManager *iom, uint32_t rounds)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int rt = bind(listen_fd, (sockaddr *)&addr, sizeof(addr));
+    _ASSERT(rt == 0);
+    listen(listen_fd, 16);
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, (sockaddr *)&addr, &len);
+    s_port = ntohs(addr.sin_port);
+    iom->schedule(std::bind(&run_client, iom, rounds));
+
+    int fd = accept(listen_fd, nullptr, nullptr);
+    _ASSERT(fd >= 0);
+    char buf[MSG_SIZE];
+    for (uint32_t i = 0; i < rounds; ++i) {
+        read_full(fd, buf, sizeof(buf));
+        write_full(fd, buf, sizeof(buf));
+    }
+    close(fd);
+    close(listen_fd);
+}
+
+static void run_client(base::IOManager *iom, uint32_t rounds)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(s_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int rt = connect(fd, (sockaddr *)&addr, sizeof(addr));
+    _ASSERT(rt == 0);
+
+    char buf[MSG_SIZE];
+    memset(buf, 'x', sizeof(buf));
+    // 预热一轮, 排除建立连接的开销
+    write_full(fd, buf, sizeof(buf));
+    read_full(fd, buf, sizeof(buf));
+
+    s_rtts.reserve(rounds);
+    base::IOManager::IOStats before = iom->getIOStats();
+    uint64_t hook_before = base::get_hook_io_count();
+    for (uint32_t i = 1; i < rounds; ++i) {
+        uint64_t start = base::GetCurrentUS();
+        write_full(fd, buf, sizeof(buf));
+        read_full(fd, buf, sizeof(buf));
+        s_rtts.push_back(base::GetCurrentUS() - start);
+    }
+    base::IOManager::IOStats after = iom->getIOStats();
+    s_hook_io = base::get_hook_io_count() - hook_before;
+    s_stats.epollCtl = after.epollCtl - before.epollCtl;
+    s_stats.wait = after.wait - before.wait;
+    s_stats.eventFdRead = after.eventFdRead - before.eventFdRead;
+    s_stats.uringEnter = after.uringEnter - before.uringEnter;
+    s_stats.uringOps = after.uringOps - before.uringOps;
+    close(fd);
+}
+
+static bool s_busy_done = false;
+
+/**
+ * 调度线程一直有就绪任务不进入 idle 时, io_uring 上的IO也要能完成
+ */
+static void test_busy(base::IOManager *iom)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int rt = bind(listen_fd, (sockaddr *)&addr, sizeof(addr));
+    _ASSERT(rt == 0);
+    listen(listen_fd, 16);
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, (sockaddr *)&addr, &len);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    rt = connect(fd, (sockaddr *)&addr, sizeof(addr));
+    _ASSERT(rt == 0);
+    int peer = accept(listen_fd, nullptr, nullptr);
+    _ASSERT(peer >= 0);
+
+    iom->schedule([]() {
+        uint64_t start = base::GetCurrentMS();
+        while (!s_busy_done && base::GetCurrentMS() - start < 3000) {
+            base::Fiber::YieldToReady();
+        }
+        _ASSERT2(s_busy_done, "io_uring read did not complete while the thread was busy");
+    });
+    iom->schedule([peer]() { write_full(peer, "x", 1); });
+
+    char c;
+    read_full(fd, &c, 1);
+    s_busy_done = true;
+    close(peer);
+    close(fd);
+    close(listen_fd);
+}
+
+/**
+ * 同一个调度线程上的回环 TCP ping-pong,
+ * 比较 epoll, epoll 持久注册与 io_uring 后端的延迟和每轮系统调用数
+ * 用法: test_io_uring [epoll|persistent|uring] [rounds]
+ */
+int main(int argc, char **argv)
+{
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    std::string mode = argc > 1 ? argv[1] : "epoll";
+    uint32_t rounds = argc > 2 ? atoi(argv[2]) : 100000;
+    base::Config::Lookup<bool>("iomanager.io_uring.enable")->setValue(mode == "uring");
+    base::Config::Lookup<bool>("iomanager.persistent_events")->setValue(mode == "persistent");
+
+    {
+        base::IOManager iom(1, false, "pingpong");
+        if (mode == "uring" && !iom.isIoUringEnabled()) {
+            mode = "epoll(io_uring unsupported)";
+        }
+        iom.schedule(std::bind(&run_server, &iom, rounds + 1));
+    }
+    if (mode == "uring") {
+        base::IOManager iom(1, false, "busy");
+        iom.schedule(std::bind(&test_busy, &iom));
+    }
+
+    std::sort(s_rtts.begin(), s_rtts.end());
+    uint64_t total = 0;
+    for (auto i : s_rtts) {
+        total += i;
+    }
+    double n = s_rtts.size();
+    std::cout << "mode=" << mode << " rounds=" << s_rtts.size()
+              << " avg_rtt=" << total / n << "us p50=" << s_rtts[s_rtts.size() / 2]
+              << "us p99=" << s_rtts[s_rtts.size() * 99 / 100] << "us" << std::endl
+              << "syscalls/round: rw=" << s_hook_io / n << " epoll_ctl=" << s_stats.epollCtl / n
+              << " wait=" << s_stats.wait / n << " eventfd_read=" << s_stats.eventFdRead / n
+              << " io_uring_enter=" << s_stats.uringEnter / n << " total="
+              << (s_hook_io + s_stats.epollCtl + s_stats.wait + s_stats.eventFdRead +
+                  s_stats.uringEnter) /
+                     n
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "base/coro/iomanager.h"
+#include "base/coro/worker.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/thread.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static void test_parse_cpu_list()
+{
+    _ASSERT((base::Thread::ParseCpuList("0-3,8,10-11")
+             == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    _ASSERT((base::Thread::ParseCpuList(" 3, 1-2 ,1") == std::vector<int>{1, 2, 3}));
+    _ASSERT(base::Thread::ParseCpuList("").empty());
+    _ASSERT(base::Thread::ParseCpuList("3-1").empty());
+    _ASSERT(base::Thread::ParseCpuList("a").empty());
+    _LOG_INFO(g_logger) << "test_parse_cpu_list ok node0="
+                        << base::Join(base::Thread::GetNumaNodeCpus(0).begin(),
+                                      base::Thread::GetNumaNodeCpus(0).end(), ",")
+                        << " cpu0_node=" << base::Thread::GetCpuNumaNode(0);
+}
+
+/**
+ * 启动后绑定到 CPU0, 之后的任务都运行在 CPU0 上, 线程的内存节点为 CPU0 所在节点
+ */
+static void test_placement()
+{
+    int node = base::Thread::GetCpuNumaNode(0);
+    base::IOManager iom(2, false, "placement");
+    base::Scheduler::Placement placement;
+    placement.cpus = {0};
+    placement.pinPerThread = true;
+    placement.memNode = node;
+    iom.setPlacement(placement);
+
+    std::atomic<int> done{0};
+    std::atomic<int> wrong{0};
+    for (int i = 0; i < 100; ++i) {
+        iom.schedule([&done, &wrong, node]() {
+            if (base::Thread::GetCpu() != 0) {
+                ++wrong;
+            }
+            ++done;
+        });
+    }
+    while (done < 100) {
+        usleep(1000);
+    }
+    _ASSERT(wrong == 0);
+
+    // 内存策略通过指定线程的任务异步设置, 等待它们执行完
+    usleep(100 * 1000);
+    std::atomic<int> checked{0};
+    std::atomic<int> bad_node{0};
+    for (size_t i = 0; i < 2; ++i) {
+        iom.schedule([&checked, &bad_node, node]() {
+            if (base::Thread::GetMemoryNode() != node) {
+                ++bad_node;
+            }
+            ++checked;
+        });
+    }
+    while (checked < 2) {
+        usleep(1000);
+    }
+    if (node >= 0) {
+        _ASSERT(bad_node == 0);
+    }
+    std::stringstream ss;
+    iom.dump(ss);
+    _LOG_INFO(g_logger) << "test_placement ok " << ss.str();
+}
+
+/**
+ * per_core 为每个CPU创建一个IOManager
+ */
+static void test_worker_per_core()
+{
+    std::map<std::string, std::map<std::string, std::string> > conf;
+    conf["core_io"] = {{"thread_num", "1"}, {"cpus", "0"}, {"per_core", "1"}};
+    base::WorkerManager mgr;
+    mgr.init(conf);
+    auto all = mgr.getAllAsIOManager("core_io");
+    _ASSERT(all.size() == 1);
+    _ASSERT((all[0]->getPlacement().cpus == std::vector<int>{0}));
+    mgr.stop();
+    _LOG_INFO(g_logger) << "test_worker_per_core ok";
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    test_parse_cpu_list();
+    test_placement();
+    test_worker_per_core();
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "base/coro/iomanager.h"
+#include "base/bytearray.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/mutex.h"
+#include "base/net/streams/zlib_stream.h"
+#include "base/pack/json_encoder.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static std::atomic<bool> s_busy_done{false};
+static std::atomic<bool> s_tick_done{false};
+static std::atomic<uint64_t> s_ticks{0};
+
+/**
+ * 只在安全点上让出的忙等
+ */
+static void busy_loop(uint64_t ms)
+{
+    uint64_t end = base::GetCurrentMS() + ms;
+    while (base::GetCurrentMS() < end) {
+        base::Fiber::MaybeYield();
+    }
+}
+
+/**
+ * 持有线程锁时经过 ByteArray 和 ZlibStream(默认不可抢占)的长循环不能让出:
+ * 单线程调度器上的另一个协程会去加同一把锁, 把唯一的调度线程卡住
+ */
+static void test_lock_held()
+{
+    base::Mutex mutex;
+    std::atomic<bool> busy_done{false};
+    std::atomic<bool> waiter_done{false};
+    std::vector<int> numbers(100000);
+    for (size_t i = 0; i < numbers.size(); ++i) {
+        numbers[i] = i;
+    }
+    base::IOManager iom(1, false, "preempt_lock");
+    iom.schedule([&]() {
+        std::string data(1024 * 1024, 0);
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = rand();
+        }
+        base::Mutex::Lock lock(mutex);
+        // 远超时间片的拷贝和压缩
+        uint64_t end = base::GetCurrentMS() + 100;
+        while (base::GetCurrentMS() < end) {
+            base::ByteArray ba(1024);
+            ba.write(data.data(), data.size());
+            auto zs = base::ZlibStream::CreateGzip(true);
+            zs->write(data.data(), data.size());
+            zs->flush();
+            base::pack::JsonEncoder je;
+            je.encode(numbers, 0);
+        }
+        busy_done = true;
+    });
+    iom.schedule([&]() {
+        base::Mutex::Lock lock(mutex);
+        _ASSERT(busy_done);
+        waiter_done = true;
+    });
+    for (int i = 0; i < 5000 && !waiter_done; ++i) {
+        usleep(1000);
+    }
+    _ASSERT(waiter_done);
+
+    // ConfigVar::toString 在读锁里编码, 同一线程上的 setValue 要拿写锁
+    auto var = base::Config::Lookup("test.preempt.numbers", numbers, "numbers");
+    busy_done = false;
+    waiter_done = false;
+    iom.schedule([&]() {
+        uint64_t end = base::GetCurrentMS() + 100;
+        while (base::GetCurrentMS() < end) {
+            var->toString();
+        }
+        busy_done = true;
+    });
+    iom.schedule([&]() {
+        var->setValue(std::vector<int>{1});
+        _ASSERT(busy_done);
+        waiter_done = true;
+    });
+    for (int i = 0; i < 5000 && !waiter_done; ++i) {
+        usleep(1000);
+    }
+    _ASSERT(waiter_done);
+    _LOG_INFO(g_logger) << "test_lock_held ok";
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+    base::Config::Lookup<uint32_t>("scheduler.preempt.slice_ms")->setValue(10);
+
+    test_lock_held();
+
+    base::Scheduler::PreemptStats stats;
+    uint64_t ticks_during_busy = 0;
+    {
+        // 单线程, 忙等的协程不让出时其它任务完全得不到执行
+        base::IOManager iom(1, false, "preempt");
+        iom.schedule([]() {
+            busy_loop(300);
+            s_busy_done = true;
+        });
+        iom.schedule([&ticks_during_busy]() {
+            while (!s_busy_done) {
+                ++s_ticks;
+                base::Fiber::YieldToReady();
+            }
+            ticks_during_busy = s_ticks;
+            s_tick_done = true;
+        });
+        while (!s_busy_done || !s_tick_done) {
+            usleep(1000);
+        }
+        stats = iom.getPreemptStats();
+        std::stringstream ss;
+        iom.dumpStats(ss);
+        _LOG_INFO(g_logger) << ss.str();
+    }
+
+    // 不在调度线程中时 MaybeYield 直接返回
+    base::Fiber::MaybeYield();
+
+    _ASSERT(stats.sliceMs == 10);
+    _ASSERT(stats.requests >= 1);
+    _ASSERT(stats.forcedYields >= 1);
+    _ASSERT(stats.forcedYields <= stats.requests);
+    _ASSERT(ticks_during_busy >= 1);
+    _LOG_INFO(g_logger) << "requests=" << stats.requests << " forced_yields=" << stats.forcedYields
+                        << " ticks=" << ticks_during_busy;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "base/coro/iomanager.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static std::atomic<uint64_t> s_done{0};
+static uint64_t s_tickle_sent = 0;
+
+static void tiny()
+{
+    s_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * 外部线程投递 total 个小任务, batch=1 时逐个 schedule, 否则按 batch 个一组 schedule(begin,end)
+ * 返回每秒执行的任务数
+ */
+static double bench(size_t threads, uint32_t batch_size, uint64_t total, uint32_t batch)
+{
+    base::Config::Lookup<uint32_t>("scheduler.batch_size")->setValue(batch_size);
+    s_done = 0;
+    uint64_t used = 0;
+    {
+        base::IOManager iom(threads, false, "bench", false);
+        std::vector<std::function<void()> > cbs;
+        uint64_t start = base::GetCurrentUS();
+        for (uint64_t i = 0; i < total; i += batch) {
+            if (batch == 1) {
+                iom.schedule(&tiny);
+                continue;
+            }
+            // schedule(begin,end) 会移走其中的回调, 每组重新填充
+            cbs.assign(std::min<uint64_t>(batch, total - i), &tiny);
+            iom.schedule(cbs.begin(), cbs.end());
+        }
+        while (s_done < total) {
+            usleep(100);
+        }
+        used = base::GetCurrentUS() - start;
+        s_tickle_sent = iom.getTickleSent();
+    }
+    _ASSERT(s_done == total);
+    return total * 1000000.0 / (used ? used : 1);
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::WARN);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    size_t threads = argc > 1 ? atoi(argv[1]) : 2;
+    uint64_t total = argc > 2 ? atoll(argv[2]) : 10000000;
+    threads = threads ? threads : 1;
+
+    for (uint32_t batch_size : {1, 32}) {
+        for (uint32_t batch : {1, 1024}) {
+            double rate = bench(threads, batch_size, total, batch);
+            std::cout << "threads=" << threads << " scheduler.batch_size=" << batch_size
+                      << " schedule_batch=" << batch << " rate=" << (uint64_t)rate << " task/s"
+                      << " tickle_sent=" << s_tickle_sent << std::endl;
+        }
+    }
+    return 0;
+}
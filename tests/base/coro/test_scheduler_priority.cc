@@ -0,0 +1,237 @@
+#include "base/coro/scheduler.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/mutex.h"
+#include <algorithm>
+#include <atomic>
+#include <sched.h>
+#include <vector>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static base::Mutex s_mutex;
+static std::vector<int> s_order;
+
+static void record(int v)
+{
+    base::Mutex::Lock lock(s_mutex);
+    s_order.push_back(v);
+}
+
+/**
+ * 启动前投递, 单线程按 REALTIME -> NORMAL -> BACKGROUND 执行
+ */
+static void test_lanes()
+{
+    s_order.clear();
+    base::Scheduler sc(1, false, "lanes");
+    for (int i = 0; i < 5; ++i) {
+        sc.schedule(std::bind(record, 200 + i), base::Fiber::BACKGROUND);
+        sc.schedule(std::bind(record, 100 + i));
+        sc.schedule(std::bind(record, i), base::Fiber::REALTIME);
+    }
+    _ASSERT(sc.getQueueDepth(base::Fiber::REALTIME) == 5);
+    _ASSERT(sc.getQueueDepth(base::Fiber::NORMAL) == 5);
+    _ASSERT(sc.getQueueDepth(base::Fiber::BACKGROUND) == 5);
+    sc.start();
+    sc.stop();
+
+    _ASSERT(s_order.size() == 15);
+    for (int i = 0; i < 15; ++i) {
+        _ASSERT(s_order[i] == (i / 5) * 100 + i % 5);
+    }
+    base::Scheduler::LaneStats stats[base::Fiber::kPriorityCount];
+    sc.getLaneStats(stats);
+    for (auto &i : stats) {
+        _ASSERT(i.depth == 0 && i.maxDepth == 5);
+    }
+    _LOG_INFO(g_logger) << "test_lanes ok";
+}
+
+/**
+ * 同一优先级中按截止时间先后执行, 没有截止时间的排在最后
+ */
+static void test_edf()
+{
+    s_order.clear();
+    // 一次取出整批, 后面的回调任务在回调协程里接着执行
+    base::Config::Lookup<uint32_t>("scheduler.batch_size")->setValue(32);
+    base::Scheduler sc(1, false, "edf");
+    base::Config::Lookup<uint32_t>("scheduler.batch_size")->setValue(1);
+    sc.schedule(std::bind(record, 4), base::Fiber::REALTIME);
+    sc.schedule(std::bind(record, 3), base::Fiber::REALTIME, 300);
+    sc.schedule(std::bind(record, 1), base::Fiber::REALTIME, 100);
+    sc.schedule(std::bind(record, 2), base::Fiber::REALTIME, 200);
+    sc.schedule(std::bind(record, 5), base::Fiber::REALTIME);
+    // 已经错过截止时间的任务最先执行, 并计入 deadline_missed,
+    // 同一批次里在回调协程中接着执行的任务也要计入
+    for (int i = 0; i < 3; ++i) {
+        sc.schedule(std::bind(record, 0), base::Fiber::REALTIME, 1);
+    }
+    usleep(5 * 1000);
+    sc.start();
+    sc.stop();
+
+    _ASSERT((s_order == std::vector<int>{0, 0, 0, 1, 2, 3, 4, 5}));
+    base::Scheduler::LaneStats stats[base::Fiber::kPriorityCount];
+    sc.getLaneStats(stats);
+    _ASSERT(stats[base::Fiber::REALTIME].deadlineMissed == 3);
+    _LOG_INFO(g_logger) << "test_edf ok";
+}
+
+/**
+ * 大量有截止时间的任务, 按截止时间先后执行, 截止时间相同时先到先出
+ */
+static void test_edf_many()
+{
+    s_order.clear();
+    const int N = 20000;
+    std::vector<std::pair<uint64_t, int> > expect;
+    base::Scheduler sc(1, false, "edf_many");
+    srand(1);
+    for (int i = 0; i < N; ++i) {
+        // 截止时间相隔1秒, 投递过程中时间的推移不影响先后
+        uint64_t deadline_ms = (rand() % 64 + 1) * 1000;
+        expect.emplace_back(deadline_ms, i);
+        sc.schedule(std::bind(record, i), base::Fiber::NORMAL, deadline_ms);
+    }
+    std::stable_sort(expect.begin(), expect.end(),
+                     [](const std::pair<uint64_t, int> &a, const std::pair<uint64_t, int> &b) {
+                         return a.first < b.first;
+                     });
+    sc.start();
+    sc.stop();
+
+    _ASSERT(s_order.size() == (size_t)N);
+    for (int i = 0; i < N; ++i) {
+        _ASSERT(s_order[i] == expect[i].second);
+    }
+    _LOG_INFO(g_logger) << "test_edf_many ok";
+}
+
+/**
+ * 指定线程的截止时间任务只由该线程取用, 各自按截止时间先后执行
+ */
+static void test_edf_bound()
+{
+    const int N = 4000;
+    base::Scheduler sc(2, false, "edf_bound");
+    sc.start();
+    std::vector<int> threads = sc.getThreadIds();
+    _ASSERT(threads.size() == 2);
+
+    // 先占住两个线程, 任务全部入队后再放开
+    std::atomic<int> blocked{0};
+    std::atomic<bool> release{false};
+    for (int thr : threads) {
+        sc.schedule(
+            [&]() {
+                ++blocked;
+                while (!release) {
+                    sched_yield();
+                }
+            },
+            thr);
+    }
+    while (blocked != 2) {
+        usleep(1000);
+    }
+
+    std::vector<std::pair<uint64_t, int> > expect[2];
+    std::vector<int> order[2];
+    std::atomic<int> wrong_thread{0};
+    srand(2);
+    for (int i = 0; i < N; ++i) {
+        int idx = i % 2;
+        uint64_t deadline_ms = (rand() % 64 + 1) * 1000;
+        expect[idx].emplace_back(deadline_ms, i);
+        sc.schedule(
+            [&, idx, i]() {
+                if (base::GetThreadId() != threads[idx]) {
+                    ++wrong_thread;
+                }
+                order[idx].push_back(i);
+            },
+            base::Fiber::NORMAL, deadline_ms, threads[idx]);
+    }
+    release = true;
+    sc.stop();
+
+    _ASSERT(wrong_thread == 0);
+    for (int idx = 0; idx < 2; ++idx) {
+        std::stable_sort(expect[idx].begin(), expect[idx].end(),
+                         [](const std::pair<uint64_t, int> &a, const std::pair<uint64_t, int> &b) {
+                             return a.first < b.first;
+                         });
+        _ASSERT(order[idx].size() == expect[idx].size());
+        for (size_t i = 0; i < order[idx].size(); ++i) {
+            _ASSERT(order[idx][i] == expect[idx][i].second);
+        }
+    }
+    _LOG_INFO(g_logger) << "test_edf_bound ok";
+}
+
+/**
+ * 每取 starvation_limit 次任务先服务一次最低优先级
+ */
+static void test_starvation()
+{
+    s_order.clear();
+    base::Config::Lookup<uint32_t>("scheduler.priority.starvation_limit")->setValue(4);
+    base::Scheduler sc(1, false, "starvation");
+    for (int i = 0; i < 20; ++i) {
+        sc.schedule(std::bind(record, i));
+    }
+    sc.schedule(std::bind(record, 100), base::Fiber::BACKGROUND);
+    sc.start();
+    sc.stop();
+
+    _ASSERT(s_order.size() == 21);
+    size_t pos = std::find(s_order.begin(), s_order.end(), 100) - s_order.begin();
+    _ASSERT(pos < 20);
+    base::Config::Lookup<uint32_t>("scheduler.priority.starvation_limit")->setValue(0);
+    _LOG_INFO(g_logger) << "test_starvation ok pos=" << pos;
+}
+
+/**
+ * 协程 yield 后按原来的优先级重新排队, 回调任务的优先级作用于回调协程
+ */
+static void test_yield_keeps_priority()
+{
+    s_order.clear();
+    base::Scheduler sc(1, false, "yield");
+    sc.schedule(
+        [&sc]() {
+            record(0);
+            for (int i = 0; i < 3; ++i) {
+                sc.schedule(std::bind(record, 100 + i));
+            }
+            base::Fiber::YieldToReady();
+            record(1);
+            _ASSERT(base::Fiber::GetThis()->getPriority() == base::Fiber::REALTIME);
+        },
+        base::Fiber::REALTIME);
+    sc.start();
+    sc.stop();
+
+    _ASSERT((s_order == std::vector<int>{0, 1, 100, 101, 102}));
+    _LOG_INFO(g_logger) << "test_yield_keeps_priority ok";
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+    // 每次只取一个任务, 执行顺序完全由优先级决定
+    base::Config::Lookup<uint32_t>("scheduler.batch_size")->setValue(1);
+    base::Config::Lookup<uint32_t>("scheduler.priority.starvation_limit")->setValue(0);
+
+    test_lanes();
+    test_edf();
+    test_edf_many();
+    test_edf_bound();
+    test_starvation();
+    test_yield_keeps_priority();
+    return 0;
+}
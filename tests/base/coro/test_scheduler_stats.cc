@@ -0,0 +1,89 @@
+#include "base/coro/iomanager.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+#include <signal.h>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static std::atomic<uint64_t> s_done{0};
+static volatile sig_atomic_t s_user_signals = 0;
+
+/**
+ * 应用自己安装的 SIGURG 处理函数, 调度器安装回溯处理函数后仍要被调用
+ */
+static void on_user_signal(int)
+{
+    ++s_user_signals;
+}
+
+/**
+ * 不让出CPU的忙等, 用来触发长时间运行检测
+ */
+static void busy_loop(uint64_t ms)
+{
+    uint64_t end = base::GetCurrentMS() + ms;
+    while (base::GetCurrentMS() < end) {
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+    base::Config::Lookup<bool>("scheduler.stats.enable")->setValue(true);
+    base::Config::Lookup<uint32_t>("scheduler.stats.long_running_ms")->setValue(100);
+    base::Config::Lookup<bool>("scheduler.stats.long_running_stack")->setValue(true);
+    signal(SIGURG, &on_user_signal);
+
+    uint64_t tasks = argc > 1 ? atoi(argv[1]) : 100000;
+    std::vector<base::SchedulerThreadStats::Snapshot> stats;
+    {
+        base::IOManager iom(2, false, "stats");
+        for (uint64_t i = 0; i < tasks; ++i) {
+            iom.schedule([]() { ++s_done; });
+        }
+        // 会让出的协程, 每次切回都是一个新的运行片段
+        iom.schedule([]() {
+            for (int i = 0; i < 10; ++i) {
+                usleep(1000);
+            }
+            ++s_done;
+        });
+        // 运行超过阈值, 看门狗会输出这个协程的调用栈
+        iom.schedule([]() {
+            busy_loop(300);
+            ++s_done;
+        });
+        while (s_done < tasks + 2) {
+            usleep(1000);
+        }
+        iom.getThreadStats(stats);
+        std::stringstream ss;
+        iom.dumpStats(ss);
+        _LOG_INFO(g_logger) << ss.str();
+    }
+
+    // 不是看门狗请求的信号交给之前的处理函数
+    raise(SIGURG);
+    _ASSERT(s_user_signals == 1);
+
+    uint64_t total_tasks = 0;
+    uint64_t long_running = 0;
+    base::LatencyHistogram::Snapshot slice;
+    for (auto &i : stats) {
+        total_tasks += i.tasks;
+        long_running += i.longRunning;
+        slice.merge(i.runSlice);
+    }
+    _ASSERT(stats.size() == 2);
+    _ASSERT(total_tasks >= tasks + 2);
+    _ASSERT(long_running >= 1);
+    // 300ms 的忙等落在 (262ms, 524ms] 的桶里
+    _ASSERT(slice.percentile(1.0) >= 300 * 1000);
+    _LOG_INFO(g_logger) << "tasks=" << total_tasks << " long_running=" << long_running
+                        << " max_slice<=" << slice.percentile(1.0) << "us";
+    return 0;
+}
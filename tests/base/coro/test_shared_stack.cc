@@ -0,0 +1,71 @@
+#include "base/coro/iomanager.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/util.h"
+#include <atomic>
+#include <fstream>
+#include <string.h>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static std::atomic<uint32_t> s_waiting{0};
+static std::atomic<uint32_t> s_done{0};
+
+/**
+ * @brief 进程常驻内存(字节)
+ */
+static uint64_t GetRss()
+{
+    std::ifstream ifs("/proc/self/statm");
+    uint64_t size = 0, rss = 0;
+    ifs >> size >> rss;
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * 模拟一个空闲连接: 解析时用掉一些栈, 然后挂起等待数据
+ */
+static void idle_conn(base::FiberSemaphore *sem)
+{
+    char frame[2048];
+    memset(frame, 1, sizeof(frame));
+    ++s_waiting;
+    sem->wait();
+    s_done += frame[0];
+}
+
+int main(int argc, char **argv)
+{
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    bool shared = argc > 1 && strcmp(argv[1], "shared") == 0;
+    uint32_t count = argc > 2 ? atoi(argv[2]) : 20000;
+    base::Config::Lookup<bool>("fiber.shared_stack.enable")->setValue(shared);
+
+    base::FiberSemaphore sem;
+    uint64_t rss_before = 0;
+    uint64_t rss_idle = 0;
+    {
+        base::IOManager iom(1, false, "conn", false);
+        // 先让调度线程跑起来, 排除线程栈/共享栈本身的内存
+        iom.schedule([]() {});
+        usleep(100 * 1000);
+        rss_before = GetRss();
+        for (uint32_t i = 0; i < count; ++i) {
+            iom.schedule(std::bind(&idle_conn, &sem));
+        }
+        while (s_waiting < count) {
+            usleep(10 * 1000);
+        }
+        rss_idle = GetRss();
+        iom.schedule([&sem]() { sem.notifyAll(); });
+        while (s_done < count) {
+            usleep(10 * 1000);
+        }
+    }
+
+    std::cout << "mode=" << (shared ? "shared_stack" : "fcontext") << " fibers=" << count
+              << " rss_delta=" << (rss_idle - rss_before)
+              << " bytes_per_idle_fiber=" << (rss_idle - rss_before) / count << std::endl;
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "base/coro/iomanager.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static std::atomic<uint64_t> s_fired{0};
+static std::atomic<uint64_t> s_max_late{0};
+static std::atomic<uint32_t> s_finished{0};
+
+static void on_timeout(uint64_t deadline)
+{
+    uint64_t late = base::GetCurrentMS() - deadline;
+    uint64_t cur = s_max_late;
+    while (late > cur && !s_max_late.compare_exchange_weak(cur, late)) {
+    }
+    ++s_fired;
+}
+
+/**
+ * 模拟 hook 的 IO 超时: 每次读写都添加一个条件定时器, IO 完成后立即取消
+ */
+static void add_cancel(base::IOManager *iom, uint32_t count)
+{
+    std::shared_ptr<int> cond(new int(0));
+    for (uint32_t i = 0; i < count; ++i) {
+        auto timer = iom->addConditionTimer(5000, []() {}, cond);
+        timer->cancel();
+    }
+    ++s_finished;
+}
+
+/**
+ * 同时挂 count 个超时定时器(1~2秒), 取消其中一半, 剩下的等待触发
+ */
+static void add_timeouts(base::IOManager *iom, uint32_t count, std::vector<base::Timer::ptr> *timers)
+{
+    timers->reserve(count);
+    uint64_t now = base::GetCurrentMS();
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t ms = 1000 + i % 1000;
+        timers->push_back(iom->addTimer(ms, std::bind(&on_timeout, now + ms)));
+    }
+    for (uint32_t i = 0; i < count; i += 2) {
+        (*timers)[i]->cancel();
+    }
+    ++s_finished;
+}
+
+/**
+ * 每次加一个 5ms 的定时器后睡 10ms(hook 的 usleep 也是定时器), 让调度线程反复进入等待
+ */
+static void add_near(base::IOManager *iom, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t now = base::GetCurrentMS();
+        iom->addTimer(5, std::bind(&on_timeout, now + 5));
+        usleep(10 * 1000);
+    }
+    ++s_finished;
+}
+
+static void wait_finished(uint32_t n)
+{
+    while (s_finished < n) {
+        usleep(100);
+    }
+    s_finished = 0;
+}
+
+int main(int argc, char **argv)
+{
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    uint32_t total = argc > 2 ? atoi(argv[2]) : 1000000;
+    uint32_t per_fiber = total / threads;
+
+    base::IOManager iom(threads, false, "timer", false);
+
+    uint64_t start = base::GetCurrentUS();
+    for (size_t i = 0; i < threads; ++i) {
+        iom.schedule(std::bind(&add_cancel, &iom, per_fiber));
+    }
+    wait_finished(threads);
+    uint64_t used = base::GetCurrentUS() - start;
+    _LOG_INFO(g_logger) << "add+cancel threads=" << threads << " count=" << per_fiber * threads
+                        << " used=" << used << "us "
+                        << (uint64_t)(per_fiber * threads * 1000000.0 / (used ? used : 1))
+                        << " op/s";
+    _ASSERT(!iom.hasTimer());
+
+    std::vector<std::vector<base::Timer::ptr> > timers(threads);
+    start = base::GetCurrentUS();
+    for (size_t i = 0; i < threads; ++i) {
+        iom.schedule(std::bind(&add_timeouts, &iom, per_fiber, &timers[i]));
+    }
+    wait_finished(threads);
+    used = base::GetCurrentUS() - start;
+    _LOG_INFO(g_logger) << "concurrent timeouts=" << per_fiber * threads
+                        << " add+cancel_half used=" << used << "us";
+
+    uint64_t expect = 0;
+    for (auto &i : timers) {
+        expect += i.size() / 2;
+    }
+    while (s_fired < expect) {
+        usleep(10 * 1000);
+    }
+    _LOG_INFO(g_logger) << "fired=" << s_fired << " expect=" << expect
+                        << " max_late=" << s_max_late << "ms";
+    _ASSERT(s_fired == expect);
+    _ASSERT(!iom.hasTimer());
+
+    // 调度线程等待远处的定时器时, 各线程加入各自分片的近处定时器都要及时唤醒它
+    s_fired = 0;
+    s_max_late = 0;
+    base::IOManager wake_iom(threads, false, "timer_wakeup");
+    auto far = wake_iom.addTimer(60 * 1000, []() {});
+    for (size_t i = 0; i < threads; ++i) {
+        wake_iom.schedule(std::bind(&add_near, &wake_iom, 100));
+    }
+    wait_finished(threads);
+    while (s_fired < threads * 100) {
+        usleep(1000);
+    }
+    far->cancel();
+    _LOG_INFO(g_logger) << "near timers fired=" << s_fired << " max_late=" << s_max_late << "ms";
+    _ASSERT(s_max_late < 1000);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "base/coro/iomanager.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static std::atomic<uint64_t> s_done{0};
+/// 最近一次测试的唤醒统计
+static uint64_t s_tickle_sent = 0;
+static uint64_t s_tickle_suppressed = 0;
+
+/**
+ * 每个种子任务在调度线程内部再派发 fanout 个小任务,
+ * 任务从工作线程内部产生, 可以覆盖本地队列 + 窃取的路径
+ */
+static void seed(base::Scheduler *sc, uint32_t fanout)
+{
+    for (uint32_t i = 0; i < fanout; ++i) {
+        sc->schedule([]() { ++s_done; });
+    }
+}
+
+static double bench(size_t threads, bool work_stealing, uint32_t seeds, uint32_t fanout)
+{
+    base::Config::Lookup<bool>("scheduler.work_stealing")->setValue(work_stealing);
+    s_done = 0;
+    uint64_t total = (uint64_t)seeds * fanout;
+    uint64_t used = 0;
+    {
+        base::IOManager iom(threads, false, "bench", false);
+        uint64_t start = base::GetCurrentUS();
+        for (uint32_t i = 0; i < seeds; ++i) {
+            iom.schedule(std::bind(&seed, &iom, fanout));
+        }
+        // 只统计任务执行耗时, 不包含调度器停止的时间
+        while (s_done < total) {
+            usleep(100);
+        }
+        used = base::GetCurrentUS() - start;
+        s_tickle_sent = iom.getTickleSent();
+        s_tickle_suppressed = iom.getTickleSuppressed();
+    }
+    _ASSERT(s_done == total);
+    return total * 1000000.0 / (used ? used : 1);
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::WARN);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    size_t max_threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+    uint32_t seeds = argc > 2 ? atoi(argv[2]) : 64;
+    uint32_t fanout = argc > 3 ? atoi(argv[3]) : 20000;
+    max_threads = max_threads ? max_threads : 1;
+
+    for (size_t n = 1; n <= max_threads; n *= 2) {
+        double global = bench(n, false, seeds, fanout);
+        std::cout << "threads=" << n << " global_queue=" << (uint64_t)global << " task/s"
+                  << " tickle_sent=" << s_tickle_sent
+                  << " tickle_suppressed=" << s_tickle_suppressed << std::endl;
+        double stealing = bench(n, true, seeds, fanout);
+        std::cout << "threads=" << n << " work_stealing=" << (uint64_t)stealing << " task/s"
+                  << " tickle_sent=" << s_tickle_sent
+                  << " tickle_suppressed=" << s_tickle_suppressed << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include "base/coro/iomanager.h"
+#include "base/coro/worker.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+/**
+ * 并发数不超过上限, waitAll 之后任务组可以继续使用
+ */
+static void test_limit()
+{
+    auto wg = base::WorkerGroup::Create(3);
+    std::atomic<int> running{0};
+    std::atomic<int> max_running{0};
+    std::atomic<int> done{0};
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 20; ++i) {
+            wg->schedule([&]() {
+                int cur = ++running;
+                int old = max_running;
+                while (cur > old && !max_running.compare_exchange_weak(old, cur)) {
+                }
+                usleep(2000);
+                --running;
+                ++done;
+            });
+        }
+        wg->waitAll();
+        _ASSERT(done == 20 * (round + 1));
+    }
+    _ASSERT(max_running <= 3);
+
+    wg->schedule([]() { usleep(50 * 1000); });
+    wg->schedule([]() { usleep(50 * 1000); });
+    wg->schedule([]() { usleep(50 * 1000); });
+    _ASSERT(!wg->trySchedule([]() {}));
+    wg->waitAll();
+
+    auto stats = wg->getStats();
+    _ASSERT(stats.submitted == 43);
+    _ASSERT(stats.completed == 43);
+    _ASSERT(stats.throttled > 0);
+    _ASSERT(stats.running == 0);
+    std::stringstream ss;
+    wg->dump(ss);
+    _LOG_INFO(g_logger) << "test_limit ok " << ss.str();
+}
+
+static void test_parallel()
+{
+    auto wg = base::WorkerGroup::Create(4);
+    std::vector<int> v(1000, 0);
+    _ASSERT(wg->parallelFor(0, v.size(), [&v](size_t i) { v[i] = i * 2; }, 64));
+    for (size_t i = 0; i < v.size(); ++i) {
+        _ASSERT(v[i] == (int)i * 2);
+    }
+
+    std::vector<std::string> in = {"a", "bb", "ccc", "dddd", "eeeee"};
+    bool ok = false;
+    auto out = wg->parallelMap(in, [](const std::string &s) { return s.size(); }, 1, &ok);
+    _ASSERT(ok);
+    _ASSERT(out.size() == in.size());
+    for (size_t i = 0; i < in.size(); ++i) {
+        _ASSERT(out[i] == in[i].size());
+    }
+    _LOG_INFO(g_logger) << "test_parallel ok";
+}
+
+static void test_cancel()
+{
+    auto wg = base::WorkerGroup::Create(2);
+    std::atomic<int> observed{0};
+    std::atomic<int> started{0};
+    std::atomic<int> nested{0};
+    for (int i = 0; i < 2; ++i) {
+        wg->schedule([&]() {
+            ++started;
+            // 任务中创建的任务组继承取消状态
+            auto inner = base::WorkerGroup::Create(1);
+            while (!base::WorkerGroup::IsCancelled()) {
+                usleep(1000);
+            }
+            if (inner->isCancelled()) {
+                ++nested;
+            }
+            ++observed;
+        });
+    }
+    while (started < 2) {
+        usleep(1000);
+    }
+    wg->cancel();
+    wg->schedule([]() { _ASSERT(false); });
+    wg->waitAll();
+    _ASSERT(observed == 2);
+    _ASSERT(nested == 2);
+    _ASSERT(!base::WorkerGroup::IsCancelled());
+
+    std::atomic<size_t> count{0};
+    auto pf = base::WorkerGroup::Create(2);
+    bool done = pf->parallelFor(0, 100000, [&](size_t i) {
+        if (++count == 100) {
+            pf->cancel();
+        }
+    }, 10);
+    _ASSERT(!done);
+    _ASSERT(count < 100000);
+    _LOG_INFO(g_logger) << "test_cancel ok count=" << count
+                        << " cancelled=" << pf->getStats().cancelled;
+}
+
+/**
+ * 执行耗时超过目标时上限减半, 恢复后逐步增加
+ */
+static void test_adaptive()
+{
+    auto wg = base::WorkerGroup::Create(16);
+    wg->setAdaptive(5, 2);
+    for (int i = 0; i < 64; ++i) {
+        wg->schedule([]() { usleep(20 * 1000); });
+    }
+    wg->waitAll();
+    auto stats = wg->getStats();
+    _ASSERT(stats.limitDecreases > 0);
+    _ASSERT(stats.limit < 16);
+    _ASSERT(stats.limit >= 2);
+
+    uint32_t low = stats.limit;
+    for (int i = 0; i < 400; ++i) {
+        wg->schedule([]() {});
+    }
+    wg->waitAll();
+    stats = wg->getStats();
+    _ASSERT(stats.limit > low);
+    _LOG_INFO(g_logger) << "test_adaptive ok limit " << low << " -> " << stats.limit
+                        << " decreases=" << stats.limitDecreases;
+}
+
+/**
+ * 任务持有任务组的最后一个引用, 任务结束时任务组在任务的协程中析构
+ */
+static void test_last_ref()
+{
+    struct Holder {
+        base::WorkerGroup::ptr wg;
+        std::atomic<bool> *destroyed;
+        ~Holder()
+        {
+            // 析构任务组返回之后才置位
+            wg.reset();
+            *destroyed = true;
+        }
+    };
+    std::atomic<bool> ran{false};
+    std::atomic<bool> destroyed{false};
+    auto holder = std::make_shared<Holder>();
+    holder->wg = base::WorkerGroup::Create(1);
+    holder->destroyed = &destroyed;
+    base::WorkerGroup *wg = holder->wg.get();
+    wg->schedule([holder, &ran]() {
+        usleep(10 * 1000);
+        ran = true;
+    });
+    holder.reset();
+    for (int i = 0; i < 1000 && !destroyed; ++i) {
+        usleep(1000);
+    }
+    _ASSERT(ran);
+    _ASSERT(destroyed);
+    _LOG_INFO(g_logger) << "test_last_ref ok";
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    std::atomic<bool> finished{false};
+    {
+        base::IOManager iom(2, false, "worker_group");
+        iom.schedule([&finished]() {
+            test_limit();
+            test_parallel();
+            test_cancel();
+            test_adaptive();
+            test_last_ref();
+            finished = true;
+        });
+        while (!finished) {
+            usleep(1000);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "base/net/rock/rock_stream.h"
+#include "base/net/tcp_server.h"
+#include "base/conf/config.h"
+#include "base/coro/iomanager.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+/**
+ * 原样返回请求体的 Rock 服务
+ */
+class EchoServer : public base::TcpServer
+{
+public:
+    EchoServer(base::IOManager *worker) : TcpServer(worker, worker, worker) {}
+
+protected:
+    void handleClient(base::Socket::ptr client) override
+    {
+        auto session = std::make_shared<base::RockSession>(client);
+        session->setWorker(m_worker);
+        session->setRequestHandler(
+            [](base::RockRequest::ptr req, base::RockResponse::ptr rsp, base::RockStream::ptr) {
+                rsp->setResult(0);
+                rsp->setBody(req->getBody());
+                return true;
+            });
+        session->start();
+    }
+};
+
+/**
+ * @return 每秒完成的请求数
+ */
+static double bench(bool batch, int port, int threads, int concurrency, int seconds)
+{
+    base::Config::Lookup<bool>("async_socket_stream.write_batch")->setValue(batch);
+    std::atomic<uint64_t> done{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<bool> stop{false};
+    std::atomic<int> running{concurrency};
+
+    base::IOManager server_iom(threads, false, "rock_server");
+    base::IOManager client_iom(threads, false, "rock_client");
+    auto server = std::make_shared<EchoServer>(&server_iom);
+    auto addr = base::Address::LookupAny("127.0.0.1:" + std::to_string(port));
+    std::vector<base::Address::ptr> addrs{addr};
+    std::vector<base::Address::ptr> fails;
+    _ASSERT(server->bind(addrs, fails));
+    server->start();
+
+    base::RockConnection::ptr conn = std::make_shared<base::RockConnection>();
+    std::atomic<bool> connected{false};
+    client_iom.schedule([conn, addr, &connected]() {
+        conn->setAutoConnect(false);
+        _ASSERT(conn->connect(addr));
+        _ASSERT(conn->start());
+        connected = true;
+    });
+    while (!connected) {
+        usleep(1000);
+    }
+
+    // 所有请求走同一个连接, 写协程每次唤醒时队列里积压多条消息
+    std::string body(64, 'x');
+    for (int i = 0; i < concurrency; ++i) {
+        client_iom.schedule([&, conn]() {
+            while (!stop) {
+                base::RockRequest::ptr req = std::make_shared<base::RockRequest>();
+                req->setCmd(100);
+                req->setBody(body);
+                auto rt = conn->request(req, 2000);
+                if (rt->response && rt->response->getBody() == body) {
+                    ++done;
+                } else {
+                    ++failed;
+                }
+            }
+            --running;
+        });
+    }
+
+    uint64_t start = base::GetCurrentMS();
+    sleep(seconds);
+    stop = true;
+    while (running) {
+        usleep(1000);
+    }
+    uint64_t elapsed = base::GetCurrentMS() - start;
+    std::atomic<bool> closed{false};
+    client_iom.schedule([conn, &closed]() {
+        conn->close();
+        closed = true;
+    });
+    while (!closed) {
+        usleep(1000);
+    }
+    server->stop();
+
+    double rate = done * 1000.0 / elapsed;
+    _LOG_INFO(g_logger) << "write_batch=" << batch << " threads=" << threads
+                        << " concurrency=" << concurrency << " done=" << done
+                        << " failed=" << failed << " req/s=" << rate;
+    _ASSERT(failed == 0);
+    return rate;
+}
+
+/**
+ * 用法: test_rock_bench [seconds] [threads] [concurrency]
+ */
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    int seconds = argc > 1 ? atoi(argv[1]) : 2;
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+    int concurrency = argc > 3 ? atoi(argv[3]) : 256;
+
+    double single = bench(false, 18092, threads, concurrency, seconds);
+    double batched = bench(true, 18093, threads, concurrency, seconds);
+    _LOG_INFO(g_logger) << "per message write req/s=" << single << " writev batch req/s=" << batched;
+    return 0;
+}
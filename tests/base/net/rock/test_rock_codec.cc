@@ -0,0 +1,205 @@
+#include "base/net/rock/rock_protocol.h"
+#include "base/net/rock/rock_codec.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <fstream>
+#include <zdict.h>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+class MemoryStream : public base::Stream
+{
+public:
+    MemoryStream(const std::string &data) : m_data(data) {}
+
+    int read(void *buffer, size_t length) override
+    {
+        size_t len = std::min(length, m_data.size() - m_pos);
+        memcpy(buffer, m_data.data() + m_pos, len);
+        m_pos += len;
+        return len;
+    }
+    int read(base::ByteArray::ptr ba, size_t length) override { return -1; }
+    int write(const void *buffer, size_t length) override { return -1; }
+    int write(base::ByteArray::ptr ba, size_t length) override { return -1; }
+    void close() override {}
+
+private:
+    std::string m_data;
+    size_t m_pos = 0;
+};
+
+/**
+ * 模拟智能体之间的 JSON 消息, 字段名和结构高度重复
+ */
+static std::string make_json(int i)
+{
+    std::stringstream ss;
+    ss << "{\"agent_id\":\"agent-" << (i % 17) << "\",\"task_id\":" << i
+       << ",\"type\":\"tool_call\",\"status\":\"" << (i % 3 ? "running" : "done")
+       << "\",\"args\":{\"query\":\"" << base::random_string(8) << "\",\"limit\":" << (i % 50)
+       << ",\"tags\":[\"search\",\"web\",\"summary\"]},\"metrics\":[";
+    for (int j = 0; j < 20 + i % 30; ++j) {
+        ss << "{\"name\":\"latency_ms\",\"value\":" << (i * j % 997) << "},";
+    }
+    ss << "{}]}";
+    return ss.str();
+}
+
+static std::string encode(base::RockMessageDecoder &encoder, base::Message::ptr msg,
+                          uint8_t *flag = nullptr)
+{
+    base::RockMsgHeader header;
+    auto ba = encoder.encode(msg, header);
+    _ASSERT(ba);
+    if (flag) {
+        *flag = header.flag;
+    }
+    std::string rt((const char *)&header, sizeof(header));
+    rt.append(ba->toString());
+    return rt;
+}
+
+static void test_roundtrip(uint8_t codec)
+{
+    base::RockMessageDecoder encoder;
+    encoder.setCodec(codec);
+    for (int i = 0; i < 100; ++i) {
+        auto req = std::make_shared<base::RockRequest>();
+        req->setSn(i + 1);
+        req->setCmd(100);
+        std::string body;
+        for (int j = 0; j <= i % 10; ++j) {
+            body.append(make_json(i * 10 + j));
+        }
+        req->setBody(body);
+
+        uint8_t flag = 0;
+        auto stream = std::make_shared<MemoryStream>(encode(encoder, req, &flag));
+        _ASSERT((flag & base::RockCodec::kFlagMask) == codec);
+        base::RockMessageDecoder decoder;
+        auto msg = std::dynamic_pointer_cast<base::RockRequest>(decoder.parseFrom(stream));
+        _ASSERT(msg);
+        _ASSERT(msg->getSn() == (uint32_t)i + 1);
+        _ASSERT(msg->getBodyView() == body);
+    }
+
+    // 压缩后没有变小的数据原样发送
+    auto nty = std::make_shared<base::RockNotify>();
+    nty->setNotify(1);
+    std::string body;
+    for (int i = 0; i < 4096; ++i) {
+        body.push_back((char)rand());
+    }
+    nty->setBody(body);
+    uint8_t flag = 0;
+    auto stream = std::make_shared<MemoryStream>(encode(encoder, nty, &flag));
+    if (codec != base::RockCodec::GZIP) {
+        _ASSERT((flag & base::RockCodec::kFlagMask) == 0);
+    }
+    base::RockMessageDecoder decoder;
+    auto msg = std::dynamic_pointer_cast<base::RockNotify>(decoder.parseFrom(stream));
+    _ASSERT(msg && msg->getBody() == body);
+    _LOG_INFO(g_logger) << "test_roundtrip " << base::RockCodec::Get(codec)->getName() << " ok";
+}
+
+/**
+ * 用样本训练 zstd 字典并通过配置加载
+ */
+static bool load_dict()
+{
+    std::string samples;
+    std::vector<size_t> sizes;
+    for (int i = 0; i < 2000; ++i) {
+        std::string s = make_json(i);
+        samples.append(s);
+        sizes.push_back(s.size());
+    }
+    std::string dict(16 * 1024, '\0');
+    size_t rt = ZDICT_trainFromBuffer(&dict[0], dict.size(), samples.data(), sizes.data(),
+                                      sizes.size());
+    if (ZDICT_isError(rt)) {
+        _LOG_ERROR(g_logger) << "ZDICT_trainFromBuffer error: " << ZDICT_getErrorName(rt);
+        return false;
+    }
+    dict.resize(rt);
+    std::string path = "/tmp/test_rock_codec.dict";
+    std::ofstream ofs(path, std::ios::binary);
+    ofs.write(dict.data(), dict.size());
+    ofs.close();
+    base::Config::Lookup<std::string>("rock.codec.zstd_dict")->setValue(path);
+    return base::RockCodec::Get(base::RockCodec::ZSTD_DICT) != nullptr;
+}
+
+/**
+ * 每种算法编码/解码同一批消息, 对比耗时和压缩率
+ */
+static void bench(uint8_t codec, int rounds, size_t msg_count)
+{
+    std::vector<base::Message::ptr> msgs;
+    size_t raw = 0;
+    for (size_t i = 0; i < msg_count; ++i) {
+        auto req = std::make_shared<base::RockRequest>();
+        req->setSn(i + 1);
+        req->setCmd(100);
+        req->setBody(make_json(i));
+        raw += req->getBodySize();
+        msgs.push_back(req);
+    }
+
+    base::RockMessageDecoder encoder;
+    encoder.setCodec(codec);
+    std::string wire;
+    uint64_t encode_us = 0;
+    uint64_t decode_us = 0;
+    for (int r = 0; r < rounds; ++r) {
+        wire.clear();
+        uint64_t ts = base::GetCurrentUS();
+        for (auto &i : msgs) {
+            wire.append(encode(encoder, i));
+        }
+        encode_us += base::GetCurrentUS() - ts;
+
+        auto stream = std::make_shared<MemoryStream>(wire);
+        base::RockMessageDecoder decoder;
+        ts = base::GetCurrentUS();
+        for (size_t i = 0; i < msgs.size(); ++i) {
+            _ASSERT(decoder.parseFrom(stream));
+        }
+        decode_us += base::GetCurrentUS() - ts;
+    }
+    auto c = base::RockCodec::Get(codec);
+    double mb = raw * rounds / 1024.0 / 1024.0;
+    _LOG_INFO(g_logger) << "codec=" << (c ? c->getName() : "none") << " raw=" << raw
+                        << " wire=" << wire.size() << " ratio=" << (double)wire.size() / raw
+                        << " encode_MB/s=" << mb / (encode_us / 1000000.0)
+                        << " decode_MB/s=" << mb / (decode_us / 1000000.0);
+}
+
+/**
+ * 用法: test_rock_codec [rounds] [msg_count]
+ */
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    base::Config::Lookup<uint32_t>("rock.protocol.compress_min_length")->setValue(256);
+
+    test_roundtrip(base::RockCodec::GZIP);
+    test_roundtrip(base::RockCodec::LZ4);
+    test_roundtrip(base::RockCodec::ZSTD);
+    bool dict = load_dict();
+    _ASSERT(dict);
+    _ASSERT(base::RockCodec::GetZstdDictId() != 0);
+    test_roundtrip(base::RockCodec::ZSTD_DICT);
+
+    int rounds = argc > 1 ? atoi(argv[1]) : 5;
+    size_t msg_count = argc > 2 ? atoi(argv[2]) : 2000;
+    bench(base::RockCodec::NONE, rounds, msg_count);
+    bench(base::RockCodec::GZIP, rounds, msg_count);
+    bench(base::RockCodec::LZ4, rounds, msg_count);
+    bench(base::RockCodec::ZSTD, rounds, msg_count);
+    bench(base::RockCodec::ZSTD_DICT, rounds, msg_count);
+    return 0;
+}
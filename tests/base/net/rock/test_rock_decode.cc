@@ -0,0 +1,142 @@
+#include "base/net/rock/rock_protocol.h"
+#include "base/conf/config.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <malloc.h>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+/**
+ * 内存中的流, 每次 read 最多返回 chunk 字节, 模拟消息跨多次 recv
+ */
+class MemoryStream : public base::Stream
+{
+public:
+    MemoryStream(const std::string &data, size_t chunk) : m_data(data), m_chunk(chunk) {}
+
+    int read(void *buffer, size_t length) override
+    {
+        size_t len = std::min(std::min(length, m_chunk), m_data.size() - m_pos);
+        memcpy(buffer, m_data.data() + m_pos, len);
+        m_pos += len;
+        return len;
+    }
+    int read(base::ByteArray::ptr ba, size_t length) override { return -1; }
+    int write(const void *buffer, size_t length) override { return -1; }
+    int write(base::ByteArray::ptr ba, size_t length) override { return -1; }
+    void close() override {}
+
+private:
+    std::string m_data;
+    size_t m_chunk;
+    size_t m_pos = 0;
+};
+
+static std::string encode_all(const std::vector<base::Message::ptr> &msgs)
+{
+    base::RockMessageDecoder encoder;
+    std::string rt;
+    for (auto &i : msgs) {
+        base::RockMsgHeader header;
+        auto ba = encoder.encode(i, header);
+        _ASSERT(ba);
+        rt.append((const char *)&header, sizeof(header));
+        rt.append(ba->toString());
+    }
+    return rt;
+}
+
+static void test_decode(size_t chunk)
+{
+    std::vector<base::Message::ptr> msgs;
+    std::vector<std::string> bodies;
+    for (int i = 0; i < 200; ++i) {
+        auto req = std::make_shared<base::RockRequest>();
+        req->setSn(i + 1);
+        req->setCmd(100);
+        // 有的消息比接收块还大, 需要单独的块
+        std::string body = base::random_string(i % 50 == 49 ? 100 * 1024 : 10 + i * 13);
+        req->setBody(body);
+        bodies.push_back(body);
+        msgs.push_back(req);
+    }
+    auto stream = std::make_shared<MemoryStream>(encode_all(msgs), chunk);
+
+    base::RockMessageDecoder decoder;
+    std::vector<base::Message::ptr> parsed;
+    for (size_t i = 0; i < msgs.size(); ++i) {
+        auto msg = decoder.parseFrom(stream);
+        _ASSERT(msg);
+        auto req = std::dynamic_pointer_cast<base::RockRequest>(msg);
+        _ASSERT(req);
+        _ASSERT(req->getSn() == i + 1);
+        // 消息体引用接收缓存, 不是 std::string 的副本
+        std::string_view view = req->getBodyView();
+        _ASSERT(view == bodies[i]);
+        parsed.push_back(req);
+    }
+    _ASSERT(!decoder.parseFrom(stream));
+
+    // 接收缓存换块后, 之前的消息体仍然有效
+    for (size_t i = 0; i < parsed.size(); ++i) {
+        auto req = std::dynamic_pointer_cast<base::RockRequest>(parsed[i]);
+        std::string_view view = req->getBodyView();
+        _ASSERT(view == bodies[i]);
+        // getBody 只复制, 不释放接收缓存, 之前的视图仍然有效
+        _ASSERT(req->getBody() == bodies[i]);
+        _ASSERT(req->getBodyView().data() == view.data() && view == bodies[i]);
+    }
+    _LOG_INFO(g_logger) << "test_decode chunk=" << chunk << " ok "
+                        << base::RecvBuffer::GetStats().toString();
+}
+
+static void test_gzip()
+{
+    base::Config::Lookup<uint32_t>("rock.protocol.gzip_min_length")->setValue(1024);
+    auto nty = std::make_shared<base::RockNotify>();
+    nty->setNotify(7);
+    std::string body(64 * 1024, 'a');
+    nty->setBody(body);
+    auto stream = std::make_shared<MemoryStream>(encode_all({nty}), 4096);
+    base::RockMessageDecoder decoder;
+    auto msg = std::dynamic_pointer_cast<base::RockNotify>(decoder.parseFrom(stream));
+    _ASSERT(msg);
+    _ASSERT(msg->getNotify() == 7);
+    _ASSERT(msg->getBody() == body);
+    base::Config::Lookup<uint32_t>("rock.protocol.gzip_min_length")->setValue(1024 * 1024 * 64);
+    _LOG_INFO(g_logger) << "test_gzip ok";
+}
+
+/**
+ * 解压后的小消息体按级别申请, 不占住整个接收块, 释放后同级别复用
+ */
+static void test_alloc_classes()
+{
+    size_t block_size = base::Config::Lookup<uint32_t>("recv_buffer.block_size")->getValue();
+    auto small = base::RecvBuffer::Alloc(1000);
+    size_t usable = malloc_usable_size(small.get());
+    _ASSERT(usable >= 1000 && usable < 4096);
+    small.reset();
+    uint64_t reuse = base::RecvBuffer::GetStats().reuse;
+    small = base::RecvBuffer::Alloc(600);
+    _ASSERT(base::RecvBuffer::GetStats().reuse == reuse + 1);
+
+    // 超过块大小一半按整块, 超过块大小按实际大小
+    auto half = base::RecvBuffer::Alloc(block_size / 2 + 1);
+    _ASSERT(malloc_usable_size(half.get()) >= block_size);
+    auto big = base::RecvBuffer::Alloc(block_size * 3);
+    usable = malloc_usable_size(big.get());
+    _ASSERT(usable >= block_size * 3 && usable < block_size * 4);
+    _LOG_INFO(g_logger) << "test_alloc_classes ok";
+}
+
+int main(int argc, char **argv)
+{
+    test_decode(1);
+    test_decode(1000);
+    test_decode(1 << 20);
+    test_gzip();
+    test_alloc_classes();
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "base/net/rock/rock_stream.h"
+#include "base/net/tcp_server.h"
+#include "base/conf/config.h"
+#include "base/coro/iomanager.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+enum Cmd {
+    /// 立即返回
+    ECHO = 1,
+    /// 不返回, 请求只能超时
+    DROP = 2,
+    /// 200ms 后返回, 晚于请求超时
+    LATE = 3,
+};
+
+class PendingServer : public base::TcpServer
+{
+public:
+    PendingServer(base::IOManager *worker) : TcpServer(worker, worker, worker) {}
+
+protected:
+    void handleClient(base::Socket::ptr client) override
+    {
+        auto session = std::make_shared<base::RockSession>(client);
+        session->setWorker(m_worker);
+        session->setRequestHandler([](base::RockRequest::ptr req, base::RockResponse::ptr rsp,
+                                      base::RockStream::ptr stream) {
+            if (req->getCmd() == DROP) {
+                return true;
+            }
+            if (req->getCmd() == LATE) {
+                usleep(200 * 1000);
+            }
+            rsp->setResult(0);
+            rsp->setBody(req->getBody());
+            return true;
+        });
+        session->start();
+    }
+};
+
+/**
+ * @param[in] max_slots 槽数上限, 小于在途请求数时一部分请求走溢出表, 否则槽数组按需扩容
+ */
+static void test_pending(uint32_t max_slots, int port)
+{
+    base::Config::Lookup<uint32_t>("async_socket_stream.pending_slots")->setValue(max_slots);
+    base::IOManager server_iom(2, false, "pending_server");
+    base::IOManager client_iom(2, false, "pending_client");
+    auto server = std::make_shared<PendingServer>(&server_iom);
+    auto addr = base::Address::LookupAny("127.0.0.1:" + std::to_string(port));
+    std::vector<base::Address::ptr> addrs{addr};
+    std::vector<base::Address::ptr> fails;
+    _ASSERT(server->bind(addrs, fails));
+    server->start();
+
+    std::atomic<bool> done{false};
+    client_iom.schedule([&]() {
+        auto conn = std::make_shared<base::RockConnection>();
+        conn->setAutoConnect(false);
+        _ASSERT(conn->connect(addr));
+        _ASSERT(conn->start());
+
+        std::vector<base::Future<base::RockResult::ptr> > futures;
+        std::vector<int> cmds;
+        for (int i = 0; i < 3000; ++i) {
+            int cmd = i % 10 == 0 ? DROP : (i % 10 == 1 ? LATE : ECHO);
+            auto req = std::make_shared<base::RockRequest>();
+            req->setCmd(cmd);
+            req->setBody(std::to_string(i));
+            futures.push_back(conn->requestAsync(req, cmd == ECHO ? 5000 : 50));
+            cmds.push_back(cmd);
+        }
+        // 槽数组从小数组开始, 只在在途请求多时扩容, 且不超过上限
+        uint32_t slots = conn->getPendingSlots();
+        _ASSERT2(slots <= max_slots && (max_slots <= 64 ? slots == max_slots : slots > 64),
+                 "slots=" << slots << " max_slots=" << max_slots);
+        uint64_t ts = base::GetCurrentMS();
+        for (size_t i = 0; i < futures.size(); ++i) {
+            auto rt = futures[i].get();
+            if (cmds[i] == ECHO) {
+                _ASSERT(rt->result == 0);
+                _ASSERT(rt->response->getBody() == std::to_string(i));
+            } else {
+                _ASSERT(rt->result == base::AsyncSocketStream::TIMEOUT);
+            }
+        }
+        _LOG_INFO(g_logger) << "3000 requests done in " << base::GetCurrentMS() - ts
+                            << "ms slots=" << slots;
+
+        // 超时后才到的响应被丢弃, 不影响之后的请求
+        usleep(300 * 1000);
+        auto req = std::make_shared<base::RockRequest>();
+        req->setCmd(ECHO);
+        req->setBody("after");
+        auto rt = conn->request(req, 1000);
+        _ASSERT(rt->result == 0 && rt->response->getBody() == "after");
+
+        // 连接断开时等待中的请求以 IO_ERROR 结束
+        req = std::make_shared<base::RockRequest>();
+        req->setCmd(DROP);
+        auto f = conn->requestAsync(req, 10000);
+        conn->close();
+        _ASSERT(f.get()->result == base::AsyncSocketStream::IO_ERROR);
+        done = true;
+    });
+    while (!done) {
+        usleep(1000);
+    }
+    server->stop();
+    _LOG_INFO(g_logger) << "test_pending max_slots=" << max_slots << " ok";
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::ERROR);
+    test_pending(64, 18097);
+    test_pending(4096, 18098);
+    return 0;
+}
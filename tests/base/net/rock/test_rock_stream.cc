@@ -0,0 +1,216 @@
+#include "base/net/rock/rock_stream.h"
+#include "base/net/tcp_server.h"
+#include "base/conf/config.h"
+#include "base/coro/iomanager.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+enum Cmd {
+    /// 原样返回流上收到的数据
+    ECHO = 1,
+    /// 读到第一块后取消
+    CANCEL = 2,
+    /// 没有处理函数
+    UNKNOWN = 3,
+};
+
+class StreamServer : public base::TcpServer
+{
+public:
+    StreamServer(base::IOManager *worker) : TcpServer(worker, worker, worker) {}
+
+protected:
+    void handleClient(base::Socket::ptr client) override
+    {
+        auto session = std::make_shared<base::RockSession>(client);
+        session->setWorker(m_worker);
+        session->setRequestHandler(
+            [](base::RockRequest::ptr req, base::RockResponse::ptr rsp, base::RockStream::ptr) {
+                rsp->setResult(0);
+                rsp->setBody(req->getBody());
+                return true;
+            });
+        session->setStreamHandler([](base::RockChannel::ptr ch, base::RockStream::ptr) {
+            if (ch->getCmd() == ECHO) {
+                std::string chunk;
+                while (ch->read(chunk)) {
+                    if (ch->write(chunk) < 0) {
+                        return;
+                    }
+                }
+                ch->finish();
+            } else if (ch->getCmd() == CANCEL) {
+                std::string chunk;
+                ch->read(chunk);
+                ch->cancel();
+            } else {
+                ch->cancel(base::RockChannel::NO_HANDLER);
+            }
+        });
+        session->start();
+    }
+};
+
+/**
+ * 老版本(v1)服务端: 不认识握手, 收到的数据全部丢弃
+ */
+class V1Server : public base::TcpServer
+{
+public:
+    V1Server(base::IOManager *worker) : TcpServer(worker, worker, worker) {}
+
+protected:
+    void handleClient(base::Socket::ptr client) override
+    {
+        char buf[4096];
+        while (client->recv(buf, sizeof(buf)) > 0) {
+        }
+    }
+};
+
+static void run(int port, std::function<void(base::RockConnection::ptr)> cb, bool v1 = false)
+{
+    base::IOManager server_iom(2, false, "stream_server");
+    base::IOManager client_iom(2, false, "stream_client");
+    base::TcpServer::ptr server;
+    if (v1) {
+        server = std::make_shared<V1Server>(&server_iom);
+    } else {
+        server = std::make_shared<StreamServer>(&server_iom);
+    }
+    auto addr = base::Address::LookupAny("127.0.0.1:" + std::to_string(port));
+    std::vector<base::Address::ptr> addrs{addr};
+    std::vector<base::Address::ptr> fails;
+    _ASSERT(server->bind(addrs, fails));
+    server->start();
+
+    std::atomic<bool> done{false};
+    client_iom.schedule([&]() {
+        base::RockConnection::ptr conn = std::make_shared<base::RockConnection>();
+        conn->setAutoConnect(false);
+        _ASSERT(conn->connect(addr));
+        _ASSERT(conn->start());
+        cb(conn);
+        conn->close();
+        done = true;
+    });
+    while (!done) {
+        usleep(1000);
+    }
+    server->stop();
+}
+
+static void test_echo()
+{
+    // 窗口远小于传输的数据量, 写方必须等待对端归还窗口
+    base::Config::Lookup<uint32_t>("rock.stream.window")->setValue(16 * 1024);
+    base::Config::Lookup<uint32_t>("rock.stream.conn_window")->setValue(32 * 1024);
+    base::Config::Lookup<uint32_t>("rock.stream.max_frame")->setValue(4 * 1024);
+    run(18094, [](base::RockConnection::ptr conn) {
+        base::WaitGroup wg;
+        std::atomic<int> ok{0};
+        for (int i = 0; i < 8; ++i) {
+            wg.add();
+            base::IOManager::GetThis()->schedule([conn, i, &wg, &ok]() {
+                auto ch = conn->openStream(ECHO, "echo");
+                _ASSERT(ch);
+                std::string data = base::random_string(256 * 1024 + i * 1000);
+                // 写协程和读协程并行, 否则回显数据填满窗口后双方都会挂起
+                base::WaitGroup writer;
+                writer.add();
+                base::IOManager::GetThis()->schedule([ch, &data, &writer]() {
+                    for (size_t off = 0; off < data.size(); off += 10000) {
+                        size_t n = std::min<size_t>(10000, data.size() - off);
+                        _ASSERT(ch->write(data.data() + off, n) == (int32_t)n);
+                    }
+                    _ASSERT(ch->finish());
+                    writer.done();
+                });
+                std::string echo;
+                _ASSERT(ch->readAll(echo));
+                writer.wait();
+                _ASSERT(echo == data);
+                ++ok;
+                wg.done();
+            });
+        }
+        wg.wait();
+        _ASSERT(ok == 8);
+        _ASSERT(conn->isV2());
+
+        // 同一连接上的 v1 请求不受影响
+        auto req = std::make_shared<base::RockRequest>();
+        req->setCmd(100);
+        req->setBody("hello");
+        auto rt = conn->request(req, 1000);
+        _ASSERT(rt->result == 0 && rt->response->getBody() == "hello");
+    });
+    _LOG_INFO(g_logger) << "test_echo ok";
+}
+
+static void test_cancel()
+{
+    run(18095, [](base::RockConnection::ptr conn) {
+        auto ch = conn->openStream(CANCEL);
+        _ASSERT(ch);
+        _ASSERT(ch->write("abc") == 3);
+        std::string chunk;
+        _ASSERT(!ch->read(chunk));
+        _ASSERT(ch->getError() == base::RockChannel::CANCELLED);
+        _ASSERT(ch->write("abc") == -(int32_t)base::RockChannel::CANCELLED);
+
+        ch = conn->openStream(UNKNOWN);
+        _ASSERT(ch);
+        std::string data;
+        _ASSERT(!ch->readAll(data));
+        _ASSERT(ch->getError() == base::RockChannel::NO_HANDLER);
+    });
+    _LOG_INFO(g_logger) << "test_cancel ok";
+}
+
+static void test_v1_fallback()
+{
+    // 不发起协商时按 v1 处理, 只能使用请求/响应
+    base::Config::Lookup<bool>("rock.protocol.v2")->setValue(false);
+    run(18096, [](base::RockConnection::ptr conn) {
+        _ASSERT(!conn->openStream(ECHO));
+        _ASSERT(!conn->isV2());
+        auto req = std::make_shared<base::RockRequest>();
+        req->setCmd(100);
+        req->setBody("v1");
+        auto rt = conn->request(req, 1000);
+        _ASSERT(rt->result == 0 && rt->response->getBody() == "v1");
+    });
+    base::Config::Lookup<bool>("rock.protocol.v2")->setValue(true);
+
+    // 对端是 v1 服务端: 第一次 openStream 等到握手超时后按 v1 处理, 之后不再等待
+    base::Config::Lookup<uint32_t>("rock.protocol.hello_timeout_ms")->setValue(200);
+    run(
+        18097,
+        [](base::RockConnection::ptr conn) {
+            uint64_t start = base::GetCurrentMS();
+            _ASSERT(!conn->openStream(ECHO));
+            _ASSERT(base::GetCurrentMS() - start >= 150);
+            start = base::GetCurrentMS();
+            _ASSERT(!conn->openStream(ECHO));
+            _ASSERT(base::GetCurrentMS() - start < 50);
+            _ASSERT(!conn->isV2());
+        },
+        true);
+    base::Config::Lookup<uint32_t>("rock.protocol.hello_timeout_ms")->setValue(1000);
+    _LOG_INFO(g_logger) << "test_v1_fallback ok";
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::ERROR);
+    test_echo();
+    test_cancel();
+    test_v1_fallback();
+    return 0;
+}
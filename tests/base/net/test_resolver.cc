@@ -0,0 +1,368 @@
+#include "base/coro/fiber_sync.h"
+#include "base/coro/hook.h"
+#include "base/coro/iomanager.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/net/resolver.h"
+#include "base/net/socket.h"
+#include "base/util.h"
+#include <arpa/inet.h>
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+/**
+ * 本地 DNS 桩服务器
+ *   a.test     A 10.0.0.1 10.0.0.2 (TTL 1), AAAA fd00::1
+ *   alias.test CNAME a.test
+ *   nx.test    NXDOMAIN (SOA MINIMUM 60)
+ *   slow.test  100ms 后才响应
+ *   big.test   UDP 响应截断, 需要走 TCP
+ *   drop.test  不响应
+ */
+class StubDns
+{
+public:
+    void start(base::IOManager *iom)
+    {
+        m_udp = base::Socket::CreateUDPSocket();
+        m_tcp = base::Socket::CreateTCPSocket();
+        auto addr = base::IPv4Address::Create("127.0.0.1", 0);
+        _ASSERT(m_udp->bind(addr));
+        // TCP 和 UDP 使用相同端口
+        auto local = std::dynamic_pointer_cast<base::IPAddress>(m_udp->getLocalAddress());
+        _ASSERT(m_tcp->bind(local) && m_tcp->listen());
+        m_addr = local;
+        m_udp->setRecvTimeout(50);
+        m_tcp->setRecvTimeout(50);
+        m_wg.add(2);
+        iom->schedule(std::bind(&StubDns::udpLoop, this));
+        iom->schedule(std::bind(&StubDns::tcpLoop, this));
+    }
+
+    void stop()
+    {
+        m_stop = true;
+        m_wg.wait();
+    }
+
+    base::IPAddress::ptr getAddress() const { return m_addr; }
+    uint64_t getQueries() const { return m_queries; }
+
+private:
+    static void putName(std::string &rsp, const std::string &name)
+    {
+        size_t begin = 0;
+        while (begin < name.size()) {
+            size_t end = name.find('.', begin);
+            if (end == std::string::npos) {
+                end = name.size();
+            }
+            rsp.push_back((char)(end - begin));
+            rsp.append(name, begin, end - begin);
+            begin = end + 1;
+        }
+        rsp.push_back(0);
+    }
+
+    static void put16(std::string &rsp, uint16_t v)
+    {
+        rsp.push_back((char)(v >> 8));
+        rsp.push_back((char)v);
+    }
+
+    static void put32(std::string &rsp, uint32_t v)
+    {
+        put16(rsp, v >> 16);
+        put16(rsp, v);
+    }
+
+    static void putRecord(std::string &rsp, uint16_t type, uint32_t ttl, const std::string &rdata,
+                          const std::string *name = nullptr)
+    {
+        if (name) {
+            putName(rsp, *name);
+        } else {
+            // 指向问题中的名字
+            put16(rsp, 0xC00C);
+        }
+        put16(rsp, type);
+        put16(rsp, 1);
+        put32(rsp, ttl);
+        put16(rsp, rdata.size());
+        rsp += rdata;
+    }
+
+    static std::string ipv4(const char *ip)
+    {
+        in_addr addr;
+        inet_pton(AF_INET, ip, &addr);
+        return std::string((const char *)&addr, 4);
+    }
+
+    /**
+     * @return 是否响应, 响应内容写入 rsp
+     */
+    bool handle(const std::string &req, std::string &rsp, bool tcp, bool &slow)
+    {
+        ++m_queries;
+        const uint8_t *p = (const uint8_t *)req.data();
+        std::string name;
+        size_t off = 12;
+        while (off < req.size() && p[off]) {
+            if (!name.empty()) {
+                name.push_back('.');
+            }
+            name.append(req, off + 1, p[off]);
+            off += p[off] + 1;
+        }
+        uint16_t qtype = p[off + 1] << 8 | p[off + 2];
+        std::string question = req.substr(12, off + 5 - 12);
+        slow = name == "slow.test";
+        if (name == "drop.test") {
+            return false;
+        }
+
+        uint16_t flags = 0x8180;
+        std::string answers;
+        std::string authority;
+        uint16_t ancount = 0;
+        uint16_t nscount = 0;
+        if (name == "a.test" || name == "slow.test") {
+            if (qtype == 1) {
+                putRecord(answers, 1, 1, ipv4("10.0.0.1"));
+                putRecord(answers, 1, 1, ipv4("10.0.0.2"));
+                ancount = 2;
+            } else if (qtype == 28) {
+                in6_addr addr;
+                inet_pton(AF_INET6, "fd00::1", &addr);
+                putRecord(answers, 28, 60, std::string((const char *)&addr, 16));
+                ancount = 1;
+            }
+        } else if (name == "alias.test") {
+            std::string target = "a.test";
+            std::string rdata;
+            putName(rdata, target);
+            putRecord(answers, 5, 60, rdata);
+            ancount = 1;
+            if (qtype == 1) {
+                putRecord(answers, 1, 60, ipv4("10.0.0.1"), &target);
+                ancount = 2;
+            }
+        } else if (name == "big.test" && !tcp) {
+            flags |= 0x0200;
+        } else if (name == "big.test") {
+            if (qtype == 1) {
+                putRecord(answers, 1, 60, ipv4("10.0.0.9"));
+                ancount = 1;
+            }
+        } else {
+            flags |= 3;
+            std::string rdata;
+            putName(rdata, "ns.test");
+            putName(rdata, "admin.test");
+            put32(rdata, 1);
+            put32(rdata, 3600);
+            put32(rdata, 600);
+            put32(rdata, 86400);
+            put32(rdata, 60);
+            std::string zone = "test";
+            putRecord(authority, 6, 3600, rdata, &zone);
+            nscount = 1;
+        }
+        rsp.clear();
+        rsp.append(req, 0, 2);
+        put16(rsp, flags);
+        put16(rsp, 1);
+        put16(rsp, ancount);
+        put16(rsp, nscount);
+        put16(rsp, 0);
+        rsp += question;
+        rsp += answers;
+        rsp += authority;
+        return true;
+    }
+
+    void udpLoop()
+    {
+        std::string buf(512, '\0');
+        while (!m_stop) {
+            base::Address::ptr from = std::make_shared<base::IPv4Address>();
+            int n = m_udp->recvFrom(&buf[0], buf.size(), from);
+            if (n <= 0) {
+                continue;
+            }
+            std::string rsp;
+            bool slow = false;
+            if (!handle(buf.substr(0, n), rsp, false, slow)) {
+                continue;
+            }
+            if (slow) {
+                m_wg.add(1);
+                base::IOManager::GetThis()->schedule([this, rsp, from]() {
+                    usleep(100 * 1000);
+                    m_udp->sendTo(rsp.data(), rsp.size(), from);
+                    m_wg.done();
+                });
+            } else {
+                m_udp->sendTo(rsp.data(), rsp.size(), from);
+            }
+        }
+        m_wg.done();
+    }
+
+    void tcpLoop()
+    {
+        while (!m_stop) {
+            auto client = m_tcp->accept();
+            if (!client) {
+                continue;
+            }
+            uint8_t len[2];
+            if (client->recv(len, 2, MSG_WAITALL) != 2) {
+                continue;
+            }
+            std::string req(len[0] << 8 | len[1], '\0');
+            if (client->recv(&req[0], req.size(), MSG_WAITALL) != (int)req.size()) {
+                continue;
+            }
+            std::string rsp;
+            bool slow = false;
+            if (handle(req, rsp, true, slow)) {
+                std::string out;
+                put16(out, rsp.size());
+                out += rsp;
+                client->send(out.data(), out.size());
+            }
+        }
+        m_wg.done();
+    }
+
+private:
+    base::Socket::ptr m_udp;
+    base::Socket::ptr m_tcp;
+    base::IPAddress::ptr m_addr;
+    std::atomic<bool> m_stop{false};
+    std::atomic<uint64_t> m_queries{0};
+    base::WaitGroup m_wg;
+};
+
+static void test_resolver(StubDns &dns)
+{
+    base::Resolver r(false);
+    r.setNameservers({dns.getAddress()});
+    r.setTimeout(200, 1);
+
+    std::vector<base::IPAddress::ptr> addrs;
+    _ASSERT(r.resolve("a.test", AF_INET, addrs) == base::Resolver::OK);
+    _ASSERT(addrs.size() == 2 && addrs[0]->toString() == "10.0.0.1:0");
+    _ASSERT(r.getQueryCount() == 1);
+
+    // 命中缓存, 名字不区分大小写
+    addrs.clear();
+    _ASSERT(r.resolve("A.Test.", AF_INET, addrs) == base::Resolver::OK && addrs.size() == 2);
+    _ASSERT(r.getQueryCount() == 1 && r.getCacheHitCount() == 1);
+
+    // TTL 过期后重新查询
+    usleep(1100 * 1000);
+    addrs.clear();
+    _ASSERT(r.resolve("a.test", AF_INET, addrs) == base::Resolver::OK);
+    _ASSERT(r.getQueryCount() == 2);
+
+    // A 和 AAAA, IPv4 在前
+    addrs.clear();
+    _ASSERT(r.resolve("a.test", AF_UNSPEC, addrs) == base::Resolver::OK);
+    _ASSERT(addrs.size() == 3 && addrs[0]->getFamily() == AF_INET
+            && addrs[2]->getFamily() == AF_INET6);
+
+    // CNAME
+    addrs.clear();
+    std::string canon;
+    _ASSERT(r.resolve("alias.test", AF_INET, addrs, &canon) == base::Resolver::OK);
+    _ASSERT(addrs.size() == 1 && canon == "a.test");
+    addrs.clear();
+    _ASSERT(r.resolve("alias.test", AF_INET6, addrs) == base::Resolver::NO_RECORD);
+
+    // 否定缓存
+    uint64_t queries = r.getQueryCount();
+    _ASSERT(r.resolve("nx.test", AF_INET, addrs) == base::Resolver::NOT_FOUND);
+    _ASSERT(r.resolve("nx.test", AF_INET, addrs) == base::Resolver::NOT_FOUND);
+    _ASSERT(r.getQueryCount() == queries + 1);
+
+    // 截断后改用 TCP
+    addrs.clear();
+    _ASSERT(r.resolve("big.test", AF_INET, addrs) == base::Resolver::OK);
+    _ASSERT(addrs.size() == 1 && addrs[0]->toString() == "10.0.0.9:0");
+
+    // 超时
+    uint64_t start = base::GetCurrentMS();
+    _ASSERT(r.resolve("drop.test", AF_INET, addrs) == base::Resolver::TIMEOUT);
+    _ASSERT(base::GetCurrentMS() - start >= 190);
+    _ASSERT(r.resolve("bad..test", AF_INET, addrs) == base::Resolver::BAD_NAME);
+
+    // 并发查询同一个名字只发送一次
+    queries = dns.getQueries();
+    base::WaitGroup wg;
+    std::atomic<int> ok{0};
+    wg.add(10);
+    for (int i = 0; i < 10; ++i) {
+        base::IOManager::GetThis()->schedule([&]() {
+            std::vector<base::IPAddress::ptr> v;
+            if (r.resolve("slow.test", AF_INET, v) == base::Resolver::OK && v.size() == 2) {
+                ++ok;
+            }
+            wg.done();
+        });
+    }
+    wg.wait();
+    _ASSERT(ok == 10 && dns.getQueries() == queries + 1 && r.getCoalescedCount() == 9);
+
+    // search 和 hosts
+    r.setSearch({"test"}, 1);
+    addrs.clear();
+    _ASSERT(r.resolve("a", AF_INET, addrs, &canon) == base::Resolver::OK && canon == "a.test");
+    r.addHost("static.test", base::IPAddress::Create("1.1.1.1"));
+    queries = dns.getQueries();
+    addrs.clear();
+    _ASSERT(r.resolve("static.test", AF_INET, addrs) == base::Resolver::OK);
+    _ASSERT(addrs.size() == 1 && dns.getQueries() == queries);
+    _LOG_INFO(g_logger) << "test_resolver ok";
+}
+
+static void test_hook(StubDns &dns)
+{
+    // hook 的 getaddrinfo/gethostbyname_r 走 Resolver
+    base::ResolverMgr::GetInstance()->setNameservers({dns.getAddress()});
+    base::ResolverMgr::GetInstance()->setSearch({});
+    _ASSERT(base::is_hook_enable());
+
+    std::vector<base::Address::ptr> result;
+    _ASSERT(base::Address::Lookup(result, "a.test:80", AF_INET, SOCK_STREAM));
+    _ASSERT(result.size() == 2 && result[0]->toString() == "10.0.0.1:80");
+
+    hostent ret;
+    hostent *h = nullptr;
+    char buf[1024];
+    int err = 0;
+    _ASSERT(gethostbyname_r("alias.test", &ret, buf, sizeof(buf), &h, &err) == 0 && h);
+    _ASSERT(std::string(h->h_name) == "a.test" && h->h_addr_list[0] && !h->h_addr_list[1]);
+    _ASSERT(gethostbyname_r("nx.test", &ret, buf, sizeof(buf), &h, &err) == 0 && !h
+            && err == HOST_NOT_FOUND);
+    _LOG_INFO(g_logger) << "test_hook ok";
+}
+
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::ERROR);
+
+    StubDns dns;
+    base::IOManager iom(2, false, "resolver");
+    dns.start(&iom);
+    iom.schedule([&dns]() {
+        test_resolver(dns);
+        test_hook(dns);
+        dns.stop();
+    });
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "base/net/tcp_server.h"
+#include "base/coro/fiber_local.h"
+#include "base/coro/iomanager.h"
+#include "base/log/log.h"
+#include "base/macro.h"
+#include "base/util.h"
+#include <atomic>
+
+static base::Logger::ptr g_logger = _LOG_ROOT();
+
+static std::atomic<uint64_t> s_accepted{0};
+/// 多接收者模式下没有在监听socket所属线程上处理的连接数
+static std::atomic<uint64_t> s_foreign{0};
+/// 接收协程启动时所在的线程, handleClient 通过 schedule() 继承
+static base::FiberLocal<int> s_listener_thread;
+
+/**
+ * 接收后立即关闭连接, 只测建连速率
+ */
+class CloseServer : public base::TcpServer
+{
+public:
+    CloseServer(base::IOManager *worker) : TcpServer(worker, worker, worker) {}
+
+protected:
+    void startAccept(base::Socket::ptr sock) override
+    {
+        s_listener_thread.set(base::GetThreadId());
+        TcpServer::startAccept(sock);
+    }
+
+    void handleClient(base::Socket::ptr client) override
+    {
+        const int *listener = s_listener_thread.get();
+        if (isReusePort() && (!listener || *listener != base::GetThreadId())) {
+            ++s_foreign;
+        }
+        ++s_accepted;
+        client->close();
+    }
+};
+
+/**
+ * @return 每秒建立的连接数
+ */
+static double bench(bool reuse_port, int port, int threads, int clients, int seconds)
+{
+    s_accepted = 0;
+    s_foreign = 0;
+    std::atomic<uint64_t> connected{0};
+    std::atomic<bool> stop{false};
+    std::atomic<int> running{clients};
+
+    base::IOManager server_iom(threads, false, reuse_port ? "reuse_port" : "acceptor");
+    base::IOManager client_iom(threads, false, "client");
+    auto server = std::make_shared<CloseServer>(&server_iom);
+    server->setReusePort(reuse_port);
+    auto addr = base::Address::LookupAny("127.0.0.1:" + std::to_string(port));
+    std::vector<base::Address::ptr> addrs{addr};
+    std::vector<base::Address::ptr> fails;
+    // 监听socket要在开启hook的调度线程上创建, 否则 accept 会阻塞整个线程
+    base::Semaphore started;
+    server_iom.schedule([&]() {
+        _ASSERT(server->bind(addrs, fails));
+        _ASSERT(server->getSocks().size() == (reuse_port ? (size_t)threads : 1));
+        server->start();
+        started.notify();
+    });
+    started.wait();
+
+    for (int i = 0; i < clients; ++i) {
+        client_iom.schedule([&]() {
+            while (!stop) {
+                auto sock = base::Socket::CreateTCP(addr);
+                if (!sock->connect(addr, 1000)) {
+                    continue;
+                }
+                // 等服务端关闭, 保证连接已经被接收
+                char c;
+                sock->recv(&c, 1);
+                ++connected;
+            }
+            --running;
+        });
+    }
+
+    uint64_t start = base::GetCurrentMS();
+    sleep(seconds);
+    stop = true;
+    while (running) {
+        usleep(1000);
+    }
+    uint64_t elapsed = base::GetCurrentMS() - start;
+    server->stop();
+
+    double rate = connected * 1000.0 / elapsed;
+    _LOG_INFO(g_logger) << "reuse_port=" << reuse_port << " threads=" << threads
+                        << " clients=" << clients << " connected=" << connected
+                        << " accepted=" << s_accepted << " foreign=" << s_foreign
+                        << " conn/s=" << rate;
+    // 连接留在接收它的监听socket所属的线程
+    _ASSERT(s_foreign == 0);
+    return rate;
+}
+
+/**
+ * 用法: test_tcp_accept_bench [seconds] [threads] [clients]
+ */
+int main(int argc, char **argv)
+{
+    g_logger->setLevel(base::LogLevel::INFO);
+    _LOG_NAME("system")->setLevel(base::LogLevel::WARN);
+
+    int seconds = argc > 1 ? atoi(argv[1]) : 2;
+    int threads = argc > 2 ? atoi(argv[2]) : 2;
+    int clients = argc > 3 ? atoi(argv[3]) : 64;
+
+    double single = bench(false, 18090, threads, clients, seconds);
+    double multi = bench(true, 18091, threads, clients, seconds);
+    _LOG_INFO(g_logger) << "single acceptor conn/s=" << single << " reuse_port conn/s=" << multi;
+    return 0;
+}